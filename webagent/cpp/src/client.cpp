@@ -11,14 +11,18 @@
 #include <unistd.h>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <iostream>
 
 #include "inc/client.h"
 #include "inc/common.h"
 #include "spdlog/spdlog.h"
 
+static std::atomic<uint64_t> nextClientId(1);
+
 Client::Client(int fileDescriptor) {
 	_sockfd.set(fileDescriptor);
+	_id = nextClientId++;
 	setConnected(false);
 }
 
@@ -39,21 +43,45 @@ void Client::send(const char *msg, size_t msgSize) const {
 		spdlog::info("### Oops, connection to client is closed");
 		return;
 	}
-	const size_t numBytesSent = ::send(_sockfd.get(), (char *)msg, msgSize, 0);
+	send(_sockfd.get(), msg, msgSize);
+}
+
+/*
+ * Send on a socket of a client, also a copy made by duplicateSocket()
+ */
+void Client::send(int fileDescriptor, const char *msg, size_t msgSize) {
+	const ssize_t numBytesSent = ::send(fileDescriptor, (char *)msg, msgSize, MSG_NOSIGNAL);
 
 	const bool sendFailed = (numBytesSent < 0);
 	if (sendFailed) {
 		throw std::runtime_error(strerror(errno));
 	}
 
-	const bool notAllBytesWereSent = (numBytesSent < msgSize);
+	const bool notAllBytesWereSent = (static_cast<size_t>(numBytesSent) < msgSize);
 	if (notAllBytesWereSent) {
 		char errorMsg[100];
-		sprintf(errorMsg, "Only %lu bytes out of %lu was sent to client", numBytesSent, msgSize);
+		sprintf(errorMsg, "Only %zd bytes out of %zu was sent to client", numBytesSent, msgSize);
 		throw std::runtime_error(errorMsg);
 	}
 }
 
+/*
+ * A copy of the socket, usable after the client is removed.  Return -1 on error.
+ */
+int Client::duplicateSocket() const {
+	return dup(_sockfd.get());
+}
+
+/*
+ * Bound the time a send may block on a client which does not read
+ */
+void Client::setSendTimeout(uint32_t timeoutSeconds) const {
+	struct timeval tv;
+	tv.tv_sec = timeoutSeconds;
+	tv.tv_usec = 0;
+	setsockopt(_sockfd.get(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
 /*
  * Receive client packets, and notify user
  */
@@ -68,7 +96,7 @@ void Client::receiveTask() {
 		}
 
 		char receivedMessage[MAX_PACKET_SIZE];
-		const size_t numOfBytesReceived = recv(_sockfd.get(), receivedMessage, MAX_PACKET_SIZE, 0);
+		const ssize_t numOfBytesReceived = recv(_sockfd.get(), receivedMessage, MAX_PACKET_SIZE, 0);
 
 		if (numOfBytesReceived < 1) {
 			const bool clientClosedConnection = (numOfBytesReceived == 0);
@@ -0,0 +1,223 @@
+/*
+ * Peer event stream
+ * Copyright (c) 2024-2025 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include "inc/events.h"
+#include "spdlog/spdlog.h"
+
+const size_t EventHub::QUEUE_SIZE;
+const uint32_t EventHub::KEEPALIVE_SEC;
+
+EventHub::EventHub() {
+}
+
+EventHub::~EventHub() {
+	stop();
+}
+
+/*
+ * Build the message pushed for an event, an empty line ends each message:
+ *   cmd:=EVENT\nevent:=NAME\ntime:=UNIX\npeer:=KEY\n...\n\n
+ */
+std::string EventHub::format(const peer_event_t &event, const char *name) {
+	char line[256];
+	std::string msg;
+
+	snprintf(line, sizeof(line), "cmd:=EVENT\nevent:=%s\ntime:=%lld\npeer:=%s\n",
+			name, (long long)time(nullptr), event.publicKey.c_str());
+	msg = line;
+
+	switch (event.type) {
+		case PeerEvent::HANDSHAKE_ESTABLISHED:
+		case PeerEvent::HANDSHAKE_STALE:
+			snprintf(line, sizeof(line), "last_handshake:=%lld\n", (long long)event.lastHandshake);
+			msg += line;
+			break;
+
+		case PeerEvent::ENDPOINT_ROAMED:
+			snprintf(line, sizeof(line), "endpoint:=%s\nprevious:=%s\n",
+					event.endpoint.c_str(), event.previousEndpoint.c_str());
+			msg += line;
+			break;
+
+		case PeerEvent::RATE:
+			snprintf(line, sizeof(line), "rate:=%.0f\n", event.rate);
+			msg += line;
+			break;
+
+		default:
+			if (!event.endpoint.empty()) {
+				msg += "endpoint:=" + event.endpoint + "\n";
+			}
+			break;
+	}
+	return msg + "\n";
+}
+
+/*
+ * Add a subscription, or change the threshold of an existing one.
+ */
+void EventHub::subscribe(uint64_t clientId, double threshold) {
+	std::lock_guard<std::mutex> lock(_subscribersMtx);
+
+	for (subscriber_t *subscriber : _subscribers) {
+		if (subscriber->clientId == clientId && subscriber->active) {
+			subscriber->threshold = threshold;
+			return;
+		}
+	}
+
+	subscriber_t *subscriber = new subscriber_t;
+	subscriber->clientId = clientId;
+	subscriber->threshold = threshold;
+	subscriber->active = true;
+	subscriber->senderThread = new std::thread(&EventHub::senderTask, this, subscriber);
+	_subscribers.push_back(subscriber);
+	spdlog::info("### client {} subscribed to peer events ({} subscribers)", clientId, _subscribers.size());
+}
+
+bool EventHub::unsubscribe(uint64_t clientId) {
+	std::vector<subscriber_t*> removed;
+	{
+		std::lock_guard<std::mutex> lock(_subscribersMtx);
+		auto it = std::stable_partition(_subscribers.begin(), _subscribers.end(),
+				[clientId](subscriber_t *subscriber) { return subscriber->clientId != clientId; });
+		removed.assign(it, _subscribers.end());
+		_subscribers.erase(it, _subscribers.end());
+	}
+	bool found = !removed.empty();
+	release(removed);
+	return found;
+}
+
+void EventHub::stop() {
+	std::vector<subscriber_t*> removed;
+	{
+		std::lock_guard<std::mutex> lock(_subscribersMtx);
+		removed.swap(_subscribers);
+	}
+	release(removed);
+}
+
+/*
+ * Stop the sender threads and free the subscribers, out of _subscribersMtx
+ * since a sender may still be blocked in a send.
+ */
+void EventHub::release(std::vector<subscriber_t*> &subscribers) {
+	for (subscriber_t *subscriber : subscribers) {
+		{
+			std::lock_guard<std::mutex> lock(subscriber->mtx);
+			subscriber->active = false;
+		}
+		subscriber->wake.notify_all();
+		subscriber->senderThread->join();
+		delete subscriber->senderThread;
+		delete subscriber;
+	}
+	subscribers.clear();
+}
+
+void EventHub::enqueue(subscriber_t *subscriber, const std::string &msg) {
+	{
+		std::lock_guard<std::mutex> lock(subscriber->mtx);
+		if (subscriber->queue.size() >= QUEUE_SIZE) {
+			subscriber->queue.pop_front();
+			subscriber->dropped++;
+		}
+		subscriber->queue.push_back(msg);
+	}
+	subscriber->wake.notify_one();
+}
+
+/*
+ * Called by the sampler thread after each dump. Subscribers whose sender has
+ * given up are reaped first.
+ */
+void EventHub::publish(const std::vector<peer_event_t> &events) {
+	std::vector<subscriber_t*> dead;
+	std::vector<std::string> messages(events.size());
+
+	for (size_t i = 0; i < events.size(); i++) {
+		switch (events[i].type) {
+			case PeerEvent::ADDED:                 messages[i] = format(events[i], "PEER_ADDED"); break;
+			case PeerEvent::REMOVED:               messages[i] = format(events[i], "PEER_REMOVED"); break;
+			case PeerEvent::HANDSHAKE_ESTABLISHED: messages[i] = format(events[i], "HANDSHAKE_ESTABLISHED"); break;
+			case PeerEvent::HANDSHAKE_STALE:       messages[i] = format(events[i], "HANDSHAKE_STALE"); break;
+			case PeerEvent::ENDPOINT_ROAMED:       messages[i] = format(events[i], "ENDPOINT_ROAMED"); break;
+			case PeerEvent::RATE:                  break;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_subscribersMtx);
+		auto it = std::stable_partition(_subscribers.begin(), _subscribers.end(),
+				[](subscriber_t *subscriber) { return subscriber->active.load(); });
+		dead.assign(it, _subscribers.end());
+		_subscribers.erase(it, _subscribers.end());
+
+		for (subscriber_t *subscriber : _subscribers) {
+			for (size_t i = 0; i < events.size(); i++) {
+				const peer_event_t &event = events[i];
+
+				if (event.type != PeerEvent::RATE) {
+					enqueue(subscriber, messages[i]);
+					continue;
+				}
+				if (subscriber->threshold <= 0) {
+					continue;
+				}
+				if (event.previousRate < subscriber->threshold && event.rate >= subscriber->threshold) {
+					enqueue(subscriber, format(event, "TRAFFIC_ABOVE"));
+				} else if (event.previousRate >= subscriber->threshold && event.rate < subscriber->threshold) {
+					enqueue(subscriber, format(event, "TRAFFIC_BELOW"));
+				}
+			}
+		}
+	}
+
+	release(dead);
+}
+
+/*
+ * Drain the queue of a subscriber. When messages were dropped the client is
+ * told how many before the next one, and an idle subscriber gets a keepalive
+ * so a closed connection is noticed. The first failed send ends it.
+ */
+void EventHub::senderTask(subscriber_t *subscriber) {
+	while (subscriber->active) {
+		std::string msg;
+		{
+			std::unique_lock<std::mutex> lock(subscriber->mtx);
+			bool ready = subscriber->wake.wait_for(lock, std::chrono::seconds(KEEPALIVE_SEC),
+					[subscriber] { return !subscriber->queue.empty() || !subscriber->active; });
+			if (!subscriber->active) {
+				break;
+			}
+
+			if (!ready) {
+				msg = "cmd:=EVENT\nevent:=KEEPALIVE\n\n";
+			} else {
+				if (subscriber->dropped) {
+					char line[64];
+					snprintf(line, sizeof(line), "cmd:=EVENT\nevent:=DROPPED\ncount:=%zu\n\n", subscriber->dropped);
+					msg = line;
+					subscriber->dropped = 0;
+				}
+				msg += subscriber->queue.front();
+				subscriber->queue.pop_front();
+			}
+		}
+
+		if (!_sendHandler || !_sendHandler(subscriber->clientId, msg)) {
+			spdlog::info("### client {} unsubscribed from peer events", subscriber->clientId);
+			subscriber->active = false;
+		}
+	}
+}
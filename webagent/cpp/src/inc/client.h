@@ -25,17 +25,22 @@ public:
 	bool operator ==(const Client &other) const;
 	void setIp(const std::string &ip) { _ip = ip; }
 	std::string getIp() const { return _ip; }
+	uint64_t getId() const { return _id; }
+	void setSendTimeout(uint32_t timeoutSeconds) const;
 	void setEventsHandler(const client_event_handler_t &eventHandler) { _eventHandlerCallback = eventHandler; }
 	void publishEvent(ClientEvent clientEvent, const std::string &msg = "");
 	bool isConnected() const { return _isConnected; }
 	void startListen();
 	void send(const char *msg, size_t msgSize) const;
+	static void send(int fileDescriptor, const char *msg, size_t msgSize);
+	int duplicateSocket() const;
 	void close();
 	void print() const;
 
 private:
 	FileDescriptor _sockfd;
 	std::string _ip = "";
+	uint64_t _id;
 	std::atomic<bool> _isConnected;
 	std::thread *_receiveThread = nullptr;
 	client_event_handler_t _eventHandlerCallback;
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2024-2025 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include "sampler.h"
+
+/*
+ * A client which asked for the peer events, with the queue of messages not
+ * yet sent to it.
+ */
+struct subscriber_t {
+	uint64_t clientId = 0;
+	double threshold = 0;           // rx+tx bytes/s, 0 for no traffic events
+	std::deque<std::string> queue;
+	size_t dropped = 0;             // messages dropped since the last send
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::atomic<bool> active;
+	std::thread *senderThread = nullptr;
+};
+
+/*
+ * Fan out the events of the sampler to the subscribers. Publishing never
+ * blocks, every subscriber has its own bounded queue which drops the oldest
+ * message when full and its own thread which does the sending.
+ */
+class EventHub {
+public:
+	using send_handler_t = std::function<bool(uint64_t clientId, const std::string &msg)>;
+
+	static const size_t QUEUE_SIZE = 256;
+	static const uint32_t KEEPALIVE_SEC = 30;
+
+	EventHub();
+	~EventHub();
+	void setSendHandler(const send_handler_t &handler) { _sendHandler = handler; }
+	void subscribe(uint64_t clientId, double threshold);
+	bool unsubscribe(uint64_t clientId);
+	void publish(const std::vector<peer_event_t> &events);
+	void stop();
+
+	static std::string format(const peer_event_t &event, const char *name);
+
+private:
+	send_handler_t _sendHandler;
+	std::vector<subscriber_t*> _subscribers;
+	std::mutex _subscribersMtx;
+
+	void senderTask(subscriber_t *subscriber);
+	void enqueue(subscriber_t *subscriber, const std::string &msg);
+	void release(std::vector<subscriber_t*> &subscribers);
+};
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2024-2025 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+/*
+ * One peer as read from the kernel by a WG_CMD_GET_DEVICE dump.
+ */
+struct peer_sample_t {
+	std::string publicKey;          // raw 32 bytes
+	uint64_t rxBytes = 0;
+	uint64_t txBytes = 0;
+	int64_t lastHandshake = 0;      // unix time, 0 if never
+	std::string endpoint;           // ip:port, empty if none
+};
+
+enum class PeerEvent {
+	ADDED,
+	REMOVED,
+	HANDSHAKE_ESTABLISHED,
+	HANDSHAKE_STALE,
+	ENDPOINT_ROAMED,
+	RATE                            // every sample, rx+tx EWMA before and after
+};
+
+/*
+ * A change of a peer, found by comparing a dump to the previous one.
+ */
+struct peer_event_t {
+	PeerEvent type;
+	std::string publicKey;          // base64
+	std::string endpoint;
+	std::string previousEndpoint;
+	int64_t lastHandshake = 0;
+	double rate = 0;                // bytes/s
+	double previousRate = 0;
+};
+
+/*
+ * Throughput of a peer, computed from the history only.
+ */
+struct peer_rate_t {
+	std::string publicKey;          // base64
+	double rxEwma = 0;              // bytes/s
+	double txEwma = 0;
+	double rxWindow = 0;            // bytes/s over the requested window
+	double txWindow = 0;
+	uint32_t windowMs = 0;          // time actually covered by the window
+	uint64_t rxBytes = 0;
+	uint64_t txBytes = 0;
+	int64_t lastHandshake = 0;
+	int handshakes = 0;             // handshakes seen in the window
+};
+
+/*
+ * History of a peer. The newest absolute counters are kept as the base and
+ * the older samples only as deltas, one column per value, so a slot costs
+ * 16 bytes whatever the counters grow to.
+ */
+struct peer_history_t {
+	static const int SLOTS = 120;
+
+	uint64_t rxBytes = 0;
+	uint64_t txBytes = 0;
+	int64_t lastHandshake = 0;
+	std::string endpoint;
+	bool fresh = false;             // handshake younger than HANDSHAKE_STALE_SEC
+	uint64_t stampMs = 0;           // monotonic time of the base
+
+	uint32_t dtMs[SLOTS];
+	uint32_t rxDelta[SLOTS];
+	uint32_t txDelta[SLOTS];
+	uint32_t handshakeDelta[SLOTS];
+	int head = 0;                   // next slot to write
+	int count = 0;
+
+	double rxEwma = 0;
+	double txEwma = 0;
+	uint64_t pass = 0;              // the last record() the peer was in
+};
+
+class PeerSampler {
+public:
+	using event_handler_t = std::function<void(const std::vector<peer_event_t>&)>;
+	using sample_handler_t = std::function<void(const std::vector<peer_sample_t>&)>;
+
+	// a session without a handshake for this long is rejected by wireguard
+	static const int HANDSHAKE_STALE_SEC = 180;
+
+	PeerSampler();
+	~PeerSampler();
+	bool start(const std::string &ifname, uint32_t intervalSec);
+	void stop();
+	void setEventHandler(const event_handler_t &handler) { _eventHandler = handler; }
+	void setSampleHandler(const sample_handler_t &handler) { _sampleHandler = handler; }
+	uint32_t interval() const { return _intervalSec; }
+	std::vector<peer_rate_t> rates(uint32_t windowSec);
+
+	static bool dumpPeers(int fd, uint16_t family, const std::string &ifname, std::vector<peer_sample_t> &peers);
+	static uint16_t resolveFamily(int fd);
+	static std::string keyToBase64(const std::string &key);
+
+private:
+	std::string _ifname;
+	uint32_t _intervalSec = 5;
+	double _ewmaTauSec = 30;
+	int _sockfd = -1;
+	uint16_t _family = 0;
+
+	std::map<std::string, peer_history_t> _history;
+	uint64_t _pass = 0;
+	std::mutex _historyMtx;
+
+	std::thread *_samplerThread = nullptr;
+	std::atomic<bool> _stopSampler;
+	std::mutex _wakeMtx;
+	std::condition_variable _wake;
+	event_handler_t _eventHandler;
+	sample_handler_t _sampleHandler;
+
+	void samplerTask();
+	bool sampleOnce();
+	void record(const std::vector<peer_sample_t> &peers, uint64_t nowMs, std::vector<peer_event_t> &events);
+};
@@ -38,12 +38,15 @@ public:
 	void subscribe(const server_observer_t &observer);
 	pipe_ret_t sendToAllClients(const char *msg, size_t size);
 	pipe_ret_t sendToClient(const std::string &clientIP, const char *msg, size_t size);
+	pipe_ret_t sendToClient(uint64_t clientId, const char *msg, size_t size);
 
 	bool sendMessage(const Client &client, const std::string result);
 	bool send_OK(const Client &client);
 	bool send_NOK(const Client &client);
+	bool sendReply(const Client &client, const std::string &reply);
 	bool shouldTerminate();
 	void setTerminate(bool flag);
+	void stopAccepting();
 
 	pipe_ret_t close();
 	void printClients();
@@ -62,7 +65,7 @@ private:
 	std::thread *_clientsRemoverThread = nullptr;
 	std::atomic<bool> _stopRemoveClientsTask;
 
-	bool _flagTerminate;
+	std::atomic<bool> _flagTerminate;
 
 	void publishClientMsg(const Client &client, const char *msg, size_t msgSize);
 	void publishSingleClientMsg(const Client &client, const char *msg, size_t msgSize);
@@ -72,4 +75,5 @@ private:
 	void removeDeadClients();
 	void terminateDeadClientsRemover();
 	static pipe_ret_t sendToClient(const Client &client, const char *msg, size_t size);
+	static pipe_ret_t sendToSocket(int fileDescriptor, const char *msg, size_t size);
 };
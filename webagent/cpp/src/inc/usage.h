@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2024-2025 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include "sampler.h"
+
+#define USAGE_FILE_PATH  "/qrwg/config/usage.bin"
+#define USAGE_FILE_MAGIC "WGU2"
+#define USAGE_FILE_MAGIC_V1 "WGU1"
+#define USAGE_BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+/*
+ * The usage file is read by vtysh for 'show wg usage' too, so the layout
+ * must not change:
+ *   header  : 48 bytes, usage_header_t
+ *   records : 80 bytes each, host byte order
+ * rxLast/txLast are counters of the interface named by the boot id and the
+ * ifindex of the header, another boot or interface starts them from 0.  A
+ * "WGU1" file has only the magic and the count, its counters are taken as
+ * the current ones.
+ */
+struct usage_header_t {
+	char magic[4];
+	uint32_t count;
+	char bootId[36];
+	uint32_t ifindex;
+};
+
+/*
+ * Lifetime traffic of a peer as stored in the usage file
+ */
+struct usage_record_t {
+	uint8_t publicKey[32];
+	uint64_t rxTotal;               // lifetime bytes
+	uint64_t txTotal;
+	uint64_t rxLast;                // kernel counters at the last update
+	uint64_t txLast;
+	int64_t since;                  // unix time the peer was first seen
+	int64_t updated;                // unix time of the last update
+};
+
+class UsageStore {
+public:
+	UsageStore();
+	~UsageStore();
+	bool load(const std::string &path, const std::string &ifname);
+	void setSaveInterval(uint32_t intervalSec) { _saveIntervalSec = intervalSec; }
+	void update(const std::vector<peer_sample_t> &peers);
+	bool save();
+
+private:
+	std::string _path;
+	uint32_t _saveIntervalSec = 1800;
+	int64_t _savedAt = 0;
+	bool _dirty = false;
+
+	std::map<std::string, usage_record_t> _usage;
+	std::mutex _usageMtx;
+
+	// the interface whose counters are in rxLast/txLast, an empty boot id
+	// until the first update when the file has none
+	std::string _ifname;
+	std::string _bootId;
+	uint32_t _ifindex = 0;
+
+	bool saveLocked();
+	void checkCounters();
+};
@@ -8,24 +8,39 @@
 #include <iostream>
 #include <csignal>
 #include <vector>
+#include <thread>
+#include <pthread.h>
 #include "inc/server.h"
 #include "inc/common.h"
 #include "inc/vtyshell.h"
+#include "inc/sampler.h"
+#include "inc/events.h"
+#include "inc/usage.h"
 #include "spdlog/spdlog.h"
 
 // tcp server instance
 TcpServer server;
 // declare a server observer which will receive incomingPacketHandler messages.
 server_observer_t observer;
+// peer statistics sampler of the wireguard interface
+PeerSampler sampler;
+uint32_t samplerInterval = 5;
+// subscribers of the peer events found by the sampler
+EventHub events;
+// lifetime traffic of the peers, kept across reboots
+UsageStore usage;
+uint32_t usageSaveInterval = 1800;
 
 const std::string versionString { "v0.9.0" }; 
 
 static void printUsage() {
-	std::cout << "Usage: web-agentd [OPTION]" << "\n";
+	std::cout << "Usage: web-agentd [OPTION] [-i SEC] [-s SEC]" << "\n";
 	std::cout << "Options" << "\n";
 	std::cout << " -f, --foreground    in foreground" << "\n";
 	std::cout << " -d, --daemon        fork in background" << "\n";
-	std::cout << " -v, --version       show version information and exit" << "\n\n";
+	std::cout << " -v, --version       show version information and exit" << "\n";
+	std::cout << " -i, --interval SEC  peer statistics sampling interval (default 5)" << "\n";
+	std::cout << " -s, --save SEC      peer usage saving interval (default 1800)" << "\n\n";
 	exit(EXIT_FAILURE);
 }
 
@@ -35,19 +50,16 @@ static void printVersion() {
 	exit(EXIT_SUCCESS);
 }
 
-static void sig_handler(int sig) {
-	switch (sig) {
-		case SIGINT:
-		case SIGTERM:
-		case SIGQUIT:
-			spdlog::info(">>> Received signal {}, exiting...", sig);
-			server.setTerminate(true);
-			server.close();
-			exit(EXIT_SUCCESS);
-			break;
-		default:
-			break;
-	}
+/*
+ * The exit signals are blocked before any thread is started, so all the
+ * threads inherit the mask and main() takes them with sigwait().
+ */
+static void blockSignals(sigset_t *quitSignals) {
+	sigemptyset(quitSignals);
+	sigaddset(quitSignals, SIGINT);
+	sigaddset(quitSignals, SIGQUIT);
+	sigaddset(quitSignals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, quitSignals, nullptr);
 }
 
 static void daemonize(void) {
@@ -68,6 +80,60 @@ bool onIncomingMsg_basedIP(const std::string &clientIP, const char *msg, size_t
 	return true;
 }
 
+/*
+ * Reply to cmd:=STATS with the rates of all peers from the sampler history.
+ * The optional window:=SEC line sets the window of the windowed rates.
+ */
+static bool replyStats(const Client &client, const std::vector<std::string> &lines) {
+	uint32_t window = 60;
+
+	if (lines.size() > 1) {
+		std::vector<std::string> x = vtyshell::split(lines[1], ":=");
+		if (x.size() == 2 && x[0] == "window") {
+			window = strtoul(x[1].c_str(), nullptr, 10);
+		}
+	}
+
+	std::vector<peer_rate_t> rates = sampler.rates(window);
+	std::string reply = "cmd:=OK\n";
+	char line[256];
+
+	snprintf(line, sizeof(line), "interval:=%u\npeer_count:=%zu\n", sampler.interval(), rates.size());
+	reply += line;
+	for (size_t i = 0; i < rates.size(); i++) {
+		const peer_rate_t &r = rates[i];
+		//peerN:=KEY,rx_ewma,tx_ewma,rx_window,tx_window,window_ms,rx_bytes,tx_bytes,last_handshake,handshakes
+		snprintf(line, sizeof(line), "peer%zu:=%s,%.0f,%.0f,%.0f,%.0f,%u,%llu,%llu,%lld,%d\n",
+				i, r.publicKey.c_str(), r.rxEwma, r.txEwma, r.rxWindow, r.txWindow, r.windowMs,
+				(unsigned long long)r.rxBytes, (unsigned long long)r.txBytes,
+				(long long)r.lastHandshake, r.handshakes);
+		reply += line;
+	}
+	return server.sendReply(client, reply);
+}
+
+/*
+ * cmd:=SUBSCRIBE keeps the connection open for pushed peer events, the
+ * optional threshold:=BYTES adds the events of the rx+tx rate crossing it.
+ */
+static bool subscribeEvents(const Client &client, const std::vector<std::string> &lines) {
+	double threshold = 0;
+
+	if (lines.size() > 1) {
+		std::vector<std::string> x = vtyshell::split(lines[1], ":=");
+		if (x.size() == 2 && x[0] == "threshold") {
+			threshold = strtod(x[1].c_str(), nullptr);
+		}
+	}
+
+	client.setSendTimeout(2);
+	if (!server.send_OK(client)) {
+		return false;
+	}
+	events.subscribe(client.getId(), threshold);
+	return true;
+}
+
 bool onIncomingMsg_basedSocket(const Client &client, const char *msg, size_t size) {
 	char buffer[MAX_PACKET_SIZE] {};
 	memcpy(buffer, msg, size);
@@ -87,6 +153,19 @@ bool onIncomingMsg_basedSocket(const Client &client, const char *msg, size_t siz
 		} else {
 			return server.send_NOK(client);
 		}
+	} else if (x[1] == "STATS") {
+		spdlog::info(">>> cmd:=STATS message received.");
+		return replyStats(client, l);
+	} else if (x[1] == "SUBSCRIBE") {
+		spdlog::info(">>> cmd:=SUBSCRIBE message received.");
+		return subscribeEvents(client, l);
+	} else if (x[1] == "UNSUBSCRIBE") {
+		spdlog::info(">>> cmd:=UNSUBSCRIBE message received.");
+		if (events.unsubscribe(client.getId())) {
+			return server.send_OK(client);
+		} else {
+			return server.send_NOK(client);
+		}
 	} else if (x[1] == "BYE") {
 		spdlog::info(">>> cmd:=BYE message received.");
 		return server.send_OK(client);
@@ -104,14 +183,33 @@ void acceptClients() {
 	try {
 		std::string clientIP = server.acceptClient(0);
 	} catch (const std::runtime_error &error) {
-		spdlog::error("Accepting client failed: {}", error.what());
+		if (!server.shouldTerminate()) {
+			spdlog::error("Accepting client failed: {}", error.what());
+		}
 	}
 }
 
 int main(int argc, char **argv) {
-	if (argc != 2) {
+	if (argc < 2 || argc % 2 != 0) {
 		printUsage();
 	}
+	for (int i = 2; i < argc; i += 2) {
+		switch (hashMagic(argv[i])) {
+			case hashMagic("-i"):
+			case hashMagic("--interval"):
+				samplerInterval = strtoul(argv[i + 1], nullptr, 10);
+				break;
+
+			case hashMagic("-s"):
+			case hashMagic("--save"):
+				usageSaveInterval = strtoul(argv[i + 1], nullptr, 10);
+				break;
+
+			default:
+				printUsage();
+				break;
+		}
+	}
 
 	switch (hashMagic(argv[1])) {
 		case hashMagic("-v"):
@@ -133,12 +231,24 @@ int main(int argc, char **argv) {
 			break;
 	}
 
-	signal(SIGINT, sig_handler);
-	signal(SIGQUIT, sig_handler);
-	signal(SIGTERM, sig_handler);
+	sigset_t quitSignals;
+	int sig = 0;
+	blockSignals(&quitSignals);
 
 	spdlog::info("Starting the web-agentd(tcp port 51821)...");
 	vtyshell::initializeVtyshMap();
+	events.setSendHandler([](uint64_t clientId, const std::string &msg) {
+		return server.sendToClient(clientId, msg.c_str(), msg.size()).isSuccessful();
+	});
+	sampler.setEventHandler([](const std::vector<peer_event_t> &peerEvents) {
+		events.publish(peerEvents);
+	});
+	usage.load(USAGE_FILE_PATH, "wg0");
+	usage.setSaveInterval(usageSaveInterval);
+	sampler.setSampleHandler([](const std::vector<peer_sample_t> &peers) {
+		usage.update(peers);
+	});
+	sampler.start("wg0", samplerInterval);
 	pipe_ret_t startRet = server.start(51821);
 	if (!startRet.isSuccessful()) {
 		spdlog::error("Server setup failed: {}", startRet.message());
@@ -152,10 +262,21 @@ int main(int argc, char **argv) {
 	observer.wantedIP = "127.0.0.1";
 	server.subscribe(observer);
 
-	while (!server.shouldTerminate()) {
-		acceptClients();
-	}
+	std::thread acceptThread([]() {
+		while (!server.shouldTerminate()) {
+			acceptClients();
+		}
+	});
+
+	sigwait(&quitSignals, &sig);
+	spdlog::info(">>> Received signal {}, exiting...", sig);
+	server.setTerminate(true);
+	server.stopAccepting();
+	acceptThread.join();
 
+	sampler.stop();
+	events.stop();
+	usage.save();
 	server.close();
 	spdlog::info("The web-agentd is stopped.");
 
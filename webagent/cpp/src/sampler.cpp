@@ -0,0 +1,490 @@
+/*
+ * Peer statistics sampler
+ * Copyright (c) 2024-2025 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <ctime>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/time_types.h>
+#include <linux/wireguard.h>
+#include "inc/sampler.h"
+#include "spdlog/spdlog.h"
+
+#define NETLINK_BUFFER_SIZE 65536
+
+static uint32_t netlinkSeq = 0;
+
+static struct nlattr *nlaData(struct nlattr *nla) {
+	return (struct nlattr *)((char *)nla + NLA_HDRLEN);
+}
+
+static int nlaLength(const struct nlattr *nla) {
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+static bool nlaOk(const struct nlattr *nla, int len) {
+	return len >= (int)sizeof(struct nlattr) && nla->nla_len >= sizeof(struct nlattr) && nla->nla_len <= len;
+}
+
+static struct nlattr *nlaNext(struct nlattr *nla, int &len) {
+	len -= NLA_ALIGN(nla->nla_len);
+	return (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+}
+
+static void nlaAdd(struct nlmsghdr *nlh, int type, const void *data, int len) {
+	struct nlattr *nla = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy(nlaData(nla), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+static uint64_t monotonicMs() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t saturate32(uint64_t value) {
+	return value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+/*
+ * Send a generic netlink request and hand every reply message to the handler
+ * until the end of the dump or the ack.
+ */
+static bool netlinkRequest(int fd, struct nlmsghdr *req, const std::function<void(struct nlmsghdr *)> &handler) {
+	struct sockaddr_nl sa;
+	std::vector<char> buffer(NETLINK_BUFFER_SIZE);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	req->nlmsg_seq = ++netlinkSeq;
+	if (sendto(fd, req, req->nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		return false;
+	}
+
+	for (;;) {
+		int len = recv(fd, buffer.data(), buffer.size(), 0);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		if (len <= 0) {
+			return false;
+		}
+
+		for (struct nlmsghdr *nlh = (struct nlmsghdr *)buffer.data(); NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != req->nlmsg_seq) {
+				continue;
+			}
+			if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+				// both carry the error code, 0 is the ack
+				int err = *(int *)NLMSG_DATA(nlh);
+				if (err < 0) {
+					errno = -err;
+					return false;
+				}
+				return true;
+			}
+			handler(nlh);
+			if (!(nlh->nlmsg_flags & NLM_F_MULTI)) {
+				return true;
+			}
+		}
+	}
+}
+
+static struct nlattr *genlAttrs(struct nlmsghdr *nlh, int &len) {
+	len = nlh->nlmsg_len - NLMSG_SPACE(GENL_HDRLEN);
+	return (struct nlattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+}
+
+static std::string endpointToString(const void *data, int len) {
+	char host[INET6_ADDRSTRLEN];
+	char endpoint[INET6_ADDRSTRLEN + 8];
+
+	if (len == sizeof(struct sockaddr_in)) {
+		struct sockaddr_in sin;
+		memcpy(&sin, data, sizeof(sin));
+		if (sin.sin_family != AF_INET || !inet_ntop(AF_INET, &sin.sin_addr, host, sizeof(host))) {
+			return "";
+		}
+		snprintf(endpoint, sizeof(endpoint), "%s:%u", host, ntohs(sin.sin_port));
+	} else if (len == sizeof(struct sockaddr_in6)) {
+		struct sockaddr_in6 sin6;
+		memcpy(&sin6, data, sizeof(sin6));
+		if (sin6.sin6_family != AF_INET6 || !inet_ntop(AF_INET6, &sin6.sin6_addr, host, sizeof(host))) {
+			return "";
+		}
+		snprintf(endpoint, sizeof(endpoint), "[%s]:%u", host, ntohs(sin6.sin6_port));
+	} else {
+		return "";
+	}
+	return endpoint;
+}
+
+static void parsePeer(struct nlattr *peer, std::vector<peer_sample_t> &peers) {
+	peer_sample_t sample;
+	int rem = nlaLength(peer);
+
+	for (struct nlattr *nla = nlaData(peer); nlaOk(nla, rem); nla = nlaNext(nla, rem)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+			case WGPEER_A_PUBLIC_KEY:
+				if (nlaLength(nla) == WG_KEY_LEN) {
+					sample.publicKey.assign((const char *)nlaData(nla), WG_KEY_LEN);
+				}
+				break;
+			case WGPEER_A_ENDPOINT:
+				sample.endpoint = endpointToString(nlaData(nla), nlaLength(nla));
+				break;
+			case WGPEER_A_RX_BYTES:
+				memcpy(&sample.rxBytes, nlaData(nla), sizeof(uint64_t));
+				break;
+			case WGPEER_A_TX_BYTES:
+				memcpy(&sample.txBytes, nlaData(nla), sizeof(uint64_t));
+				break;
+			case WGPEER_A_LAST_HANDSHAKE_TIME:
+				if (nlaLength(nla) == sizeof(struct __kernel_timespec)) {
+					struct __kernel_timespec ts;
+					memcpy(&ts, nlaData(nla), sizeof(ts));
+					sample.lastHandshake = ts.tv_sec;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	// a peer split over several messages is continued with its key and the
+	// remaining allowed ips only, the counters came with the first part
+	if (sample.publicKey.empty() || (!peers.empty() && peers.back().publicKey == sample.publicKey)) {
+		return;
+	}
+	peers.push_back(sample);
+}
+
+PeerSampler::PeerSampler() {
+	_stopSampler = false;
+}
+
+PeerSampler::~PeerSampler() {
+	stop();
+}
+
+/*
+ * Get the id of the wireguard generic netlink family, 0 if the module is not loaded.
+ */
+uint16_t PeerSampler::resolveFamily(int fd) {
+	char buf[NLMSG_SPACE(GENL_HDRLEN) + 64] {};
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct genlmsghdr *genl = (struct genlmsghdr *)NLMSG_DATA(nlh);
+	uint16_t id = 0;
+
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type = GENL_ID_CTRL;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	genl->cmd = CTRL_CMD_GETFAMILY;
+	genl->version = 1;
+	nlaAdd(nlh, CTRL_ATTR_FAMILY_NAME, WG_GENL_NAME, sizeof(WG_GENL_NAME));
+
+	netlinkRequest(fd, nlh, [&id](struct nlmsghdr *reply) {
+		int len;
+		for (struct nlattr *nla = genlAttrs(reply, len); nlaOk(nla, len); nla = nlaNext(nla, len)) {
+			if ((nla->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID) {
+				memcpy(&id, nlaData(nla), sizeof(id));
+			}
+		}
+	});
+	return id;
+}
+
+/*
+ * Dump the counters of all peers of the interface with WG_CMD_GET_DEVICE.
+ */
+bool PeerSampler::dumpPeers(int fd, uint16_t family, const std::string &ifname, std::vector<peer_sample_t> &peers) {
+	char buf[NLMSG_SPACE(GENL_HDRLEN) + 64] {};
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct genlmsghdr *genl = (struct genlmsghdr *)NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type = family;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP;
+	genl->cmd = WG_CMD_GET_DEVICE;
+	genl->version = WG_GENL_VERSION;
+	nlaAdd(nlh, WGDEVICE_A_IFNAME, ifname.c_str(), ifname.size() + 1);
+
+	peers.clear();
+	return netlinkRequest(fd, nlh, [&peers](struct nlmsghdr *reply) {
+		int len;
+		for (struct nlattr *nla = genlAttrs(reply, len); nlaOk(nla, len); nla = nlaNext(nla, len)) {
+			if ((nla->nla_type & NLA_TYPE_MASK) != WGDEVICE_A_PEERS) {
+				continue;
+			}
+			int rem = nlaLength(nla);
+			for (struct nlattr *peer = nlaData(nla); nlaOk(peer, rem); peer = nlaNext(peer, rem)) {
+				parsePeer(peer, peers);
+			}
+		}
+	});
+}
+
+std::string PeerSampler::keyToBase64(const std::string &key) {
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	size_t i;
+
+	for (i = 0; i + 2 < key.size(); i += 3) {
+		uint32_t v = (uint8_t)key[i] << 16 | (uint8_t)key[i + 1] << 8 | (uint8_t)key[i + 2];
+		out += table[v >> 18 & 63];
+		out += table[v >> 12 & 63];
+		out += table[v >> 6 & 63];
+		out += table[v & 63];
+	}
+	if (i < key.size()) {
+		uint32_t v = (uint8_t)key[i] << 16 | (i + 1 < key.size() ? (uint8_t)key[i + 1] << 8 : 0);
+		out += table[v >> 18 & 63];
+		out += table[v >> 12 & 63];
+		out += (i + 1 < key.size()) ? table[v >> 6 & 63] : '=';
+		out += '=';
+	}
+	return out;
+}
+
+/*
+ * Start the sampler thread, the first dump is taken right away.
+ */
+bool PeerSampler::start(const std::string &ifname, uint32_t intervalSec) {
+	if (_samplerThread) {
+		return false;
+	}
+	_ifname = ifname;
+	_intervalSec = intervalSec > 0 ? intervalSec : 1;
+	_stopSampler = false;
+	_samplerThread = new std::thread(&PeerSampler::samplerTask, this);
+	return true;
+}
+
+void PeerSampler::stop() {
+	if (_samplerThread) {
+		{
+			std::lock_guard<std::mutex> lock(_wakeMtx);
+			_stopSampler = true;
+		}
+		_wake.notify_all();
+		_samplerThread->join();
+		delete _samplerThread;
+		_samplerThread = nullptr;
+	}
+	if (_sockfd >= 0) {
+		::close(_sockfd);
+		_sockfd = -1;
+	}
+}
+
+void PeerSampler::samplerTask() {
+	auto next = std::chrono::steady_clock::now();
+
+	while (!_stopSampler) {
+		sampleOnce();
+
+		next += std::chrono::seconds(_intervalSec);
+		std::unique_lock<std::mutex> lock(_wakeMtx);
+		_wake.wait_until(lock, next, [this] { return _stopSampler.load(); });
+	}
+}
+
+/*
+ * Take one dump and add it to the history. The socket and the family id are
+ * looked up again after a failure, the module may be loaded later.
+ */
+bool PeerSampler::sampleOnce() {
+	std::vector<peer_sample_t> peers;
+
+	if (_sockfd < 0) {
+		_sockfd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+		if (_sockfd < 0) {
+			spdlog::debug("sampler: netlink socket failed: {}", strerror(errno));
+			return false;
+		}
+	}
+	if (_family == 0 && (_family = resolveFamily(_sockfd)) == 0) {
+		spdlog::debug("sampler: wireguard netlink family not found");
+		return false;
+	}
+
+	if (!dumpPeers(_sockfd, _family, _ifname, peers)) {
+		spdlog::debug("sampler: dump of {} failed: {}", _ifname, strerror(errno));
+		::close(_sockfd);
+		_sockfd = -1;
+		_family = 0;
+		return false;
+	}
+
+	std::vector<peer_event_t> events;
+	record(peers, monotonicMs(), events);
+	if (_sampleHandler) {
+		_sampleHandler(peers);
+	}
+	if (_eventHandler) {
+		_eventHandler(events);
+	}
+	return true;
+}
+
+/*
+ * Append the differences to the previous dump. A counter that went backwards
+ * belongs to a peer that was removed and added again, so it counts from zero.
+ * The history is updated in place, the peers not in this dump are gone from
+ * the device and forgotten. The changes of state found on the way are
+ * returned as events.
+ */
+void PeerSampler::record(const std::vector<peer_sample_t> &peers, uint64_t nowMs, std::vector<peer_event_t> &events) {
+	std::lock_guard<std::mutex> lock(_historyMtx);
+	int64_t now = time(nullptr);
+
+	_pass++;
+	for (const peer_sample_t &sample : peers) {
+		auto found = _history.find(sample.publicKey);
+		peer_event_t event;
+		bool fresh = sample.lastHandshake != 0 && now - sample.lastHandshake < HANDSHAKE_STALE_SEC;
+
+		event.publicKey = keyToBase64(sample.publicKey);
+		event.endpoint = sample.endpoint;
+		event.lastHandshake = sample.lastHandshake;
+
+		if (found == _history.end()) {
+			peer_history_t &h = _history[sample.publicKey];
+			h.rxBytes = sample.rxBytes;
+			h.txBytes = sample.txBytes;
+			h.lastHandshake = sample.lastHandshake;
+			h.endpoint = sample.endpoint;
+			h.fresh = fresh;
+			h.stampMs = nowMs;
+			h.pass = _pass;
+			event.type = PeerEvent::ADDED;
+			events.push_back(event);
+			continue;
+		}
+		peer_history_t &h = found->second;
+		h.pass = _pass;
+
+		if (fresh != h.fresh) {
+			event.type = fresh ? PeerEvent::HANDSHAKE_ESTABLISHED : PeerEvent::HANDSHAKE_STALE;
+			events.push_back(event);
+			h.fresh = fresh;
+		}
+		if (sample.endpoint != h.endpoint && !h.endpoint.empty() && !sample.endpoint.empty()) {
+			event.type = PeerEvent::ENDPOINT_ROAMED;
+			event.previousEndpoint = h.endpoint;
+			events.push_back(event);
+		}
+		h.endpoint = sample.endpoint;
+
+		uint64_t dt = nowMs - h.stampMs;
+		if (dt == 0) {
+			continue;
+		}
+		uint64_t drx = sample.rxBytes >= h.rxBytes ? sample.rxBytes - h.rxBytes : sample.rxBytes;
+		uint64_t dtx = sample.txBytes >= h.txBytes ? sample.txBytes - h.txBytes : sample.txBytes;
+		int64_t dhs = sample.lastHandshake - h.lastHandshake;
+
+		h.dtMs[h.head] = saturate32(dt);
+		h.rxDelta[h.head] = saturate32(drx);
+		h.txDelta[h.head] = saturate32(dtx);
+		h.handshakeDelta[h.head] = dhs > 0 ? saturate32(dhs) : 0;
+		h.head = (h.head + 1) % peer_history_t::SLOTS;
+		if (h.count < peer_history_t::SLOTS) {
+			h.count++;
+		}
+
+		double previousRate = h.rxEwma + h.txEwma;
+		double rxRate = drx * 1000.0 / dt;
+		double txRate = dtx * 1000.0 / dt;
+		if (h.count == 1) {
+			h.rxEwma = rxRate;
+			h.txEwma = txRate;
+		} else {
+			double alpha = 1.0 - std::exp(-(dt / 1000.0) / _ewmaTauSec);
+			h.rxEwma += alpha * (rxRate - h.rxEwma);
+			h.txEwma += alpha * (txRate - h.txEwma);
+		}
+
+		// the thresholds belong to the subscribers, they pick the crossings
+		event.type = PeerEvent::RATE;
+		event.previousRate = previousRate;
+		event.rate = h.rxEwma + h.txEwma;
+		events.push_back(event);
+
+		h.rxBytes = sample.rxBytes;
+		h.txBytes = sample.txBytes;
+		h.lastHandshake = sample.lastHandshake;
+		h.stampMs = nowMs;
+	}
+
+	for (auto it = _history.begin(); it != _history.end(); ) {
+		if (it->second.pass == _pass) {
+			++it;
+			continue;
+		}
+		peer_event_t event;
+		event.type = PeerEvent::REMOVED;
+		event.publicKey = keyToBase64(it->first);
+		event.endpoint = it->second.endpoint;
+		event.lastHandshake = it->second.lastHandshake;
+		events.push_back(event);
+		it = _history.erase(it);
+	}
+}
+
+/*
+ * Rates of all peers from the history, the newest samples covering at least
+ * windowSec make up the window.
+ */
+std::vector<peer_rate_t> PeerSampler::rates(uint32_t windowSec) {
+	std::lock_guard<std::mutex> lock(_historyMtx);
+	std::vector<peer_rate_t> result;
+	uint64_t windowMs = (uint64_t)windowSec * 1000;
+
+	result.reserve(_history.size());
+	for (const auto &entry : _history) {
+		const peer_history_t &h = entry.second;
+		peer_rate_t rate;
+		uint64_t covered = 0, rx = 0, tx = 0;
+
+		rate.publicKey = keyToBase64(entry.first);
+		rate.rxEwma = h.rxEwma;
+		rate.txEwma = h.txEwma;
+		rate.rxBytes = h.rxBytes;
+		rate.txBytes = h.txBytes;
+		rate.lastHandshake = h.lastHandshake;
+
+		for (int i = 0; i < h.count && covered < windowMs; i++) {
+			int slot = (h.head - 1 - i + peer_history_t::SLOTS) % peer_history_t::SLOTS;
+			covered += h.dtMs[slot];
+			rx += h.rxDelta[slot];
+			tx += h.txDelta[slot];
+			if (h.handshakeDelta[slot]) {
+				rate.handshakes++;
+			}
+		}
+		if (covered > 0) {
+			rate.rxWindow = rx * 1000.0 / covered;
+			rate.txWindow = tx * 1000.0 / covered;
+		}
+		rate.windowMs = saturate32(covered);
+		result.push_back(rate);
+	}
+	return result;
+}
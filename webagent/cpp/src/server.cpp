@@ -255,16 +255,24 @@ pipe_ret_t TcpServer::waitForClient(uint32_t timeout) {
  * Return true if message was sent successfully to all clients
  */
 pipe_ret_t TcpServer::sendToAllClients(const char * msg, size_t size) {
-	std::lock_guard<std::mutex> lock(_clientsMtx);
+	std::vector<int> fileDescriptors;
+	{
+		std::lock_guard<std::mutex> lock(_clientsMtx);
 
-	for (const Client *client : _clients) {
-		pipe_ret_t sendingResult = sendToClient(*client, msg, size);
-		if (!sendingResult.isSuccessful()) {
-			return sendingResult;
+		for (const Client *client : _clients) {
+			fileDescriptors.push_back(client->duplicateSocket());
 		}
 	}
 
-	return pipe_ret_t::success();
+	pipe_ret_t result = pipe_ret_t::success();
+	for (int fileDescriptor : fileDescriptors) {
+		pipe_ret_t sendingResult = sendToSocket(fileDescriptor, msg, size);
+		if (!sendingResult.isSuccessful() && result.isSuccessful()) {
+			result = sendingResult;
+		}
+	}
+
+	return result;
 }
 
 /*
@@ -281,18 +289,62 @@ pipe_ret_t TcpServer::sendToClient(const Client &client, const char *msg, size_t
 	return pipe_ret_t::success();
 }
 
+/*
+ * Send on a copy of the socket of a client, taken under _clientsMtx.  The
+ * send may block up to the send timeout of the client, so it is made
+ * without the lock, and the copy stays valid if the client is removed.
+ */
+pipe_ret_t TcpServer::sendToSocket(int fileDescriptor, const char *msg, size_t size) {
+	if (fileDescriptor < 0) {
+		return pipe_ret_t::failure(strerror(errno));
+	}
+	try {
+		Client::send(fileDescriptor, msg, size);
+	} catch (const std::runtime_error &error) {
+		::close(fileDescriptor);
+		return pipe_ret_t::failure(error.what());
+	}
+	::close(fileDescriptor);
+
+	return pipe_ret_t::success();
+}
+
 pipe_ret_t TcpServer::sendToClient(const std::string &clientIP, const char *msg, size_t size) {
-	std::lock_guard<std::mutex> lock(_clientsMtx);
+	int fileDescriptor;
+	{
+		std::lock_guard<std::mutex> lock(_clientsMtx);
+
+		const auto clientIter = std::find_if(_clients.begin(), _clients.end(),
+				[&clientIP](Client *client) { return client->getIp() == clientIP; });
+
+		if (clientIter == _clients.end()) {
+			return pipe_ret_t::failure("client not found");
+		}
+		fileDescriptor = (*clientIter)->duplicateSocket();
+	}
 
-	const auto clientIter = std::find_if(_clients.begin(), _clients.end(),
-			[&clientIP](Client *client) { return client->getIp() == clientIP; });
+	return sendToSocket(fileDescriptor, msg, size);
+}
 
-	if (clientIter == _clients.end()) {
-		return pipe_ret_t::failure("client not found");
+/*
+ * Send message to specific client (determined by client id), it fails once the
+ * client is disconnected.
+ */
+pipe_ret_t TcpServer::sendToClient(uint64_t clientId, const char *msg, size_t size) {
+	int fileDescriptor;
+	{
+		std::lock_guard<std::mutex> lock(_clientsMtx);
+
+		const auto clientIter = std::find_if(_clients.begin(), _clients.end(),
+				[clientId](Client *client) { return client->getId() == clientId; });
+
+		if (clientIter == _clients.end() || !(*clientIter)->isConnected()) {
+			return pipe_ret_t::failure("client not found");
+		}
+		fileDescriptor = (*clientIter)->duplicateSocket();
 	}
 
-	const Client &client = *(*clientIter);
-	return sendToClient(client, msg, size);
+	return sendToSocket(fileDescriptor, msg, size);
 }
 
 /*
@@ -323,6 +375,19 @@ bool TcpServer::send_NOK(const Client &client) {
 	return sendMessage(client, "NOK");
 }
 
+/*
+ * Send a reply which carries data, already formatted by the caller.
+ */
+bool TcpServer::sendReply(const Client &client, const std::string &reply) {
+	pipe_ret_t sendingResult = sendToClient(client, reply.c_str(), reply.size());
+	if (sendingResult.isSuccessful()) {
+		spdlog::info("<<< OK, reply sent to client.");
+		return true;
+	} else {
+		return false;
+	}
+}
+
 /*
  * Get a flag value to terminiate program.
  */
@@ -337,6 +402,13 @@ void TcpServer::setTerminate(bool flag) {
 	_flagTerminate = flag;
 }
 
+/*
+ * Wake up a thread blocked in acceptClient(), which then fails.
+ */
+void TcpServer::stopAccepting() {
+	::shutdown(_sockfd.get(), SHUT_RDWR);
+}
+
 /*
  * Close server and clients resources.
  * Return true is successFlag, false otherwise
@@ -0,0 +1,219 @@
+/*
+ * Persistent per-peer traffic counters
+ * Copyright (c) 2024-2025 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include "inc/usage.h"
+#include "spdlog/spdlog.h"
+
+static_assert(sizeof(usage_header_t) == 48, "usage file layout changed");
+static_assert(sizeof(usage_record_t) == 80, "usage file layout changed");
+
+/*
+ * The id of the running kernel, it changes on every boot
+ */
+static std::string bootId() {
+	static std::string id;
+	char buf[64] = "";
+
+	if (!id.empty()) {
+		return id;
+	}
+	FILE *fp = fopen(USAGE_BOOT_ID_PATH, "r");
+	if (fp) {
+		if (!fgets(buf, sizeof(buf), fp)) {
+			buf[0] = '\0';
+		}
+		fclose(fp);
+	}
+	buf[strcspn(buf, "\n")] = '\0';
+	id = std::string(buf, strnlen(buf, sizeof(usage_header_t::bootId)));
+	return id;
+}
+
+UsageStore::UsageStore() {
+}
+
+UsageStore::~UsageStore() {
+	save();
+}
+
+/*
+ * Read the totals saved before, a missing file is an empty history.
+ */
+bool UsageStore::load(const std::string &path, const std::string &ifname) {
+	std::lock_guard<std::mutex> lock(_usageMtx);
+	usage_header_t header;
+
+	_path = path;
+	_ifname = ifname;
+	_usage.clear();
+	_savedAt = time(nullptr);
+	_bootId.clear();
+	_ifindex = 0;
+
+	FILE *fp = fopen(path.c_str(), "r");
+	if (!fp) {
+		return errno == ENOENT;
+	}
+	memset(&header, 0, sizeof(header));
+	bool v1 = fread(&header, offsetof(usage_header_t, bootId), 1, fp) == 1 &&
+		memcmp(header.magic, USAGE_FILE_MAGIC_V1, sizeof(header.magic)) == 0;
+	if (!v1 && (memcmp(header.magic, USAGE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+			fread(header.bootId, sizeof(header) - offsetof(usage_header_t, bootId), 1, fp) != 1)) {
+		spdlog::error("usage: {} is not a usage file", path);
+		fclose(fp);
+		return false;
+	}
+
+	usage_record_t record;
+	for (uint32_t i = 0; i < header.count && fread(&record, sizeof(record), 1, fp) == 1; i++) {
+		_usage[std::string((const char *)record.publicKey, sizeof(record.publicKey))] = record;
+	}
+	fclose(fp);
+	spdlog::info("usage: {} peers loaded from {}", _usage.size(), path);
+
+	// The saved counters are of the interface of the file
+	if (!v1) {
+		_bootId = std::string(header.bootId, strnlen(header.bootId, sizeof(header.bootId)));
+		_ifindex = header.ifindex;
+	}
+	return true;
+}
+
+/*
+ * After a reboot or a restart of the interface its counters start from 0,
+ * and one grown past the saved one would look like it went on counting.
+ * The interface of the counters is checked before every update.
+ */
+void UsageStore::checkCounters() {
+	uint32_t ifindex = if_nametoindex(_ifname.c_str());
+	std::string current = bootId();
+
+	if (ifindex == 0) {
+		return;
+	}
+	if (_bootId.empty()) {
+		_bootId = current;
+		_ifindex = ifindex;
+		_dirty = true;
+		return;
+	}
+	if (_bootId == current && _ifindex == ifindex) {
+		return;
+	}
+
+	spdlog::info("usage: {} was restarted, its counters start from 0", _ifname);
+	for (auto &entry : _usage) {
+		entry.second.rxLast = 0;
+		entry.second.txLast = 0;
+	}
+	_bootId = current;
+	_ifindex = ifindex;
+	_dirty = true;
+}
+
+/*
+ * Add the traffic since the previous sample to the totals. A counter smaller
+ * than the last one was reset by a reboot or an interface restart, the base
+ * rolls forward and the whole counter is new traffic. The file is written
+ * at most once per save interval, and only when something changed.
+ */
+void UsageStore::update(const std::vector<peer_sample_t> &peers) {
+	std::lock_guard<std::mutex> lock(_usageMtx);
+	int64_t now = time(nullptr);
+
+	checkCounters();
+
+	for (const peer_sample_t &sample : peers) {
+		auto found = _usage.find(sample.publicKey);
+
+		if (found == _usage.end()) {
+			usage_record_t record;
+			memset(&record, 0, sizeof(record));
+			memcpy(record.publicKey, sample.publicKey.data(), sizeof(record.publicKey));
+			record.rxTotal = record.rxLast = sample.rxBytes;
+			record.txTotal = record.txLast = sample.txBytes;
+			record.since = record.updated = now;
+			_usage[sample.publicKey] = record;
+			_dirty = true;
+			continue;
+		}
+
+		usage_record_t &record = found->second;
+		uint64_t drx = sample.rxBytes >= record.rxLast ? sample.rxBytes - record.rxLast : sample.rxBytes;
+		uint64_t dtx = sample.txBytes >= record.txLast ? sample.txBytes - record.txLast : sample.txBytes;
+
+		if (sample.rxBytes != record.rxLast || sample.txBytes != record.txLast) {
+			record.rxTotal += drx;
+			record.txTotal += dtx;
+			record.rxLast = sample.rxBytes;
+			record.txLast = sample.txBytes;
+			record.updated = now;
+			_dirty = true;
+		}
+	}
+
+	if (_dirty && now - _savedAt >= (int64_t)_saveIntervalSec) {
+		saveLocked();
+	}
+}
+
+bool UsageStore::save() {
+	std::lock_guard<std::mutex> lock(_usageMtx);
+	return saveLocked();
+}
+
+/*
+ * Write the whole file next to the old one and rename it over, a power cut
+ * leaves either the old totals or the new ones.
+ */
+bool UsageStore::saveLocked() {
+	if (!_dirty || _path.empty()) {
+		return true;
+	}
+
+	std::string tmp = _path + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (!fp) {
+		spdlog::error("usage: can't write {}: {}", tmp, strerror(errno));
+		return false;
+	}
+
+	usage_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, USAGE_FILE_MAGIC, sizeof(header.magic));
+	header.count = _usage.size();
+	memcpy(header.bootId, _bootId.data(), std::min(_bootId.size(), sizeof(header.bootId)));
+	header.ifindex = _ifindex;
+
+	uint32_t count = header.count;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	for (const auto &entry : _usage) {
+		ok = ok && fwrite(&entry.second, sizeof(usage_record_t), 1, fp) == 1;
+	}
+	ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmp.c_str(), _path.c_str()) != 0) {
+		spdlog::error("usage: can't save {}: {}", _path, strerror(errno));
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	_savedAt = time(nullptr);
+	_dirty = false;
+	spdlog::debug("usage: {} peers saved to {}", count, _path);
+	return true;
+}
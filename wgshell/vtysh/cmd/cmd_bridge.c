@@ -50,7 +50,7 @@ DEFUN (bridge_add,
 	int nNum = atoi(argv[0]);
 	char *pEth1 = argv[1];
 	char *pEth2 = argv[2];
-	char szInfo[1024];
+	char szInfo[1024], szLeft[128];
 
 	if (nNum < 1  || nNum > 9) {
 		vty_out(vty, "%% bridge number %s error\n", argv[0]);
@@ -67,10 +67,9 @@ DEFUN (bridge_add,
 		vty_out(vty, "%% interface %s invalid\n", pEth2);
 		return CMD_WARNING;
 	}
-	snprintf(szInfo, sizeof(szInfo), "bridge %d", nNum);
-	config_del_line_byleft(config_top, szInfo);
+	snprintf(szLeft, sizeof(szLeft), "bridge %d", nNum);
 	snprintf(szInfo, sizeof(szInfo), "bridge %d %s %s", nNum, pEth1, pEth2);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
@@ -144,7 +143,7 @@ DEFUN (show_bridge_mac,
 		vty_out(vty, "%% invalid bridge name\n");
 		return CMD_WARNING;
 	}
-	return cmd_execute_system_command("brctl", 2, myargv);
+	return cmd_execute_show_command("brctl", 2, myargv);
 }
 
 int cmd_bridge_init()
@@ -7,6 +7,7 @@
 
 #include "command.h"
 #include "vtysh_config.h"
+#include "uci.h"
 #include <ctype.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -212,20 +213,15 @@ DEFUN (config_write_file,
        "Write running configuration to memory, network, or terminal\n"
        "Write to configuration file\n")
 {
-	FILE *fp;
-
 	if (host.config == NULL) {
 		vty_out (vty, "%% Can't save to configuration file, using vtysh.%s", VTY_NEWLINE);
 		return CMD_WARNING;
 	}
-	fp = fopen(host.config, "w");
-	if (fp == NULL) {
-		vty_out (vty, "%% Can't open configuration file %s.%s", host.config, VTY_NEWLINE);
+	if (config_write(host.config) < 0) {
+		vty_out (vty, "%% Can't write configuration file %s.%s", host.config, VTY_NEWLINE);
 		return CMD_WARNING;
 	}
 
-	config_dump(fp);
-	fflush(fp);
 	vty_out (vty, "Configuration saved SUCCESS %s", VTY_NEWLINE);
 
 	if (host.chpasswd) {
@@ -302,6 +298,27 @@ DEFUN (show_startup_config,
 	return CMD_SUCCESS;
 }
 
+#define SYSTEM_CONFIG	"/etc/config/system"
+
+/* Set the hostname in the kernel and in the system config.  Nothing else
+   has to be reloaded: 'system reload' would only set the kernel hostname
+   again and restart the logger, the DHCP client sends the new name at its
+   next renewal. */
+static void hostname_apply (char *name)
+{
+	struct uci_package *pkg;
+	struct uci_section *sec;
+
+	sethostname(name, strlen(name));
+
+	if ((pkg = uci_load(SYSTEM_CONFIG)) == NULL)
+		return;
+	sec = uci_section_find(pkg, "system", NULL, NULL);
+	if (sec && uci_option_set(sec, "hostname", name))
+		uci_save(pkg, SYSTEM_CONFIG);
+	uci_free(pkg);
+}
+
 /* Hostname configuration */
 DEFUN (config_hostname, 
        hostname_cmd,
@@ -309,27 +326,19 @@ DEFUN (config_hostname,
        "Set system's network name\n"
        "This system's network name\n")
 {
-	char szCmd[1024];
-
 	if (!isalpha((int) *argv[0])) {
 		vty_out (vty, "%% Please specify string starting with alphabet%s", VTY_NEWLINE);
 		return CMD_WARNING;
 	}
 
-	config_del_line_byleft(config_top, "hostname");
-	config_add_line(config_top, "hostname %s", argv[0]);
+	config_replace_line_byleft(config_top, "hostname", "hostname %s", argv[0]);
 	ENSURE_CONFIG(vty);
 
 	if (host.name)
 		XFREE (0, host.name);
 	host.name = strdup (argv[0]);
 
-	sethostname(host.name, strlen(host.name));
-
-	sprintf(szCmd, "uci set system.@system[0].hostname='%s'", argv[0]);
-	system(szCmd);
-	system("uci commit system");
-	system("/etc/init.d/system reload");
+	hostname_apply(host.name);
 
 	return CMD_SUCCESS;
 }
@@ -347,9 +356,7 @@ DEFUN (config_no_hostname,
 	config_del_line_byleft(config_top, "hostname ");
 
 #if defined(NANO_R2S_PLUS)
-	system("uci set system.@system[0].hostname='nano-r2s-plus'");
-	system("uci commit system");
-	system("/etc/init.d/system reload");
+	hostname_apply("nano-r2s-plus");
 #endif
 
 	return CMD_SUCCESS;
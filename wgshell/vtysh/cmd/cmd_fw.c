@@ -7,11 +7,22 @@
 
 #include "command.h"
 #include "vtysh_config.h"
+#include "memory.h"
+#include "hash.h"
+#include "linklist.h"
+#include "conntrack.h"
+#include "sort.h"
+#include <stdarg.h>
 #include <ctype.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -29,12 +40,649 @@
  * show sfirewall (all|nat|filter)
  */
 
-void apply_firewall_rules(void)
+#define FW_ORIG_FILE		"/etc/config/firewall.ORG"
+#define FW_CONFIG_FILE		"/etc/config/firewall"
+#define SFW_CONFIG_FILE		"/etc/config/sfirewall"
+#define SFW_BASE_STAMP		"/tmp/.sfirewall.base"
+#define SFW_NFT_BATCH		"/tmp/.sfirewall.nft"
+
+/* The ruleset fw4 makes of /etc/config/firewall and the one running */
+#ifndef SFW_FW4_PRINT
+#define SFW_FW4_PRINT		"fw4 print 2>/dev/null"
+#endif
+#ifndef SFW_NFT_LIST
+#define SFW_NFT_LIST		"nft -a list table inet fw4 2>/dev/null"
+#endif
+#define SFW_IPSET_FILE		"/etc/config/sfirewall_ipset"
+
+/* Port forwarding maps, loaded by fw4 from its include directories */
+#define SFW_PORTMAP_MAP		"sfw_portmap_"
+#define SFW_PORTMAP_MAP_FILE	"/usr/share/nftables.d/table-pre/sfirewall-portmap.nft"
+#define SFW_PORTMAP_RULE_DIR	"/usr/share/nftables.d/chain-pre/dstnat_%s"
+#define SFW_PORTMAP_RULE_FILE	"sfirewall-portmap.nft"
+
+/* Every rule generated by sfirewall is named "SFW-..." with a hash of its
+   config line, so the rules fw4 created from /etc/config/firewall and the
+   rules added below can be told apart by their "!fw4: NAME" comment. */
+#define SFW_NAME_PREFIX		"SFW-"
+
+/* Concatenate the files into dst, replaced atomically. */
+static int fw_concat(char *dst, char **src, int count)
+{
+	char tmpfile[256], buf[4096];
+	FILE *rfp, *wfp;
+	size_t n;
+	int i;
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", dst);
+	wfp = fopen(tmpfile, "w");
+	if (!wfp)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		rfp = fopen(src[i], "r");
+		if (!rfp)
+			continue;
+		while ((n = fread(buf, 1, sizeof(buf), rfp)) > 0)
+			fwrite(buf, 1, n, wfp);
+		fclose(rfp);
+	}
+
+	if (fflush(wfp) != 0 || fsync(fileno(wfp)) < 0) {
+		fclose(wfp);
+		unlink(tmpfile);
+		return -1;
+	}
+	fclose(wfp);
+	return rename(tmpfile, dst);
+}
+
+/* Create the directories of an fw4 include file. */
+static void fw_include_dir(char *path)
+{
+	char dir[256], *p;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		mkdir(dir, 0755);
+		*p = '/';
+	}
+}
+
+static unsigned int fw_file_hash(char *path)
+{
+	char buf[4096];
+	FILE *fp;
+	size_t n, i;
+	unsigned int hash = 2166136261U;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		for (i = 0; i < n; i++) {
+			hash ^= (unsigned char)buf[i];
+			hash *= 16777619U;
+		}
+	}
+	fclose(fp);
+	return hash;
+}
+
+/* Has firewall.ORG changed since the last full restart ?  The stamp lives
+   in /tmp, so the first apply after boot always restarts. */
+static int fw_base_changed(unsigned int *hash)
+{
+	char xbuf[32];
+	FILE *fp;
+	int changed = 1;
+
+	*hash = fw_file_hash(FW_ORIG_FILE);
+	fp = fopen(SFW_BASE_STAMP, "r");
+	if (fp) {
+		if (fgets(xbuf, sizeof(xbuf), fp) && strtoul(xbuf, NULL, 16) == *hash)
+			changed = 0;
+		fclose(fp);
+	}
+	return changed;
+}
+
+static void fw_base_stamp(unsigned int hash)
+{
+	FILE *fp;
+
+	fp = fopen(SFW_BASE_STAMP, "w");
+	if (fp) {
+		fprintf(fp, "%08x\n", hash);
+		fclose(fp);
+	}
+}
+
+static int fw_restart(void)
+{
+	char *restart[] = { "/etc/init.d/firewall", "restart", NULL };
+
+	return cmd_run(NULL, restart, 0, 0);
+}
+
+/* A rule of the fw4 ruleset, as printed by 'fw4 print' or listed by
+   'nft -a list'. */
+struct fw_rule {
+	char chain[64];
+
+	/* The "!fw4: NAME" comment fw4 gives the rules of its config, empty
+	   for a rule without one */
+	char name[128];
+
+	/* The text of a sfirewall rule printed by fw4, NULL otherwise */
+	char *expr;
+
+	/* nft rule handle, for a rule listed by nft */
+	int handle;
+};
+
+/* The chains of a ruleset with their rules in order, and its sets. */
+struct fw_ruleset {
+	struct fw_rule *rules;
+	int count;
+
+	/* Chain names, in the order of the rules */
+	struct list *chains;
+
+	/* List of struct fw_set */
+	struct list *sets;
+};
+
+static int fw_rule_sfw(struct fw_rule *rule)
+{
+	return !strncmp(rule->name, SFW_NAME_PREFIX, strlen(SFW_NAME_PREFIX));
+}
+
+/* A set or a map as fw4 sees it, the elements are kept normalized by
+   fw_set_elements() so two sets compare with strcmp(). */
+struct fw_set {
+	char name[64];
+	char *elements;
+
+	/* map instead of set */
+	int map;
+};
+
+static void fw_set_free(struct fw_set *set)
+{
+	if (set->elements)
+		XFREE(MTYPE_TMP, set->elements);
+	XFREE(MTYPE_TMP, set);
+}
+
+static struct fw_set *fw_set_find(struct list *sets, char *name)
+{
+	struct fw_set *set;
+	struct listnode *nn;
+
+	LIST_LOOP(sets, set, nn)
+		if (!strcmp(set->name, name))
+			return set;
+	return NULL;
+}
+
+/* Is the element in the normalized element list ? */
+static int fw_element_find(char *elements, char *elem)
+{
+	char *p = elements;
+	int len = strlen(elem);
+
+	while ((p = strstr(p, elem)) != NULL) {
+		if ((p == elements || p[-1] == ' ') && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+static int fw_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Sort the elements separated by ',' and join them with ", ".  Blanks
+   are collapsed and a host prefix(/32) is written as nft prints it. */
+static char *fw_set_elements(char *text)
+{
+	char *copy, *tok, *save = NULL, **elem = NULL, *out, *p, *q;
+	int count = 0, size = 0, len = 0, i;
+
+	copy = XSTRDUP(MTYPE_TMP, text);
+	for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		for (p = q = tok; *p; p++) {
+			if (isspace((unsigned char)*p)) {
+				if (q != tok && q[-1] != ' ')
+					*q++ = ' ';
+			} else
+				*q++ = *p;
+		}
+		if (q != tok && q[-1] == ' ')
+			q--;
+		*q = '\0';
+		if (*tok == '\0')
+			continue;
+		if (q - tok > 3 && !strcmp(q - 3, "/32"))
+			q[-3] = '\0';
+
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			elem = XREALLOC(MTYPE_TMP, elem, sizeof(char *) * size);
+		}
+		elem[count++] = tok;
+		len += strlen(tok) + 2;
+	}
+	if (count)
+		qsort(elem, count, sizeof(char *), fw_strcmp);
+
+	out = XCALLOC(MTYPE_TMP, len + 1);
+	for (i = 0, p = out; i < count; i++)
+		p += sprintf(p, "%s%s", i ? ", " : "", elem[i]);
+
+	if (elem)
+		XFREE(MTYPE_TMP, elem);
+	XFREE(MTYPE_TMP, copy);
+	return out;
+}
+
+static void fw_ruleset_init(struct fw_ruleset *rs)
+{
+	memset(rs, 0, sizeof(*rs));
+	rs->chains = list_new();
+	rs->chains->del = (void (*) (void *)) free;
+	rs->sets = list_new();
+	rs->sets->del = (void (*) (void *)) fw_set_free;
+}
+
+static void fw_ruleset_free(struct fw_ruleset *rs)
+{
+	int i;
+
+	for (i = 0; i < rs->count; i++)
+		if (rs->rules[i].expr)
+			XFREE(MTYPE_TMP, rs->rules[i].expr);
+	if (rs->rules)
+		XFREE(MTYPE_TMP, rs->rules);
+	list_delete(rs->chains);
+	list_delete(rs->sets);
+}
+
+/* Parse a ruleset printed by 'fw4 print' or listed by 'nft -a list' (or
+   a file written the same way), collecting the rules of every chain in
+   order and all the sets and maps.  Only the text of the sfirewall rules
+   is kept. */
+static void fw_ruleset_parse(FILE *fp, struct fw_ruleset *rs)
+{
+	char xbuf[4096], chain[64], name[64], *p, *q;
+	struct fw_rule *rule;
+	struct fw_set *set = NULL;
+	char *elements = NULL;
+	int size = rs->count, len = 0, map;
+
+	chain[0] = '\0';
+	while (fgets(xbuf, sizeof(xbuf), fp)) {
+		/* elements = { a, b,
+				c, d } */
+		if (elements || (set && (p = strstr(xbuf, "elements = {")) != NULL)) {
+			p = elements ? xbuf : p + strlen("elements = {");
+			if ((q = strchr(p, '}')) != NULL)
+				*q = '\0';
+			elements = XREALLOC(MTYPE_TMP, elements, len + strlen(p) + 2);
+			len += sprintf(elements + len, ",%s", p);
+			if (q) {
+				XFREE(MTYPE_TMP, set->elements);
+				set->elements = fw_set_elements(elements);
+				XFREE(MTYPE_TMP, elements);
+				elements = NULL;
+				len = 0;
+			}
+			continue;
+		}
+		if (chain[0] == '\0' && ((map = (sscanf(xbuf, " map %63s {", name) == 1)) ||
+					sscanf(xbuf, " set %63s {", name) == 1)) {
+			set = XCALLOC(MTYPE_TMP, sizeof(struct fw_set));
+			snprintf(set->name, sizeof(set->name), "%s", name);
+			set->map = map;
+			set->elements = XSTRDUP(MTYPE_TMP, "");
+			listnode_add(rs->sets, set);
+			continue;
+		}
+		if (sscanf(xbuf, " chain %63s {", chain) == 1) {
+			set = NULL;
+			listnode_add(rs->chains, strdup(chain));
+			continue;
+		}
+
+		for (p = xbuf; isspace((unsigned char)*p); p++)
+			;
+		p[strcspn(p, "\r\n")] = '\0';
+		if (!strcmp(p, "}")) {
+			chain[0] = '\0';
+			set = NULL;
+			continue;
+		}
+		/* Chain type, policy and fw4 include lines are no rules */
+		if (chain[0] == '\0' || *p == '\0' || *p == '#' || !strncmp(p, "include ", 8) ||
+				!strncmp(p, "policy ", 7) || strstr(p, " hook "))
+			continue;
+
+		if (rs->count == size) {
+			size = size ? size * 2 : 64;
+			rs->rules = XREALLOC(MTYPE_TMP, rs->rules, sizeof(struct fw_rule) * size);
+		}
+		rule = &rs->rules[rs->count++];
+		memset(rule, 0, sizeof(*rule));
+		snprintf(rule->chain, sizeof(rule->chain), "%s", chain);
+		if ((q = strstr(p, " # handle ")) != NULL) {
+			rule->handle = atoi(q + strlen(" # handle "));
+			*q = '\0';
+		}
+		if ((q = strstr(p, "comment \"!fw4: ")) != NULL) {
+			q += strlen("comment \"!fw4: ");
+			snprintf(rule->name, sizeof(rule->name), "%.*s", (int)strcspn(q, "\""), q);
+		}
+		if (fw_rule_sfw(rule))
+			rule->expr = XSTRDUP(MTYPE_TMP, p);
+	}
+	if (elements)
+		XFREE(MTYPE_TMP, elements);
+}
+
+/* Read the output of a command printing a ruleset.  Return -1 if it
+   failed, fw4(nftables) is not running or not installed. */
+static int fw_ruleset_read(char *cmd, struct fw_ruleset *rs)
+{
+	int status;
+	FILE *fp;
+
+	fp = popen(cmd, "r");
+	if (fp == NULL)
+		return -1;
+	fw_ruleset_parse(fp, rs);
+	status = pclose(fp);
+	return (status != 0 || listcount(rs->chains) == 0) ? -1 : 0;
+}
+
+static int fw_chain_find(struct fw_ruleset *rs, char *chain)
+{
+	struct listnode *nn;
+	char *name;
+
+	LIST_LOOP(rs->chains, name, nn)
+		if (!strcmp(name, chain))
+			return 1;
+	return 0;
+}
+
+/* The index of the rule of the chain with the name, -1 if there is none
+   and -2 if there are several. */
+static int fw_rule_lookup(struct fw_ruleset *rs, char *chain, char *name)
+{
+	int i, found = -1;
+
+	for (i = 0; i < rs->count; i++) {
+		if (strcmp(rs->rules[i].chain, chain) || strcmp(rs->rules[i].name, name))
+			continue;
+		if (found >= 0)
+			return -2;
+		found = i;
+	}
+	return found;
+}
+
+/* A sfirewall rule of the wanted ruleset which is not running yet. */
+static int fw_rule_new(struct fw_ruleset *running, struct fw_rule *rule)
+{
+	return fw_rule_sfw(rule) && fw_rule_lookup(running, rule->chain, rule->name) == -1;
+}
+
+/* The running rule a wanted rule can be placed next to: a named rule,
+   the only one of its name in the chain of both rulesets.  Return its
+   index in running or -1. */
+static int fw_rule_anchor(struct fw_ruleset *running, struct fw_ruleset *wanted, struct fw_rule *rule)
+{
+	int i;
+
+	if (rule->name[0] == '\0' || fw_rule_lookup(wanted, rule->chain, rule->name) < 0)
+		return -1;
+	i = fw_rule_lookup(running, rule->chain, rule->name);
+	return i >= 0 ? i : -1;
+}
+
+static int fw_chain_used(struct fw_ruleset *rs, char *chain)
+{
+	int i;
+
+	for (i = 0; i < rs->count; i++)
+		if (!strcmp(rs->rules[i].chain, chain))
+			return 1;
+	return 0;
+}
+
+/* Are the rules of the chain which can be placed by running in the same
+   order in both rulesets ? */
+static int fw_chain_ordered(struct fw_ruleset *running, struct fw_ruleset *wanted, char *chain)
+{
+	int i, anchor, prev = -1;
+
+	for (i = 0; i < wanted->count; i++) {
+		if (strcmp(wanted->rules[i].chain, chain))
+			continue;
+		if ((anchor = fw_rule_anchor(running, wanted, &wanted->rules[i])) < 0)
+			continue;
+		if (anchor < prev)
+			return 0;
+		prev = anchor;
+	}
+	return 1;
+}
+
+
+/* Update the elements of a running map one by one, a map element is
+   "key : value" and the keys are unique.  Return the number of changes. */
+static int fw_map_update(FILE *fp, struct fw_set *set, struct fw_set *rset)
 {
-	char *orig_firewall_rule_file = "/etc/config/firewall.ORG";
+	char *want, *have, *w, *h, *sep, *wsave = NULL, *hsave = NULL;
+	int changes = 0;
+
+	/* Elements gone or changed */
+	have = XSTRDUP(MTYPE_TMP, rset->elements);
+	for (h = strtok_r(have, ",", &hsave); h; h = strtok_r(NULL, ",", &hsave)) {
+		while (*h == ' ')
+			h++;
+		if (fw_element_find(set->elements, h))
+			continue;
+		if ((sep = strstr(h, " :")) != NULL)
+			*sep = '\0';
+		fprintf(fp, "delete element inet fw4 %s { %s }\n", set->name, h);
+		changes++;
+	}
+	XFREE(MTYPE_TMP, have);
+
+	/* Elements new or changed */
+	want = XSTRDUP(MTYPE_TMP, set->elements);
+	for (w = strtok_r(want, ",", &wsave); w; w = strtok_r(NULL, ",", &wsave)) {
+		while (*w == ' ')
+			w++;
+		if (fw_element_find(rset->elements, w))
+			continue;
+		fprintf(fp, "add element inet fw4 %s { %s }\n", set->name, w);
+		changes++;
+	}
+	XFREE(MTYPE_TMP, want);
+	return changes;
+}
+
+/* Add the new sfirewall rules of a chain next to the running rules they
+   follow or precede in the wanted chain.  Each run of new rules is
+   inserted before the running rule after it or, if that one can't be
+   told apart, added after the one before it, right after it so in
+   reverse.  Return the number of rules added or -1 if a run has no such
+   neighbour. */
+static int fw_chain_add(FILE *fp, struct fw_ruleset *running, struct fw_ruleset *wanted, char *chain)
+{
+	struct fw_rule *rules = wanted->rules;
+	int first = -1, last = -1, added = 0;
+	int i, j, k, anchor;
+
+	for (i = 0; i < wanted->count; i++) {
+		if (strcmp(rules[i].chain, chain))
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+	}
+
+	for (i = first; i >= 0 && i <= last; i = j) {
+		if (!fw_rule_new(running, &rules[i])) {
+			j = i + 1;
+			continue;
+		}
+		for (j = i; j <= last && fw_rule_new(running, &rules[j]); j++)
+			/* A rule fw4 writes with a define can't be added alone */
+			if (strchr(rules[j].expr, '$'))
+				return -1;
+
+		if (j <= last && (anchor = fw_rule_anchor(running, wanted, &rules[j])) >= 0) {
+			for (k = i; k < j; k++)
+				fprintf(fp, "insert rule inet fw4 %s position %d %s\n", chain,
+						running->rules[anchor].handle, rules[k].expr);
+		} else if (i > first && (anchor = fw_rule_anchor(running, wanted, &rules[i - 1])) >= 0) {
+			for (k = j - 1; k >= i; k--)
+				fprintf(fp, "add rule inet fw4 %s position %d %s\n", chain,
+						running->rules[anchor].handle, rules[k].expr);
+		} else if (!fw_chain_used(running, chain)) {
+			for (k = i; k < j; k++)
+				fprintf(fp, "add rule inet fw4 %s %s\n", chain, rules[k].expr);
+		} else
+			return -1;
+		added += j - i;
+	}
+	return added;
+}
+
+/* Write the nft commands bringing the running fw4 ruleset in line with
+   the wanted one: delete the sfirewall rules which are gone, refill the
+   sets whose elements changed, update the changed map elements and add
+   the new rules in place.  Return the number of changes or -1 if only a
+   full restart can do it. */
+static int fw_delta_write(FILE *fp, struct fw_ruleset *running, struct fw_ruleset *wanted)
+{
+	struct fw_set *set, *rset;
+	struct fw_rule *rule;
+	struct listnode *nn;
+	char *chain;
+	int changes = 0, added;
+	int i;
+
+	/* fw4 creates some chains, and the jumps to them, only for the rules
+	   which need them.  The rules running must also be in fw4's order. */
+	LIST_LOOP(wanted->chains, chain, nn)
+		if (!fw_chain_find(running, chain) || !fw_chain_ordered(running, wanted, chain))
+			return -1;
+	for (i = 0; i < wanted->count; i++) {
+		rule = &wanted->rules[i];
+		if (rule->name[0] && !fw_rule_sfw(rule) &&
+				fw_rule_lookup(running, rule->chain, rule->name) == -1)
+			return -1;
+	}
+
+	/* The portmap maps are fw4 includes, read only when the firewall
+	   starts.  A map added or gone needs a restart. */
+	LIST_LOOP(wanted->sets, set, nn) {
+		rset = fw_set_find(running->sets, set->name);
+		if (set->map && (rset == NULL || !rset->map))
+			return -1;
+	}
+	LIST_LOOP(running->sets, rset, nn) {
+		if (rset->map && !strncmp(rset->name, SFW_PORTMAP_MAP, strlen(SFW_PORTMAP_MAP)) &&
+				fw_set_find(wanted->sets, rset->name) == NULL)
+			return -1;
+	}
+
+	for (i = 0; i < running->count; i++) {
+		rule = &running->rules[i];
+		if (fw_rule_sfw(rule) && fw_rule_lookup(wanted, rule->chain, rule->name) == -1) {
+			fprintf(fp, "delete rule inet fw4 %s handle %d\n", rule->chain, rule->handle);
+			changes++;
+		}
+	}
+	/* A set no longer used stays until the next restart */
+	LIST_LOOP(wanted->sets, set, nn) {
+		rset = fw_set_find(running->sets, set->name);
+		if (rset && !strcmp(rset->elements, set->elements))
+			continue;
+		if (set->map) {
+			changes += fw_map_update(fp, set, rset);
+			continue;
+		}
+		if (rset == NULL)
+			fprintf(fp, "add set inet fw4 %s { type ipv4_addr; flags interval; auto-merge; }\n",
+					set->name);
+		fprintf(fp, "flush set inet fw4 %s\n", set->name);
+		if (set->elements[0])
+			fprintf(fp, "add element inet fw4 %s { %s }\n", set->name, set->elements);
+		changes++;
+	}
+	LIST_LOOP(wanted->chains, chain, nn) {
+		if ((added = fw_chain_add(fp, running, wanted, chain)) < 0)
+			return -1;
+		changes += added;
+	}
+	return changes;
+}
+
+/* Bring the running fw4 ruleset in line with the rules fw4 makes of the
+   new /etc/config/firewall in one nft transaction.  Return 0 on success
+   and -1 if a full restart is needed. */
+static int fw_apply_delta(void)
+{
+	char *batch[] = { "nft", "-f", SFW_NFT_BATCH, NULL };
+	struct fw_ruleset running, wanted;
+	int changes, ret = -1;
+	FILE *fp;
+
+	fw_ruleset_init(&running);
+	fw_ruleset_init(&wanted);
+	if (fw_ruleset_read(SFW_NFT_LIST, &running) < 0 || fw_ruleset_read(SFW_FW4_PRINT, &wanted) < 0)
+		goto out;
+	if ((fp = fopen(SFW_PORTMAP_MAP_FILE, "r")) != NULL) {
+		fw_ruleset_parse(fp, &wanted);
+		fclose(fp);
+	}
+
+	fp = fopen(SFW_NFT_BATCH, "w");
+	if (!fp)
+		goto out;
+	changes = fw_delta_write(fp, &running, &wanted);
+	fclose(fp);
+
+	if (changes == 0 || (changes > 0 && cmd_run(NULL, batch, 10, 0) == 0))
+		ret = 0;
+	unlink(SFW_NFT_BATCH);
+out:
+	fw_ruleset_free(&running);
+	fw_ruleset_free(&wanted);
+	return ret;
+}
+
+/* Return 0 if the changed rules were applied, 1 if the firewall was
+   restarted and -1 on error. */
+static int apply_firewall_rules(void)
+{
+	char *orig_firewall_rule_file = FW_ORIG_FILE;
 	char *sfirewall_filter_rule_file = "/etc/config/sfirewall_filter";
 	char *sfirewall_macfilter_rule_file = "/etc/config/sfirewall_mac";
 	char *sfirewall_nat_rule_file = "/etc/config/sfirewall_nat";
+	char *fragments[] = { SFW_IPSET_FILE, sfirewall_filter_rule_file,
+		sfirewall_macfilter_rule_file, sfirewall_nat_rule_file };
+	char *firewall[] = { FW_ORIG_FILE, SFW_CONFIG_FILE };
+	unsigned int base;
 	struct stat sb;
 
 	// New firewall = firewall.ORG + (sfirewall_filter + sfirewall_nat + sfirewall_mac)
@@ -42,28 +690,212 @@ void apply_firewall_rules(void)
 		system("cp /etc/config/firewall /etc/config/firewall.ORG > /dev/null 2>&1");
 	}
 
-	// if not exist, let's create an empty file.
-	{
-		if (stat(sfirewall_filter_rule_file, &sb) != 0)
-			system("touch /etc/config/sfirewall_filter > /dev/null 2>&1");
-		if (stat(sfirewall_macfilter_rule_file, &sb) != 0)
-			system("touch /etc/config/sfirewall_mac > /dev/null 2>&1");
-		if (stat(sfirewall_nat_rule_file, &sb) != 0)
-			system("touch /etc/config/sfirewall_nat > /dev/null 2>&1");
+	// Regenerate the /etc/config/sfirewall file with sfirewall_ipset/_filter/_mac/_nat files,
+	// missing fragments count as empty.
+	if (fw_concat(SFW_CONFIG_FILE, fragments, 4) < 0)
+		return -1;
+
+	// Regenerate the /etc/config/firewall file, used by the firewall at boot.
+	if (fw_concat(FW_CONFIG_FILE, firewall, 2) < 0)
+		return -1;
+
+	// Apply only the changed sfirewall rules, unless the base config changed.
+	if (!fw_base_changed(&base) && fw_apply_delta() == 0)
+		return 0;
+
+	if (fw_restart() != 0)
+		return -1;
+	fw_base_stamp(base);
+	return 1;
+}
+
+/*
+ * Firewall apply queue.
+ *
+ * Commands only queue the work and return; a background worker applies
+ * it.  Requests made while the worker waits for FW_APPLY_WINDOW_MS (or
+ * while it is applying) are coalesced into the next single apply.  The
+ * queue state is kept in FW_APPLY_STATE, locked with flock(), so it is
+ * shared by every vtysh process.  Each request gets a generation number,
+ * the state records the last generation applied.
+ */
+#define FW_APPLY_STATE		"/tmp/.sfirewall.apply"
+#define FW_APPLY_WINDOW_MS	300
+
+struct fw_apply_state {
+	int pid;		/* worker, 0 if none */
+	int pending;		/* FW_APPLY_* flags not yet taken by the worker */
+	int running;		/* FW_APPLY_* flags being applied */
+	int requested;		/* last generation requested */
+	int applied;		/* last generation applied */
+	int result;		/* result of the last apply */
+	long time;		/* when the last apply finished */
+};
+
+static int fw_apply_lock(struct fw_apply_state *st)
+{
+	char buf[512];
+	ssize_t n;
+	int fd;
+
+	memset(st, 0, sizeof(*st));
+	fd = open(FW_APPLY_STATE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, LOCK_EX) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	if (n > 0) {
+		buf[n] = '\0';
+		sscanf(buf, "pid %d\npending %d\nrunning %d\nrequested %d\napplied %d\nresult %d\ntime %ld\n",
+				&st->pid, &st->pending, &st->running, &st->requested, &st->applied,
+				&st->result, &st->time);
+	}
+	return fd;
+}
+
+/* Write the state back and release the lock. */
+static void fw_apply_unlock(int fd, struct fw_apply_state *st)
+{
+	char buf[512];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "pid %d\npending %d\nrunning %d\nrequested %d\napplied %d\nresult %d\ntime %ld\n",
+			st->pid, st->pending, st->running, st->requested, st->applied,
+			st->result, st->time);
+	if (ftruncate(fd, 0) < 0 || pwrite(fd, buf, len, 0) != len)
+		fprintf(stderr, "%% Can't write %s: %s\n", FW_APPLY_STATE, strerror(errno));
+	close(fd);
+}
+
+static int fw_apply_worker_alive(struct fw_apply_state *st)
+{
+	return st->pid > 0 && (kill(st->pid, 0) == 0 || errno == EPERM);
+}
+
+static void fw_apply_worker(void)
+{
+	char *reload[] = { "/etc/init.d/firewall", "reload", NULL };
+	struct fw_apply_state st;
+	int fd, what, gen, ret;
+
+	while (1) {
+		usleep(FW_APPLY_WINDOW_MS * 1000);
+
+		if ((fd = fw_apply_lock(&st)) < 0)
+			break;
+		what = st.pending;
+		gen = st.requested;
+		if (what == 0) {
+			st.pid = 0;
+			fw_apply_unlock(fd, &st);
+			break;
+		}
+		st.pending = 0;
+		st.running = what;
+		fw_apply_unlock(fd, &st);
+
+		ret = 0;
+		if (what & FW_APPLY_RULES)
+			ret = apply_firewall_rules();
+		/* A restart has already loaded /etc/config/firewall */
+		if ((what & FW_APPLY_RELOAD) && ret != 1)
+			ret = (cmd_run(NULL, reload, 0, 0) == 0) ? 0 : -1;
+
+		if ((fd = fw_apply_lock(&st)) < 0)
+			break;
+		st.running = 0;
+		st.applied = gen;
+		st.result = (ret < 0) ? -1 : 0;
+		st.time = time(NULL);
+		fw_apply_unlock(fd, &st);
+	}
+}
+
+/* Start a worker detached from the vtysh process, so a short lived vtysh
+   can exit and the worker is never left as a zombie.  Return its pid. */
+static int fw_apply_spawn(int lockfd)
+{
+	int pfd[2], pid = -1, null;
+	pid_t child;
+
+	if (pipe(pfd) < 0)
+		return -1;
+
+	child = fork();
+	if (child < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+	if (child == 0) {
+		/* Closing the inherited descriptor keeps the caller's lock */
+		close(lockfd);
+		close(pfd[0]);
+		setsid();
+		child = fork();
+		if (child == 0) {
+			close(pfd[1]);
+			null = open("/dev/null", O_RDWR);
+			if (null >= 0) {
+				dup2(null, STDIN_FILENO);
+				dup2(null, STDOUT_FILENO);
+				dup2(null, STDERR_FILENO);
+				if (null > STDERR_FILENO)
+					close(null);
+			}
+			fw_apply_worker();
+			_exit(0);
+		}
+		pid = child;
+		if (write(pfd[1], &pid, sizeof(pid)) != sizeof(pid))
+			_exit(1);
+		_exit(0);
 	}
 
-	// Regenerate the /etc/config/sfirewall file with sfirewall_filter/_mac/_nat files.
-	system("cat /etc/config/sfirewall_filter /etc/config/sfirewall_mac /etc/config/sfirewall_nat > /tmp/sfirewall");
-	system("mv /tmp/sfirewall /etc/config > /dev/null 2>&1");
+	close(pfd[1]);
+	if (read(pfd[0], &pid, sizeof(pid)) != sizeof(pid))
+		pid = -1;
+	close(pfd[0]);
+	waitpid(child, NULL, 0);
+	return pid;
+}
 
-	// Regenerate the /etc/config/firewall file.
-	system("cat /etc/config/firewall.ORG /etc/config/sfirewall > /tmp/firewall");
-	
-	system("mv /tmp/firewall /etc/config > /dev/null 2>&1");
+/* Queue a firewall apply, return its generation or -1 if it could not be
+   queued. */
+int fw_apply_queue(int what)
+{
+	struct fw_apply_state st;
+	int fd, gen;
+
+	if ((fd = fw_apply_lock(&st)) < 0)
+		return -1;
+
+	gen = ++st.requested;
+	st.pending |= what;
+	if (!fw_apply_worker_alive(&st))
+		st.pid = fw_apply_spawn(fd);
+	if (st.pid < 0) {
+		st.pid = 0;
+		st.pending &= ~what;
+		st.requested--;
+		gen = -1;
+	}
+	fw_apply_unlock(fd, &st);
+	return gen;
+}
 
-	// Apply a new file rules.
-	system("uci commit firewall > /dev/null 2>&1");
-	system("/etc/init.d/firewall restart > /dev/null 2>&1");
+static int fw_apply_queued(struct vty *vty, int gen)
+{
+	if (gen < 0) {
+		vty_out(vty, "%% Failed to queue the firewall apply%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	vty_out(vty, "Firewall apply queued, generation %d%s", gen, VTY_NEWLINE);
+	return CMD_SUCCESS;
 }
 
 #if 0
@@ -191,33 +1023,132 @@ DEFUN (no_sfirewall_nat_portmap, no_sfirewall_nat_portmap_cmd,
 	return 0;
 }
 
-DEFUN (sfirewall_nat_portmap_apply,
-        sfirewall_nat_portmap_apply_cmd,
-        "sfirewall nat portmap apply",
-        "Configure smart firewall rules\n"
-		"Add NAT rules\n"
-		"Port forwarding\n"
-        "Apply\n")
+/*
+ * Port forwarding with one map lookup per zone.  A portmap with a tcp or
+ * udp port is an element "proto . port : address . port" of the map
+ * sfw_portmap_<zone>, and one dnat rule at the head of the dstnat_<zone>
+ * chain looks the new connection up in it.  Only a portmap forwarding
+ * all the ports(0) is still a fw4 redirect rule.  The map and the rule
+ * are fw4 includes, so a changed mapping is applied as an element update.
+ * fw4 creates dstnat_<zone>, the jump to it and the forward accept of the
+ * dnat'ed connections only for a zone with a redirect, so a zone with a
+ * map always gets a redirect which never matches, see fw_portmap_hook().
+ */
+static char *fw_portmap_zones[] = { "wan", "vpn", NULL };
+
+static int fw_key_cmp(char *a, char *b)
+{
+	return !strcmp(a, b);
+}
+
+static void fw_key_free(char *key)
+{
+	XFREE(MTYPE_TMP, key);
+}
+
+static int fw_portmap_mappable(char **param)
+{
+	char *s;
+
+	if (strcmp(param[3], "tcp") && strcmp(param[3], "udp"))
+		return 0;
+	for (s = param[4]; *s; s++)
+		if (!isdigit(*s))
+			return 0;
+	for (s = param[5]; *s; s++)
+		if (!isdigit(*s))
+			return 0;
+	return atoi(param[4]) > 0 && atoi(param[5]) > 0;
+}
+
+/* The redirect keeping the dstnat hook of the zone, from the broadcast
+   address no connection comes from. */
+static void fw_portmap_hook(FILE *wfp, char *zone)
+{
+	fprintf(wfp, "config redirect\n");
+	fprintf(wfp, "       option target          'DNAT'\n");
+	fprintf(wfp, "       option src             '%s'\n", zone);
+	fprintf(wfp, "       option dest            'lan'\n");
+	fprintf(wfp, "       option proto           'tcp'\n");
+	fprintf(wfp, "       option src_ip          '255.255.255.255'\n");
+	fprintf(wfp, "       option dest_ip         '127.0.0.1'\n");
+	fprintf(wfp, "       option name            '" SFW_NAME_PREFIX "NAT-hook-%s'\n", zone);
+	fprintf(wfp, "       option enabled         '1'\n");
+	fprintf(wfp, "\n");
+}
+
+/* Write the map include and the rule include of every zone, from the
+   elements per zone. */
+static int fw_portmap_write_includes(char **elements)
+{
+	char dir[256], path[512];
+	FILE *wfp, *rfp;
+	int i;
+
+	fw_include_dir(SFW_PORTMAP_MAP_FILE);
+	wfp = fopen(SFW_PORTMAP_MAP_FILE, "w");
+	if (!wfp)
+		return -1;
+	for (i = 0; fw_portmap_zones[i]; i++) {
+		snprintf(dir, sizeof(dir), SFW_PORTMAP_RULE_DIR, fw_portmap_zones[i]);
+		snprintf(path, sizeof(path), "%s/" SFW_PORTMAP_RULE_FILE, dir);
+		if (elements[i] == NULL) {
+			unlink(path);
+			continue;
+		}
+
+		fprintf(wfp, "map " SFW_PORTMAP_MAP "%s {\n", fw_portmap_zones[i]);
+		fprintf(wfp, "\ttype inet_proto . inet_service : ipv4_addr . inet_service\n");
+		fprintf(wfp, "\telements = { %s }\n", elements[i]);
+		fprintf(wfp, "}\n\n");
+
+		fw_include_dir(path);
+		rfp = fopen(path, "w");
+		if (!rfp)
+			continue;
+		fprintf(rfp, "meta nfproto ipv4 counter dnat ip addr . port to meta l4proto . th dport map @"
+				SFW_PORTMAP_MAP "%s comment \"sfirewall portmap\"\n", fw_portmap_zones[i]);
+		fclose(rfp);
+	}
+	fclose(wfp);
+	return 0;
+}
+
+/* Write the portmaps of portmap.txt forwarding all the ports as fw4
+   redirect sections, and collect the map elements of the others per
+   zone.  Return 0 on success and -1 on error. */
+static int fw_portmap_write(char *portmap_config_file, char *sfirewall_nat_rule_file, char **elements)
 {
-	char *portmap_config_file = CONFIG_DIR "/" "portmap.txt";
-	char *sfirewall_nat_rule_file = "/etc/config/sfirewall_nat";
 	FILE *rfp, *wfp;
 	char xbuf[1024], *s;
-	char param[6][32]; 
+	char param[6][32], *pparam[6];
+	char element[256];
+	struct hash *keys;
 	int portmap_len = strlen("sfirewall nat portmap");
+	unsigned int key;
+	int i, zone;
 
 	wfp = fopen(sfirewall_nat_rule_file, "w");
 	if (!wfp)
-		return CMD_WARNING;
+		return -1;
 	fprintf(wfp, "\n");
 
 	rfp = fopen(portmap_config_file, "r");
-	if (!rfp)
-		return CMD_WARNING;
+	if (!rfp) {
+		fclose(wfp);
+		return -1;
+	}
+
+	/* The first portmap of a port wins, as the first redirect rule did */
+	keys = hash_create_size(64, (unsigned int (*) (void *)) string_hash_make,
+			(int (*) (void *, void *)) fw_key_cmp);
+	for (i = 0; i < 6; i++)
+		pparam[i] = param[i];
 
 	memset(xbuf, 0, sizeof(xbuf));
 	while (fgets(xbuf, sizeof(xbuf), rfp)) {
 		xbuf[strlen(xbuf)-1] = '\0';
+		key = string_hash_make(xbuf);
 
 		// ex: sfirewall nat portmap 10 wan 192.168.8.100 tcp 8080 80
 		if (!strncmp(xbuf, "sfirewall nat portmap", portmap_len)) {
@@ -246,7 +1177,27 @@ DEFUN (sfirewall_nat_portmap_apply,
 			sprintf(param[5], "%s", s);
 
 			// ---------------------------------------------
-			
+
+			for (zone = 0; fw_portmap_zones[zone]; zone++)
+				if (!strcmp(fw_portmap_zones[zone], param[1]))
+					break;
+
+			if (fw_portmap_zones[zone] && fw_portmap_mappable(pparam)) {
+				snprintf(element, sizeof(element), "%s %s . %s", param[1], param[3], param[4]);
+				if (hash_lookup(keys, element))
+					continue;
+				hash_get(keys, XSTRDUP(MTYPE_TMP, element), hash_alloc_intern);
+
+				snprintf(element, sizeof(element), "%s . %s : %s . %s",
+						param[3], param[4], param[2], param[5]);
+				s = elements[zone];
+				elements[zone] = XMALLOC(MTYPE_TMP, (s ? strlen(s) + 2 : 0) + strlen(element) + 1);
+				sprintf(elements[zone], "%s%s%s", s ? s : "", s ? ", " : "", element);
+				if (s)
+					XFREE(MTYPE_TMP, s);
+				continue;
+			}
+
 			fprintf(wfp, "config redirect\n");
 			fprintf(wfp, "       option target          'DNAT'\n");
 			fprintf(wfp, "       option src             '%s'\n", param[1]);
@@ -257,29 +1208,222 @@ DEFUN (sfirewall_nat_portmap_apply,
 			fprintf(wfp, "       option dest_ip         '%s'\n", param[2]);
 			if (strcmp(param[5], "0"))  // any port
 				fprintf(wfp, "       option dest_port       '%s'\n", param[5]);
+			fprintf(wfp, "       option name            '" SFW_NAME_PREFIX "NAT-%s-%08x'\n", param[0], key);
 			fprintf(wfp, "       option enabled         '1'\n");
 			fprintf(wfp, "\n");
 		}
 		memset(xbuf, 0, sizeof(xbuf));
 	}
+	for (zone = 0; fw_portmap_zones[zone]; zone++)
+		if (elements[zone])
+			fw_portmap_hook(wfp, fw_portmap_zones[zone]);
 	fclose(wfp);
 	fclose(rfp);
 
-	apply_firewall_rules();
-
-    return CMD_SUCCESS;
+	hash_clean(keys, (void (*) (void *)) fw_key_free);
+	hash_free(keys);
+	return 0;
 }
 
-DEFUN (sfirewall_filter_rules, sfirewall_filter_rules_cmd,
-		"sfirewall filter NUM (lan2wan|wan2lan) (in|out|fw) (insert|append) (permit|deny|reject) (tcp|udp|icmp) A.B.C.D/E PORT A.B.C.D/E PORT DAY FROMTIME TOTIME",
-		"Configure smart firewall rules\n"
-		"Add filter rules\n"
-		"Index number(Rule order) e.g. 10\n"
-		"from lan to wan zone\n"
-		"from wan to lan zone\n"
-		"Input direction\n"
-		"Output direction\n"
-		"Forward direction\n"
+DEFUN (sfirewall_nat_portmap_apply,
+        sfirewall_nat_portmap_apply_cmd,
+        "sfirewall nat portmap apply",
+        "Configure smart firewall rules\n"
+		"Add NAT rules\n"
+		"Port forwarding\n"
+        "Apply\n")
+{
+	char *elements[sizeof(fw_portmap_zones) / sizeof(char *)] = { NULL };
+	int zone;
+
+	if (fw_portmap_write(CONFIG_DIR "/" "portmap.txt", "/etc/config/sfirewall_nat", elements) < 0)
+		return CMD_WARNING;
+
+	fw_portmap_write_includes(elements);
+	for (zone = 0; fw_portmap_zones[zone]; zone++)
+		if (elements[zone])
+			XFREE(MTYPE_TMP, elements[zone]);
+
+	return fw_apply_queued(vty, fw_apply_queue(FW_APPLY_RULES));
+}
+
+/*
+ * ipset: named lists of networks, compiled into nftables interval sets.
+ * A filter rule refers to a set with @NAME instead of an address, so the
+ * rule is matched by one set lookup whatever the size of the list.
+ */
+#define SFW_IPSET_PREFIX	"sfirewall ipset "
+
+static int fw_ipset_name_valid(char *name)
+{
+	int len = strlen(name);
+	int i;
+
+	if (len == 0 || len > 31 || !isalpha(name[0]))
+		return 0;
+	for (i = 0; i < len; i++)
+		if (!isalnum(name[i]) && name[i] != '_')
+			return 0;
+	return 1;
+}
+
+/* Write the sets configured with 'sfirewall ipset' as fw4 ipset sections.
+   config_top is sorted, so the members of a set are adjacent. */
+static int fw_ipset_write(char *path)
+{
+	struct listnode *nn;
+	char name[64], prefix[32], *line;
+	char cur[64] = "";
+	FILE *wfp;
+
+	wfp = fopen(path, "w");
+	if (!wfp)
+		return -1;
+	fprintf(wfp, "\n");
+
+	LIST_LOOP(config_top, line, nn) {
+		if (strncmp(line, SFW_IPSET_PREFIX, strlen(SFW_IPSET_PREFIX)))
+			continue;
+		if (sscanf(line + strlen(SFW_IPSET_PREFIX), "%63s %31s", name, prefix) != 2)
+			continue;
+
+		if (strcmp(cur, name)) {
+			if (cur[0])
+				fprintf(wfp, "\n");
+			fprintf(wfp, "config ipset\n");
+			fprintf(wfp, "        option name '%s'\n", name);
+			fprintf(wfp, "        option family 'ipv4'\n");
+			fprintf(wfp, "        list match 'net'\n");
+			snprintf(cur, sizeof(cur), "%s", name);
+		}
+		fprintf(wfp, "        list entry '%s'\n", prefix);
+	}
+	if (cur[0])
+		fprintf(wfp, "\n");
+	fclose(wfp);
+	return 0;
+}
+
+/* Parse A.B.C.D/M and write it with the host bits cleared, nft refuses
+   an interval element like 10.1.2.3/8. */
+static int fw_ipset_prefix(char *str, char *buf, int size)
+{
+	struct in_addr addr;
+	char xbuf[32], *s;
+	int len;
+
+	snprintf(xbuf, sizeof(xbuf), "%s", str);
+	if ((s = strchr(xbuf, '/')) == NULL)
+		return -1;
+	*s++ = '\0';
+	len = atoi(s);
+	if (!isdigit(*s) || len < 0 || len > 32 || inet_aton(xbuf, &addr) == 0)
+		return -1;
+
+	addr.s_addr &= len ? htonl(0xffffffffU << (32 - len)) : 0;
+	snprintf(buf, size, "%s/%d", inet_ntoa(addr), len);
+	return 0;
+}
+
+DEFUN (sfirewall_ipset, sfirewall_ipset_cmd,
+		"sfirewall ipset WORD A.B.C.D/M",
+		"Configure smart firewall rules\n"
+		"Add a network to an address set, applied with 'sfirewall filter apply'\n"
+		"Set name e.g. blocklist, referred to as @blocklist in filter rules\n"
+		"Network ip address/netmask(CIDR) e.g. 10.0.0.0/8\n")
+{
+	char line[1024], prefix[32];
+
+	if (!fw_ipset_name_valid(argv[0])) {
+		vty_out(vty, "%% Invalid ipset name '%s'\n", argv[0]);
+		return CMD_ERR_NOTHING_TODO;
+	}
+	if (fw_ipset_prefix(argv[1], prefix, sizeof(prefix)) < 0) {
+		vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[1]);
+		return CMD_ERR_NOTHING_TODO;
+	}
+
+	snprintf(line, sizeof(line), SFW_IPSET_PREFIX "%s %s", argv[0], prefix);
+	config_del_line(config_top, line);
+	config_add_line(config_top, line);
+
+	ENSURE_CONFIG(vty);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN (no_sfirewall_ipset, no_sfirewall_ipset_cmd,
+		"no sfirewall ipset WORD A.B.C.D/M",
+		NO_STR
+		"Configure smart firewall rules\n"
+		"Add a network to an address set, applied with 'sfirewall filter apply'\n"
+		"Set name e.g. blocklist, referred to as @blocklist in filter rules\n"
+		"Network ip address/netmask(CIDR) e.g. 10.0.0.0/8\n")
+{
+	char line[1024], prefix[32];
+
+	if (fw_ipset_prefix(argv[1], prefix, sizeof(prefix)) < 0) {
+		vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[1]);
+		return CMD_ERR_NOTHING_TODO;
+	}
+
+	snprintf(line, sizeof(line), SFW_IPSET_PREFIX "%s %s", argv[0], prefix);
+	config_del_line(config_top, line);
+
+	ENSURE_CONFIG(vty);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN (no_sfirewall_ipset_all, no_sfirewall_ipset_all_cmd,
+		"no sfirewall ipset WORD",
+		NO_STR
+		"Configure smart firewall rules\n"
+		"Add a network to an address set, applied with 'sfirewall filter apply'\n"
+		"Set name e.g. blocklist\n")
+{
+	char left[128];
+
+	snprintf(left, sizeof(left), SFW_IPSET_PREFIX "%s ", argv[0]);
+	while (config_get_line_byleft(config_top, left))
+		config_del_line_byleft(config_top, left);
+
+	ENSURE_CONFIG(vty);
+
+	return CMD_SUCCESS;
+}
+
+/* The days of a mon|tue|... string as a mask, bit 0 is monday.  Return
+   -1 if a day is not known. */
+static int fw_days_parse(char *str)
+{
+	static const char *days[] = { "mon", "tue", "wed", "thu", "fri", "sat", "sun" };
+	char xbuf[128], *s, *save = NULL;
+	int mask = 0, i;
+
+	if (!strcmp(str, "any"))
+		return 0x7f;
+	snprintf(xbuf, sizeof(xbuf), "%s", str);
+	for (s = strtok_r(xbuf, "|", &save); s; s = strtok_r(NULL, "|", &save)) {
+		for (i = 0; i < 7 && strcmp(s, days[i]); i++)
+			;
+		if (i == 7)
+			return -1;
+		mask |= 1 << i;
+	}
+	return mask ? mask : -1;
+}
+
+DEFUN (sfirewall_filter_rules, sfirewall_filter_rules_cmd,
+		"sfirewall filter NUM (lan2wan|wan2lan) (in|out|fw) (insert|append) (permit|deny|reject) (tcp|udp|icmp) A.B.C.D/E PORT A.B.C.D/E PORT DAY FROMTIME TOTIME",
+		"Configure smart firewall rules\n"
+		"Add filter rules\n"
+		"Index number(Rule order) e.g. 10\n"
+		"from lan to wan zone\n"
+		"from wan to lan zone\n"
+		"Input direction\n"
+		"Output direction\n"
+		"Forward direction\n"
 		"Insert at the front\n"
 		"Append to the back\n"
 		"Permit\n"
@@ -288,9 +1432,9 @@ DEFUN (sfirewall_filter_rules, sfirewall_filter_rules_cmd,
 		"TCP Protocol\n"
 		"UDP Protocol\n"
 		"ICMP Protocol\n"
-		"Source ip address/netmask(CIDR) e.g. 192.168.5.200/32\n"
+		"Source ip address/netmask(CIDR) e.g. 192.168.5.200/32 or @IPSET\n"
 		"Source port e.g. 8080 or any\n"
-		"Destination ip address/netmask(CIDR) e.g. 0.0.0.0/0\n"
+		"Destination ip address/netmask(CIDR) e.g. 0.0.0.0/0 or @IPSET\n"
 		"Destination port e.g. 80\n"
 		"Limit day e.g. mon|tue|wed|thu|fri|sat|sun or any\n"
 		"Start(from) time(00:00 ~ 23:59) e.g. 09:00 or any\n"
@@ -357,37 +1501,55 @@ DEFUN (sfirewall_filter_rules, sfirewall_filter_rules_cmd,
 		}
 	}
 
-	/* ip address/netmask sanity check */
-	if (!isdigit(argv[6][0])) {
-		vty_out(vty, "%% Invalid ip address '%s'\n", argv[6]);
+	/* ip address/netmask sanity check, @NAME refers to a sfirewall ipset */
+	if (argv[6][0] == '@' && argv[8][0] == '@') {
+		vty_out(vty, "%% Only one of the addresses can be an ipset\n");
 		return CMD_ERR_NOTHING_TODO;
 	}
-	sprintf(sip, "%s", argv[6]);
-	s = strstr(sip, "/");
-	if (s) {
-		if (strlen(s) > 3) {
-			vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+	if (argv[6][0] == '@') {
+		if (!fw_ipset_name_valid(&argv[6][1])) {
+			vty_out(vty, "%% Invalid ipset name '%s'\n", argv[6]);
 			return CMD_ERR_NOTHING_TODO;
 		}
 	} else {
-		vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[6]);
-		return CMD_ERR_NOTHING_TODO;
+		if (!isdigit(argv[6][0])) {
+			vty_out(vty, "%% Invalid ip address '%s'\n", argv[6]);
+			return CMD_ERR_NOTHING_TODO;
+		}
+		sprintf(sip, "%s", argv[6]);
+		s = strstr(sip, "/");
+		if (s) {
+			if (strlen(s) > 3) {
+				vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+				return CMD_ERR_NOTHING_TODO;
+			}
+		} else {
+			vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[6]);
+			return CMD_ERR_NOTHING_TODO;
+		}
 	}
 
-	if (!isdigit(argv[8][0])) {
-		vty_out(vty, "%% Invalid ip address '%s'\n", argv[8]);
-		return CMD_ERR_NOTHING_TODO;
-	}
-	sprintf(dip, "%s", argv[8]);
-	s = strstr(dip, "/");
-	if (s) {
-		if (strlen(s) > 3) {
-			vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+	if (argv[8][0] == '@') {
+		if (!fw_ipset_name_valid(&argv[8][1])) {
+			vty_out(vty, "%% Invalid ipset name '%s'\n", argv[8]);
 			return CMD_ERR_NOTHING_TODO;
 		}
 	} else {
-		vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[8]);
-		return CMD_ERR_NOTHING_TODO;
+		if (!isdigit(argv[8][0])) {
+			vty_out(vty, "%% Invalid ip address '%s'\n", argv[8]);
+			return CMD_ERR_NOTHING_TODO;
+		}
+		sprintf(dip, "%s", argv[8]);
+		s = strstr(dip, "/");
+		if (s) {
+			if (strlen(s) > 3) {
+				vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+				return CMD_ERR_NOTHING_TODO;
+			}
+		} else {
+			vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[8]);
+			return CMD_ERR_NOTHING_TODO;
+		}
 	}
 
 	/* Sanity check for day string(mon|tue|wed|thu|fri|sat|sun) */
@@ -402,7 +1564,7 @@ DEFUN (sfirewall_filter_rules, sfirewall_filter_rules_cmd,
 			day_count++;
 			s = strtok(NULL, "|");
 		}
-		if (day_count > 7) {
+		if (day_count > 7 || fw_days_parse(argv[10]) < 0) {
 			vty_out(vty, "%% Invalid day value '%s'\n", argv[10]);
 			return CMD_ERR_NOTHING_TODO;
 		}
@@ -513,9 +1675,9 @@ DEFUN (no_sfirewall_filter_rules, no_sfirewall_filter_rules_cmd,
 		"TCP Protocol\n"
 		"UDP Protocol\n"
 		"ICMP Protocol\n"
-		"Source ip address/netmask(CIDR) e.g. 192.168.5.200/32\n"
+		"Source ip address/netmask(CIDR) e.g. 192.168.5.200/32 or @IPSET\n"
 		"Source port e.g. 8080 or any\n"
-		"Destination ip address/netmask(CIDR) e.g. 0.0.0.0/0\n"
+		"Destination ip address/netmask(CIDR) e.g. 0.0.0.0/0 or @IPSET\n"
 		"Destination port e.g. 80\n"
 		"Limit day e.g. mon|tue|wed|thu|fri|sat|sun or any\n"
 		"Start(from) time(00:00 ~ 23:59) e.g. 09:00 or any\n"
@@ -582,37 +1744,55 @@ DEFUN (no_sfirewall_filter_rules, no_sfirewall_filter_rules_cmd,
 		}
 	}
 
-	/* ip address/netmask sanity check */
-	if (!isdigit(argv[6][0])) {
-		vty_out(vty, "%% Invalid ip address '%s'\n", argv[6]);
+	/* ip address/netmask sanity check, @NAME refers to a sfirewall ipset */
+	if (argv[6][0] == '@' && argv[8][0] == '@') {
+		vty_out(vty, "%% Only one of the addresses can be an ipset\n");
 		return CMD_ERR_NOTHING_TODO;
 	}
-	sprintf(sip, "%s", argv[6]);
-	s = strstr(sip, "/");
-	if (s) {
-		if (strlen(s) > 3) {
-			vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+	if (argv[6][0] == '@') {
+		if (!fw_ipset_name_valid(&argv[6][1])) {
+			vty_out(vty, "%% Invalid ipset name '%s'\n", argv[6]);
 			return CMD_ERR_NOTHING_TODO;
 		}
 	} else {
-		vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[6]);
-		return CMD_ERR_NOTHING_TODO;
+		if (!isdigit(argv[6][0])) {
+			vty_out(vty, "%% Invalid ip address '%s'\n", argv[6]);
+			return CMD_ERR_NOTHING_TODO;
+		}
+		sprintf(sip, "%s", argv[6]);
+		s = strstr(sip, "/");
+		if (s) {
+			if (strlen(s) > 3) {
+				vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+				return CMD_ERR_NOTHING_TODO;
+			}
+		} else {
+			vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[6]);
+			return CMD_ERR_NOTHING_TODO;
+		}
 	}
 
-	if (!isdigit(argv[8][0])) {
-		vty_out(vty, "%% Invalid ip address '%s'\n", argv[8]);
-		return CMD_ERR_NOTHING_TODO;
-	}
-	sprintf(dip, "%s", argv[8]);
-	s = strstr(dip, "/");
-	if (s) {
-		if (strlen(s) > 3) {
-			vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+	if (argv[8][0] == '@') {
+		if (!fw_ipset_name_valid(&argv[8][1])) {
+			vty_out(vty, "%% Invalid ipset name '%s'\n", argv[8]);
 			return CMD_ERR_NOTHING_TODO;
 		}
 	} else {
-		vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[8]);
-		return CMD_ERR_NOTHING_TODO;
+		if (!isdigit(argv[8][0])) {
+			vty_out(vty, "%% Invalid ip address '%s'\n", argv[8]);
+			return CMD_ERR_NOTHING_TODO;
+		}
+		sprintf(dip, "%s", argv[8]);
+		s = strstr(dip, "/");
+		if (s) {
+			if (strlen(s) > 3) {
+				vty_out(vty, "%% Invalid netmask '%s'\n", &s[1]);
+				return CMD_ERR_NOTHING_TODO;
+			}
+		} else {
+			vty_out(vty, "%% Invalid ip address/netmask '%s'\n", argv[8]);
+			return CMD_ERR_NOTHING_TODO;
+		}
 	}
 
 	/* Sanity check for day string(mon|tue|wed|thu|fri|sat|sun) */
@@ -627,7 +1807,7 @@ DEFUN (no_sfirewall_filter_rules, no_sfirewall_filter_rules_cmd,
 			day_count++;
 			s = strtok(NULL, "|");
 		}
-		if (day_count > 7) {
+		if (day_count > 7 || fw_days_parse(argv[10]) < 0) {
 			vty_out(vty, "%% Invalid day value '%s'\n", argv[10]);
 			return CMD_ERR_NOTHING_TODO;
 		}
@@ -705,139 +1885,433 @@ DEFUN (no_sfirewall_filter_rules, no_sfirewall_filter_rules_cmd,
 	return 0;
 }
 
-DEFUN (sfirewall_filter_rules_apply,
-        sfirewall_filter_rules_apply_cmd,
-        "sfirewall filter apply",
-        "Configure smart firewall rules\n"
-		"Add filter rules\n"
-        "Apply\n")
+/*
+ * Filter rule optimizer.
+ *
+ * The rules of filter.txt are evaluated in order, so before they are
+ * emitted:
+ *  - a rule whose match is contained in the match of an earlier rule never
+ *    fires and is removed (shadowed, or duplicate if the rules are equal),
+ *  - a rule followed by a rule with the same action whose match contains
+ *    it is removed, unless a rule in between overlaps it,
+ *  - two rules equal but for sibling prefixes(10.0.0.0/25 and
+ *    10.0.0.128/25) are merged into one rule with the parent prefix,
+ *    unless a rule in between overlaps the later one.
+ * Overlap is decided conservatively, only a difference known for sure
+ * (zone, protocol, disjoint prefixes, ports or days) makes two rules
+ * disjoint.
+ */
+#define FW_FILTER_PARAMS	13
+
+struct fw_prefix {
+	unsigned int addr;
+	int len;
+
+	/* @NAME, a set only compares equal to itself */
+	int set;
+};
+
+struct fw_filter {
+	char line[1024];
+	char param[FW_FILTER_PARAMS][64];
+
+	struct fw_prefix src, dst;
+	int sport_lo, sport_hi;
+	int dport_lo, dport_hi;
+	int days;		/* -1 if a day is not known */
+
+	/* Why the rule was removed, NULL if it is kept */
+	const char *removed;
+	int by;
+
+	/* A prefix was widened by merging */
+	int merged;
+};
+
+static unsigned int fw_mask(int len)
+{
+	return len ? 0xffffffffU << (32 - len) : 0;
+}
+
+static int fw_prefix_parse(char *str, struct fw_prefix *p)
+{
+	struct in_addr addr;
+	char xbuf[64], *s;
+
+	memset(p, 0, sizeof(*p));
+	if (str[0] == '@') {
+		p->set = 1;
+		return 0;
+	}
+	snprintf(xbuf, sizeof(xbuf), "%s", str);
+	if ((s = strchr(xbuf, '/')) == NULL)
+		return -1;
+	*s++ = '\0';
+	p->len = atoi(s);
+	if (p->len < 0 || p->len > 32 || inet_aton(xbuf, &addr) == 0)
+		return -1;
+	p->addr = ntohl(addr.s_addr) & fw_mask(p->len);
+	return 0;
+}
+
+/* Does a contain b ? */
+static int fw_prefix_contains(struct fw_prefix *a, char *astr, struct fw_prefix *b, char *bstr)
+{
+	if (a->set || b->set)
+		return !strcmp(astr, bstr);
+	return a->len <= b->len && (b->addr & fw_mask(a->len)) == a->addr;
+}
+
+static int fw_prefix_overlaps(struct fw_prefix *a, struct fw_prefix *b)
+{
+	if (a->set || b->set)
+		return 1;
+	return (a->addr & fw_mask(b->len)) == b->addr || (b->addr & fw_mask(a->len)) == a->addr;
+}
+
+/* Can a and b be merged into their parent prefix ? */
+static int fw_prefix_siblings(struct fw_prefix *a, struct fw_prefix *b)
+{
+	if (a->set || b->set || a->len != b->len || a->len == 0)
+		return 0;
+	return (a->addr ^ b->addr) == (1U << (32 - a->len));
+}
+
+static void fw_port_parse(char *str, int *lo, int *hi)
+{
+	char *s;
+
+	if (!strcmp(str, "any")) {
+		*lo = 0;
+		*hi = 65535;
+		return;
+	}
+	*lo = *hi = atoi(str);
+	if ((s = strchr(str, ':')) != NULL)
+		*hi = atoi(s + 1);
+}
+
+/* ex: sfirewall filter 10 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 80 mon|tue|wed|thu|fri 21:00 09:00 */
+static int fw_filter_parse(char *line, struct fw_filter *f)
 {
-	char *filter_config_file = CONFIG_DIR "/" "filter.txt";
-	char *sfirewall_filter_rule_file = "/etc/config/sfirewall_filter";
-	FILE *rfp, *wfp;
-	char xbuf[1024], *s;
-	char param[13][64]; 
-	char *action[3] = { "ACCEPT", "DROP", "REJECT" };
-	int action_index = 0;
-	int count = 0;
 	int filter_rule_len = strlen("sfirewall filter");
+	char xbuf[1024], *s, *save = NULL;
 	int i;
 
-	wfp = fopen(sfirewall_filter_rule_file, "w");
-	if (!wfp)
-		return CMD_WARNING;
-	fprintf(wfp, "\n");
+	if (strncmp(line, "sfirewall filter", filter_rule_len) || line[filter_rule_len] != ' ')
+		return -1;
 
-	rfp = fopen(filter_config_file, "r");
-	if (!rfp)
-		return CMD_WARNING;
+	memset(f, 0, sizeof(*f));
+	snprintf(f->line, sizeof(f->line), "%s", line);
+	snprintf(xbuf, sizeof(xbuf), "%s", &line[filter_rule_len + 1]);
+	for (i = 0, s = strtok_r(xbuf, " ", &save); i < FW_FILTER_PARAMS; i++, s = strtok_r(NULL, " ", &save)) {
+		if (s == NULL)
+			return -1;
+		snprintf(f->param[i], sizeof(f->param[i]), "%s", s);
+	}
 
-	memset(xbuf, 0, sizeof(xbuf));
-	while (fgets(xbuf, sizeof(xbuf), rfp)) {
-		xbuf[strlen(xbuf)-1] = '\0';
+	if (fw_prefix_parse(f->param[6], &f->src) < 0 || fw_prefix_parse(f->param[8], &f->dst) < 0)
+		return -1;
+	fw_port_parse(f->param[7], &f->sport_lo, &f->sport_hi);
+	fw_port_parse(f->param[9], &f->dport_lo, &f->dport_hi);
+	f->days = fw_days_parse(f->param[10]);
+	return 0;
+}
 
-		// ex: sfirewall filter 10 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 80 mon|tue|wed|thu|fri 21:00 09:00
-		if (!strncmp(xbuf, "sfirewall filter", filter_rule_len)) {
-			s = strtok(&xbuf[filter_rule_len+1], " "); // 10
-			if (s == NULL) continue;
-			sprintf(param[0], "%s", s);
+/* The zone and the protocol, the match fields compared as strings.  The
+   direction(in|out|fw) is not written to the fw4 rule, so rules which
+   differ only in it match the same packets. */
+static int fw_filter_same_kind(struct fw_filter *a, struct fw_filter *b)
+{
+	return !strcmp(a->param[1], b->param[1]) && !strcmp(a->param[5], b->param[5]);
+}
 
-			s = strtok(NULL, " ");      // lan2wan
-			if (s == NULL) continue;
-			sprintf(param[1], "%s", s);
+static int fw_filter_contains(struct fw_filter *a, struct fw_filter *b)
+{
+	int ports = strcmp(a->param[5], "icmp");
+
+	if (!fw_filter_same_kind(a, b))
+		return 0;
+	/* Days not known are taken as every day, and contain nothing nor are
+	   contained */
+	if (a->days < 0 || b->days < 0)
+		return 0;
+	if (!fw_prefix_contains(&a->src, a->param[6], &b->src, b->param[6]) ||
+			!fw_prefix_contains(&a->dst, a->param[8], &b->dst, b->param[8]))
+		return 0;
+	if (ports && (a->sport_lo > b->sport_lo || a->sport_hi < b->sport_hi ||
+				a->dport_lo > b->dport_lo || a->dport_hi < b->dport_hi))
+		return 0;
+	if ((a->days & b->days) != b->days)
+		return 0;
+	if (strcmp(a->param[11], "any") &&
+			(strcmp(a->param[11], b->param[11]) || strcmp(a->param[12], b->param[12])))
+		return 0;
+	return 1;
+}
 
-			s = strtok(NULL, " ");      // fw
-			if (s == NULL) continue;
-			sprintf(param[2], "%s", s);
+static int fw_filter_overlaps(struct fw_filter *a, struct fw_filter *b)
+{
+	int ports = strcmp(a->param[5], "icmp");
+
+	if (!fw_filter_same_kind(a, b))
+		return 0;
+	if (!fw_prefix_overlaps(&a->src, &b->src) || !fw_prefix_overlaps(&a->dst, &b->dst))
+		return 0;
+	if (ports && (a->sport_hi < b->sport_lo || b->sport_hi < a->sport_lo ||
+				a->dport_hi < b->dport_lo || b->dport_hi < a->dport_lo))
+		return 0;
+	if (a->days >= 0 && b->days >= 0 && (a->days & b->days) == 0)
+		return 0;
+	return 1;
+}
 
-			s = strtok(NULL, " ");      // insert
-			if (s == NULL) continue;
-			sprintf(param[3], "%s", s);
+/* Is there a kept rule between i and j overlapping rule k ? */
+static int fw_filter_crossed(struct fw_filter *f, int i, int j, int k)
+{
+	int n;
 
-			s = strtok(NULL, " ");      // deny
-			if (s == NULL) continue;
-			sprintf(param[4], "%s", s);
+	for (n = i + 1; n < j; n++)
+		if (!f[n].removed && fw_filter_overlaps(&f[n], &f[k]))
+			return 1;
+	return 0;
+}
 
-			s = strtok(NULL, " ");      // tcp
-			if (s == NULL) continue;
-			sprintf(param[5], "%s", s);
+/* Rules i and j differ only in the source or the destination prefix, and
+   those are siblings.  Return 6 or 8, the differing param, or 0. */
+static int fw_filter_mergeable(struct fw_filter *a, struct fw_filter *b)
+{
+	int i;
 
-			s = strtok(NULL, " ");      // 0.0.0.0/0
-			if (s == NULL) continue;
-			sprintf(param[6], "%s", s);
+	for (i = 1; i < FW_FILTER_PARAMS; i++)
+		if (i != 3 && i != 6 && i != 8 && strcmp(a->param[i], b->param[i]))
+			return 0;
+	if (!strcmp(a->param[8], b->param[8]) && fw_prefix_siblings(&a->src, &b->src))
+		return 6;
+	if (!strcmp(a->param[6], b->param[6]) && fw_prefix_siblings(&a->dst, &b->dst))
+		return 8;
+	return 0;
+}
 
-			s = strtok(NULL, " ");      // any
-			if (s == NULL) continue;
-			sprintf(param[7], "%s", s);
+static void fw_filter_merge(struct fw_filter *a, int param)
+{
+	struct fw_prefix *p = (param == 6) ? &a->src : &a->dst;
+	struct in_addr addr;
+	int i, len;
+
+	a->merged = 1;
+	p->len--;
+	p->addr &= fw_mask(p->len);
+	addr.s_addr = htonl(p->addr);
+	snprintf(a->param[param], sizeof(a->param[param]), "%s/%d", inet_ntoa(addr), p->len);
+
+	/* The rule name follows its content */
+	len = snprintf(a->line, sizeof(a->line), "sfirewall filter");
+	for (i = 0; i < FW_FILTER_PARAMS; i++)
+		len += snprintf(a->line + len, sizeof(a->line) - len, " %s", a->param[i]);
+}
 
-			s = strtok(NULL, " ");      // 0.0.0.0/0
-			if (s == NULL) continue;
-			sprintf(param[8], "%s", s);
+/* Return the number of rules removed. */
+static int fw_filter_optimize(struct fw_filter *f, int count)
+{
+	int removed = 0, changed = 1;
+	int i, j, param;
+
+	while (changed) {
+		changed = 0;
+		for (j = 0; j < count; j++) {
+			if (f[j].removed)
+				continue;
+			for (i = 0; i < j && !f[j].removed; i++) {
+				if (f[i].removed)
+					continue;
+
+				if (fw_filter_contains(&f[i], &f[j])) {
+					f[j].removed = fw_filter_contains(&f[j], &f[i]) &&
+						!strcmp(f[i].param[4], f[j].param[4]) ? "duplicate of" : "shadowed by";
+					f[j].by = i;
+				} else if (!strcmp(f[i].param[4], f[j].param[4]) &&
+						fw_filter_contains(&f[j], &f[i]) && !fw_filter_crossed(f, i, j, i)) {
+					f[i].removed = "contained in";
+					f[i].by = j;
+				} else if (!strcmp(f[i].param[4], f[j].param[4]) &&
+						(param = fw_filter_mergeable(&f[i], &f[j])) &&
+						!fw_filter_crossed(f, i, j, j)) {
+					fw_filter_merge(&f[i], param);
+					f[j].removed = "merged into";
+					f[j].by = i;
+				} else
+					continue;
+				removed++;
+				changed = 1;
+			}
+		}
+	}
+	return removed;
+}
 
-			s = strtok(NULL, " ");      // 80
-			if (s == NULL) continue;
-			sprintf(param[9], "%s", s);
+/* Read and optimize filter.txt, return the rules or NULL. */
+static struct fw_filter *fw_filter_load(char *path, int *count, int *removed)
+{
+	struct fw_filter *f = NULL;
+	char xbuf[1024];
+	int size = 0;
+	FILE *rfp;
 
-			s = strtok(NULL, " ");      // mon|tue|wed|thu|fri
-			if (s == NULL) continue;
-			sprintf(param[10], "%s", s);
-			for (i=0; i<strlen(param[10]); i++) {
-				if (param[10][i] == '|')
-					param[10][i] = ' ';
-			}
+	*count = *removed = 0;
+	rfp = fopen(path, "r");
+	if (!rfp)
+		return NULL;
 
-			s = strtok(NULL, " ");      // 21:00
-			if (s == NULL) continue;
-			sprintf(param[11], "%s", s);
+	while (fgets(xbuf, sizeof(xbuf), rfp)) {
+		xbuf[strcspn(xbuf, "\r\n")] = '\0';
+		if (*count == size) {
+			size = size ? size * 2 : 64;
+			f = XREALLOC(MTYPE_TMP, f, sizeof(struct fw_filter) * size);
+		}
+		if (fw_filter_parse(xbuf, &f[*count]) == 0)
+			(*count)++;
+	}
+	fclose(rfp);
 
-			s = strtok(NULL, " ");      // 09:00
-			if (s == NULL) continue;
-			sprintf(param[12], "%s", s);
-		
-			// ---------------------------------------------
-			
-			if (!strcmp(param[4], "permit"))
-				action_index = 0;
-			else if (!strcmp(param[4], "deny"))
-				action_index = 1;
-			else if (!strcmp(param[4], "reject"))
-				action_index = 2;
-
-			fprintf(wfp, "config rule\n");
-			if (!strcmp(param[1], "lan2wan")) {
-				fprintf(wfp, "        option src 'lan'\n");
-				fprintf(wfp, "        option dest 'wan'\n");
-			} else if (!strcmp(param[1], "wan2lan")) {
-				fprintf(wfp, "        option src 'wan'\n");
-				fprintf(wfp, "        option dest 'lan'\n");
-			}
-			fprintf(wfp, "        option proto '%s'\n", param[5]);
-			fprintf(wfp, "        option family 'ipv4'\n");
+	if (f == NULL)
+		f = XCALLOC(MTYPE_TMP, sizeof(struct fw_filter));
+	*removed = fw_filter_optimize(f, *count);
+	return f;
+}
+
+/* Write the optimized rules of filter.txt as fw4 rule sections.  Return
+   0 on success and -1 on error. */
+static int fw_filter_write(char *filter_config_file, char *sfirewall_filter_rule_file)
+{
+	FILE *wfp;
+	char weekdays[64], *param[FW_FILTER_PARAMS];
+	char *action[3] = { "ACCEPT", "DROP", "REJECT" };
+	int action_index = 0;
+	struct fw_filter *filters;
+	int count, removed;
+	int i, n;
+
+	filters = fw_filter_load(filter_config_file, &count, &removed);
+	if (!filters)
+		return -1;
+
+	wfp = fopen(sfirewall_filter_rule_file, "w");
+	if (!wfp) {
+		XFREE(MTYPE_TMP, filters);
+		return -1;
+	}
+	fprintf(wfp, "\n");
+
+	for (n = 0; n < count; n++) {
+		if (filters[n].removed)
+			continue;
+		for (i = 0; i < FW_FILTER_PARAMS; i++)
+			param[i] = filters[n].param[i];
+
+		snprintf(weekdays, sizeof(weekdays), "%s", param[10]);
+		for (i = 0; weekdays[i]; i++) {
+			if (weekdays[i] == '|')
+				weekdays[i] = ' ';
+		}
+
+		if (!strcmp(param[4], "permit"))
+			action_index = 0;
+		else if (!strcmp(param[4], "deny"))
+			action_index = 1;
+		else if (!strcmp(param[4], "reject"))
+			action_index = 2;
+
+		fprintf(wfp, "config rule\n");
+		if (!strcmp(param[1], "lan2wan")) {
+			fprintf(wfp, "        option src 'lan'\n");
+			fprintf(wfp, "        option dest 'wan'\n");
+		} else if (!strcmp(param[1], "wan2lan")) {
+			fprintf(wfp, "        option src 'wan'\n");
+			fprintf(wfp, "        option dest 'lan'\n");
+		}
+		fprintf(wfp, "        option proto '%s'\n", param[5]);
+		fprintf(wfp, "        option family 'ipv4'\n");
+		if (param[6][0] == '@')
+			fprintf(wfp, "        option ipset '%s src'\n", &param[6][1]);
+		else
 			fprintf(wfp, "        option src_ip '%s'\n", param[6]);
-			if (strcmp(param[7], "any"))
-				fprintf(wfp, "        option src_port '%s'\n", param[7]);
+		if (strcmp(param[7], "any"))
+			fprintf(wfp, "        option src_port '%s'\n", param[7]);
+		if (param[8][0] == '@')
+			fprintf(wfp, "        option ipset '%s dest'\n", &param[8][1]);
+		else
 			fprintf(wfp, "        option dest_ip '%s'\n", param[8]);
-			if (strcmp(param[9], "any"))
-				fprintf(wfp, "        option dest_port '%s'\n", param[9]);
-			if (strcmp(param[10], "any"))
-				fprintf(wfp, "        option weekdays '%s'\n", param[10]);
-			if (strcmp(param[11], "any")) {
-				fprintf(wfp, "        option start_time '%s'\n", param[11]);
-				fprintf(wfp, "        option stop_time '%s'\n", param[12]);
-			}
-			fprintf(wfp, "        option target '%s'\n", action[action_index]);
-			fprintf(wfp, "        option name 'SFIREWALL_FILTER%d'\n", count++);
-			fprintf(wfp, "        option enabled '1'\n");
-			fprintf(wfp, "\n");
+		if (strcmp(param[9], "any"))
+			fprintf(wfp, "        option dest_port '%s'\n", param[9]);
+		if (strcmp(weekdays, "any"))
+			fprintf(wfp, "        option weekdays '%s'\n", weekdays);
+		if (strcmp(param[11], "any")) {
+			fprintf(wfp, "        option start_time '%s'\n", param[11]);
+			fprintf(wfp, "        option stop_time '%s'\n", param[12]);
 		}
-		memset(xbuf, 0, sizeof(xbuf));
+		fprintf(wfp, "        option target '%s'\n", action[action_index]);
+		fprintf(wfp, "        option name '" SFW_NAME_PREFIX "FLT-%s-%08x'\n", param[0],
+				string_hash_make(filters[n].line));
+		fprintf(wfp, "        option enabled '1'\n");
+		fprintf(wfp, "\n");
 	}
 	fclose(wfp);
-	fclose(rfp);
+	XFREE(MTYPE_TMP, filters);
+	return 0;
+}
 
-	apply_firewall_rules();
+DEFUN (sfirewall_filter_rules_apply,
+        sfirewall_filter_rules_apply_cmd,
+        "sfirewall filter apply",
+        "Configure smart firewall rules\n"
+		"Add filter rules\n"
+        "Apply\n")
+{
+	// The sets the filter rules refer to
+	if (fw_ipset_write(SFW_IPSET_FILE) < 0)
+		return CMD_WARNING;
+
+	if (fw_filter_write(CONFIG_DIR "/" "filter.txt", "/etc/config/sfirewall_filter") < 0)
+		return CMD_WARNING;
 
-    return CMD_SUCCESS;
+	return fw_apply_queued(vty, fw_apply_queue(FW_APPLY_RULES));
+}
+
+DEFUN (show_sfirewall_optimized,
+		show_sfirewall_optimized_cmd,
+		"show sfirewall optimized",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the filter rules removed or merged by the optimizer\n")
+{
+	struct fw_filter *filters;
+	int count, removed;
+	int n;
+
+	filters = fw_filter_load(CONFIG_DIR "/" "filter.txt", &count, &removed);
+	if (!filters) {
+		vty_out(vty, "%% No filter rules%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+
+	for (n = 0; n < count; n++) {
+		if (!filters[n].removed)
+			continue;
+		vty_out(vty, "Rule %s %s rule %s%s", filters[n].param[0], filters[n].removed,
+				filters[filters[n].by].param[0], VTY_NEWLINE);
+		vty_out(vty, "  %s%s", filters[n].line, VTY_NEWLINE);
+	}
+	for (n = 0; n < count; n++) {
+		if (filters[n].removed || !filters[n].merged)
+			continue;
+		vty_out(vty, "Rule %s after merging%s", filters[n].param[0], VTY_NEWLINE);
+		vty_out(vty, "  %s%s", filters[n].line, VTY_NEWLINE);
+	}
+	vty_out(vty, "%d rules, %d emitted, %d eliminated%s", count, count - removed, removed,
+			VTY_NEWLINE);
+	XFREE(MTYPE_TMP, filters);
+	return CMD_SUCCESS;
 }
 
 #if 0
@@ -909,6 +2383,570 @@ DEFUN (no_sfirewall_policy_youtubefilter,
 }
 #endif
 
+/* Write to the nft batch the deletion of the running rules of the chain
+   with the comment. */
+static void fw_delete_commented(FILE *bfp, char *chain, char *comment)
+{
+	char cmd[128], xbuf[1024], *p;
+	FILE *fp;
+
+	snprintf(cmd, sizeof(cmd), "nft -a list chain inet fw4 %s 2>/dev/null", chain);
+	if ((fp = popen(cmd, "r")) == NULL)
+		return;
+	while (fgets(xbuf, sizeof(xbuf), fp)) {
+		if ((p = strstr(xbuf, "comment \"")) && !strncmp(p + 9, comment, strlen(comment)) &&
+				p[9 + strlen(comment)] == '"' && (p = strstr(xbuf, "# handle ")) != NULL)
+			fprintf(bfp, "delete rule inet fw4 %s handle %d\n", chain, atoi(p + strlen("# handle ")));
+	}
+	pclose(fp);
+}
+
+/*
+ * wg-notrack: the encrypted WireGuard packets to and from the listen port
+ * skip conntrack.  The rules are fw4 includes of the raw chains, so they
+ * survive a firewall restart, and are changed in the running ruleset as
+ * well when the port changes.
+ */
+#define SFW_NOTRACK_LINE	"sfirewall wg-notrack"
+#define SFW_NOTRACK_RULE_FILE	"/usr/share/nftables.d/chain-pre/%s/sfirewall-wg-notrack.nft"
+#define SFW_NOTRACK_BATCH	"/tmp/.sfirewall-notrack.nft"
+
+static struct {
+	char *chain;
+	char *match;
+} fw_notrack_rules[] = {
+	{ "raw_prerouting", "udp dport" },
+	{ "raw_output",     "udp sport" },
+	{ NULL,             NULL }
+};
+
+/* Install the notrack rules for the port, or remove them if port is 0.
+   Return -1 if the running ruleset could not be changed. */
+int fw_wg_notrack_apply(int port)
+{
+	char *batch[] = { "nft", "-f", SFW_NOTRACK_BATCH, NULL };
+	char path[256];
+	FILE *wfp, *bfp;
+	int i, ret;
+
+	bfp = fopen(SFW_NOTRACK_BATCH, "w");
+	if (!bfp)
+		return -1;
+
+	for (i = 0; fw_notrack_rules[i].chain; i++) {
+		snprintf(path, sizeof(path), SFW_NOTRACK_RULE_FILE, fw_notrack_rules[i].chain);
+		if (port) {
+			fw_include_dir(path);
+			wfp = fopen(path, "w");
+			if (wfp) {
+				fprintf(wfp, "%s %d counter notrack comment \"" SFW_NOTRACK_LINE "\"\n",
+						fw_notrack_rules[i].match, port);
+				fclose(wfp);
+			}
+		} else
+			unlink(path);
+
+		/* Replace the rules in the running chain */
+		fw_delete_commented(bfp, fw_notrack_rules[i].chain, SFW_NOTRACK_LINE);
+		if (port)
+			fprintf(bfp, "insert rule inet fw4 %s %s %d counter notrack comment \"" SFW_NOTRACK_LINE "\"\n",
+					fw_notrack_rules[i].chain, fw_notrack_rules[i].match, port);
+	}
+	fclose(bfp);
+
+	ret = cmd_run(NULL, batch, 10, 0);
+	unlink(SFW_NOTRACK_BATCH);
+	return ret == 0 ? 0 : -1;
+}
+
+DEFUN (sfirewall_wg_notrack,
+		sfirewall_wg_notrack_cmd,
+		"sfirewall wg-notrack",
+		"Configure smart firewall rules\n"
+		"Bypass conntrack for the WireGuard listen port\n")
+{
+	char *line;
+
+	config_del_line(config_top, SFW_NOTRACK_LINE);
+	config_add_line(config_top, SFW_NOTRACK_LINE);
+
+	ENSURE_CONFIG(vty);
+
+	line = config_get_line_byleft(config_top, "wg listenport ");
+	if (line == NULL) {
+		vty_out(vty, "%% No WireGuard listen port, the rules follow 'wg listenport'%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	if (fw_wg_notrack_apply(atoi(line + strlen("wg listenport "))) < 0)
+		vty_out(vty, "%% Not applied to the running firewall, it is at the next restart%s", VTY_NEWLINE);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN (no_sfirewall_wg_notrack,
+		no_sfirewall_wg_notrack_cmd,
+		"no sfirewall wg-notrack",
+		NO_STR
+		"Configure smart firewall rules\n"
+		"Bypass conntrack for the WireGuard listen port\n")
+{
+	config_del_line(config_top, SFW_NOTRACK_LINE);
+
+	ENSURE_CONFIG(vty);
+
+	fw_wg_notrack_apply(0);
+
+	return CMD_SUCCESS;
+}
+
+/*
+ * flow-offload: a flowtable over the LAN, WAN and WireGuard devices.  The
+ * forwarded tcp/udp flows are added to it, and their packets then skip the
+ * netfilter forward path in the software fast path.  Like wg-notrack, the
+ * flowtable and the rule are fw4 includes, changed in the running ruleset
+ * as well.
+ */
+#define SFW_OFFLOAD_LINE	"sfirewall flow-offload"
+#define SFW_OFFLOAD_FLOWTABLE	"sfw_ft"
+#define SFW_OFFLOAD_TABLE_FILE	"/usr/share/nftables.d/table-pre/sfirewall-flowtable.nft"
+#define SFW_OFFLOAD_RULE_FILE	"/usr/share/nftables.d/chain-pre/forward/sfirewall-flow-offload.nft"
+#define SFW_OFFLOAD_BATCH	"/tmp/.sfirewall-offload.nft"
+
+/* The devices of the interfaces of 'ip address': lan, wan, wg0 and wg1 */
+static char *fw_offload_devices[] = { "br-lan", "eth0", "wg0", "wg1", NULL };
+
+static int fw_nft_exists(char *object)
+{
+	char cmd[128], xbuf[256];
+	FILE *fp;
+
+	snprintf(cmd, sizeof(cmd), "nft list %s 2>/dev/null", object);
+	if ((fp = popen(cmd, "r")) == NULL)
+		return 0;
+	while (fgets(xbuf, sizeof(xbuf), fp))
+		;
+	return pclose(fp) == 0;
+}
+
+static int fw_flow_offload_apply(int on)
+{
+	char *batch[] = { "nft", "-f", SFW_OFFLOAD_BATCH, NULL };
+	char devices[128] = "";
+	FILE *wfp, *bfp;
+	int i, len = 0, ret;
+
+	/* A flowtable can't refer to a device which does not exist */
+	for (i = 0; fw_offload_devices[i]; i++) {
+		if (if_nametoindex(fw_offload_devices[i]) == 0)
+			continue;
+		len += snprintf(devices + len, sizeof(devices) - len, "%s%s",
+				len ? ", " : "", fw_offload_devices[i]);
+	}
+	if (on && len == 0)
+		return -1;
+
+	if (on) {
+		fw_include_dir(SFW_OFFLOAD_TABLE_FILE);
+		fw_include_dir(SFW_OFFLOAD_RULE_FILE);
+		if ((wfp = fopen(SFW_OFFLOAD_TABLE_FILE, "w")) != NULL) {
+			fprintf(wfp, "flowtable " SFW_OFFLOAD_FLOWTABLE " {\n");
+			fprintf(wfp, "\thook ingress priority filter\n");
+			fprintf(wfp, "\tdevices = { %s }\n", devices);
+			fprintf(wfp, "}\n");
+			fclose(wfp);
+		}
+		if ((wfp = fopen(SFW_OFFLOAD_RULE_FILE, "w")) != NULL) {
+			fprintf(wfp, "meta l4proto { tcp, udp } flow add @" SFW_OFFLOAD_FLOWTABLE
+					" comment \"" SFW_OFFLOAD_LINE "\"\n");
+			fclose(wfp);
+		}
+	} else {
+		unlink(SFW_OFFLOAD_TABLE_FILE);
+		unlink(SFW_OFFLOAD_RULE_FILE);
+	}
+
+	bfp = fopen(SFW_OFFLOAD_BATCH, "w");
+	if (!bfp)
+		return -1;
+	fw_delete_commented(bfp, "forward", SFW_OFFLOAD_LINE);
+	if (fw_nft_exists("flowtable inet fw4 " SFW_OFFLOAD_FLOWTABLE))
+		fprintf(bfp, "delete flowtable inet fw4 " SFW_OFFLOAD_FLOWTABLE "\n");
+	if (on) {
+		fprintf(bfp, "add flowtable inet fw4 " SFW_OFFLOAD_FLOWTABLE
+				" { hook ingress priority filter; devices = { %s }; }\n", devices);
+		fprintf(bfp, "insert rule inet fw4 forward meta l4proto { tcp, udp } flow add @"
+				SFW_OFFLOAD_FLOWTABLE " comment \"" SFW_OFFLOAD_LINE "\"\n");
+	}
+	fclose(bfp);
+
+	ret = cmd_run(NULL, batch, 10, 0);
+	unlink(SFW_OFFLOAD_BATCH);
+	return ret == 0 ? 0 : -1;
+}
+
+DEFUN (sfirewall_flow_offload,
+		sfirewall_flow_offload_cmd,
+		"sfirewall flow-offload (software|off)",
+		"Configure smart firewall rules\n"
+		"Forward the established flows in the fast path\n"
+		"Software flow offloading of LAN, WAN and WireGuard\n"
+		"No flow offloading\n")
+{
+	int on = !strcmp(argv[0], "software");
+
+	if (on)
+		config_replace_line_byleft(config_top, SFW_OFFLOAD_LINE, SFW_OFFLOAD_LINE " %s", argv[0]);
+	else
+		config_del_line_byleft(config_top, SFW_OFFLOAD_LINE);
+
+	ENSURE_CONFIG(vty);
+
+	if (fw_flow_offload_apply(on) < 0)
+		vty_out(vty, "%% Not applied to the running firewall, it is at the next restart%s", VTY_NEWLINE);
+
+	return CMD_SUCCESS;
+}
+
+/* Count the flows in the conntrack table, and those offloaded. */
+static int fw_conntrack_count(int *total, int *offloaded)
+{
+	char xbuf[1024];
+	FILE *fp;
+
+	*total = *offloaded = 0;
+	fp = fopen("/proc/net/nf_conntrack", "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(xbuf, sizeof(xbuf), fp)) {
+		(*total)++;
+		if (strstr(xbuf, "[OFFLOAD]") || strstr(xbuf, "[HW_OFFLOAD]"))
+			(*offloaded)++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+DEFUN (show_sfirewall_flow_offload,
+		show_sfirewall_flow_offload_cmd,
+		"show sfirewall flow-offload",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the flow offloading state\n")
+{
+	char xbuf[256], *line;
+	int total, offloaded;
+	FILE *fp;
+
+	line = config_get_line_byleft(config_top, SFW_OFFLOAD_LINE " ");
+	vty_out(vty, "Flow offload      : %s%s", line ? line + strlen(SFW_OFFLOAD_LINE " ") : "off",
+			VTY_NEWLINE);
+
+	if (line && (fp = fopen(SFW_OFFLOAD_TABLE_FILE, "r")) != NULL) {
+		while (fgets(xbuf, sizeof(xbuf), fp)) {
+			if (strstr(xbuf, "devices = { ") && strstr(xbuf, " }")) {
+				*strstr(xbuf, " }") = '\0';
+				vty_out(vty, "Devices           : %s%s", strstr(xbuf, "{ ") + 2, VTY_NEWLINE);
+			}
+		}
+		fclose(fp);
+	}
+
+	if (fw_conntrack_count(&total, &offloaded) < 0) {
+		vty_out(vty, "Offloaded flows   : unavailable%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	vty_out(vty, "Offloaded flows   : %d%s", offloaded, VTY_NEWLINE);
+	vty_out(vty, "Tracked flows     : %d%s", total, VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+/*
+ * sessions: the conntrack table read over ctnetlink and summed up by
+ * source, destination or WireGuard peer.  The top N are picked with
+ * partial_sort(), so only those N are ever sorted.
+ */
+#define FW_SESSIONS_TOP		10
+
+enum { FW_BY_SOURCE, FW_BY_DESTINATION, FW_BY_PEER };
+
+struct fw_talker {
+	char key[64];
+	uint64_t flows;
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+/* An allowed-ips prefix of a WireGuard peer */
+struct fw_peer_prefix {
+	uint32_t addr;
+	uint32_t mask;
+	char *pubkey;
+};
+
+struct fw_sessions {
+	int group;
+	struct hash *talkers;
+
+	struct fw_peer_prefix *peers;
+	int npeers;
+
+	uint64_t flows;
+};
+
+static unsigned int fw_talker_key(struct fw_talker *t)
+{
+	return string_hash_make(t->key);
+}
+
+static int fw_talker_cmp(struct fw_talker *a, struct fw_talker *b)
+{
+	return !strcmp(a->key, b->key);
+}
+
+static struct fw_talker *fw_talker_alloc(struct fw_talker *t)
+{
+	struct fw_talker *new = XCALLOC(MTYPE_TMP, sizeof(struct fw_talker));
+
+	snprintf(new->key, sizeof(new->key), "%s", t->key);
+	return new;
+}
+
+static void fw_talker_free(struct fw_talker *t)
+{
+	XFREE(MTYPE_TMP, t);
+}
+
+/* The allowed-ips of the 'wg peer' lines */
+static void fw_sessions_peers(struct fw_sessions *ss)
+{
+	char pubkey[64], ips[1024], *tok, *save = NULL, *line;
+	struct fw_prefix prefix;
+	struct listnode *nn;
+	int size = 0;
+
+	LIST_LOOP(config_top, line, nn) {
+		if (strncmp(line, "wg peer ", 8))
+			continue;
+		if (sscanf(line, "wg peer %63s allowed-ips %1023s", pubkey, ips) != 2 || !strcmp(ips, "none"))
+			continue;
+		for (tok = strtok_r(ips, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+			if (fw_prefix_parse(tok, &prefix) < 0 || prefix.set)
+				continue;
+			if (ss->npeers == size) {
+				size = size ? size * 2 : 64;
+				ss->peers = XREALLOC(MTYPE_TMP, ss->peers, sizeof(struct fw_peer_prefix) * size);
+			}
+			ss->peers[ss->npeers].addr = htonl(prefix.addr);
+			ss->peers[ss->npeers].mask = htonl(fw_mask(prefix.len));
+			ss->peers[ss->npeers].pubkey = line + 8;
+			ss->npeers++;
+		}
+	}
+}
+
+/* The peer whose allowed-ips best match the address */
+static char *fw_sessions_peer(struct fw_sessions *ss, uint32_t addr, char *key, int size)
+{
+	uint32_t best = 0;
+	char *pubkey = NULL;
+	int i;
+
+	for (i = 0; i < ss->npeers; i++) {
+		if ((addr & ss->peers[i].mask) != ss->peers[i].addr)
+			continue;
+		if (pubkey == NULL || ntohl(ss->peers[i].mask) > ntohl(best)) {
+			best = ss->peers[i].mask;
+			pubkey = ss->peers[i].pubkey;
+		}
+	}
+	if (pubkey == NULL)
+		return NULL;
+	snprintf(key, size, "%.*s", (int)strcspn(pubkey, " "), pubkey);
+	return key;
+}
+
+static void fw_sessions_add(struct conntrack_entry *ct, void *arg)
+{
+	struct fw_sessions *ss = arg;
+	struct fw_talker t, *talker;
+	struct in_addr addr;
+
+	ss->flows++;
+	if (ss->group == FW_BY_PEER) {
+		if (!fw_sessions_peer(ss, ct->src, t.key, sizeof(t.key)) &&
+				!fw_sessions_peer(ss, ct->dst, t.key, sizeof(t.key)))
+			return;
+	} else {
+		addr.s_addr = (ss->group == FW_BY_SOURCE) ? ct->src : ct->dst;
+		snprintf(t.key, sizeof(t.key), "%s", inet_ntoa(addr));
+	}
+
+	talker = hash_get(ss->talkers, &t, (void * (*) (void *)) fw_talker_alloc);
+	talker->flows++;
+	talker->packets += ct->packets;
+	talker->bytes += ct->bytes;
+}
+
+/* Descending by the metric, then by the flows */
+static int fw_talker_rank(void *a, void *b, void *arg)
+{
+	struct fw_talker *ta = a, *tb = b;
+	int packets = *(int *)arg;
+	uint64_t va = packets ? ta->packets : ta->bytes;
+	uint64_t vb = packets ? tb->packets : tb->bytes;
+
+	if (va != vb)
+		return va > vb ? -1 : 1;
+	if (ta->flows != tb->flows)
+		return ta->flows > tb->flows ? -1 : 1;
+	return 0;
+}
+
+struct fw_talkers {
+	struct fw_talker **list;
+	int count;
+};
+
+static void fw_talker_collect(struct hash_backet *hb, void *arg)
+{
+	struct fw_talkers *all = arg;
+
+	all->list[all->count++] = hb->data;
+}
+
+DEFUN (show_sfirewall_sessions,
+		show_sfirewall_sessions_cmd,
+		"show sfirewall sessions",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the connection tracking sessions\n")
+{
+	static const char *groups[] = { "Source", "Destination", "Peer" };
+	struct fw_sessions ss;
+	struct fw_talkers all;
+	struct fw_talker *t;
+	int i, n, top = FW_SESSIONS_TOP, packets = 0, ret = CMD_SUCCESS;
+
+	memset(&ss, 0, sizeof(ss));
+
+	/* [source|destination|peer] [top NUM] [by bytes|packets] */
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "source"))
+			ss.group = FW_BY_SOURCE;
+		else if (!strcmp(argv[i], "destination"))
+			ss.group = FW_BY_DESTINATION;
+		else if (!strcmp(argv[i], "peer"))
+			ss.group = FW_BY_PEER;
+		else if (!strcmp(argv[i], "packets"))
+			packets = 1;
+		else if (!strcmp(argv[i], "bytes"))
+			packets = 0;
+		else if ((n = atoi(argv[i])) > 0 && n <= 1000)
+			top = n;
+		else {
+			vty_out(vty, "%% Invalid count '%s', 1 ~ 1000%s", argv[i], VTY_NEWLINE);
+			return CMD_WARNING;
+		}
+	}
+
+	ss.talkers = hash_create_size(1024, (unsigned int (*) (void *)) fw_talker_key,
+			(int (*) (void *, void *)) fw_talker_cmp);
+	if (ss.group == FW_BY_PEER)
+		fw_sessions_peers(&ss);
+
+	if (conntrack_dump(fw_sessions_add, &ss) < 0) {
+		vty_out(vty, "%% Can't read the conntrack table: %s%s", strerror(errno), VTY_NEWLINE);
+		ret = CMD_WARNING;
+		goto out;
+	}
+
+	all.list = XCALLOC(MTYPE_TMP, sizeof(struct fw_talker *) * (ss.talkers->count + 1));
+	all.count = 0;
+	hash_iterate(ss.talkers, fw_talker_collect, &all);
+	partial_sort((void **)all.list, all.count, top, fw_talker_rank, &packets);
+	if (top > all.count)
+		top = all.count;
+
+	vty_out(vty, "%lu sessions, %lu %s%s%s", (unsigned long)ss.flows, ss.talkers->count,
+			ss.group == FW_BY_PEER ? "peers" : "addresses",
+			packets ? ", top by packets" : ", top by bytes", VTY_NEWLINE);
+	vty_out(vty, "%-4s %-*s %8s %12s %14s%s", "Rank", ss.group == FW_BY_PEER ? 44 : 15,
+			groups[ss.group], "Flows", "Packets", "Bytes", VTY_NEWLINE);
+	for (i = 0; i < top; i++) {
+		t = all.list[i];
+		vty_out(vty, "%-4d %-*s %8llu %12llu %14llu%s", i + 1, ss.group == FW_BY_PEER ? 44 : 15,
+				t->key, (unsigned long long)t->flows, (unsigned long long)t->packets,
+				(unsigned long long)t->bytes, VTY_NEWLINE);
+	}
+	if (top && all.list[0]->packets == 0)
+		vty_out(vty, "%% No counters, enable net.netfilter.nf_conntrack_acct%s", VTY_NEWLINE);
+	XFREE(MTYPE_TMP, all.list);
+out:
+	hash_clean(ss.talkers, (void (*) (void *)) fw_talker_free);
+	hash_free(ss.talkers);
+	if (ss.peers)
+		XFREE(MTYPE_TMP, ss.peers);
+	return ret;
+}
+
+ALIAS (show_sfirewall_sessions,
+		show_sfirewall_sessions_group_cmd,
+		"show sfirewall sessions (source|destination|peer)",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the connection tracking sessions\n"
+		"Summed up by source address\n"
+		"Summed up by destination address\n"
+		"Summed up by WireGuard peer\n")
+
+ALIAS (show_sfirewall_sessions,
+		show_sfirewall_sessions_top_cmd,
+		"show sfirewall sessions top NUM",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the connection tracking sessions\n"
+		"Show the top entries only\n"
+		"Number of entries(1 ~ 1000), 10 by default\n")
+
+ALIAS (show_sfirewall_sessions,
+		show_sfirewall_sessions_top_by_cmd,
+		"show sfirewall sessions top NUM by (bytes|packets)",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the connection tracking sessions\n"
+		"Show the top entries only\n"
+		"Number of entries(1 ~ 1000), 10 by default\n"
+		"Rank by\n"
+		"Bytes of both directions\n"
+		"Packets of both directions\n")
+
+ALIAS (show_sfirewall_sessions,
+		show_sfirewall_sessions_group_top_cmd,
+		"show sfirewall sessions (source|destination|peer) top NUM",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the connection tracking sessions\n"
+		"Summed up by source address\n"
+		"Summed up by destination address\n"
+		"Summed up by WireGuard peer\n"
+		"Show the top entries only\n"
+		"Number of entries(1 ~ 1000), 10 by default\n")
+
+ALIAS (show_sfirewall_sessions,
+		show_sfirewall_sessions_group_top_by_cmd,
+		"show sfirewall sessions (source|destination|peer) top NUM by (bytes|packets)",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the connection tracking sessions\n"
+		"Summed up by source address\n"
+		"Summed up by destination address\n"
+		"Summed up by WireGuard peer\n"
+		"Show the top entries only\n"
+		"Number of entries(1 ~ 1000), 10 by default\n"
+		"Rank by\n"
+		"Bytes of both directions\n"
+		"Packets of both directions\n")
+
 DEFUN (show_sfirewall,
 		show_sfirewall_cmd,
 		"show sfirewall (all|nat|filter|mangle)",
@@ -930,6 +2968,42 @@ DEFUN (show_sfirewall,
 	return CMD_SUCCESS;
 }
 
+DEFUN (show_sfirewall_apply_status,
+		show_sfirewall_apply_status_cmd,
+		"show sfirewall apply-status",
+		SHOW_STR
+		"show smart firewall rules\n"
+		"show the state of the firewall apply queue\n")
+{
+	struct fw_apply_state st;
+	char tbuf[64];
+	struct tm tm;
+	time_t t;
+	int fd;
+
+	if ((fd = fw_apply_lock(&st)) < 0) {
+		vty_out(vty, "%% Can't read %s%s", FW_APPLY_STATE, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	fw_apply_unlock(fd, &st);
+
+	if (!fw_apply_worker_alive(&st))
+		st.running = 0;
+	vty_out(vty, "State               : %s%s", st.running ? "running" :
+			(st.pending && fw_apply_worker_alive(&st)) ? "pending" :
+			st.pending ? "stalled" : "idle", VTY_NEWLINE);
+	vty_out(vty, "Requested generation: %d%s", st.requested, VTY_NEWLINE);
+	vty_out(vty, "Applied generation  : %d%s", st.applied, VTY_NEWLINE);
+	if (st.time) {
+		t = st.time;
+		localtime_r(&t, &tm);
+		strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+		vty_out(vty, "Last result         : %s at %s%s", st.result ? "failed" : "ok",
+				tbuf, VTY_NEWLINE);
+	}
+	return CMD_SUCCESS;
+}
+
 int cmd_firewall_init()
 {
 	// enable/disable
@@ -948,6 +3022,18 @@ int cmd_firewall_init()
 	cmd_install_element (CONFIG_NODE, &no_sfirewall_filter_rules_cmd);
 	cmd_install_element (CONFIG_NODE, &sfirewall_filter_rules_apply_cmd);
 
+	// wg-notrack
+	cmd_install_element (CONFIG_NODE, &sfirewall_wg_notrack_cmd);
+	cmd_install_element (CONFIG_NODE, &no_sfirewall_wg_notrack_cmd);
+
+	// flow-offload
+	cmd_install_element (CONFIG_NODE, &sfirewall_flow_offload_cmd);
+
+	// ipset
+	cmd_install_element (CONFIG_NODE, &sfirewall_ipset_cmd);
+	cmd_install_element (CONFIG_NODE, &no_sfirewall_ipset_cmd);
+	cmd_install_element (CONFIG_NODE, &no_sfirewall_ipset_all_cmd);
+
 #if 0
 	cmd_install_element (CONFIG_NODE, &sfirewall_policy_youtubefilter_cmd);
 	cmd_install_element (CONFIG_NODE, &no_sfirewall_policy_youtubefilter_cmd);
@@ -956,6 +3042,24 @@ int cmd_firewall_init()
 	// show
 	cmd_install_element (ENABLE_NODE, &show_sfirewall_cmd);
 	cmd_install_element (CONFIG_NODE, &show_sfirewall_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_apply_status_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_apply_status_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_optimized_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_optimized_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_flow_offload_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_flow_offload_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_sessions_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_sessions_group_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_sessions_top_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_sessions_top_by_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_sessions_group_top_cmd);
+	cmd_install_element (ENABLE_NODE, &show_sfirewall_sessions_group_top_by_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_sessions_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_sessions_group_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_sessions_top_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_sessions_top_by_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_sessions_group_top_cmd);
+	cmd_install_element (CONFIG_NODE, &show_sfirewall_sessions_group_top_by_cmd);
 
 	return 0;
 }
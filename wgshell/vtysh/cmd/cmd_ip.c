@@ -7,7 +7,210 @@
 
 #include "command.h"
 #include "vtysh_config.h"
+#include "linklist.h"
+#include "uci.h"
+#include "rtnl.h"
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+
+#define NETWORK_CONFIG	"/etc/config/network"
+
+/* Seconds to wait for netifd to bring an interface back(DHCP included) */
+#define IP_IFUP_TIMEOUT	15
+
+/* Milliseconds to wait for netifd to start taking an interface down */
+#define IP_IFUP_SETTLE	2000
+
+/*
+ * The addresses and the routes are set in the kernel over rtnetlink right
+ * away, and written to the network UCI config only to be there at the next
+ * boot.  While the apply is deferred(boot/batch) both are collected and
+ * done once by cmd_ip_flush(): one UCI save and one netlink exchange.
+ */
+static struct uci_package *ip_network;
+static int ip_network_dirty;
+static struct rtnl_batch ip_batch;
+
+/* An interface left to netifd while deferred, reloaded by cmd_ip_flush() */
+static char ip_deferred_ifup[IF_NAMESIZE];
+
+/* The device of a logical interface */
+static char *ip_ifname (char *name)
+{
+	if (!strcmp(name, "lan"))
+		return "br-lan";
+	if (!strcmp(name, "wan"))
+		return "eth0";
+	return name;
+}
+
+static int ip_ifindex (struct vty *vty, char *name)
+{
+	int ifindex = if_nametoindex(ip_ifname(name));
+
+	if (ifindex == 0)
+		vty_out(vty, "%% No such interface(%s).\n", ip_ifname(name));
+	return ifindex;
+}
+
+/* Keep the addresses of a subnet when its primary address is removed, an
+   address added to the subnet of the old one is a secondary. */
+static void ip_promote_secondaries (char *name)
+{
+	char path[128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/sys/net/ipv4/conf/%s/promote_secondaries", ip_ifname(name));
+	if ((fp = fopen(path, "w")) != NULL) {
+		fputs("1\n", fp);
+		fclose(fp);
+	}
+}
+
+/* The prefix length of a netmask, -1 if it is not contiguous */
+static int ip_masklen (char *netmask)
+{
+	struct in_addr mask;
+	unsigned int m;
+	int len = 0;
+
+	if (inet_aton(netmask, &mask) == 0)
+		return -1;
+	for (m = ntohl(mask.s_addr); m & 0x80000000U; m <<= 1)
+		len++;
+	return m ? -1 : len;
+}
+
+static struct uci_package *ip_network_load (void)
+{
+	if (ip_network == NULL)
+		ip_network = uci_load(NETWORK_CONFIG);
+	return ip_network;
+}
+
+/* The 'config interface NAME' section */
+static struct uci_section *ip_network_iface (char *name)
+{
+	struct uci_section *sec;
+	struct listnode *nn;
+
+	if (ip_network_load() == NULL)
+		return NULL;
+	LIST_LOOP(ip_network->sections, sec, nn)
+		if (!strcmp(sec->type, "interface") && sec->name && !strcmp(sec->name, name))
+			return sec;
+	return NULL;
+}
+
+static void ip_network_set (struct uci_section *sec, char *name, char *value)
+{
+	if (value)
+		ip_network_dirty |= uci_option_set(sec, name, value);
+	else if (uci_option_get(sec, name)) {
+		uci_option_del(sec, name);
+		ip_network_dirty = 1;
+	}
+}
+
+static double ip_elapsed (struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* The IPv4 address of the device, 0 if it has none */
+static uint32_t ip_address_of (char *ifname)
+{
+	struct ifreq ifr;
+	int fd, ret;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return 0;
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	ret = ioctl(fd, SIOCGIFADDR, &ifr);
+	close(fd);
+	return ret == 0 ? ((struct sockaddr_in *) &ifr.ifr_addr)->sin_addr.s_addr : 0;
+}
+
+/* Reload only this logical interface with netifd('ifup' reloads the
+   changed config and restarts that interface alone), instead of the whole
+   network which would also take the tunnels down.  netifd does it in the
+   background: the interface is down from when its old address goes away
+   until it has an address again. */
+static int ip_ifup (struct vty *vty, char *iface)
+{
+	char *myargv[] = { "ifup", iface, NULL };
+	struct timespec start;
+	char *ifname = ip_ifname(iface);
+	uint32_t old = ip_address_of(ifname);
+	double down, ms;
+
+	if (host.defer) {
+		snprintf(ip_deferred_ifup, sizeof(ip_deferred_ifup), "%s", iface);
+		return CMD_SUCCESS;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (cmd_run(vty, myargv, IP_IFUP_TIMEOUT, 0) != 0) {
+		vty_out(vty, "%% Can't reload the interface(%s).\n", iface);
+		return CMD_WARNING;
+	}
+	while (old && ip_address_of(ifname) == old && ip_elapsed(&start) < IP_IFUP_SETTLE)
+		usleep(10000);
+	down = ip_elapsed(&start);
+	while (ip_address_of(ifname) == 0 && ip_elapsed(&start) < IP_IFUP_TIMEOUT * 1000)
+		usleep(10000);
+
+	ms = ip_elapsed(&start) - down;
+	if (ip_address_of(ifname) == 0)
+		vty_out(vty, "%s reloaded, no address after %.1f s.\n", iface, ms / 1000);
+	else
+		vty_out(vty, "%s reloaded, down for %.2f s, other interfaces untouched.\n", iface, ms / 1000);
+	return CMD_SUCCESS;
+}
+
+/* Save the network config and send the queued netlink messages, unless
+   deferred. */
+static int ip_commit (struct vty *vty)
+{
+	int failed;
+
+	if (host.defer)
+		return CMD_SUCCESS;
+
+	if (ip_network) {
+		if (ip_network_dirty && uci_save(ip_network, NETWORK_CONFIG) < 0)
+			vty_out(vty, "%% Can't save %s: %s\n", NETWORK_CONFIG, strerror(errno));
+		uci_free(ip_network);
+		ip_network = NULL;
+		ip_network_dirty = 0;
+	}
+
+	failed = rtnl_batch_commit(&ip_batch);
+	if (failed) {
+		vty_out(vty, "%% Can't apply to the kernel: %s\n", strerror(errno));
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+void cmd_ip_flush ()
+{
+	ip_commit(NULL);
+	if (ip_deferred_ifup[0]) {
+		ip_ifup(NULL, ip_deferred_ifup);
+		ip_deferred_ifup[0] = '\0';
+	}
+}
 
 DEFUN (show_ip_address,
        show_ip_address_cmd,
@@ -19,7 +222,7 @@ DEFUN (show_ip_address,
 	char *myargv[2];
 
 	myargv[0] = "addr";
-	return cmd_execute_system_command("ip", 1, myargv);
+	return cmd_execute_show_command("ip", 1, myargv);
 }
 
 DEFUN (show_ip_config,
@@ -32,7 +235,7 @@ DEFUN (show_ip_config,
 	char *myargv[2];
 
 	myargv[0] = "-a";
-	return cmd_execute_system_command("ifconfig", 1, myargv);
+	return cmd_execute_show_command("ifconfig", 1, myargv);
 }
 
 DEFUN (show_ip_config_name,
@@ -43,7 +246,27 @@ DEFUN (show_ip_config_name,
        "IP config name\n"
 	   "the interface name\n")
 {
-	return cmd_execute_system_command("ifconfig", 1, argv);
+	return cmd_execute_show_command("ifconfig", 1, argv);
+}
+
+static void show_ip_route_one (struct rtnl_route *rt, void *arg)
+{
+	struct vty *vty = arg;
+	char dst[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN], mask[INET_ADDRSTRLEN];
+	char ifname[IF_NAMESIZE], flags[8];
+	uint32_t m = rt->len ? htonl(0xffffffffU << (32 - rt->len)) : 0;
+
+	if (rt->type != RTN_UNICAST)
+		return;
+
+	inet_ntop(AF_INET, &rt->dst, dst, sizeof(dst));
+	inet_ntop(AF_INET, &rt->gw, gw, sizeof(gw));
+	inet_ntop(AF_INET, &m, mask, sizeof(mask));
+	if (rt->ifindex == 0 || if_indextoname(rt->ifindex, ifname) == NULL)
+		snprintf(ifname, sizeof(ifname), "*");
+	snprintf(flags, sizeof(flags), "U%s%s", rt->gw ? "G" : "", rt->len == 32 ? "H" : "");
+
+	vty_out(vty, "%-15s %-15s %-15s %-5s %-6d %s\n", dst, gw, mask, flags, rt->metric, ifname);
 }
 
 DEFUN(show_ip_route, 
@@ -53,10 +276,14 @@ DEFUN(show_ip_route,
       IP_STR
       "IP routing table\n")
 {
-	char *myargv[2];
-
-	myargv[0] = "-n";
-	return cmd_execute_system_command("route", 1, myargv);
+	vty_out(vty, "Kernel IP routing table\n");
+	vty_out(vty, "%-15s %-15s %-15s %-5s %-6s %s\n",
+			"Destination", "Gateway", "Genmask", "Flags", "Metric", "Iface");
+	if (rtnl_route_dump(show_ip_route_one, vty) < 0) {
+		vty_out(vty, "%% Can't read the routing table: %s\n", strerror(errno));
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
 }
 
 DEFUN (ip_address, ip_address_cmd, 
@@ -67,8 +294,11 @@ DEFUN (ip_address, ip_address_cmd,
        "ip address e.g. x.x.x.x\n"
        "ip netmask  e.g. 255.255.0.0\n")
 {
-	char *myargv[10];
-	char line[1024];
+	struct uci_section *sec;
+	struct in_addr addr;
+	struct timespec start;
+	char line[1024], left[128], *proto;
+	int ifindex, len, ret, reload = 0;
 
 	if (strcmp(argv[0], "lan") &&    /* LAN: br-lan(eth1) */
 			strcmp(argv[0], "wan") &&    /* WAN: eth0 */
@@ -77,63 +307,51 @@ DEFUN (ip_address, ip_address_cmd,
 		vty_out(vty, "%% Not supported interface(%s).\n", argv[0]);
 		return CMD_WARNING;
 	}
+	if (inet_aton(argv[1], &addr) == 0 || (len = ip_masklen(argv[2])) < 0) {
+		vty_out(vty, "%% Invalid address(%s %s).\n", argv[1], argv[2]);
+		return CMD_WARNING;
+	}
 
-	sprintf(line, "ip address %s", argv[0]);
-	config_del_line_byleft(config_top, line);
+	sprintf(left, "ip address %s", argv[0]);
 	sprintf(line, "ip address %s %s %s", argv[0], argv[1], argv[2]);
-	config_add_line(config_top, line);
+	config_replace_line_byleft(config_top, left, line);
 
 	ENSURE_CONFIG(vty);
 
-	if (!strcmp(argv[0], "lan")) {
-		/* Change the LAN configurations */
-		sprintf(line, "uci set network.lan.proto='static' > /dev/null 2>&1");  /* set: set or add */
-		system(line);
-
-		sprintf(line, "uci set network.lan.ipaddr='%s' > /dev/null 2>&1", argv[1]);
-		system(line);
-
-		sprintf(line, "uci set network.lan.netmask='%s' > /dev/null 2>&1", argv[2]);
-		system(line);
-
-		sprintf(line, "uci commit network > /dev/null 2>&1");
-		system(line);
-
-	} else if (!strcmp(argv[0], "wan")) {
-		/* Change the LAN configurations */
-		sprintf(line, "uci set network.wan.proto='static' > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci set network.wan.ipaddr='%s' > /dev/null 2>&1", argv[1]);
-		system(line);
-
-		sprintf(line, "uci set network.wan.netmask='%s' > /dev/null 2>&1", argv[2]);
-		system(line);
-
-		sprintf(line, "uci commit network > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "/etc/init.d/network restart > /dev/null 2>&1");
-		system(line);
-
-	} else if (!strncmp(argv[0], "wg0", 3) || !strncmp(argv[0], "wg1", 3)) {
-
-	} else {
-		vty_out(vty, "%% Not supported interface(%s).\n", argv[0]);
-		return CMD_WARNING;
+	/* LAN and WAN are kept in the network config, wg0/wg1 only in ours */
+	if ((!strcmp(argv[0], "lan") || !strcmp(argv[0], "wan")) &&
+			(sec = ip_network_iface(argv[0]))) {
+		proto = uci_option_get(sec, "proto");
+		/* netifd has to stop the DHCP client of the WAN */
+		reload = !strcmp(argv[0], "wan") && (proto == NULL || strcmp(proto, "static"));
+		ip_network_set(sec, "proto", "static");
+		ip_network_set(sec, "ipaddr", argv[1]);
+		ip_network_set(sec, "netmask", argv[2]);
 	}
 
-	myargv[0] = argv[0];
-	myargv[1] = argv[1];
-	myargv[2] = "netmask";
-	myargv[3] = argv[2];
-	cmd_execute_system_command("ifconfig", 4, myargv);
-
-	if (!strcmp(argv[0], "lan")) {
-		vty_out(vty, "You should reboot the system after 'write' to apply your changes.\n");
+	if (reload) {
+		ip_commit(vty);
+		return ip_ifup(vty, argv[0]);
 	}
 
-	return CMD_SUCCESS;
+	/* Swap the address and bring the link up, like ifconfig does */
+	if ((ifindex = ip_ifindex(vty, argv[0])) == 0) {
+		ip_commit(vty);
+		return CMD_WARNING;
+	}
+	/* The new address goes first: the routes of an interface go with its
+	   last address */
+	ip_promote_secondaries(argv[0]);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rtnl_batch_addr(&ip_batch, RTM_NEWADDR, ifindex, addr.s_addr, len);
+	rtnl_batch_addr_flush(&ip_batch, ifindex, addr.s_addr, len);
+	rtnl_batch_link(&ip_batch, ifindex, 1);
+
+	ret = ip_commit(vty);
+	if (ret == CMD_SUCCESS && !host.defer)
+		vty_out(vty, "%s address swapped, down for %.1f ms, other interfaces untouched.\n",
+				argv[0], ip_elapsed(&start));
+	return ret;
 }
 
 DEFUN (no_ip_address, no_ip_address_cmd, 
@@ -144,8 +362,9 @@ DEFUN (no_ip_address, no_ip_address_cmd,
        "config the ip address\n"
        "interface name(lan|wan|wg0|wg1)\n")
 {
-	char *myargv[10];
+	struct uci_section *sec;
 	char line[1024];
+	int ifindex;
 
 	if (strcmp(argv[0], "lan") &&  /* LAN: br-lan(eth1) */
 		strcmp(argv[0], "wan") &&  /* WAN: eth0 */
@@ -166,50 +385,22 @@ DEFUN (no_ip_address, no_ip_address_cmd,
 	sprintf(line, "ip address %s", argv[0]);
 	config_del_line_byleft(config_top, line);
 
-	if (!strcmp(argv[0], "lan")) {
-		sprintf(line, "uci delete network.lan.proto > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci delete network.lan.ipaddr > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci delete network.lan.netmask > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci commit network > /dev/null 2>&1");
-		system(line);
-
-	} else if (!strcmp(argv[0], "wan")) {
-		sprintf(line, "uci delete network.wan.proto > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci delete network.wan.ipaddr > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci delete network.wan.netmask > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci commit network > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "/etc/init.d/network restart > /dev/null 2>&1");
-		system(line);
-
-	} else if (!strncmp(argv[0], "wg0", 3) || !strncmp(argv[0], "wg1", 3)) {
+	if ((!strcmp(argv[0], "lan") || !strcmp(argv[0], "wan")) &&
+			(sec = ip_network_iface(argv[0]))) {
+		ip_network_set(sec, "proto", NULL);
+		ip_network_set(sec, "ipaddr", NULL);
+		ip_network_set(sec, "netmask", NULL);
+	}
 
-	} else {
-		vty_out(vty, "%% Not supported interface(%s).\n", argv[0]);
+	/* Remove the addresses and bring the link down, like ifconfig does */
+	if ((ifindex = ip_ifindex(vty, argv[0])) == 0) {
+		ip_commit(vty);
 		return CMD_WARNING;
 	}
+	rtnl_batch_addr_flush(&ip_batch, ifindex, 0, 0);
+	rtnl_batch_link(&ip_batch, ifindex, 0);
 
-	myargv[0] = argv[0];
-	myargv[1] = "down";
-	cmd_execute_system_command("ifconfig", 2, myargv);
-
-	if (!strcmp(argv[0], "lan")) {
-		vty_out(vty, "You should reboot the system after 'write' to apply your changes.\n");
-	}
-	return CMD_SUCCESS;
+	return ip_commit(vty);
 }
 
 DEFUN (ip_address_dhcp, ip_address_dhcp_cmd, 
@@ -219,37 +410,73 @@ DEFUN (ip_address_dhcp, ip_address_dhcp_cmd,
        "interface name(wan)\n"
        "DHCP mode\n")
 {
-	char line[1024];
+	struct uci_section *sec;
+	char line[1024], left[128];
 
 	if (strcmp(argv[0], "wan")) {
 		vty_out(vty, "%% Not supported interface(%s).\n", argv[0]);
 		return CMD_WARNING;
 	}
 
-	sprintf(line, "ip address %s", argv[0]);
-	config_del_line_byleft(config_top, line);
+	sprintf(left, "ip address %s", argv[0]);
 	sprintf(line, "ip address %s dhcp", argv[0]);
-	config_add_line(config_top, line);
+	config_replace_line_byleft(config_top, left, line);
 
 	ENSURE_CONFIG(vty);
 
-	if (!strcmp(argv[0], "wan")) {
-		sprintf(line, "uci delete network.wan.ipaddr > /dev/null 2>&1");
-		system(line);
-
-		sprintf(line, "uci delete network.wan.netmask > /dev/null 2>&1");
-		system(line);
+	if ((sec = ip_network_iface(argv[0]))) {
+		ip_network_set(sec, "ipaddr", NULL);
+		ip_network_set(sec, "netmask", NULL);
+		ip_network_set(sec, "proto", "dhcp");
+	}
+	ip_commit(vty);
 
-		sprintf(line, "uci set network.wan.proto=dhcp > /dev/null 2>&1");  /* set: set or add */
-		system(line);
+	/* The DHCP client is run by netifd */
+	return ip_ifup(vty, argv[0]);
+}
 
-		sprintf(line, "uci commit network > /dev/null 2>&1");
-		system(line);
+/* Queue a route to the kernel and its 'config route' section. */
+static int ip_route_set (struct vty *vty, int add, char *target, char *netmask,
+		char *gateway, char *iface)
+{
+	struct uci_section *sec, *next;
+	struct in_addr dst, gw = { 0 };
+	int len, ifindex = 0, found = 0;
 
-		sprintf(line, "/etc/init.d/network restart > /dev/null 2>&1");
-		system(line);
+	if (inet_aton(target, &dst) == 0 || (len = ip_masklen(netmask)) < 0 ||
+			(gateway && inet_aton(gateway, &gw) == 0)) {
+		vty_out(vty, "%% Invalid route(%s %s).\n", target, netmask);
+		return CMD_WARNING;
+	}
+	dst.s_addr &= len ? htonl(0xffffffffU << (32 - len)) : 0;
+
+	if (ip_network_load()) {
+		for (sec = uci_section_find(ip_network, "route", "target", target); sec; sec = next) {
+			next = uci_section_find_next(ip_network, sec, "route", "target", target);
+			if (uci_option_get(sec, "netmask") == NULL ||
+					strcmp(uci_option_get(sec, "netmask"), netmask))
+				continue;
+			if (!add) {
+				uci_section_del(ip_network, sec);
+				ip_network_dirty = 1;
+			} else if (!found++) {
+				ip_network_set(sec, "interface", iface);
+				ip_network_set(sec, "gateway", gateway);
+			}
+		}
+		if (add && !found) {
+			sec = uci_section_add(ip_network, "route", NULL);
+			ip_network_set(sec, "interface", iface);
+			ip_network_set(sec, "target", target);
+			ip_network_set(sec, "netmask", netmask);
+			ip_network_set(sec, "gateway", gateway);
+		}
 	}
 
+	if (add && (ifindex = ip_ifindex(vty, iface)) == 0)
+		return CMD_WARNING;
+	rtnl_batch_route(&ip_batch, add ? RTM_NEWROUTE : RTM_DELROUTE, dst.s_addr, len,
+			add ? gw.s_addr : 0, ifindex);
 	return CMD_SUCCESS;
 }
 
@@ -264,6 +491,7 @@ DEFUN (ip_route, ip_route_cmd,
        "interface name(lan or wan)\n")
 {
 	char line[1024];
+	int ret;
 
 	if (strcmp(argv[3], "lan") &&    /* LAN: br-lan(eth1) */
 		strcmp(argv[3], "wan") &&    /* WAN: eth0 */
@@ -279,28 +507,10 @@ DEFUN (ip_route, ip_route_cmd,
 
 	ENSURE_CONFIG(vty);
 
-	sprintf(line, "uci add network route > /dev/null 2>&1");
-	system(line);
-
-	sprintf(line, "uci set network.@route[-1].interface='%s' > /dev/null 2>&1", argv[3]);
-	system(line);
-
-	sprintf(line, "uci set network.@route[-1].target='%s' > /dev/null 2>&1", argv[0]);
-	system(line);
-
-	sprintf(line, "uci set network.@route[-1].netmask='%s' > /dev/null 2>&1", argv[1]);
-	system(line);
-
-	sprintf(line, "uci set network.@route[-1].gateway='%s' > /dev/null 2>&1", argv[2]);
-	system(line);
-
-	sprintf(line, "uci commit network > /dev/null 2>&1");
-	system(line);
-
-	sprintf(line, "/etc/init.d/network restart > /dev/null 2>&1");
-	system(line);
-
-	return CMD_SUCCESS;
+	ret = ip_route_set(vty, 1, argv[0], argv[1], argv[2], argv[3]);
+	if (ip_commit(vty) != CMD_SUCCESS)
+		ret = CMD_WARNING;
+	return ret;
 }
 
 DEFUN (no_ip_route, no_ip_route_cmd, 
@@ -312,20 +522,17 @@ DEFUN (no_ip_route, no_ip_route_cmd,
        "Destination adress netmask e.g. 255.255.255.0\n")
 {
 	char line[1024];
+	int ret;
 
 	sprintf(line, "ip route %s %s", argv[0], argv[1]);
 	config_del_line_byleft(config_top, line);
 
-	sprintf(line, "uci delete network.@route[-1] > /dev/null 2>&1");
-	system(line);
-
-	sprintf(line, "uci commit network > /dev/null 2>&1");
-	system(line);
-
-	sprintf(line, "/etc/init.d/network restart > /dev/null 2>&1");
-	system(line);
+	ENSURE_CONFIG(vty);
 
-	return CMD_SUCCESS;
+	ret = ip_route_set(vty, 0, argv[0], argv[1], NULL, NULL);
+	if (ip_commit(vty) != CMD_SUCCESS)
+		ret = CMD_WARNING;
+	return ret;
 }
 
 /*
@@ -340,8 +547,7 @@ DEFUN (config_dns, config_dns_cmd,
        "the second dns server ip\n")
 {
 	FILE *fp = NULL;
-	config_del_line_byleft(config_top, "nameserver");
-	config_add_line(config_top, "nameserver %s %s", argv[0], argv[1]);
+	config_replace_line_byleft(config_top, "nameserver", "nameserver %s %s", argv[0], argv[1]);
 
 	ENSURE_CONFIG(vty);
 
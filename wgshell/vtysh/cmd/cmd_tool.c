@@ -189,7 +189,7 @@ DEFUN (show_date,
         SHOW_STR
         "Displays the current date\n")
 {
-    return cmd_execute_system_command("date", 0, argv);
+    return cmd_execute_show_command("date", 0, argv);
 }
 
 DEFUN(net_netstat_info,
@@ -7,31 +7,398 @@
 
 #include "command.h"
 #include "vtysh_config.h"
+#include "memory.h"
+#include "hash.h"
+#include "linklist.h"
+#include "uci.h"
 #include <ctype.h>
+#include <stddef.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/file.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <net/if.h>
 #include "../encoding.h"
+#include "../curve25519.h"
+#include "../wgnl.h"
+#include "../sort.h"
+#include "../lpm.h"
+#include <arpa/inet.h>
 
 /*
  * wg listenport PORT
  * wg peer PUBLICKEY allowed-ips (none|WORD) endpoint (none|FQDN:PORT|A.B.C.D:PORT) persistent-keepalive (off|NUM)
+ * wg peer PUBLICKEY allowed-ips WORD aggregate
+ * wg optimize allowed-ips
  * no wg peer PUBLIC KEY
  * wg link-up|link-down
  * wg regenerate-key
  * wg clear-key
+ * wg generate-keys count NUM
  * show wg
  * show wg ETHNAME
+ * show wg peers [sort (rx|tx|handshake)] [limit NUM [offset NUM]] [json]
+ * show wg usage
+ * show wg peer-for (A.B.C.D|X:X::X:X)
  */
 
 #define PRIVATEKEY_PATH     CONFIG_DIR "/privatekey"
 #define PUBLICKEY_PATH      CONFIG_DIR "/publickey"
 #define PUBLICKEY_MAX_LEN   44
+#define GENERATE_KEYS_MAX   10000
+#ifndef USAGE_PATH
+#define USAGE_PATH          CONFIG_DIR "/usage.bin"
+#endif
+#define USAGE_MAGIC         "WGU2"
+#define USAGE_MAGIC_V1      "WGU1"
+#ifndef USAGE_BOOT_ID_PATH
+#define USAGE_BOOT_ID_PATH  "/proc/sys/kernel/random/boot_id"
+#endif
+
+#ifndef FIREWALL_CONFIG
+#define FIREWALL_CONFIG     "/etc/config/firewall"
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
+/* Peers and listen port set while the apply is deferred(boot/batch). */
+static struct hash *wg_deferred_peers;
+static int wg_deferred_port;
+
+static unsigned int wg_peer_key (char *key)
+{
+	return string_hash_make (key);
+}
+
+static int wg_peer_cmp (char *k1, char *k2)
+{
+	return strcmp (k1, k2) == 0;
+}
+
+static void *wg_peer_alloc (char *key)
+{
+	return XSTRDUP (MTYPE_TMP, key);
+}
+
+static void wg_peer_free (char *key)
+{
+	XFREE (MTYPE_TMP, key);
+}
+
+/* Remember the peer, it is set by cmd_vpn_flush(). */
+static void wg_defer_peer (char *pubkey)
+{
+	if (wg_deferred_peers == NULL)
+		wg_deferred_peers = hash_create_size (64, (unsigned int (*) (void *)) wg_peer_key,
+				(int (*) (void *, void *)) wg_peer_cmp);
+	hash_get (wg_deferred_peers, pubkey, (void * (*) (void *)) wg_peer_alloc);
+}
+
+/*
+ * The allowed-ips of all configured peers, each prefix with a copy of the
+ * key of its peer.  The kernel silently moves a prefix given to a second
+ * peer away from the first one, so such an overlap is caught at config time.
+ */
+static struct lpm_table *wg_allowedips;
+
+/* Split a comma separated allowed-ips list into *p, allocated for one
+   prefix per entry and freed by the caller.  Return the number of
+   prefixes, or -1 with the entry which is not a prefix in bad. */
+static int wg_allowedips_parse (const char *list, struct lpm_prefix **p, char *bad, int size)
+{
+	char *buf, *tok, *save = NULL;
+	const char *c;
+	int n = 1;
+
+	for (c = list; *c; c++)
+		if (*c == ',')
+			n++;
+	*p = XCALLOC(MTYPE_TMP, n * sizeof(struct lpm_prefix));
+	buf = XSTRDUP(MTYPE_TMP, (char *) list);
+
+	n = 0;
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (lpm_prefix_parse(&(*p)[n], tok) < 0) {
+			snprintf(bad, size, "%s", tok);
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	if (n == 0)
+		snprintf(bad, size, "%s", list);
+	XFREE(MTYPE_TMP, buf);
+
+	if (n <= 0) {
+		XFREE(MTYPE_TMP, *p);
+		*p = NULL;
+		return -1;
+	}
+	return n;
+}
+
+/* The prefixes of a "wg peer KEY allowed-ips X ..." line in *p, 0 if
+   none. */
+static int wg_allowedips_of_line (char *line, struct lpm_prefix **p)
+{
+	char *buf, bad[64], *s;
+	int n;
+
+	*p = NULL;
+	if (line == NULL || (s = strstr(line, " allowed-ips ")) == NULL)
+		return 0;
+	buf = XSTRDUP(MTYPE_TMP, s + strlen(" allowed-ips "));
+	buf[strcspn(buf, " ")] = '\0';
+	n = wg_allowedips_parse(buf, p, bad, sizeof(bad));
+	XFREE(MTYPE_TMP, buf);
+	return n < 0 ? 0 : n;
+}
+
+static int wg_allowedips_of (char *pubkey, struct lpm_prefix **p)
+{
+	char szLeft[128];
+
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", pubkey);
+	return wg_allowedips_of_line(config_get_line_byleft(config_top, szLeft), p);
+}
+
+/* Drop the prefixes of the peer, except those another peer took over. */
+static void wg_allowedips_remove (char *pubkey, struct lpm_prefix *p, int n)
+{
+	char *owner;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		owner = lpm_get(wg_allowedips, &p[i]);
+		if (owner && strcmp(owner, pubkey) == 0)
+			XFREE(MTYPE_TMP, lpm_delete(wg_allowedips, &p[i]));
+	}
+}
+
+static void wg_allowedips_add (char *pubkey, struct lpm_prefix *p, int n)
+{
+	char *old;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if ((old = lpm_insert(wg_allowedips, &p[i], XSTRDUP(MTYPE_TMP, pubkey))) != NULL)
+			XFREE(MTYPE_TMP, old);
+}
+
+/* Index config_top on first use.  The peer lines loaded from the config
+   cache are not executed, and a load which executes them does not need
+   the index yet. */
+static void wg_allowedips_build (void)
+{
+	struct lpm_prefix *p;
+	struct listnode *nn;
+	char *line, key[64];
+	int n;
+
+	wg_allowedips = lpm_table_new();
+	LIST_LOOP(config_top, line, nn) {
+		if (strncmp(line, "wg peer ", 8) || sscanf(line + 8, "%63s", key) != 1)
+			continue;
+		if ((n = wg_allowedips_of_line(line, &p)) > 0)
+			wg_allowedips_add(key, p, n);
+		XFREE(MTYPE_TMP, p);
+	}
+}
+
+/* Replace the allowed-ips of the peer in the index, list is NULL when the
+   peer loses them.  An overlap with another peer is refused when typed and
+   only warned about in a config being loaded, at boot too: a saved config
+   the kernel took must come up the same. */
+static int wg_allowedips_set (struct vty *vty, char *pubkey, const char *list)
+{
+	struct lpm_prefix *new = NULL, *old, found;
+	char bad[64], prefix[64], other[64], *owner;
+	int i, nnew = 0, nold, overlaps = 0;
+	int loading = vty->type == VTY_FILE || host.boot;
+
+	if (list && (nnew = wg_allowedips_parse(list, &new, bad, sizeof(bad))) < 0) {
+		vty_out (vty, "%% Invalid allowed-ips '%s', Please input the correct value %s",
+				bad, VTY_NEWLINE);
+		return CMD_ERR_NOTHING_TODO;
+	}
+
+	if (wg_allowedips == NULL) {
+		if (vty->type == VTY_FILE) {
+			XFREE(MTYPE_TMP, new);
+			return CMD_SUCCESS;
+		}
+		wg_allowedips_build();
+	}
+	nold = wg_allowedips_of(pubkey, &old);
+	wg_allowedips_remove(pubkey, old, nold);
+
+	for (i = 0; i < nnew; i++) {
+		if ((owner = lpm_overlap(wg_allowedips, &new[i], &found)) == NULL)
+			continue;
+		vty_out (vty, "%% %sallowed-ips %s overlaps %s of peer %s%s",
+				loading ? "Warning: " : "",
+				lpm_prefix_str(&new[i], prefix, sizeof(prefix)),
+				lpm_prefix_str(&found, other, sizeof(other)), owner, VTY_NEWLINE);
+		overlaps++;
+	}
+	if (overlaps && !loading)
+		wg_allowedips_add(pubkey, old, nold);
+	else
+		wg_allowedips_add(pubkey, new, nnew);
+
+	XFREE(MTYPE_TMP, new);
+	XFREE(MTYPE_TMP, old);
+	return overlaps && !loading ? CMD_WARNING : CMD_SUCCESS;
+}
+
+/* Rewrite an allowed-ips list with the fewest prefixes covering the same
+   addresses, see lpm_aggregate().  Return the new list, freed by the
+   caller, with the number of prefixes before and after in *before and
+   *after, or NULL if the list is not valid. */
+static char *wg_allowedips_aggregate (const char *list, int *before, int *after)
+{
+	struct lpm_prefix *p;
+	char bad[64], prefix[64], *buf;
+	int i, len = 0;
+
+	if ((*before = wg_allowedips_parse(list, &p, bad, sizeof(bad))) < 0)
+		return NULL;
+	*after = lpm_aggregate(p, *before);
+
+	buf = XMALLOC(MTYPE_TMP, *after * sizeof(prefix) + 1);
+	buf[0] = '\0';
+	for (i = 0; i < *after; i++)
+		len += sprintf(buf + len, "%s%s", i ? "," : "",
+				lpm_prefix_str(&p[i], prefix, sizeof(prefix)));
+	XFREE(MTYPE_TMP, p);
+	return buf;
+}
+
+/* Point the Allow-WG-Inbound rule of the firewall config at the port.
+   Return 1 if the file was changed, 0 if the rule was already right and
+   -1 on error. */
+static int wg_firewall_rule_update(char *path, int nNum)
+{
+	struct uci_package *pkg;
+	struct uci_section *sec, *dup;
+	char port[16];
+	int changed = 0;
+
+	pkg = uci_load(path);
+	if (pkg == NULL)
+		return -1;
+
+	sec = uci_section_find(pkg, "rule", "name", "Allow-WG-Inbound");
+	if (sec == NULL) {
+		sec = uci_section_add(pkg, "rule", NULL);
+		changed = 1;
+	}
+
+	/* Duplicated rules left behind by older versions */
+	while ((dup = uci_section_find_next(pkg, sec, "rule", "name", "Allow-WG-Inbound")) != NULL) {
+		uci_section_del(pkg, dup);
+		changed = 1;
+	}
+
+	snprintf(port, sizeof(port), "%d", nNum);
+	changed |= uci_option_set(sec, "src", "*");
+	changed |= uci_option_set(sec, "target", "ACCEPT");
+	changed |= uci_option_set(sec, "proto", "udp");
+	changed |= uci_option_set(sec, "dest_port", port);
+	changed |= uci_option_set(sec, "name", "Allow-WG-Inbound");
+
+	if (changed && uci_save(pkg, path) < 0)
+		changed = -1;
+	uci_free(pkg);
+	return changed;
+}
+
+/* Open the WireGuard listen port in the firewall.  The Allow-WG-Inbound
+   rule is edited in /etc/config/firewall directly and a firewall reload
+   is queued only when the rule changed. */
+static void wg_apply_firewall_rule(int nNum)
+{
+	if (wg_firewall_rule_update(FIREWALL_CONFIG, nNum) == 1)
+		fw_apply_queue(FW_APPLY_RELOAD);
+}
+
+static void wg_apply_listenport(int nNum)
+{
+	char szInfo[1024];
+
+	/* wg set wg0 listen-port PORT */
+	sprintf(szInfo, "wg set wg0 listen-port %d > /dev/null 2>&1", nNum);
+	system(szInfo);
+
+	wg_apply_firewall_rule(nNum);
+
+	/* The conntrack bypass follows the port */
+	if (config_get_line_byleft(config_top, "sfirewall wg-notrack"))
+		fw_wg_notrack_apply(nNum);
+}
+
+/* Write a key in base64 the way 'wg genkey' does, replacing the file
+   atomically. */
+static int wg_key_write (char *path, const uint8_t key[CURVE25519_KEY_SIZE], mode_t mode)
+{
+	char base64[WG_KEY_LEN_BASE64 + 1], tmpfile[256];
+	int fd, len, ret;
+
+	key_to_base64(base64, key);
+	len = strlen(base64);
+	base64[len++] = '\n';
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", path);
+	fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if (fd < 0)
+		return -1;
+	ret = (write(fd, base64, len) == len && fsync(fd) == 0) ? 0 : -1;
+	close(fd);
+	if (ret == 0 && rename(tmpfile, path) < 0)
+		ret = -1;
+	if (ret < 0)
+		unlink(tmpfile);
+	memset(base64, 0, sizeof(base64));
+	return ret;
+}
+
+/* The keypair of this router, generated in-process. */
+static int wg_keys_ready;
+
+static int wg_generate_keys (uint8_t pub[CURVE25519_KEY_SIZE])
+{
+	uint8_t secret[1][CURVE25519_KEY_SIZE], public[1][CURVE25519_KEY_SIZE];
+	int ret = -1;
+
+	if (curve25519_generate_keypairs(secret, public, 1) == 0 &&
+			wg_key_write(PRIVATEKEY_PATH, secret[0], 0600) == 0 &&
+			wg_key_write(PUBLICKEY_PATH, public[0], 0644) == 0)
+		ret = 0;
+	if (pub)
+		memcpy(pub, public[0], CURVE25519_KEY_SIZE);
+	memset(secret, 0, sizeof(secret));
+	wg_keys_ready = (ret == 0);
+	return ret;
+}
+
+/* Generate the keypair if there is none yet.  The file is looked at once,
+   not before every peer edit. */
+static void wg_ensure_keys (void)
+{
+	struct stat sb;
+
+	if (wg_keys_ready)
+		return;
+	if (stat(PRIVATEKEY_PATH, &sb) == 0)
+		wg_keys_ready = 1;
+	else
+		wg_generate_keys(NULL);
+}
+
 DEFUN (wg_listenport,
         wg_listenport_cmd,
         "wg listenport NUM",
@@ -40,52 +407,19 @@ DEFUN (wg_listenport,
         "1024 ~ 65535\n")
 {
 	int nNum = atoi(argv[0]);
-	char szInfo[1024], xbuf[256];
-	FILE *fp = NULL;
-	int fwrule = -1;
+	char szInfo[1024], szLeft[128];
 
-	snprintf(szInfo, sizeof(szInfo), "wg listenport");
-	config_del_line_byleft(config_top, szInfo);
+	snprintf(szLeft, sizeof(szLeft), "wg listenport");
 	snprintf(szInfo, sizeof(szInfo), "wg listenport %d", nNum);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
-	/* wg set wg0 listen-port PORT */
-	sprintf(szInfo, "wg set wg0 listen-port %s > /dev/null 2>&1", argv[0]);
-	system(szInfo);
-
-	/* Delete the existing UCI firewall rule for WG listen port */
-	/*
-	 * fwrule=`uci show firewall  | grep "Allow-WG-Inbound" | awk -F'=' '{ print $1 }' | sed s"/.name//g"`
-	 * uci delete $fwrule > /dev/null 2>&1
-	 * uci commit firewall > /dev/null 2>&1
-	 */
-	system("uci show firewall  | grep \"Allow-WG-Inbound\" | awk -F'=' '{ print $1 }' | sed s\"/.name//g\" > /tmp/.fwrule");
-	fp = fopen("/tmp/.fwrule", "r");
-	if (fp) {
-		memset(xbuf, 0, sizeof(xbuf));
-		if (fgets(xbuf, sizeof(xbuf), fp)) {
-			fwrule = atoi(xbuf);
-		}
-		fclose(fp);
-	}
-	unlink("/tmp/.fwrule");
-	if (fwrule > 0) {
-		sprintf(szInfo, "uci delete %d > /dev/null 2>&1", fwrule);
-		system(szInfo);
+	if (host.defer) {
+		wg_deferred_port = nNum;
+		return CMD_SUCCESS;
 	}
-
-	/* Add a new UCI firewall rule for WG listen port */
-	system("uci add firewall rule > /dev/null 2>&1");
-	system("uci set firewall.@rule[-1].src=\"*\" > /dev/null 2>&1");
-	system("uci set firewall.@rule[-1].target=\"ACCEPT\" > /dev/null 2>&1");
-	system("uci set firewall.@rule[-1].proto=\"udp\" > /dev/null 2>&1");
-	sprintf(szInfo, "uci set firewall.@rule[-1].dest_port=\"%s\" > /dev/null 2>&1", argv[0]);
-	system(szInfo);
-	system("uci set firewall.@rule[-1].name=\"Allow-WG-Inbound\" > /dev/null 2>&1");
-	system("uci commit firewall > /dev/null 2>&1");
-	system("/etc/init.d/firewall restart > /dev/null 2>&1");
+	wg_apply_listenport(nNum);
 
 	return CMD_SUCCESS;
 }
@@ -109,8 +443,7 @@ DEFUN (wg_peer_full,
         "no keepalive\n"
         "Seconds 1-1800\n")
 {
-	char szInfo[2048];
-	struct stat sb;
+	char szInfo[2048], szLeft[128];
 	int knum;
 
 	/* sanity check for public key ! */
@@ -145,18 +478,12 @@ DEFUN (wg_peer_full,
 		}
 	}
 
-	if (stat(PRIVATEKEY_PATH, &sb) == -1) {
-		sprintf(szInfo, "wg genkey | tee %s/privatekey | wg pubkey > %s/publickey",
-				CONFIG_DIR, CONFIG_DIR);
-		system(szInfo);
-	}
-
-	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
-	config_del_line_byleft(config_top, szInfo);
+	wg_ensure_keys();
 
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", argv[0]);
 	snprintf(szInfo, sizeof(szInfo), "wg peer %s allowed-ips %s endpoint %s persistent-keepalive %s",
 			argv[0], argv[1], argv[2], argv[3]);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
@@ -202,8 +529,7 @@ DEFUN (wg_peer_public_key,
         "Specify peer information\n"
         "Public key\n")
 {
-	char szInfo[2048];
-	struct stat sb;
+	char szInfo[2048], szLeft[128];
 
 	/* sanity check for public key ! */
 	if (strlen(argv[0]) != PUBLICKEY_MAX_LEN || argv[0][strlen(argv[0])-1] != '=') { /* public key size */
@@ -211,20 +537,20 @@ DEFUN (wg_peer_public_key,
 		return CMD_ERR_NOTHING_TODO;
 	}
 
-	if (stat(PRIVATEKEY_PATH, &sb) == -1) {
-		sprintf(szInfo, "wg genkey | tee %s/privatekey | wg pubkey > %s/publickey",
-				CONFIG_DIR, CONFIG_DIR);
-		system(szInfo);
-	}
-
-	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
-	config_del_line_byleft(config_top, szInfo);
+	wg_allowedips_set(vty, argv[0], NULL);
+	wg_ensure_keys();
 
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", argv[0]);
 	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
+	if (host.defer) {
+		wg_defer_peer(argv[0]);
+		return CMD_SUCCESS;
+	}
+
 	/*
 	 * wg set wg0 private-key privatekey peer SERVERPUB allowed-ips 5.5.5.0/24 \
 	 * endpoint vpn.server.com:12000 persistent-keepalive 10
@@ -245,8 +571,8 @@ DEFUN (wg_peer_allowed_ips,
         "Allow ip addresses\n"
         "ip network e.g. 192.168.1.0/24,172.16.0.0/16\n")
 {
-	char szInfo[2048];
-	struct stat sb;
+	char szInfo[2048], szLeft[128];
+	int ret;
 
 	/* sanity check for public key ! */
 	if (strlen(argv[0]) != PUBLICKEY_MAX_LEN || argv[0][strlen(argv[0])-1] != '=') { /* public key size */
@@ -254,26 +580,21 @@ DEFUN (wg_peer_allowed_ips,
 		return CMD_ERR_NOTHING_TODO;
 	}
 
-	if (!isdigit(argv[1][0])) {
-		vty_out (vty, "%% Invalid allowed-ips '%s', Please input the correct value %s",
-				argv[1], VTY_NEWLINE);
-		return CMD_ERR_NOTHING_TODO;
-	}
-
-	if (stat(PRIVATEKEY_PATH, &sb) == -1) {
-		sprintf(szInfo, "wg genkey | tee %s/privatekey | wg pubkey > %s/publickey",
-				CONFIG_DIR, CONFIG_DIR);
-		system(szInfo);
-	}
-
-	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
-	config_del_line_byleft(config_top, szInfo);
+	if ((ret = wg_allowedips_set(vty, argv[0], argv[1])) != CMD_SUCCESS)
+		return ret;
+	wg_ensure_keys();
 
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", argv[0]);
 	snprintf(szInfo, sizeof(szInfo), "wg peer %s allowed-ips %s", argv[0], argv[1]);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
+	if (host.defer) {
+		wg_defer_peer(argv[0]);
+		return CMD_SUCCESS;
+	}
+
 	/*
 	 * wg set wg0 private-key privatekey peer SERVERPUB allowed-ips 5.5.5.0/24
 	 */
@@ -284,6 +605,30 @@ DEFUN (wg_peer_allowed_ips,
 	return CMD_SUCCESS;
 }
 
+/* The list is stored and set aggregated, an invalid one is left as it is
+   for wg_peer_allowed_ips() to refuse. */
+DEFUN (wg_peer_allowed_ips_aggregate,
+        wg_peer_allowed_ips_aggregate_cmd,
+        "wg peer PUBLICKEY allowed-ips WORD aggregate",
+        "Configure WireGuard rules\n"
+        "Specify peer information\n"
+        "Public key\n"
+        "Allow ip addresses\n"
+        "ip network e.g. 192.168.1.0/24,172.16.0.0/16\n"
+        "Merge the ip networks into the fewest covering the same addresses\n")
+{
+	char *list, *args[2];
+	int before, after, ret;
+
+	args[0] = argv[0];
+	args[1] = argv[1];
+	if ((list = wg_allowedips_aggregate(argv[1], &before, &after)) != NULL)
+		args[1] = list;
+	ret = wg_peer_allowed_ips (self, vty, argc, args);
+	XFREE(MTYPE_TMP, list);
+	return ret;
+}
+
 DEFUN (wg_peer_endpoint,
         wg_peer_endpoint_cmd,
         "wg peer PUBLICKEY allowed-ips WORD endpoint (none|FQDN:PORT|A.B.C.D:PORT)",
@@ -297,8 +642,8 @@ DEFUN (wg_peer_endpoint,
         "FQDN and port e.g. test.yourdomain.com:12345\n"
         "ip address and port e.g. x.x.x.x:y\n")
 {
-	char szInfo[2048];
-	struct stat sb;
+	char szInfo[2048], szLeft[128];
+	int ret;
 
 	/* sanity check for public key ! */
 	if (strlen(argv[0]) != PUBLICKEY_MAX_LEN || argv[0][strlen(argv[0])-1] != '=') { /* public key size */
@@ -306,12 +651,6 @@ DEFUN (wg_peer_endpoint,
 		return CMD_ERR_NOTHING_TODO;
 	}
 
-	if (!isdigit(argv[1][0])) {
-		vty_out (vty, "%% Invalid allowed-ips '%s', Please input the correct value %s",
-				argv[1], VTY_NEWLINE);
-		return CMD_ERR_NOTHING_TODO;
-	}
-
 	if (strlen(argv[2]) > 128) {
 		vty_out (vty, "%% Invalid endpoint '%s', Too long FQDN %s",
 				argv[2], VTY_NEWLINE);
@@ -323,21 +662,22 @@ DEFUN (wg_peer_endpoint,
 		return CMD_WARNING;
 	}
 
-	if (stat(PRIVATEKEY_PATH, &sb) == -1) {
-		sprintf(szInfo, "wg genkey | tee %s/privatekey | wg pubkey > %s/publickey",
-				CONFIG_DIR, CONFIG_DIR);
-		system(szInfo);
-	}
-
-	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
-	config_del_line_byleft(config_top, szInfo);
+	if ((ret = wg_allowedips_set(vty, argv[0], argv[1])) != CMD_SUCCESS)
+		return ret;
+	wg_ensure_keys();
 
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", argv[0]);
 	snprintf(szInfo, sizeof(szInfo), "wg peer %s allowed-ips %s endpoint %s",
 			argv[0], argv[1], argv[2]);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
+	if (host.defer) {
+		wg_defer_peer(argv[0]);
+		return CMD_SUCCESS;
+	}
+
 	/*
 	 * wg set wg0 private-key privatekey peer SERVERPUB allowed-ips 5.5.5.0/24 \
 	 * endpoint vpn.server.com:12000
@@ -365,9 +705,8 @@ DEFUN (wg_peer_persistent_keepalive,
         "no keepalive\n"
         "Seconds 1-1800\n")
 {
-	char szInfo[2048];
-	struct stat sb;
-	int knum;
+	char szInfo[2048], szLeft[128];
+	int knum, ret;
 
 	/* sanity check for public key ! */
 	if (strlen(argv[0]) != PUBLICKEY_MAX_LEN || argv[0][strlen(argv[0])-1] != '=') { /* public key size */
@@ -375,12 +714,6 @@ DEFUN (wg_peer_persistent_keepalive,
 		return CMD_ERR_NOTHING_TODO;
 	}
 
-	if (!isdigit(argv[1][0])) {
-		vty_out (vty, "%% Invalid allowed-ips '%s', Please input the correct value %s",
-				argv[1], VTY_NEWLINE);
-		return CMD_ERR_NOTHING_TODO;
-	}
-
 	if (strlen(argv[2]) > 128) {
 		vty_out (vty, "%% Invalid endpoint '%s', Too long FQDN %s",
 				argv[2], VTY_NEWLINE);
@@ -401,21 +734,22 @@ DEFUN (wg_peer_persistent_keepalive,
 		}
 	}
 
-	if (stat(PRIVATEKEY_PATH, &sb) == -1) {
-		sprintf(szInfo, "wg genkey | tee %s/privatekey | wg pubkey > %s/publickey",
-				CONFIG_DIR, CONFIG_DIR);
-		system(szInfo);
-	}
-
-	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
-	config_del_line_byleft(config_top, szInfo);
+	if ((ret = wg_allowedips_set(vty, argv[0], argv[1])) != CMD_SUCCESS)
+		return ret;
+	wg_ensure_keys();
 
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", argv[0]);
 	snprintf(szInfo, sizeof(szInfo), "wg peer %s allowed-ips %s endpoint %s persistent-keepalive %s",
 			argv[0], argv[1], argv[2], argv[3]);
-	config_add_line(config_top, szInfo);
+	config_replace_line_byleft(config_top, szLeft, szInfo);
 
 	ENSURE_CONFIG(vty);
 
+	if (host.defer) {
+		wg_defer_peer(argv[0]);
+		return CMD_SUCCESS;
+	}
+
 	/*
 	 * wg set wg0 private-key privatekey peer SERVERPUB allowed-ips 5.5.5.0/24 \
 	 * endpoint vpn.server.com:12000 persistent-keepalive 10
@@ -437,6 +771,7 @@ DEFUN (no_wg_peer,
 {
 	char szInfo[1024];
 
+	wg_allowedips_set(vty, argv[0], NULL);
 	snprintf(szInfo, sizeof(szInfo), "wg peer %s", argv[0]);
 	config_del_line_byleft(config_top, szInfo);
 
@@ -497,25 +832,20 @@ DEFUN (wg_rekey,
         "Regenerate private & public keys\n")
 {
 	char szInfo[1024];
-	FILE *fp = NULL;
-	char xbuf[1024];
+	char base64[WG_KEY_LEN_BASE64];
+	uint8_t pub[CURVE25519_KEY_SIZE];
 
-	sprintf(szInfo, "wg genkey | tee %s/privatekey | wg pubkey > %s/publickey",
-			CONFIG_DIR, CONFIG_DIR);
-	system(szInfo);
+	if (wg_generate_keys(pub) < 0) {
+		vty_out (vty, "%% Can't generate the keys: %s\n", strerror(errno));
+		return CMD_WARNING;
+	}
 
 	sprintf(szInfo, "wg set wg0 private-key %s/privatekey", CONFIG_DIR);
 	system(szInfo);
 
+	key_to_base64(base64, pub);
 	vty_out (vty, "My Private key => [hidden]\n");
-	fp = fopen(PUBLICKEY_PATH, "r");
-	if (fp) {
-		memset(xbuf, 0, sizeof(xbuf));
-		if (fgets(xbuf, sizeof(xbuf), fp)) {
-			vty_out (vty, "My Public key => %s", xbuf);
-		}
-		fclose(fp);
-	}
+	vty_out (vty, "My Public key => %s\n", base64);
 
 	return CMD_SUCCESS;
 }
@@ -526,13 +856,61 @@ DEFUN (wg_clearkey,
         "Configure WireGuard rules\n"
         "Remove curve25519 private & public keys\n")
 {
-	char szInfo[1024];
+	unlink(PUBLICKEY_PATH);
+	unlink(PRIVATEKEY_PATH);
+	wg_keys_ready = 0;
 
-	sprintf(szInfo, "rm %s/publickey > /dev/null 2>&1", CONFIG_DIR);
-	system(szInfo);
-	sprintf(szInfo, "rm %s/privatekey > /dev/null 2>&1", CONFIG_DIR);
-	system(szInfo);
+	return CMD_SUCCESS;
+}
+
+/* Keypairs for new clients, none of them is kept.  The time taken is
+   shown as keys per second. */
+DEFUN (wg_generate_keypairs,
+        wg_generate_keypairs_cmd,
+        "wg generate-keys count NUM",
+        "Configure WireGuard rules\n"
+        "Generate client keypairs\n"
+        "Number of keypairs\n"
+        "1-10000\n")
+{
+	uint8_t (*secret)[CURVE25519_KEY_SIZE], (*pub)[CURVE25519_KEY_SIZE];
+	char base64[WG_KEY_LEN_BASE64], base64_pub[WG_KEY_LEN_BASE64];
+	struct timespec start, end;
+	double sec;
+	int i, count;
+
+	count = atoi(argv[0]);
+	if (!isdigit(argv[0][0]) || count < 1 || count > GENERATE_KEYS_MAX) {
+		vty_out (vty, "%% Invalid count '%s', 1 ~ %d\n", argv[0], GENERATE_KEYS_MAX);
+		return CMD_WARNING;
+	}
+
+	secret = XMALLOC(MTYPE_TMP, (size_t) count * CURVE25519_KEY_SIZE);
+	pub = XMALLOC(MTYPE_TMP, (size_t) count * CURVE25519_KEY_SIZE);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (curve25519_generate_keypairs(secret, pub, count) < 0) {
+		vty_out (vty, "%% Can't generate the keys: %s\n", strerror(errno));
+		XFREE(MTYPE_TMP, secret);
+		XFREE(MTYPE_TMP, pub);
+		return CMD_WARNING;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
+	vty_out (vty, "%-44s %s\n", "Private key", "Public key");
+	for (i = 0; i < count; i++) {
+		key_to_base64(base64, secret[i]);
+		key_to_base64(base64_pub, pub[i]);
+		vty_out (vty, "%s %s\n", base64, base64_pub);
+	}
+
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	vty_out (vty, "%d keypairs in %.3f s, %.0f keys/s\n", count, sec, sec > 0 ? count / sec : 0);
+
+	memset(secret, 0, (size_t) count * CURVE25519_KEY_SIZE);
+	memset(base64, 0, sizeof(base64));
+	XFREE(MTYPE_TMP, secret);
+	XFREE(MTYPE_TMP, pub);
 	return CMD_SUCCESS;
 }
 
@@ -561,22 +939,710 @@ DEFUN (show_wg_conf,
 	return CMD_SUCCESS;
 }
 
+/*
+ * show wg peers: the device read over generic netlink, the page asked for
+ * picked with partial_sort() so a top N of many peers stays cheap.
+ */
+enum { WG_SORT_NONE, WG_SORT_RX, WG_SORT_TX, WG_SORT_HANDSHAKE };
+
+static int wg_peer_rank (void *a, void *b, void *arg)
+{
+	struct wgpeer *pa = a, *pb = b;
+	int sort = *(int *) arg;
+	uint64_t va, vb;
+
+	if (sort == WG_SORT_RX) {
+		va = pa->rx_bytes;
+		vb = pb->rx_bytes;
+	} else if (sort == WG_SORT_TX) {
+		va = pa->tx_bytes;
+		vb = pb->tx_bytes;
+	} else {
+		va = pa->last_handshake_time.tv_sec;
+		vb = pb->last_handshake_time.tv_sec;
+	}
+	/* Largest first, the public key keeps the pages stable */
+	if (va != vb)
+		return va > vb ? -1 : 1;
+	return memcmp(pa->public_key, pb->public_key, WG_KEY_LEN);
+}
+
+static char *wg_endpoint_str (struct wgpeer *peer, char *buf, int size)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	if (peer->endpoint.addr.sa_family == AF_INET) {
+		inet_ntop(AF_INET, &peer->endpoint.addr4.sin_addr, addr, sizeof(addr));
+		snprintf(buf, size, "%s:%u", addr, ntohs(peer->endpoint.addr4.sin_port));
+	} else if (peer->endpoint.addr.sa_family == AF_INET6) {
+		inet_ntop(AF_INET6, &peer->endpoint.addr6.sin6_addr, addr, sizeof(addr));
+		snprintf(buf, size, "[%s]:%u", addr, ntohs(peer->endpoint.addr6.sin6_port));
+	} else
+		buf[0] = '\0';
+	return buf;
+}
+
+/* The allowed ips of the peer, comma separated and quoted for json, in a
+   string the caller frees.  The list is never cut, json needs it whole. */
+static char *wg_allowedips_str (struct wgpeer *peer, int json)
+{
+	struct wgallowedip *ip;
+	char addr[INET6_ADDRSTRLEN], *buf;
+	int n = 0, len = 0;
+
+	for_each_wgallowedip(peer, ip)
+		n++;
+	/* ,"addr/128" */
+	buf = XMALLOC(MTYPE_TMP, n * (INET6_ADDRSTRLEN + 7) + 1);
+
+	buf[0] = '\0';
+	for_each_wgallowedip(peer, ip) {
+		inet_ntop(ip->family, ip->family == AF_INET ? (void *) &ip->ip4 : (void *) &ip->ip6,
+				addr, sizeof(addr));
+		len += sprintf(buf + len, json ? "%s\"%s/%u\"" : "%s%s/%u",
+				len ? "," : "", addr, ip->cidr);
+	}
+	return buf;
+}
+
+static char *wg_handshake_str (struct wgpeer *peer, time_t now, char *buf, int size)
+{
+	long ago;
+
+	if (peer->last_handshake_time.tv_sec == 0)
+		snprintf(buf, size, "never");
+	else if ((ago = now - peer->last_handshake_time.tv_sec) < 60)
+		snprintf(buf, size, "%lds", ago);
+	else if (ago < 3600)
+		snprintf(buf, size, "%ldm%02lds", ago / 60, ago % 60);
+	else if (ago < 86400)
+		snprintf(buf, size, "%ldh%02ldm", ago / 3600, ago % 3600 / 60);
+	else
+		snprintf(buf, size, "%ldd%02ldh", ago / 86400, ago % 86400 / 3600);
+	return buf;
+}
+
+static int wg_show_peers (struct vty *vty, int argc, char **argv, int json)
+{
+	static const char *sorts[] = { "none", "rx", "tx", "handshake" };
+	struct wgdevice *dev;
+	struct wgpeer *peer, **list;
+	char key[WG_KEY_LEN_BASE64], endpoint[64], *ips, handshake[16];
+	int i, n, count = 0, sort = WG_SORT_NONE, limit = -1, offset = 0, end;
+	time_t now = time(NULL);
+
+	/* [sort (rx|tx|handshake)] [limit NUM [offset NUM]] */
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "rx"))
+			sort = WG_SORT_RX;
+		else if (!strcmp(argv[i], "tx"))
+			sort = WG_SORT_TX;
+		else if (!strcmp(argv[i], "handshake"))
+			sort = WG_SORT_HANDSHAKE;
+		else if (!isdigit(argv[i][0]) || (n = atoi(argv[i])) < 0 || (limit < 0 && n == 0)) {
+			vty_out (vty, "%% Invalid number '%s'\n", argv[i]);
+			return CMD_WARNING;
+		} else if (limit < 0)
+			limit = n;
+		else
+			offset = n;
+	}
+
+	if (wgnl_get_device(&dev, "wg0") < 0) {
+		vty_out (vty, "%% Can't read wg0: %s\n", strerror(errno));
+		return CMD_WARNING;
+	}
+
+	for_each_wgpeer(dev, peer)
+		count++;
+	list = XCALLOC(MTYPE_TMP, sizeof(struct wgpeer *) * (count + 1));
+	i = 0;
+	for_each_wgpeer(dev, peer)
+		list[i++] = peer;
+
+	end = (limit < 0 || offset + limit > count) ? count : offset + limit;
+	if (offset > count)
+		offset = count;
+	if (sort != WG_SORT_NONE)
+		partial_sort((void **) list, count, end, wg_peer_rank, &sort);
+
+	key_to_base64(key, dev->public_key);
+	if (json) {
+		vty_out (vty, "{\"interface\":\"%s\",\"public_key\":\"%s\",\"listen_port\":%u,"
+				"\"sort\":\"%s\",\"total\":%d,\"offset\":%d,\"peers\":[",
+				dev->name, (dev->flags & WGDEVICE_HAS_PUBLIC_KEY) ? key : "",
+				dev->listen_port, sorts[sort], count, offset);
+	} else {
+		vty_out (vty, "interface: %s, public key: %s, listening port: %u\n", dev->name,
+				(dev->flags & WGDEVICE_HAS_PUBLIC_KEY) ? key : "(none)", dev->listen_port);
+		vty_out (vty, "peers %d-%d of %d%s%s\n", end > offset ? offset + 1 : 0, end, count,
+				sort != WG_SORT_NONE ? ", sorted by " : "",
+				sort != WG_SORT_NONE ? sorts[sort] : "");
+		vty_out (vty, "%-44s %-21s %-9s %14s %14s %s\n", "Peer", "Endpoint", "Handshake",
+				"RX", "TX", "Allowed IPs");
+	}
+
+	for (i = offset; i < end; i++) {
+		peer = list[i];
+		key_to_base64(key, peer->public_key);
+		wg_endpoint_str(peer, endpoint, sizeof(endpoint));
+		ips = wg_allowedips_str(peer, json);
+		if (json)
+			vty_out (vty, "%s{\"public_key\":\"%s\",\"endpoint\":\"%s\",\"allowed_ips\":[%s],"
+					"\"latest_handshake\":%lld,\"rx_bytes\":%llu,\"tx_bytes\":%llu,"
+					"\"persistent_keepalive\":%u}",
+					i > offset ? "," : "", key, endpoint, ips,
+					(long long) peer->last_handshake_time.tv_sec,
+					(unsigned long long) peer->rx_bytes, (unsigned long long) peer->tx_bytes,
+					peer->persistent_keepalive_interval);
+		else
+			vty_out (vty, "%-44s %-21s %-9s %14llu %14llu %s\n", key,
+					endpoint[0] ? endpoint : "(none)", wg_handshake_str(peer, now, handshake, sizeof(handshake)),
+					(unsigned long long) peer->rx_bytes, (unsigned long long) peer->tx_bytes,
+					ips[0] ? ips : "(none)");
+		XFREE(MTYPE_TMP, ips);
+	}
+	if (json)
+		vty_out (vty, "]}\n");
+
+	XFREE(MTYPE_TMP, list);
+	free_wgdevice(dev);
+	return CMD_SUCCESS;
+}
+
+#define SHOW_WG_PEERS_STR \
+	SHOW_STR \
+	"Show the wireguard tunnel info\n" \
+	"Show the peers of wg0\n"
+#define SHOW_WG_PEERS_SORT_STR \
+	"Sort the peers, largest first\n" \
+	"Received bytes\n" \
+	"Sent bytes\n" \
+	"Latest handshake\n"
+#define SHOW_WG_PEERS_LIMIT_STR \
+	"Show this many peers only\n" \
+	"Number of peers\n"
+#define SHOW_WG_PEERS_OFFSET_STR \
+	"Skip the first peers\n" \
+	"Number of peers to skip\n"
+#define SHOW_WG_PEERS_JSON_STR \
+	"JSON output\n"
+
+DEFUN (show_wg_peers,
+        show_wg_peers_cmd,
+        "show wg peers",
+        SHOW_WG_PEERS_STR)
+{
+	return wg_show_peers(vty, argc, argv, 0);
+}
+
+ALIAS (show_wg_peers,
+        show_wg_peers_sort_cmd,
+        "show wg peers sort (rx|tx|handshake)",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_SORT_STR)
+
+ALIAS (show_wg_peers,
+        show_wg_peers_sort_limit_cmd,
+        "show wg peers sort (rx|tx|handshake) limit NUM",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_SORT_STR
+        SHOW_WG_PEERS_LIMIT_STR)
+
+ALIAS (show_wg_peers,
+        show_wg_peers_sort_limit_offset_cmd,
+        "show wg peers sort (rx|tx|handshake) limit NUM offset NUM",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_SORT_STR
+        SHOW_WG_PEERS_LIMIT_STR
+        SHOW_WG_PEERS_OFFSET_STR)
+
+ALIAS (show_wg_peers,
+        show_wg_peers_limit_cmd,
+        "show wg peers limit NUM",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_LIMIT_STR)
+
+ALIAS (show_wg_peers,
+        show_wg_peers_limit_offset_cmd,
+        "show wg peers limit NUM offset NUM",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_LIMIT_STR
+        SHOW_WG_PEERS_OFFSET_STR)
+
+DEFUN (show_wg_peers_json,
+        show_wg_peers_json_cmd,
+        "show wg peers json",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_JSON_STR)
+{
+	return wg_show_peers(vty, argc, argv, 1);
+}
+
+ALIAS (show_wg_peers_json,
+        show_wg_peers_sort_json_cmd,
+        "show wg peers sort (rx|tx|handshake) json",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_SORT_STR
+        SHOW_WG_PEERS_JSON_STR)
+
+ALIAS (show_wg_peers_json,
+        show_wg_peers_sort_limit_json_cmd,
+        "show wg peers sort (rx|tx|handshake) limit NUM json",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_SORT_STR
+        SHOW_WG_PEERS_LIMIT_STR
+        SHOW_WG_PEERS_JSON_STR)
+
+ALIAS (show_wg_peers_json,
+        show_wg_peers_sort_limit_offset_json_cmd,
+        "show wg peers sort (rx|tx|handshake) limit NUM offset NUM json",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_SORT_STR
+        SHOW_WG_PEERS_LIMIT_STR
+        SHOW_WG_PEERS_OFFSET_STR
+        SHOW_WG_PEERS_JSON_STR)
+
+ALIAS (show_wg_peers_json,
+        show_wg_peers_limit_json_cmd,
+        "show wg peers limit NUM json",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_LIMIT_STR
+        SHOW_WG_PEERS_JSON_STR)
+
+ALIAS (show_wg_peers_json,
+        show_wg_peers_limit_offset_json_cmd,
+        "show wg peers limit NUM offset NUM json",
+        SHOW_WG_PEERS_STR
+        SHOW_WG_PEERS_LIMIT_STR
+        SHOW_WG_PEERS_OFFSET_STR
+        SHOW_WG_PEERS_JSON_STR)
+
+/* The peer wg0 sends a packet to, looked up in the allowed-ips of the
+   configured peers like the kernel does. */
+DEFUN (show_wg_peer_for,
+        show_wg_peer_for_cmd,
+        "show wg peer-for A.B.C.D",
+        SHOW_STR
+        "Show the wireguard tunnel info\n"
+        "Show the peer whose allowed-ips cover an address\n"
+        "IP address\n")
+{
+	struct lpm_prefix addr, match;
+	char prefix[64], *owner;
+
+	if (strchr(argv[0], '/') || lpm_prefix_parse(&addr, argv[0]) < 0) {
+		vty_out (vty, "%% Invalid address '%s'\n", argv[0]);
+		return CMD_WARNING;
+	}
+	if (wg_allowedips == NULL)
+		wg_allowedips_build();
+	if ((owner = lpm_match(wg_allowedips, &addr, &match)) == NULL) {
+		vty_out (vty, "%% No peer for %s\n", argv[0]);
+		return CMD_WARNING;
+	}
+
+	vty_out (vty, "%s via peer %s, allowed-ips %s\n", argv[0], owner,
+			lpm_prefix_str(&match, prefix, sizeof(prefix)));
+	return CMD_SUCCESS;
+}
+
+ALIAS (show_wg_peer_for,
+        show_wg_peer_for_ipv6_cmd,
+        "show wg peer-for X:X::X:X",
+        SHOW_STR
+        "Show the wireguard tunnel info\n"
+        "Show the peer whose allowed-ips cover an address\n"
+        "IPv6 address\n")
+
+/*
+ * show wg usage: the lifetime totals saved by web-agentd, brought up to
+ * date with the counters of the kernel the same way the agent does it.
+ */
+
+/* The header and a record of the usage file, the layout is the
+   usage_header_t and usage_record_t of web-agentd.  rx_last/tx_last are
+   counters of the interface of boot_id and ifindex.  A "WGU1" file has
+   only the magic and the count. */
+struct wg_usage_header {
+	char magic[4];
+	uint32_t count;
+	char boot_id[36];
+	uint32_t ifindex;
+};
+
+struct wg_usage {
+	uint8_t public_key[WG_KEY_LEN];
+	uint64_t rx_total;
+	uint64_t tx_total;
+	uint64_t rx_last;
+	uint64_t tx_last;
+	int64_t since;
+	int64_t updated;
+};
+
+static int wg_usage_cmp (const void *a, const void *b)
+{
+	return memcmp(((struct wg_usage *) a)->public_key, ((struct wg_usage *) b)->public_key, WG_KEY_LEN);
+}
+
+static int wg_usage_rank (void *a, void *b, void *arg)
+{
+	struct wg_usage *ua = a, *ub = b;
+	uint64_t va = ua->rx_total + ua->tx_total, vb = ub->rx_total + ub->tx_total;
+
+	if (va != vb)
+		return va > vb ? -1 : 1;
+	return memcmp(ua->public_key, ub->public_key, WG_KEY_LEN);
+}
+
+/* Are the saved counters those of the interface now ?  Not after a reboot
+   or a restart of the interface, its counters started from 0 again. */
+static int wg_usage_current (struct wg_usage_header *header, char *ifname)
+{
+	char boot_id[64] = "";
+	FILE *fp;
+
+	if (!memcmp(header->magic, USAGE_MAGIC_V1, sizeof(header->magic)))
+		return 1;
+	if ((fp = fopen(USAGE_BOOT_ID_PATH, "r")) != NULL) {
+		if (fgets(boot_id, sizeof(boot_id), fp) == NULL)
+			boot_id[0] = '\0';
+		fclose(fp);
+	}
+	boot_id[strcspn(boot_id, "\n")] = '\0';
+	return strlen(boot_id) == sizeof(header->boot_id) &&
+		!memcmp(header->boot_id, boot_id, sizeof(header->boot_id)) &&
+		header->ifindex == if_nametoindex(ifname);
+}
+
+/* Read the usage file, return the number of records or -1.  The saved
+   counters of another boot or interface are set to 0. */
+static int wg_usage_load (struct wg_usage **usage, time_t *saved, char *ifname)
+{
+	struct wg_usage_header header;
+	struct stat st;
+	FILE *fp;
+	int i, n = 0;
+
+	*usage = NULL;
+	*saved = 0;
+	if ((fp = fopen(USAGE_PATH, "r")) == NULL)
+		return errno == ENOENT ? 0 : -1;
+	if (fstat(fileno(fp), &st) == 0)
+		*saved = st.st_mtime;
+
+	memset(&header, 0, sizeof(header));
+	if (fread(&header, offsetof(struct wg_usage_header, boot_id), 1, fp) != 1 ||
+			(memcmp(header.magic, USAGE_MAGIC_V1, sizeof(header.magic)) &&
+			 (memcmp(header.magic, USAGE_MAGIC, sizeof(header.magic)) ||
+			  fread(header.boot_id, sizeof(header) - offsetof(struct wg_usage_header, boot_id), 1, fp) != 1))) {
+		fclose(fp);
+		errno = EINVAL;
+		return -1;
+	}
+	if (header.count) {
+		*usage = XCALLOC(MTYPE_TMP, sizeof(struct wg_usage) * header.count);
+		n = fread(*usage, sizeof(struct wg_usage), header.count, fp);
+	}
+	fclose(fp);
+
+	if (!wg_usage_current(&header, ifname))
+		for (i = 0; i < n; i++)
+			(*usage)[i].rx_last = (*usage)[i].tx_last = 0;
+	return n;
+}
+
+DEFUN (show_wg_usage,
+        show_wg_usage_cmd,
+        "show wg usage",
+        SHOW_STR
+        "Show the wireguard tunnel info\n"
+        "Show the lifetime traffic of the peers\n")
+{
+	struct wg_usage *usage, *list, *u, key;
+	struct wgdevice *dev = NULL;
+	struct wgpeer *peer;
+	struct tm tm;
+	char pub[WG_KEY_LEN_BASE64], since[16], date[32];
+	uint64_t rx = 0, tx = 0;
+	void **order;
+	time_t saved;
+	int i, n, count = 0, total;
+
+	if ((n = wg_usage_load(&usage, &saved, "wg0")) < 0) {
+		vty_out (vty, "%% Can't read %s: %s\n", USAGE_PATH, strerror(errno));
+		return CMD_WARNING;
+	}
+	if (wgnl_get_device(&dev, "wg0") < 0)
+		dev = NULL;
+	if (dev)
+		for_each_wgpeer(dev, peer)
+			count++;
+
+	/* The saved peers first, the peers the agent has not saved yet after */
+	list = XCALLOC(MTYPE_TMP, sizeof(struct wg_usage) * (n + count + 1));
+	if (n)
+		memcpy(list, usage, sizeof(struct wg_usage) * n);
+	qsort(list, n, sizeof(struct wg_usage), wg_usage_cmp);
+	total = n;
+
+	if (dev) {
+		for_each_wgpeer(dev, peer) {
+			memcpy(key.public_key, peer->public_key, WG_KEY_LEN);
+			u = bsearch(&key, list, n, sizeof(struct wg_usage), wg_usage_cmp);
+			if (u == NULL) {
+				u = &list[total++];
+				memcpy(u->public_key, peer->public_key, WG_KEY_LEN);
+				u->since = -1;
+				u->rx_last = u->tx_last = 0;
+			}
+			/* A counter below the saved one was reset, all of it is new */
+			u->rx_total += peer->rx_bytes >= u->rx_last ? peer->rx_bytes - u->rx_last : peer->rx_bytes;
+			u->tx_total += peer->tx_bytes >= u->tx_last ? peer->tx_bytes - u->tx_last : peer->tx_bytes;
+		}
+	}
+
+	order = XCALLOC(MTYPE_TMP, sizeof(void *) * (total + 1));
+	for (i = 0; i < total; i++)
+		order[i] = &list[i];
+	partial_sort(order, total, total, wg_usage_rank, NULL);
+
+	vty_out (vty, "%-44s %-10s %16s %16s %16s\n", "Peer", "Since", "RX", "TX", "Total");
+	for (i = 0; i < total; i++) {
+		u = order[i];
+		key_to_base64(pub, u->public_key);
+		if (u->since > 0) {
+			time_t t = u->since;
+			strftime(since, sizeof(since), "%Y-%m-%d", localtime_r(&t, &tm));
+		} else
+			snprintf(since, sizeof(since), "-");
+		vty_out (vty, "%-44s %-10s %16llu %16llu %16llu\n", pub, since,
+				(unsigned long long) u->rx_total, (unsigned long long) u->tx_total,
+				(unsigned long long) (u->rx_total + u->tx_total));
+		rx += u->rx_total;
+		tx += u->tx_total;
+	}
+	vty_out (vty, "%-44s %-10s %16llu %16llu %16llu\n", "(all peers)", "",
+			(unsigned long long) rx, (unsigned long long) tx, (unsigned long long) (rx + tx));
+
+	if (saved) {
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime_r(&saved, &tm));
+		vty_out (vty, "saved: %s%s\n", date, dev ? ", counters of wg0 added" : "");
+	} else
+		vty_out (vty, "saved: never%s\n", dev ? ", counters of wg0 only" : "");
+
+	XFREE(MTYPE_TMP, order);
+	XFREE(MTYPE_TMP, list);
+	if (usage)
+		XFREE(MTYPE_TMP, usage);
+	if (dev)
+		free_wgdevice(dev);
+	return CMD_SUCCESS;
+}
+
+/* Apply the peers and the listen port deferred during boot or batch
+   execution.  The peers are set from their final config lines with a few
+   'wg set' runs of many peers each, instead of one run per line. */
+#define WG_SET_CHUNK	32768
+
+struct wg_set_buf {
+	char cmd[WG_SET_CHUNK + 1024];
+	int len;
+	int npeers;
+};
+
+static void wg_set_run (struct wg_set_buf *buf)
+{
+	if (buf->npeers) {
+		snprintf(buf->cmd + buf->len, sizeof(buf->cmd) - buf->len, " > /dev/null 2>&1");
+		system(buf->cmd);
+	}
+	buf->len = snprintf(buf->cmd, sizeof(buf->cmd), "wg set wg0 private-key %s", PRIVATEKEY_PATH);
+	buf->npeers = 0;
+}
+
+static void wg_set_append (struct wg_set_buf *buf, char *pubkey)
+{
+	char szLeft[128], line[1024];
+	char *tok, *val, *save = NULL;
+	char *line_cfg;
+
+	snprintf(szLeft, sizeof(szLeft), "wg peer %s", pubkey);
+	line_cfg = config_get_line_byleft(config_top, szLeft);
+	if (line_cfg == NULL)	/* removed again */
+		return;
+
+	if (buf->len > WG_SET_CHUNK)
+		wg_set_run(buf);
+
+	buf->len += snprintf(buf->cmd + buf->len, sizeof(buf->cmd) - buf->len,
+			" peer %s", pubkey);
+
+	/* wg peer KEY [allowed-ips X [endpoint Y [persistent-keepalive Z]]] */
+	snprintf(line, sizeof(line), "%s", line_cfg + strlen(szLeft));
+	for (tok = strtok_r(line, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+		if ((val = strtok_r(NULL, " ", &save)) == NULL)
+			break;
+		if (strcmp(val, "none") == 0)
+			continue;
+		buf->len += snprintf(buf->cmd + buf->len, sizeof(buf->cmd) - buf->len,
+				" %s %s", tok, val);
+	}
+	buf->npeers++;
+}
+
+static void wg_set_peer (struct hash_backet *hb, struct wg_set_buf *buf)
+{
+	wg_set_append(buf, hb->data);
+}
+
+void cmd_vpn_flush()
+{
+	struct wg_set_buf *buf;
+
+	if (wg_deferred_port) {
+		wg_apply_listenport(wg_deferred_port);
+		wg_deferred_port = 0;
+	}
+
+	if (wg_deferred_peers == NULL)
+		return;
+
+	buf = XMALLOC(MTYPE_TMP, sizeof(struct wg_set_buf));
+	wg_set_run(buf);
+	hash_iterate(wg_deferred_peers, (void (*) (struct hash_backet *, void *)) wg_set_peer, buf);
+	wg_set_run(buf);
+	XFREE(MTYPE_TMP, buf);
+
+	hash_clean(wg_deferred_peers, (void (*) (void *)) wg_peer_free);
+}
+
+/* Aggregate the allowed-ips of every peer in its config line, the peers
+   whose list got shorter are set together like the deferred ones. */
+DEFUN (wg_optimize_allowed_ips,
+        wg_optimize_allowed_ips_cmd,
+        "wg optimize allowed-ips",
+        "Configure WireGuard rules\n"
+        "Optimize the WireGuard configuration\n"
+        "Merge the allowed-ips of every peer into the fewest ip networks\n")
+{
+	struct wg_set_buf *buf = NULL;
+	struct list *keys;
+	struct listnode *nn;
+	char szLeft[128], szInfo[128];
+	char *line, *key, *list, *merged, *rest;
+	int before, after, npeers = 0, nbefore = 0, nafter = 0;
+
+	/* config_top is changed below, so the peers are listed first */
+	keys = list_new();
+	keys->del = (void (*) (void *)) wg_peer_free;
+	LIST_LOOP(config_top, line, nn) {
+		if (strncmp(line, "wg peer ", 8) || strstr(line, " allowed-ips ") == NULL)
+			continue;
+		snprintf(szInfo, sizeof(szInfo), "%s", line + 8);
+		szInfo[strcspn(szInfo, " ")] = '\0';
+		listnode_add(keys, XSTRDUP(MTYPE_TMP, szInfo));
+	}
+
+	LIST_LOOP(keys, key, nn) {
+		snprintf(szLeft, sizeof(szLeft), "wg peer %s", key);
+		if ((line = config_get_line_byleft(config_top, szLeft)) == NULL)
+			continue;
+		list = XSTRDUP(MTYPE_TMP, strstr(line, " allowed-ips ") + strlen(" allowed-ips "));
+		list[strcspn(list, " ")] = '\0';
+
+		merged = wg_allowedips_aggregate(list, &before, &after);
+		XFREE(MTYPE_TMP, list);
+		if (merged == NULL || before <= after || wg_allowedips_set(vty, key, merged) != CMD_SUCCESS) {
+			XFREE(MTYPE_TMP, merged);
+			continue;
+		}
+
+		/* keep the endpoint and persistent-keepalive after the list */
+		rest = strchr(strstr(line, " allowed-ips ") + strlen(" allowed-ips "), ' ');
+		config_replace_line_byleft(config_top, szLeft, "wg peer %s allowed-ips %s%s",
+				key, merged, rest ? rest : "");
+		XFREE(MTYPE_TMP, merged);
+
+		npeers++;
+		nbefore += before;
+		nafter += after;
+
+		if (host.defer) {
+			wg_defer_peer(key);
+			continue;
+		}
+		if (buf == NULL) {
+			buf = XMALLOC(MTYPE_TMP, sizeof(struct wg_set_buf));
+			wg_set_run(buf);
+		}
+		wg_set_append(buf, key);
+	}
+	list_delete(keys);
+
+	if (buf) {
+		wg_set_run(buf);
+		XFREE(MTYPE_TMP, buf);
+	}
+
+	if (npeers)
+		vty_out (vty, "allowed-ips of %d peers merged, %d ip networks into %d\n",
+				npeers, nbefore, nafter);
+	else
+		vty_out (vty, "allowed-ips are already merged\n");
+	return CMD_SUCCESS;
+}
+
 int cmd_vpn_init()
 {
 	cmd_install_element (ENABLE_NODE, &show_wg_cmd);
 	cmd_install_element (CONFIG_NODE, &show_wg_cmd);
 	cmd_install_element (ENABLE_NODE, &show_wg_conf_cmd);
 	cmd_install_element (CONFIG_NODE, &show_wg_conf_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_sort_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_sort_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_sort_limit_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_sort_limit_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_sort_limit_offset_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_sort_limit_offset_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_limit_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_limit_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_limit_offset_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_limit_offset_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_json_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_json_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_sort_json_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_sort_json_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_sort_limit_json_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_sort_limit_json_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_sort_limit_offset_json_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_sort_limit_offset_json_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_limit_json_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_limit_json_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peers_limit_offset_json_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peers_limit_offset_json_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_usage_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_usage_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peer_for_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peer_for_cmd);
+	cmd_install_element (ENABLE_NODE, &show_wg_peer_for_ipv6_cmd);
+	cmd_install_element (CONFIG_NODE, &show_wg_peer_for_ipv6_cmd);
 
 	cmd_install_element (CONFIG_NODE, &wg_listenport_cmd);
 	cmd_install_element (CONFIG_NODE, &wg_peer_public_key_cmd);
 	cmd_install_element (CONFIG_NODE, &wg_peer_allowed_ips_cmd);
+	cmd_install_element (CONFIG_NODE, &wg_peer_allowed_ips_aggregate_cmd);
 	cmd_install_element (CONFIG_NODE, &wg_peer_endpoint_cmd);
 	cmd_install_element (CONFIG_NODE, &wg_peer_persistent_keepalive_cmd);
 	cmd_install_element (CONFIG_NODE, &no_wg_peer_cmd);
+	cmd_install_element (CONFIG_NODE, &wg_optimize_allowed_ips_cmd);
 
 	cmd_install_element (CONFIG_NODE, &wg_link_cmd);
 	cmd_install_element (CONFIG_NODE, &wg_rekey_cmd);
+	cmd_install_element (CONFIG_NODE, &wg_generate_keypairs_cmd);
 	cmd_install_element (CONFIG_NODE, &wg_clearkey_cmd);
 
 	return 0;
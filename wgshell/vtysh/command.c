@@ -38,6 +38,10 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
 
 // the common node 
 struct cmd_node view_node =
@@ -1745,133 +1749,149 @@ int cmd_execute_command_strict (vector vline, struct vty *vty, struct cmd_elemen
     return (*matched_element->func) (matched_element, vty, argc, argv);
 }
 
-/* Execute command in child process. */
-#if 0
-int cmd_execute_system_command (char *command, int argc, char **argv)
+extern char **environ;
+
+/* Run argv[0] with the arguments in argv(NULL terminated) and wait for
+   it.  With CMD_RUN_CAPTURE the output is read through a pipe and written
+   with vty_out(), otherwise the child writes to our stdout directly.  The
+   child's stderr is dropped unless CMD_RUN_STDERR is given.  A child still
+   running after timeout seconds(0 is no limit) is killed.  Return the
+   exit status, 128 + the signal number if it was killed by a signal, or
+   -1 if it could not be run. */
+int cmd_run (struct vty *vty, char **argv, int timeout, int flags)
 {
-    int ret;
-    pid_t pid;
-    int status;
-
-    /* Call fork(). */
-    pid = fork ();
-
-    if (pid < 0) {
-        /* Failure of fork(). */
-        fprintf (stderr, "Can't fork: %s\n", strerror (errno));
-        return -1;
-    } else if (pid == 0) {
-        /* This is child process. we should use the execvp ?*/
-        switch (argc) {
-            case 0:
-                ret = execlp (command, command, NULL);
-                break;
-            case 1:
-                ret = execlp (command, command, argv[0], NULL);
-                break;
-            case 2:
-                ret = execlp (command, command, argv[0], argv[1], NULL);
-                break;
-            case 3:
-                ret = execlp (command, command, argv[0], argv[1], argv[2], NULL);
-                break;
-            case 4:
-                ret = execlp (command, command, argv[0], argv[1], argv[2], argv[3], NULL);
-                break;
-            case 5:
-                ret = execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], NULL);
-                break;
-            case 6:
-                ret = execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], NULL);
-                break;
-            case 7:
-                ret = execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], NULL);
-                break;
-            case 8:
-                ret = execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], NULL);
-                break;
-        }
+	posix_spawn_file_actions_t fa;
+	struct timespec start, now;
+	struct pollfd pfd;
+	char buf[4096];
+	int pipefd[2] = { -1, -1 };
+	int status, ret, left, timed_out = 0;
+	ssize_t n;
+	pid_t pid;
 
-        /* When execlp suceed, this part is not executed. */
-        fprintf (stderr, "Can't execute %s: %s\n", command, strerror (errno));
-        exit (1);
-    } else {
-        /* This is parent. */
-        ret = wait4 (pid, &status, 0, NULL);
-    }
-    return 0;
+	if (flags & CMD_RUN_CAPTURE) {
+		if (pipe (pipefd) < 0)
+			return -1;
+		fcntl (pipefd[0], F_SETFD, FD_CLOEXEC);
+	}
+
+	posix_spawn_file_actions_init (&fa);
+	if (flags & CMD_RUN_CAPTURE) {
+		posix_spawn_file_actions_adddup2 (&fa, pipefd[1], STDOUT_FILENO);
+		if (flags & CMD_RUN_STDERR)
+			posix_spawn_file_actions_adddup2 (&fa, pipefd[1], STDERR_FILENO);
+		posix_spawn_file_actions_addclose (&fa, pipefd[1]);
+	}
+	if (! (flags & CMD_RUN_STDERR))
+		posix_spawn_file_actions_addopen (&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+	ret = posix_spawnp (&pid, argv[0], &fa, NULL, argv, environ);
+	posix_spawn_file_actions_destroy (&fa);
+
+	if (flags & CMD_RUN_CAPTURE)
+		close (pipefd[1]);
+	if (ret != 0) {
+		if (flags & CMD_RUN_CAPTURE)
+			close (pipefd[0]);
+		return -1;
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	/* Copy the output until the child closes the pipe. */
+	while (flags & CMD_RUN_CAPTURE) {
+		left = -1;
+		if (timeout > 0) {
+			clock_gettime (CLOCK_MONOTONIC, &now);
+			left = timeout * 1000 - ((now.tv_sec - start.tv_sec) * 1000 +
+					(now.tv_nsec - start.tv_nsec) / 1000000);
+			if (left <= 0) {
+				timed_out = 1;
+				break;
+			}
+		}
+
+		pfd.fd = pipefd[0];
+		pfd.events = POLLIN;
+		ret = poll (&pfd, 1, left);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			break;
+		if (ret == 0)
+			continue;
+
+		n = read (pipefd[0], buf, sizeof (buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		vty_out (vty, "%.*s", (int) n, buf);
+	}
+	if (flags & CMD_RUN_CAPTURE) {
+		fflush (stdout);
+		close (pipefd[0]);
+	}
+
+	while (1) {
+		if (timed_out)
+			kill (pid, SIGKILL);
+
+		ret = waitpid (pid, &status, (timeout > 0 && ! timed_out) ? WNOHANG : 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		if (ret == pid)
+			break;
+
+		/* Not yet exited, check the time limit every 10ms. */
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - start.tv_sec) >= timeout)
+			timed_out = 1;
+		else
+			usleep (10000);
+	}
+
+	if (timed_out)
+		vty_out (vty, "%% %s timed out after %d seconds%s", argv[0], timeout, VTY_NEWLINE);
+
+	if (WIFEXITED (status))
+		return WEXITSTATUS (status);
+	if (WIFSIGNALED (status))
+		return 128 + WTERMSIG (status);
+	return -1;
 }
-#else
-/* Execute command in child process. */
-int cmd_execute_system_command (char *command, int argc, char **argv)
+
+static int cmd_execute_argv (char *command, int argc, char **argv, int timeout, int flags)
 {
-    pid_t pid;
-    int status;
+	char **args;
+	int i, ret;
 
-	int save_out = dup(2);
-	int dnull = open("/dev/null", O_WRONLY);
-	dup2(dnull, 2); /* redirect stderr to /dev/null */
+	args = XMALLOC (MTYPE_TMP, sizeof (char *) * (argc + 2));
+	args[0] = command;
+	for (i = 0; i < argc; i++)
+		args[i + 1] = argv[i];
+	args[argc + 1] = NULL;
 
-    /* Call fork(). */
-    pid = fork ();
+	ret = cmd_run (vty, args, timeout, flags);
+	XFREE (MTYPE_TMP, args);
 
-    if (pid < 0) {
-        /* Failure of fork(). */
-#if 0
-        fprintf (stderr, "Can't fork: %s\n", strerror (errno));
-#endif
-		close(dnull);
-        return -1;
-    } else if (pid == 0) {
-        /* This is child process. we should use the execvp ?*/
-        switch (argc) {
-            case 0:
-                execlp (command, command, NULL);
-                break;
-            case 1:
-                execlp (command, command, argv[0], NULL);
-                break;
-            case 2:
-                execlp (command, command, argv[0], argv[1], NULL);
-                break;
-            case 3:
-                execlp (command, command, argv[0], argv[1], argv[2], NULL);
-                break;
-            case 4:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], NULL);
-                break;
-            case 5:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], NULL);
-                break;
-            case 6:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], NULL);
-                break;
-            case 7:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], NULL);
-                break;
-            case 8:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], NULL);
-                break;
-            case 9:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], NULL);
-                break;
-            case 10:
-                execlp (command, command, argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9], NULL);
-                break;
-        }
+	return (ret == 0) ? CMD_SUCCESS : CMD_WARNING;
+}
 
-        /* When execlp suceed, this part is not executed. */
-#if 0
-        fprintf (stderr, "Can't execute %s: %s\n", command, strerror (errno));
-#endif
-        exit (1);
-    } else {
-		/* This is parent. */
-		wait4 (pid, &status, 0, NULL);
-		dup2(save_out, 2); /* restore */
-		close(dnull);
-    }
-    return 0;
+/* Execute command in child process. */
+int cmd_execute_system_command (char *command, int argc, char **argv)
+{
+	return cmd_execute_argv (command, argc, argv, 0, 0);
+}
+
+/* Execute a show command in child process, its output goes through the
+   vty and it may not run longer than CMD_SHOW_TIMEOUT seconds. */
+int cmd_execute_show_command (char *command, int argc, char **argv)
+{
+	return cmd_execute_argv (command, argc, argv, CMD_SHOW_TIMEOUT,
+			CMD_RUN_CAPTURE | CMD_RUN_STDERR);
 }
 
 int _vtysh_system(char *command)
@@ -1998,7 +2018,6 @@ FILE * _vtysh_popen(const char *program, const char *type)
 	pidlist = cur;
 	return (iop);
 }
-#endif
 
 /* Initialize command interface. Install basic nodes and commands. */
 void cmd_init (int terminal)
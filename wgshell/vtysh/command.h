@@ -48,6 +48,13 @@ struct host
 	int trytimes;
 
 	int chpasswd;
+
+	/* Apply the wireguard, address and route changes once at the
+	   end(boot/batch). */
+	int defer;
+
+	/* The saved config is being replayed at boot. */
+	int boot;
 };
 
 /* There are some command levels which called from command node. */
@@ -188,7 +195,15 @@ char **cmd_complete_command (vector vline, struct vty *vty, int *status);
 char *cmd_prompt (enum node_type node);
 int cmd_execute_command (vector vline, struct vty *vty, struct cmd_element **cmd);
 int cmd_execute_command_strict (vector vline, struct vty *vty, struct cmd_element **cmd);
+/* cmd_run() flags */
+#define CMD_RUN_CAPTURE	0x01	/* Read the output and write it to the vty */
+#define CMD_RUN_STDERR	0x02	/* Keep the output to stderr */
+
+#define CMD_SHOW_TIMEOUT	10
+
+int cmd_run (struct vty *vty, char **argv, int timeout, int flags);
 int cmd_execute_system_command (char *command, int argc, char **argv);
+int cmd_execute_show_command (char *command, int argc, char **argv);
 int _vtysh_system(char *command);
 FILE * _vtysh_popen(const char *program, const char *type);
 vector cmd_describe_command (vector vline, struct vty *vty, int *status);
@@ -199,6 +214,15 @@ void cmd_install_element (enum node_type ntype, struct cmd_element *cmd);
 void cmd_install_node (struct cmd_node *node, int (*func) (struct vty *));
 void cmd_sort_node ();
 void cmd_parse_init();
+void cmd_vpn_flush();
+void cmd_ip_flush();
+
+/* fw_apply_queue() flags */
+#define FW_APPLY_RULES	0x01	/* Regenerate and apply the sfirewall rules */
+#define FW_APPLY_RELOAD	0x02	/* Reload /etc/config/firewall */
+
+int fw_apply_queue(int what);
+int fw_wg_notrack_apply(int port);
 
 extern struct cmd_node view_node;
 extern struct cmd_node enable_node;
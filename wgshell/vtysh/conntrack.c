@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Minimal reader of the conntrack table over ctnetlink. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#include "conntrack.h"
+
+#define CONNTRACK_BUFSIZE	65536
+
+#define NLA_DATA(nla)		((void *) ((char *) (nla) + NLA_HDRLEN))
+#define NLA_LEN(nla)		((nla)->nla_len - NLA_HDRLEN)
+#define NLA_OK(nla, len)	((len) >= (int) sizeof (struct nlattr) && \
+				 (nla)->nla_len >= sizeof (struct nlattr) && \
+				 (nla)->nla_len <= (len))
+#define NLA_NEXT(nla, len)	((len) -= NLA_ALIGN ((nla)->nla_len), \
+				 (struct nlattr *) ((char *) (nla) + NLA_ALIGN ((nla)->nla_len)))
+
+/* Index the attributes of a stream by type, tb[] has max + 1 slots. */
+static void conntrack_parse_attr (struct nlattr **tb, int max, struct nlattr *nla, int len)
+{
+	int type;
+
+	memset (tb, 0, sizeof (struct nlattr *) * (max + 1));
+	for (; NLA_OK (nla, len); nla = NLA_NEXT (nla, len)) {
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (type <= max)
+			tb[type] = nla;
+	}
+}
+
+static void conntrack_parse_nested (struct nlattr **tb, int max, struct nlattr *nla)
+{
+	conntrack_parse_attr (tb, max, NLA_DATA (nla), NLA_LEN (nla));
+}
+
+static uint64_t conntrack_u64 (struct nlattr *nla)
+{
+	uint64_t v;
+
+	if (nla == NULL)
+		return 0;
+	if (NLA_LEN (nla) == sizeof (uint32_t)) {
+		uint32_t v32;
+
+		memcpy (&v32, NLA_DATA (nla), sizeof (v32));
+		return be32toh (v32);
+	}
+	memcpy (&v, NLA_DATA (nla), sizeof (v));
+	return be64toh (v);
+}
+
+static void conntrack_counters (struct nlattr *nla, struct conntrack_entry *ct)
+{
+	struct nlattr *tb[CTA_COUNTERS_MAX + 1];
+
+	if (nla == NULL)
+		return;
+	conntrack_parse_nested (tb, CTA_COUNTERS_MAX, nla);
+	ct->packets += conntrack_u64 (tb[CTA_COUNTERS_PACKETS]);
+	ct->bytes += conntrack_u64 (tb[CTA_COUNTERS_BYTES]);
+}
+
+/* Fill ct from one IPCTNL_MSG_CT_NEW message, return -1 if it is not an
+   IPv4 entry. */
+static int conntrack_parse (struct nlmsghdr *nlh, struct conntrack_entry *ct)
+{
+	struct nlattr *tb[CTA_MAX + 1];
+	struct nlattr *tuple[CTA_TUPLE_MAX + 1];
+	struct nlattr *ip[CTA_IP_MAX + 1];
+	struct nlattr *proto[CTA_PROTO_MAX + 1];
+	struct nfgenmsg *nfg = NLMSG_DATA (nlh);
+	int len;
+
+	len = nlh->nlmsg_len - NLMSG_SPACE (sizeof (struct nfgenmsg));
+	if (len < 0 || nfg->nfgen_family != AF_INET)
+		return -1;
+	conntrack_parse_attr (tb, CTA_MAX,
+			(struct nlattr *) ((char *) nfg + NLMSG_ALIGN (sizeof (struct nfgenmsg))), len);
+	if (tb[CTA_TUPLE_ORIG] == NULL)
+		return -1;
+
+	memset (ct, 0, sizeof (*ct));
+	conntrack_parse_nested (tuple, CTA_TUPLE_MAX, tb[CTA_TUPLE_ORIG]);
+	if (tuple[CTA_TUPLE_IP] == NULL)
+		return -1;
+	conntrack_parse_nested (ip, CTA_IP_MAX, tuple[CTA_TUPLE_IP]);
+	if (ip[CTA_IP_V4_SRC] == NULL || ip[CTA_IP_V4_DST] == NULL)
+		return -1;
+	memcpy (&ct->src, NLA_DATA (ip[CTA_IP_V4_SRC]), sizeof (ct->src));
+	memcpy (&ct->dst, NLA_DATA (ip[CTA_IP_V4_DST]), sizeof (ct->dst));
+
+	if (tuple[CTA_TUPLE_PROTO]) {
+		conntrack_parse_nested (proto, CTA_PROTO_MAX, tuple[CTA_TUPLE_PROTO]);
+		if (proto[CTA_PROTO_NUM])
+			ct->proto = *(uint8_t *) NLA_DATA (proto[CTA_PROTO_NUM]);
+		if (proto[CTA_PROTO_SRC_PORT])
+			memcpy (&ct->sport, NLA_DATA (proto[CTA_PROTO_SRC_PORT]), sizeof (ct->sport));
+		if (proto[CTA_PROTO_DST_PORT])
+			memcpy (&ct->dport, NLA_DATA (proto[CTA_PROTO_DST_PORT]), sizeof (ct->dport));
+	}
+
+	conntrack_counters (tb[CTA_COUNTERS_ORIG], ct);
+	conntrack_counters (tb[CTA_COUNTERS_REPLY], ct);
+	return 0;
+}
+
+int conntrack_dump (void (*func) (struct conntrack_entry *, void *), void *arg)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct nfgenmsg nfg;
+	} req;
+	struct sockaddr_nl sa;
+	struct conntrack_entry ct;
+	struct nlmsghdr *nlh;
+	char *buf;
+	int fd, len, count = 0, done = 0;
+	int rcvbuf = 1024 * 1024;
+
+	fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+	if (fd < 0)
+		return -1;
+	setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+	memset (&req, 0, sizeof (req));
+	req.nlh.nlmsg_len = sizeof (req);
+	req.nlh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = time (NULL);
+	req.nfg.nfgen_family = AF_INET;
+	req.nfg.version = NFNETLINK_V0;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	if (sendto (fd, &req, sizeof (req), 0, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+		close (fd);
+		return -1;
+	}
+
+	buf = malloc (CONNTRACK_BUFSIZE);
+	if (buf == NULL) {
+		close (fd);
+		return -1;
+	}
+
+	while (!done) {
+		len = recv (fd, buf, CONNTRACK_BUFSIZE, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			count = -1;
+			break;
+		}
+		if (len == 0)
+			break;
+
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len)) {
+			if (nlh->nlmsg_seq != req.nlh.nlmsg_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				errno = -((struct nlmsgerr *) NLMSG_DATA (nlh))->error;
+				count = -1;
+				done = 1;
+				break;
+			}
+			if (conntrack_parse (nlh, &ct) == 0) {
+				(*func) (&ct, arg);
+				count++;
+			}
+		}
+	}
+
+	free (buf);
+	close (fd);
+	return count;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Minimal reader of the conntrack table over ctnetlink, without
+ * libnetfilter_conntrack and without parsing /proc text. */
+
+#ifndef __CONNTRACK_H__
+#define __CONNTRACK_H__
+
+#include <stdint.h>
+
+struct conntrack_entry {
+	/* Original direction, in network byte order */
+	uint32_t src;
+	uint32_t dst;
+	uint16_t sport;
+	uint16_t dport;
+	uint8_t proto;
+
+	/* Both directions, zero unless nf_conntrack_acct is on */
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+/* Call func for every IPv4 entry.  Return the number of entries or -1. */
+int conntrack_dump (void (*func) (struct conntrack_entry *, void *), void *arg);
+
+#endif
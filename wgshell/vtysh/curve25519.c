@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* X25519(RFC 7748): a constant time Montgomery ladder over GF(2^255 - 19).
+ * The field elements are 5 limbs of 51 bits where the compiler has 128 bit
+ * integers(aarch64, x86_64), 16 limbs of 16 bits otherwise. */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "curve25519.h"
+
+#if defined(__SIZEOF_INT128__) && !defined(CURVE25519_NO_INT128)
+
+typedef uint64_t fe[5];
+typedef unsigned __int128 u128;
+
+#define MASK51	0x7ffffffffffffULL
+
+static uint64_t load64 (const uint8_t *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static void store64 (uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		p[i] = v & 0xff;
+}
+
+static void fe_frombytes (fe h, const uint8_t *s)
+{
+	h[0] = load64 (s) & MASK51;
+	h[1] = (load64 (s + 6) >> 3) & MASK51;
+	h[2] = (load64 (s + 12) >> 6) & MASK51;
+	h[3] = (load64 (s + 19) >> 1) & MASK51;
+	h[4] = (load64 (s + 24) >> 12) & MASK51;
+}
+
+static void fe_carry (fe h)
+{
+	uint64_t c;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		c = h[i] >> 51;
+		h[i] &= MASK51;
+		h[i + 1] += c;
+	}
+	c = h[4] >> 51;
+	h[4] &= MASK51;
+	h[0] += c * 19;
+}
+
+static void fe_tobytes (uint8_t *s, const fe f)
+{
+	fe h;
+	uint64_t q;
+	int i;
+
+	memcpy (h, f, sizeof (fe));
+	fe_carry (h);
+	fe_carry (h);
+	fe_carry (h);
+
+	/* Subtract p once if h >= p */
+	q = (h[0] + 19) >> 51;
+	for (i = 1; i < 5; i++)
+		q = (h[i] + q) >> 51;
+	h[0] += 19 * q;
+	for (i = 0; i < 4; i++) {
+		h[i + 1] += h[i] >> 51;
+		h[i] &= MASK51;
+	}
+	h[4] &= MASK51;
+
+	store64 (s, h[0] | (h[1] << 51));
+	store64 (s + 8, (h[1] >> 13) | (h[2] << 38));
+	store64 (s + 16, (h[2] >> 26) | (h[3] << 25));
+	store64 (s + 24, (h[3] >> 39) | (h[4] << 12));
+}
+
+static void fe_0 (fe h)
+{
+	memset (h, 0, sizeof (fe));
+}
+
+static void fe_1 (fe h)
+{
+	memset (h, 0, sizeof (fe));
+	h[0] = 1;
+}
+
+static void fe_add (fe h, const fe f, const fe g)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		h[i] = f[i] + g[i];
+}
+
+/* f + 2p - g, g is at most a little over 51 bits */
+static void fe_sub (fe h, const fe f, const fe g)
+{
+	h[0] = f[0] + 0xfffffffffffdaULL - g[0];
+	h[1] = f[1] + 0xffffffffffffeULL - g[1];
+	h[2] = f[2] + 0xffffffffffffeULL - g[2];
+	h[3] = f[3] + 0xffffffffffffeULL - g[3];
+	h[4] = f[4] + 0xffffffffffffeULL - g[4];
+}
+
+static void fe_reduce (fe h, u128 *r)
+{
+	r[1] += r[0] >> 51;
+	r[2] += r[1] >> 51;
+	r[3] += r[2] >> 51;
+	r[4] += r[3] >> 51;
+	r[0] = (r[0] & MASK51) + (r[4] >> 51) * 19;
+	h[1] = (r[1] & MASK51) + (uint64_t) (r[0] >> 51);
+	h[0] = r[0] & MASK51;
+	h[2] = r[2] & MASK51;
+	h[3] = r[3] & MASK51;
+	h[4] = r[4] & MASK51;
+}
+
+static void fe_mul (fe h, const fe f, const fe g)
+{
+	uint64_t g1_19 = g[1] * 19, g2_19 = g[2] * 19, g3_19 = g[3] * 19, g4_19 = g[4] * 19;
+	u128 r[5];
+
+	r[0] = (u128) f[0] * g[0] + (u128) f[1] * g4_19 + (u128) f[2] * g3_19 +
+		(u128) f[3] * g2_19 + (u128) f[4] * g1_19;
+	r[1] = (u128) f[0] * g[1] + (u128) f[1] * g[0] + (u128) f[2] * g4_19 +
+		(u128) f[3] * g3_19 + (u128) f[4] * g2_19;
+	r[2] = (u128) f[0] * g[2] + (u128) f[1] * g[1] + (u128) f[2] * g[0] +
+		(u128) f[3] * g4_19 + (u128) f[4] * g3_19;
+	r[3] = (u128) f[0] * g[3] + (u128) f[1] * g[2] + (u128) f[2] * g[1] +
+		(u128) f[3] * g[0] + (u128) f[4] * g4_19;
+	r[4] = (u128) f[0] * g[4] + (u128) f[1] * g[3] + (u128) f[2] * g[2] +
+		(u128) f[3] * g[1] + (u128) f[4] * g[0];
+	fe_reduce (h, r);
+}
+
+static void fe_sq (fe h, const fe f)
+{
+	uint64_t f0_2 = f[0] * 2, f1_2 = f[1] * 2;
+	uint64_t f1_38 = f[1] * 38, f2_38 = f[2] * 38, f3_38 = f[3] * 38;
+	uint64_t f3_19 = f[3] * 19, f4_19 = f[4] * 19;
+	u128 r[5];
+
+	r[0] = (u128) f[0] * f[0] + (u128) f1_38 * f[4] + (u128) f2_38 * f[3];
+	r[1] = (u128) f0_2 * f[1] + (u128) f2_38 * f[4] + (u128) f3_19 * f[3];
+	r[2] = (u128) f0_2 * f[2] + (u128) f[1] * f[1] + (u128) f3_38 * f[4];
+	r[3] = (u128) f0_2 * f[3] + (u128) f1_2 * f[2] + (u128) f4_19 * f[4];
+	r[4] = (u128) f0_2 * f[4] + (u128) f1_2 * f[3] + (u128) f[2] * f[2];
+	fe_reduce (h, r);
+}
+
+static void fe_mul121665 (fe h, const fe f)
+{
+	u128 r[5];
+	int i;
+
+	for (i = 0; i < 5; i++)
+		r[i] = (u128) f[i] * 121665;
+	fe_reduce (h, r);
+}
+
+static void fe_cswap (fe f, fe g, unsigned int b)
+{
+	uint64_t mask = (uint64_t) 0 - b, t;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		t = mask & (f[i] ^ g[i]);
+		f[i] ^= t;
+		g[i] ^= t;
+	}
+}
+
+#else
+
+/* 16 signed limbs of 16 bits, the products fit in 64 bits. */
+typedef int64_t fe[16];
+
+static void fe_carry (fe h)
+{
+	int64_t c;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		h[i] += (int64_t) 1 << 16;
+		c = h[i] >> 16;
+		if (i < 15)
+			h[i + 1] += c - 1;
+		else
+			h[0] += 38 * (c - 1);
+		h[i] -= c << 16;
+	}
+}
+
+static void fe_frombytes (fe h, const uint8_t *s)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h[i] = s[2 * i] + ((int64_t) s[2 * i + 1] << 8);
+	h[15] &= 0x7fff;
+}
+
+static void fe_cswap (fe f, fe g, unsigned int b)
+{
+	int64_t mask = ~((int64_t) b - 1), t;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		t = mask & (f[i] ^ g[i]);
+		f[i] ^= t;
+		g[i] ^= t;
+	}
+}
+
+static void fe_tobytes (uint8_t *s, const fe f)
+{
+	fe m, t;
+	int i, j;
+	unsigned int b;
+
+	memcpy (t, f, sizeof (fe));
+	fe_carry (t);
+	fe_carry (t);
+	fe_carry (t);
+
+	/* Subtract p while t >= p, twice at most */
+	for (j = 0; j < 2; j++) {
+		m[0] = t[0] - 0xffed;
+		for (i = 1; i < 15; i++) {
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		b = (m[15] >> 16) & 1;
+		m[14] &= 0xffff;
+		fe_cswap (t, m, 1 - b);
+	}
+	for (i = 0; i < 16; i++) {
+		s[2 * i] = t[i] & 0xff;
+		s[2 * i + 1] = t[i] >> 8;
+	}
+}
+
+static void fe_0 (fe h)
+{
+	memset (h, 0, sizeof (fe));
+}
+
+static void fe_1 (fe h)
+{
+	memset (h, 0, sizeof (fe));
+	h[0] = 1;
+}
+
+static void fe_add (fe h, const fe f, const fe g)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h[i] = f[i] + g[i];
+}
+
+static void fe_sub (fe h, const fe f, const fe g)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h[i] = f[i] - g[i];
+}
+
+static void fe_mul (fe h, const fe f, const fe g)
+{
+	int64_t t[31];
+	int i, j;
+
+	memset (t, 0, sizeof (t));
+	for (i = 0; i < 16; i++)
+		for (j = 0; j < 16; j++)
+			t[i + j] += f[i] * g[j];
+	for (i = 0; i < 15; i++)
+		t[i] += 38 * t[i + 16];
+	memcpy (h, t, sizeof (fe));
+	fe_carry (h);
+	fe_carry (h);
+}
+
+static void fe_sq (fe h, const fe f)
+{
+	fe_mul (h, f, f);
+}
+
+static void fe_mul121665 (fe h, const fe f)
+{
+	static const fe a24 = { 0xdb41, 1 };
+
+	fe_mul (h, f, a24);
+}
+
+#endif
+
+static void fe_sqn (fe h, const fe f, int n)
+{
+	fe_sq (h, f);
+	while (--n > 0)
+		fe_sq (h, h);
+}
+
+/* z^(p - 2) */
+static void fe_invert (fe out, const fe z)
+{
+	fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+	fe_sq (z2, z);
+	fe_sqn (t, z2, 2);
+	fe_mul (z9, t, z);
+	fe_mul (z11, z9, z2);
+	fe_sq (t, z11);
+	fe_mul (z2_5_0, t, z9);
+	fe_sqn (t, z2_5_0, 5);
+	fe_mul (z2_10_0, t, z2_5_0);
+	fe_sqn (t, z2_10_0, 10);
+	fe_mul (z2_20_0, t, z2_10_0);
+	fe_sqn (t, z2_20_0, 20);
+	fe_mul (t, t, z2_20_0);
+	fe_sqn (t, t, 10);
+	fe_mul (z2_50_0, t, z2_10_0);
+	fe_sqn (t, z2_50_0, 50);
+	fe_mul (z2_100_0, t, z2_50_0);
+	fe_sqn (t, z2_100_0, 100);
+	fe_mul (t, t, z2_100_0);
+	fe_sqn (t, t, 50);
+	fe_mul (t, t, z2_50_0);
+	fe_sqn (t, t, 5);
+	fe_mul (out, t, z11);
+}
+
+void curve25519_clamp_secret (uint8_t secret[CURVE25519_KEY_SIZE])
+{
+	secret[0] &= 248;
+	secret[31] = (secret[31] & 127) | 64;
+}
+
+void curve25519 (uint8_t out[CURVE25519_KEY_SIZE], const uint8_t scalar[CURVE25519_KEY_SIZE],
+		const uint8_t point[CURVE25519_KEY_SIZE])
+{
+	uint8_t e[CURVE25519_KEY_SIZE];
+	fe x1, x2, z2, x3, z3, a, aa, b, bb, e_, c, d, da, cb;
+	unsigned int swap = 0, bit;
+	int pos;
+
+	memcpy (e, scalar, sizeof (e));
+	curve25519_clamp_secret (e);
+
+	fe_frombytes (x1, point);
+	fe_1 (x2);
+	fe_0 (z2);
+	memcpy (x3, x1, sizeof (fe));
+	fe_1 (z3);
+
+	for (pos = 254; pos >= 0; pos--) {
+		bit = (e[pos / 8] >> (pos & 7)) & 1;
+		swap ^= bit;
+		fe_cswap (x2, x3, swap);
+		fe_cswap (z2, z3, swap);
+		swap = bit;
+
+		fe_add (a, x2, z2);
+		fe_sub (b, x2, z2);
+		fe_add (c, x3, z3);
+		fe_sub (d, x3, z3);
+		fe_sq (aa, a);
+		fe_sq (bb, b);
+		fe_mul (da, d, a);
+		fe_mul (cb, c, b);
+		fe_sub (e_, aa, bb);
+
+		fe_add (x3, da, cb);
+		fe_sq (x3, x3);
+		fe_sub (z3, da, cb);
+		fe_sq (z3, z3);
+		fe_mul (z3, z3, x1);
+
+		fe_mul (x2, aa, bb);
+		fe_mul121665 (z2, e_);
+		fe_add (z2, z2, aa);
+		fe_mul (z2, z2, e_);
+	}
+	fe_cswap (x2, x3, swap);
+	fe_cswap (z2, z3, swap);
+
+	fe_invert (z2, z2);
+	fe_mul (x2, x2, z2);
+	fe_tobytes (out, x2);
+
+	memset (e, 0, sizeof (e));
+}
+
+void curve25519_generate_public (uint8_t pub[CURVE25519_KEY_SIZE],
+		const uint8_t secret[CURVE25519_KEY_SIZE])
+{
+	static const uint8_t basepoint[CURVE25519_KEY_SIZE] = { 9 };
+
+	curve25519 (pub, secret, basepoint);
+}
+
+/* getrandom(2), /dev/urandom on kernels older than 3.17 */
+static int curve25519_random (uint8_t *buf, size_t len)
+{
+	size_t off = 0;
+	ssize_t n;
+	int fd = -1;
+
+	while (off < len) {
+#ifdef SYS_getrandom
+		if (fd < 0) {
+			n = syscall (SYS_getrandom, buf + off, len - off, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n > 0) {
+				off += n;
+				continue;
+			}
+			if (errno != ENOSYS)
+				return -1;
+		}
+#endif
+		if (fd < 0 && (fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0)
+			return -1;
+		n = read (fd, buf + off, len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			close (fd);
+			return -1;
+		}
+		off += n;
+	}
+	if (fd >= 0)
+		close (fd);
+	return 0;
+}
+
+int curve25519_generate_keypairs (uint8_t (*secret)[CURVE25519_KEY_SIZE],
+		uint8_t (*pub)[CURVE25519_KEY_SIZE], int count)
+{
+	int i;
+
+	if (curve25519_random ((uint8_t *) secret, (size_t) count * CURVE25519_KEY_SIZE) < 0)
+		return -1;
+	for (i = 0; i < count; i++) {
+		curve25519_clamp_secret (secret[i]);
+		curve25519_generate_public (pub[i], secret[i]);
+	}
+	return 0;
+}
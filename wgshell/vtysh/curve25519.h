@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* X25519(RFC 7748) for WireGuard keys, without running 'wg genkey' and
+ * 'wg pubkey'. */
+
+#ifndef __CURVE25519_H__
+#define __CURVE25519_H__
+
+#include <stdint.h>
+
+#define CURVE25519_KEY_SIZE	32
+
+void curve25519 (uint8_t out[CURVE25519_KEY_SIZE], const uint8_t scalar[CURVE25519_KEY_SIZE],
+		const uint8_t point[CURVE25519_KEY_SIZE]);
+
+void curve25519_clamp_secret (uint8_t secret[CURVE25519_KEY_SIZE]);
+void curve25519_generate_public (uint8_t pub[CURVE25519_KEY_SIZE],
+		const uint8_t secret[CURVE25519_KEY_SIZE]);
+
+/* Fill count keypairs, the secrets are read from the kernel in one go.
+   Return 0 or -1 if no random bytes could be read. */
+int curve25519_generate_keypairs (uint8_t (*secret)[CURVE25519_KEY_SIZE],
+		uint8_t (*pub)[CURVE25519_KEY_SIZE], int count);
+
+#endif
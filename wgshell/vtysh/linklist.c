@@ -82,8 +82,8 @@ listnode_add_old (struct list *list, void *val)
 	list->count++;
 }
 
-/* Add new node with sort function. */
-void
+/* Add new node with sort function.  Return the new node. */
+struct listnode *
 listnode_add_sort (struct list *list, void *val)
 {
 	struct listnode *n;
@@ -92,6 +92,10 @@ listnode_add_sort (struct list *list, void *val)
 	new = listnode_new ();
 	new->data = val;
 
+	/* Fast path: sorted input (e.g. a saved config) always goes last. */
+	if (list->cmp && list->tail && (*list->cmp) (val, list->tail->data) >= 0)
+		goto append;
+
 	if (list->cmp) {
 		for (n = list->head; n; n = n->next) {
 			if ((*list->cmp) (val, n->data) < 0) {	    
@@ -104,11 +108,12 @@ listnode_add_sort (struct list *list, void *val)
 					list->head = new;
 				n->prev = new;
 				list->count++;
-				return;
+				return new;
 			}
 		}
 	}
 
+append:
 	new->prev = list->tail;
 
 	if (list->tail)
@@ -118,6 +123,7 @@ listnode_add_sort (struct list *list, void *val)
 
 	list->tail = new;
 	list->count++;
+	return new;
 }
 
 void
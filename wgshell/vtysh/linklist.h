@@ -56,7 +56,7 @@ struct list *list_new();
 void list_free (struct list *);
 
 void listnode_add_old (struct list *, void *);
-void listnode_add_sort (struct list *, void *);
+struct listnode *listnode_add_sort (struct list *, void *);
 #define listnode_add listnode_add_sort
 void listnode_add_after (struct list *, struct listnode *, void *);
 void listnode_delete (struct list *, void *);
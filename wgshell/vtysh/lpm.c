@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Longest prefix match table, see lpm.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "memory.h"
+#include "lpm.h"
+
+#define LPM_BIT(addr, i)	(((addr)[(i) / 8] >> (7 - (i) % 8)) & 1)
+
+static int lpm_maxlen (int family)
+{
+	return family == AF_INET ? 32 : 128;
+}
+
+static struct lpm_node **lpm_root (struct lpm_table *table, int family)
+{
+	return &table->root[family == AF_INET ? 0 : 1];
+}
+
+struct lpm_table *lpm_table_new (void)
+{
+	return XCALLOC (MTYPE_ROUTE_TABLE, sizeof (struct lpm_table));
+}
+
+static void lpm_node_free (struct lpm_node *node, void (*free_func) (void *))
+{
+	if (node == NULL)
+		return;
+	lpm_node_free (node->link[0], free_func);
+	lpm_node_free (node->link[1], free_func);
+	if (node->data && free_func)
+		(*free_func) (node->data);
+	XFREE (MTYPE_ROUTE_NODE, node);
+}
+
+void lpm_table_free (struct lpm_table *table, void (*free_func) (void *))
+{
+	lpm_node_free (table->root[0], free_func);
+	lpm_node_free (table->root[1], free_func);
+	XFREE (MTYPE_ROUTE_TABLE, table);
+}
+
+int lpm_prefix_parse (struct lpm_prefix *p, const char *str)
+{
+	char buf[INET6_ADDRSTRLEN + 8], *slash, *end;
+	long plen;
+	int i;
+
+	if (strlen (str) >= sizeof (buf))
+		return -1;
+	strcpy (buf, str);
+	memset (p, 0, sizeof (*p));
+
+	if ((slash = strchr (buf, '/')) != NULL)
+		*slash++ = '\0';
+	if (inet_pton (AF_INET, buf, p->addr) == 1)
+		p->family = AF_INET;
+	else if (inet_pton (AF_INET6, buf, p->addr) == 1)
+		p->family = AF_INET6;
+	else
+		return -1;
+
+	p->plen = lpm_maxlen (p->family);
+	if (slash) {
+		plen = strtol (slash, &end, 10);
+		if (*slash == '\0' || *end != '\0' || plen < 0 || plen > p->plen)
+			return -1;
+		p->plen = plen;
+	}
+
+	/* Clear the host bits */
+	for (i = p->plen; i < lpm_maxlen (p->family); i++)
+		p->addr[i / 8] &= ~(0x80 >> (i % 8));
+	return 0;
+}
+
+char *lpm_prefix_str (const struct lpm_prefix *p, char *buf, int size)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	inet_ntop (p->family, p->addr, addr, sizeof (addr));
+	snprintf (buf, size, "%s/%d", addr, p->plen);
+	return buf;
+}
+
+void *lpm_insert (struct lpm_table *table, const struct lpm_prefix *p, void *data)
+{
+	struct lpm_node **link = lpm_root (table, p->family);
+	void *old;
+	int i;
+
+	for (i = 0; ; i++) {
+		if (*link == NULL)
+			*link = XCALLOC (MTYPE_ROUTE_NODE, sizeof (struct lpm_node));
+		if (i == p->plen)
+			break;
+		link = &(*link)->link[LPM_BIT (p->addr, i)];
+	}
+
+	old = (*link)->data;
+	(*link)->data = data;
+	if (old == NULL)
+		table->count++;
+	return old;
+}
+
+void *lpm_get (struct lpm_table *table, const struct lpm_prefix *p)
+{
+	struct lpm_node *node = *lpm_root (table, p->family);
+	int i;
+
+	for (i = 0; node && i < p->plen; i++)
+		node = node->link[LPM_BIT (p->addr, i)];
+	return node ? node->data : NULL;
+}
+
+void *lpm_delete (struct lpm_table *table, const struct lpm_prefix *p)
+{
+	struct lpm_node **path[129], **link = lpm_root (table, p->family), *node;
+	void *data;
+	int i;
+
+	for (i = 0; ; i++) {
+		if (*link == NULL)
+			return NULL;
+		path[i] = link;
+		if (i == p->plen)
+			break;
+		link = &(*link)->link[LPM_BIT (p->addr, i)];
+	}
+
+	if ((data = (*link)->data) == NULL)
+		return NULL;
+	(*link)->data = NULL;
+	table->count--;
+
+	/* Drop the nodes left without a prefix below them, so every node
+	   leads to a prefix and lpm_overlap() finds one in O(length). */
+	for (; i >= 0; i--) {
+		node = *path[i];
+		if (node->data || node->link[0] || node->link[1])
+			break;
+		XFREE (MTYPE_ROUTE_NODE, node);
+		*path[i] = NULL;
+	}
+	return data;
+}
+
+void *lpm_match (struct lpm_table *table, const struct lpm_prefix *p, struct lpm_prefix *match)
+{
+	struct lpm_node *node = *lpm_root (table, p->family);
+	void *data = NULL;
+	int i, len = 0;
+
+	for (i = 0; node; i++) {
+		if (node->data) {
+			data = node->data;
+			len = i;
+		}
+		if (i == p->plen)
+			break;
+		node = node->link[LPM_BIT (p->addr, i)];
+	}
+
+	if (data && match) {
+		*match = *p;
+		match->plen = len;
+		for (i = len; i < lpm_maxlen (p->family); i++)
+			match->addr[i / 8] &= ~(0x80 >> (i % 8));
+	}
+	return data;
+}
+
+void *lpm_overlap (struct lpm_table *table, const struct lpm_prefix *p, struct lpm_prefix *found)
+{
+	struct lpm_node *node;
+	struct lpm_prefix f;
+	void *data;
+	int i, bit;
+
+	/* A prefix covering p lies on the path to it */
+	if ((data = lpm_match (table, p, &f)) != NULL) {
+		if (found)
+			*found = f;
+		return data;
+	}
+
+	/* Otherwise any prefix below p is inside it, the first one down the
+	   trie is found without a search since no branch is empty. */
+	node = *lpm_root (table, p->family);
+	for (i = 0; node && i < p->plen; i++)
+		node = node->link[LPM_BIT (p->addr, i)];
+	if (node == NULL)
+		return NULL;
+
+	f = *p;
+	for (; node->data == NULL; i++) {
+		bit = node->link[0] ? 0 : 1;
+		if (bit)
+			f.addr[i / 8] |= 0x80 >> (i % 8);
+		node = node->link[bit];
+	}
+	f.plen = i;
+	if (found)
+		*found = f;
+	return node->data;
+}
+
+static int lpm_prefix_cmp (const void *a, const void *b)
+{
+	const struct lpm_prefix *p1 = a, *p2 = b;
+	int ret;
+
+	if (p1->family != p2->family)
+		return p1->family - p2->family;
+	if ((ret = memcmp (p1->addr, p2->addr, sizeof (p1->addr))) != 0)
+		return ret;
+	return p1->plen - p2->plen;
+}
+
+/* Whether p covers q */
+static int lpm_prefix_covers (const struct lpm_prefix *p, const struct lpm_prefix *q)
+{
+	int n = p->plen / 8;
+
+	if (p->family != q->family || p->plen > q->plen)
+		return 0;
+	if (memcmp (p->addr, q->addr, n) != 0)
+		return 0;
+	return p->plen % 8 == 0 || ((p->addr[n] ^ q->addr[n]) & (0xff << (8 - p->plen % 8))) == 0;
+}
+
+/* Whether p and q are the lower and the upper half of one prefix */
+static int lpm_prefix_halves (const struct lpm_prefix *p, const struct lpm_prefix *q)
+{
+	struct lpm_prefix upper;
+	int i;
+
+	if (p->family != q->family || p->plen != q->plen || p->plen == 0)
+		return 0;
+	i = p->plen - 1;
+	if (LPM_BIT (p->addr, i))
+		return 0;
+	upper = *p;
+	upper.addr[i / 8] |= 0x80 >> (i % 8);
+	return memcmp (upper.addr, q->addr, sizeof (q->addr)) == 0;
+}
+
+int lpm_aggregate (struct lpm_prefix *p, int n)
+{
+	int i, k = 0;
+
+	qsort (p, n, sizeof (*p), lpm_prefix_cmp);
+
+	/* In address order a prefix inside an earlier one is inside the last
+	   one kept, and the halves to merge meet on top of the kept ones. */
+	for (i = 0; i < n; i++) {
+		if (k && lpm_prefix_covers (&p[k - 1], &p[i]))
+			continue;
+		p[k++] = p[i];
+		while (k >= 2 && lpm_prefix_halves (&p[k - 2], &p[k - 1])) {
+			k--;
+			p[k - 1].plen--;
+		}
+	}
+	return k;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Longest prefix match table of IPv4 and IPv6 prefixes, a binary trie
+ * walked one bit per level so every operation costs O(prefix length). */
+
+#ifndef __LPM_H__
+#define __LPM_H__
+
+#include <stdint.h>
+
+struct lpm_prefix {
+	int family;		/* AF_INET or AF_INET6 */
+	int plen;
+	uint8_t addr[16];
+};
+
+struct lpm_node {
+	struct lpm_node *link[2];
+	void *data;		/* set where a prefix ends */
+};
+
+struct lpm_table {
+	struct lpm_node *root[2];	/* IPv4, IPv6 */
+	unsigned long count;
+};
+
+struct lpm_table *lpm_table_new (void);
+void lpm_table_free (struct lpm_table *table, void (*free_func) (void *));
+
+/* "A.B.C.D[/M]" or "X:X::X:X[/M]", the host bits are cleared.  Return 0
+   or -1 if it is not a prefix. */
+int lpm_prefix_parse (struct lpm_prefix *p, const char *str);
+char *lpm_prefix_str (const struct lpm_prefix *p, char *buf, int size);
+
+/* Set the data of the prefix, return the data it replaced or NULL. */
+void *lpm_insert (struct lpm_table *table, const struct lpm_prefix *p, void *data);
+/* Remove the prefix, return its data or NULL if it was not there. */
+void *lpm_delete (struct lpm_table *table, const struct lpm_prefix *p);
+/* The data of exactly this prefix. */
+void *lpm_get (struct lpm_table *table, const struct lpm_prefix *p);
+
+/* The longest prefix covering p, copied to match.  Return its data or
+   NULL if none. */
+void *lpm_match (struct lpm_table *table, const struct lpm_prefix *p, struct lpm_prefix *match);
+/* A prefix which covers p or lies inside it, copied to found.  Return its
+   data or NULL if p overlaps nothing. */
+void *lpm_overlap (struct lpm_table *table, const struct lpm_prefix *p, struct lpm_prefix *found);
+
+/* Sort the n prefixes and replace them with the fewest prefixes covering
+   the same addresses: a prefix inside another is dropped and the two
+   halves of a prefix become that prefix.  Return the new count. */
+int lpm_aggregate (struct lpm_prefix *p, int n);
+
+#endif
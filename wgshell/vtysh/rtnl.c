@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Minimal rtnetlink client for IPv4 addresses, routes and the link state. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "rtnl.h"
+
+#define RTNL_BUFSIZE	32768
+
+struct rtnl_dump_addr {
+	struct rtnl_batch *b;
+	int ifindex;
+
+	/* The address left in place, 0 for none */
+	uint32_t keep;
+	int keeplen;
+};
+
+struct rtnl_dump_route {
+	void (*func) (struct rtnl_route *, void *);
+	void *arg;
+};
+
+static int rtnl_open (void)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int rtnl_send (int fd, void *buf, int len)
+{
+	struct sockaddr_nl sa;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	return sendto (fd, buf, len, 0, (struct sockaddr *) &sa, sizeof (sa));
+}
+
+/* Dump the objects of a RTM_GET* type, calling func for every message. */
+static int rtnl_dump (int type, void *req, int reqlen,
+		int (*func) (struct nlmsghdr *, void *), void *arg)
+{
+	struct nlmsghdr *nlh = req;
+	char *buf;
+	int fd, len, count = 0, done = 0;
+
+	fd = rtnl_open ();
+	if (fd < 0)
+		return -1;
+
+	nlh->nlmsg_len = reqlen;
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	nlh->nlmsg_seq = time (NULL);
+	if (rtnl_send (fd, req, reqlen) < 0) {
+		close (fd);
+		return -1;
+	}
+
+	buf = malloc (RTNL_BUFSIZE);
+	if (buf == NULL) {
+		close (fd);
+		return -1;
+	}
+
+	while (!done) {
+		len = recv (fd, buf, RTNL_BUFSIZE, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			count = -1;
+			break;
+		}
+		if (len == 0)
+			break;
+
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				errno = -((struct nlmsgerr *) NLMSG_DATA (nlh))->error;
+				count = -1;
+				done = 1;
+				break;
+			}
+			count += (*func) (nlh, arg);
+		}
+	}
+
+	free (buf);
+	close (fd);
+	return count;
+}
+
+/* Append a message header to the batch, return it with the room for the
+   payload and the attributes cleared. */
+static struct nlmsghdr *rtnl_batch_msg (struct rtnl_batch *b, int type, int flags, int payload)
+{
+	struct nlmsghdr *nlh;
+	int need = NLMSG_SPACE (payload) + 256;
+
+	if (b->len + need > b->size) {
+		char *buf = realloc (b->buf, b->size + need + RTNL_BUFSIZE);
+
+		if (buf == NULL)
+			return NULL;
+		b->buf = buf;
+		b->size += need + RTNL_BUFSIZE;
+	}
+
+	nlh = (struct nlmsghdr *) (b->buf + b->len);
+	memset (nlh, 0, need);
+	nlh->nlmsg_len = NLMSG_LENGTH (payload);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	return nlh;
+}
+
+static void rtnl_batch_done (struct rtnl_batch *b, struct nlmsghdr *nlh)
+{
+	b->len += NLMSG_ALIGN (nlh->nlmsg_len);
+	b->count++;
+}
+
+static void rtnl_attr_add (struct nlmsghdr *nlh, int type, void *data, int len)
+{
+	struct rtattr *rta = (struct rtattr *) ((char *) nlh + NLMSG_ALIGN (nlh->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH (len);
+	memcpy (RTA_DATA (rta), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN (nlh->nlmsg_len) + RTA_ALIGN (rta->rta_len);
+}
+
+void rtnl_batch_init (struct rtnl_batch *b)
+{
+	memset (b, 0, sizeof (*b));
+}
+
+void rtnl_batch_free (struct rtnl_batch *b)
+{
+	free (b->buf);
+	memset (b, 0, sizeof (*b));
+}
+
+int rtnl_batch_addr (struct rtnl_batch *b, int type, int ifindex, uint32_t addr, int len)
+{
+	struct nlmsghdr *nlh;
+	struct ifaddrmsg *ifa;
+	uint32_t brd;
+
+	nlh = rtnl_batch_msg (b, type,
+			(type == RTM_NEWADDR) ? NLM_F_CREATE | NLM_F_REPLACE : 0, sizeof (*ifa));
+	if (nlh == NULL)
+		return -1;
+
+	ifa = NLMSG_DATA (nlh);
+	ifa->ifa_family = AF_INET;
+	ifa->ifa_prefixlen = len;
+	ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa->ifa_index = ifindex;
+	rtnl_attr_add (nlh, IFA_LOCAL, &addr, sizeof (addr));
+	rtnl_attr_add (nlh, IFA_ADDRESS, &addr, sizeof (addr));
+	if (type == RTM_NEWADDR && len < 31) {
+		brd = addr | htonl (len ? 0xffffffffU >> len : 0xffffffffU);
+		rtnl_attr_add (nlh, IFA_BROADCAST, &brd, sizeof (brd));
+	}
+	rtnl_batch_done (b, nlh);
+	return 0;
+}
+
+static int rtnl_addr_flush_one (struct nlmsghdr *nlh, void *arg)
+{
+	struct rtnl_dump_addr *da = arg;
+	struct ifaddrmsg *ifa = NLMSG_DATA (nlh);
+	struct rtattr *rta;
+	int len;
+
+	if (nlh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET ||
+			(int) ifa->ifa_index != da->ifindex)
+		return 0;
+
+	len = IFA_PAYLOAD (nlh);
+	for (rta = IFA_RTA (ifa); RTA_OK (rta, len); rta = RTA_NEXT (rta, len))
+		if (rta->rta_type == IFA_LOCAL) {
+			if (da->keep && *(uint32_t *) RTA_DATA (rta) == da->keep &&
+					ifa->ifa_prefixlen == da->keeplen)
+				return 0;
+			rtnl_batch_addr (da->b, RTM_DELADDR, da->ifindex,
+					*(uint32_t *) RTA_DATA (rta), ifa->ifa_prefixlen);
+			return 1;
+		}
+	return 0;
+}
+
+int rtnl_batch_addr_flush (struct rtnl_batch *b, int ifindex, uint32_t keep, int keeplen)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifaddrmsg ifa;
+	} req;
+	struct rtnl_dump_addr da = { b, ifindex, keep, keeplen };
+
+	memset (&req, 0, sizeof (req));
+	req.ifa.ifa_family = AF_INET;
+	return rtnl_dump (RTM_GETADDR, &req, sizeof (req), rtnl_addr_flush_one, &da);
+}
+
+int rtnl_batch_route (struct rtnl_batch *b, int type, uint32_t dst, int len,
+		uint32_t gw, int ifindex)
+{
+	struct nlmsghdr *nlh;
+	struct rtmsg *rtm;
+
+	nlh = rtnl_batch_msg (b, type,
+			(type == RTM_NEWROUTE) ? NLM_F_CREATE | NLM_F_REPLACE : 0, sizeof (*rtm));
+	if (nlh == NULL)
+		return -1;
+
+	rtm = NLMSG_DATA (nlh);
+	rtm->rtm_family = AF_INET;
+	rtm->rtm_dst_len = len;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	if (type == RTM_NEWROUTE) {
+		rtm->rtm_protocol = RTPROT_STATIC;
+		rtm->rtm_scope = gw ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+		rtm->rtm_type = RTN_UNICAST;
+	} else
+		rtm->rtm_scope = RT_SCOPE_NOWHERE;
+
+	rtnl_attr_add (nlh, RTA_DST, &dst, sizeof (dst));
+	if (gw)
+		rtnl_attr_add (nlh, RTA_GATEWAY, &gw, sizeof (gw));
+	if (ifindex > 0)
+		rtnl_attr_add (nlh, RTA_OIF, &ifindex, sizeof (ifindex));
+	rtnl_batch_done (b, nlh);
+	return 0;
+}
+
+int rtnl_batch_link (struct rtnl_batch *b, int ifindex, int up)
+{
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+
+	nlh = rtnl_batch_msg (b, RTM_NEWLINK, 0, sizeof (*ifi));
+	if (nlh == NULL)
+		return -1;
+
+	ifi = NLMSG_DATA (nlh);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = ifindex;
+	ifi->ifi_flags = up ? IFF_UP : 0;
+	ifi->ifi_change = IFF_UP;
+	rtnl_batch_done (b, nlh);
+	return 0;
+}
+
+int rtnl_batch_commit (struct rtnl_batch *b)
+{
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	unsigned int seq;
+	char *buf;
+	int fd, len, off, acked = 0, failed = 0, first = 0;
+
+	if (b->count == 0)
+		return 0;
+
+	fd = rtnl_open ();
+	if (fd < 0)
+		goto fail;
+
+	/* Number the messages to match the acks */
+	seq = time (NULL);
+	for (off = 0; off < b->len; off += NLMSG_ALIGN (nlh->nlmsg_len)) {
+		nlh = (struct nlmsghdr *) (b->buf + off);
+		nlh->nlmsg_seq = seq + acked++;
+	}
+	acked = 0;
+
+	if (rtnl_send (fd, b->buf, b->len) < 0) {
+		close (fd);
+		goto fail;
+	}
+
+	buf = malloc (RTNL_BUFSIZE);
+	if (buf == NULL) {
+		close (fd);
+		goto fail;
+	}
+
+	while (acked < b->count) {
+		len = recv (fd, buf, RTNL_BUFSIZE, 0);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			failed = -1;
+			break;
+		}
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR ||
+					nlh->nlmsg_seq - seq >= (unsigned int) b->count)
+				continue;
+			err = NLMSG_DATA (nlh);
+			acked++;
+			if (err->error) {
+				if (failed++ == 0)
+					first = -err->error;
+			}
+		}
+	}
+
+	free (buf);
+	close (fd);
+	rtnl_batch_free (b);
+	if (first)
+		errno = first;
+	return failed;
+
+fail:
+	rtnl_batch_free (b);
+	return -1;
+}
+
+static int rtnl_route_one (struct nlmsghdr *nlh, void *arg)
+{
+	struct rtnl_dump_route *dr = arg;
+	struct rtmsg *rtm = NLMSG_DATA (nlh);
+	struct rtnl_route rt;
+	struct rtattr *rta;
+	int len;
+
+	if (nlh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_family != AF_INET ||
+			rtm->rtm_table != RT_TABLE_MAIN)
+		return 0;
+
+	memset (&rt, 0, sizeof (rt));
+	rt.len = rtm->rtm_dst_len;
+	rt.protocol = rtm->rtm_protocol;
+	rt.scope = rtm->rtm_scope;
+	rt.type = rtm->rtm_type;
+
+	len = RTM_PAYLOAD (nlh);
+	for (rta = RTM_RTA (rtm); RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+		switch (rta->rta_type) {
+		case RTA_TABLE:
+			if (*(uint32_t *) RTA_DATA (rta) != RT_TABLE_MAIN)
+				return 0;
+			break;
+		case RTA_DST:
+			rt.dst = *(uint32_t *) RTA_DATA (rta);
+			break;
+		case RTA_GATEWAY:
+			rt.gw = *(uint32_t *) RTA_DATA (rta);
+			break;
+		case RTA_PREFSRC:
+			rt.prefsrc = *(uint32_t *) RTA_DATA (rta);
+			break;
+		case RTA_OIF:
+			rt.ifindex = *(int *) RTA_DATA (rta);
+			break;
+		case RTA_PRIORITY:
+			rt.metric = *(uint32_t *) RTA_DATA (rta);
+			break;
+		}
+	}
+
+	(*dr->func) (&rt, dr->arg);
+	return 1;
+}
+
+int rtnl_route_dump (void (*func) (struct rtnl_route *, void *), void *arg)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtmsg rtm;
+	} req;
+	struct rtnl_dump_route dr = { func, arg };
+
+	memset (&req, 0, sizeof (req));
+	req.rtm.rtm_family = AF_INET;
+	return rtnl_dump (RTM_GETROUTE, &req, sizeof (req), rtnl_route_one, &dr);
+}
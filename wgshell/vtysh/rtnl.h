@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Minimal rtnetlink client: IPv4 addresses, routes and the link state are
+ * changed with RTM_* messages instead of running ifconfig, route or ip. */
+
+#ifndef __RTNL_H__
+#define __RTNL_H__
+
+#include <stdint.h>
+
+/* Messages queued to be sent in one exchange by rtnl_batch_commit(). */
+struct rtnl_batch {
+	char *buf;
+	int len;
+	int size;
+
+	/* Number of queued messages */
+	int count;
+};
+
+struct rtnl_route {
+	/* In network byte order, gw is 0 for a directly connected route */
+	uint32_t dst;
+	uint32_t gw;
+	uint32_t prefsrc;
+	int len;
+
+	int ifindex;
+	int metric;
+	int protocol;
+	int scope;
+	int type;
+};
+
+void rtnl_batch_init (struct rtnl_batch *b);
+void rtnl_batch_free (struct rtnl_batch *b);
+
+/* type is RTM_NEWADDR or RTM_DELADDR, addr in network byte order */
+int rtnl_batch_addr (struct rtnl_batch *b, int type, int ifindex, uint32_t addr, int len);
+
+/* Queue the removal of every IPv4 address of the interface but keep/keeplen
+   (keep in network byte order, 0 to remove them all).  Removing the last
+   address of an interface also removes its routes, so a new address is
+   queued before the old ones are flushed. */
+int rtnl_batch_addr_flush (struct rtnl_batch *b, int ifindex, uint32_t keep, int keeplen);
+
+/* type is RTM_NEWROUTE(created or replaced) or RTM_DELROUTE */
+int rtnl_batch_route (struct rtnl_batch *b, int type, uint32_t dst, int len,
+		uint32_t gw, int ifindex);
+
+int rtnl_batch_link (struct rtnl_batch *b, int ifindex, int up);
+
+/* Send the queued messages at once and wait for their acks.  Return the
+   number of messages the kernel refused(errno is the first error) or -1
+   if the exchange itself failed.  The batch is emptied. */
+int rtnl_batch_commit (struct rtnl_batch *b);
+
+/* Call func for every IPv4 route of the main table.  Return the number of
+   routes or -1. */
+int rtnl_route_dump (void (*func) (struct rtnl_route *, void *), void *arg);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Partial sort of an array of pointers with a bounded heap. */
+
+#include "sort.h"
+
+struct sort_heap {
+	void **base;
+	int (*cmp) (void *, void *, void *);
+	void *arg;
+};
+
+/* Restore the heap below i, the item sorting last is at the root. */
+static void sort_sift_down (struct sort_heap *h, int i, int size)
+{
+	void *t;
+	int max, l, r;
+
+	while (1) {
+		max = i;
+		l = 2 * i + 1;
+		r = l + 1;
+		if (l < size && (*h->cmp) (h->base[l], h->base[max], h->arg) > 0)
+			max = l;
+		if (r < size && (*h->cmp) (h->base[r], h->base[max], h->arg) > 0)
+			max = r;
+		if (max == i)
+			return;
+		t = h->base[i];
+		h->base[i] = h->base[max];
+		h->base[max] = t;
+		i = max;
+	}
+}
+
+void partial_sort (void **base, int n, int k, int (*cmp) (void *, void *, void *), void *arg)
+{
+	struct sort_heap h = { base, cmp, arg };
+	void *t;
+	int i;
+
+	if (k > n)
+		k = n;
+	if (k <= 0)
+		return;
+
+	for (i = k / 2 - 1; i >= 0; i--)
+		sort_sift_down (&h, i, k);
+
+	/* An item sorting before the root replaces it */
+	for (i = k; i < n; i++) {
+		if ((*cmp) (base[i], base[0], arg) < 0) {
+			t = base[0];
+			base[0] = base[i];
+			base[i] = t;
+			sort_sift_down (&h, 0, k);
+		}
+	}
+
+	/* Heap sort of the k items */
+	for (i = k - 1; i > 0; i--) {
+		t = base[0];
+		base[0] = base[i];
+		base[i] = t;
+		sort_sift_down (&h, 0, i);
+	}
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+#ifndef __SORT_H__
+#define __SORT_H__
+
+/* Move the k items that sort first by cmp to the start of base, in
+ * order, leaving the others behind them in no order.  A heap of k items
+ * is kept, so a top k of n items costs O(n log k) instead of a full
+ * sort.  cmp gets the items themselves, not pointers to them. */
+void partial_sort (void **base, int n, int k, int (*cmp) (void *, void *, void *), void *arg);
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Keypairs per second of curve25519_generate_keypairs(), run with
+ * 'make bench'.  bench_curve25519 [COUNT] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../curve25519.h"
+
+int main (int argc, char **argv)
+{
+	uint8_t (*secret)[CURVE25519_KEY_SIZE], (*pub)[CURVE25519_KEY_SIZE];
+	struct timespec start, end;
+	int count = argc > 1 ? atoi (argv[1]) : 2000;
+	double sec;
+
+	if (count < 1) {
+		fprintf (stderr, "usage: %s [COUNT]\n", argv[0]);
+		return 1;
+	}
+	secret = malloc ((size_t) count * CURVE25519_KEY_SIZE);
+	pub = malloc ((size_t) count * CURVE25519_KEY_SIZE);
+	if (secret == NULL || pub == NULL)
+		return 1;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	if (curve25519_generate_keypairs (secret, pub, count) < 0) {
+		perror ("curve25519_generate_keypairs");
+		return 1;
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf ("%s: %d keypairs in %.3f s, %.0f keys/s\n", argv[0], count, sec,
+			sec > 0 ? count / sec : 0);
+	free (secret);
+	free (pub);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Checks shared by the tests run with 'make check'.  A test program
+ * returns test_result(), non zero when a check failed.  The tests run
+ * from the vtysh directory, fixtures are read from tests/fixtures. */
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIXTURE_DIR	"tests/fixtures"
+
+static int test_checks, test_failures;
+
+#define CHECK(expr) \
+	do { \
+		test_checks++; \
+		if (!(expr)) { \
+			fprintf (stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+			test_failures++; \
+		} \
+	} while (0)
+
+#define CHECK_STR(got, want) \
+	do { \
+		const char *_g = (got), *_w = (want); \
+		test_checks++; \
+		if (_g == NULL || strcmp (_g, _w) != 0) { \
+			fprintf (stderr, "%s:%d: %s\n  got:  %s\n  want: %s\n", __FILE__, __LINE__, \
+					#got, _g ? _g : "(null)", _w); \
+			test_failures++; \
+		} \
+	} while (0)
+
+/* The whole file in a malloc()ed string, NULL if it can't be read. */
+static inline char *test_read_file (const char *path)
+{
+	FILE *fp = fopen (path, "r");
+	char *buf;
+	long size;
+
+	if (fp == NULL)
+		return NULL;
+	fseek (fp, 0, SEEK_END);
+	size = ftell (fp);
+	rewind (fp);
+	buf = malloc (size + 1);
+	if (fread (buf, 1, size, fp) != (size_t) size)
+		size = 0;
+	buf[size] = '\0';
+	fclose (fp);
+	return buf;
+}
+
+/* Compare a file with the expected text in a fixture. */
+#define CHECK_FILE(path, fixture) \
+	do { \
+		char *_got = test_read_file (path), *_want = test_read_file (fixture); \
+		test_checks++; \
+		if (_got == NULL || _want == NULL || strcmp (_got, _want) != 0) { \
+			fprintf (stderr, "%s:%d: %s differs from %s\n", __FILE__, __LINE__, path, fixture); \
+			if (_got) \
+				fprintf (stderr, "--- got\n%s--- want\n%s", _got, _want ? _want : ""); \
+			test_failures++; \
+		} \
+		free (_got); \
+		free (_want); \
+	} while (0)
+
+static inline int test_result (const char *name)
+{
+	printf ("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+	return test_failures != 0;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* vtysh_batch() with the commands installed as vtysh does, a line which
+   fails its checks fails the batch. */
+
+#include <unistd.h>
+
+#include "../linklist.h"
+#include "../command.h"
+#include "../vtysh.h"
+#include "../vtysh_config.h"
+#include "test.h"
+
+static void batch_write (const char *path, const char *text)
+{
+	FILE *fp = fopen (path, "w");
+
+	fputs (text, fp);
+	fclose (fp);
+}
+
+static int batch_has (const char *line)
+{
+	struct listnode *nn;
+	char *data;
+
+	LIST_LOOP (config_top, data, nn)
+		if (!strcmp (data, line))
+			return 1;
+	return 0;
+}
+
+static void test_batch (void)
+{
+	char path[64];
+
+	snprintf (path, sizeof (path), "/tmp/test_batch.%d", (int) getpid ());
+
+	batch_write (path, "# sets\n"
+			"sfirewall ipset good 10.0.0.0/8\n"
+			"\n"
+			"sfirewall ipset also 192.168.0.0/16\n");
+	CHECK (vtysh_batch (path, 0) == 0);
+	CHECK (batch_has ("sfirewall ipset good 10.0.0.0/8"));
+	CHECK (batch_has ("sfirewall ipset also 192.168.0.0/16"));
+
+	/* The batch stops at the invalid name */
+	batch_write (path, "sfirewall ipset 9bad 10.0.0.0/8\n"
+			"sfirewall ipset next 172.16.0.0/12\n");
+	CHECK (vtysh_batch (path, 0) == 1);
+	CHECK (!batch_has ("sfirewall ipset next 172.16.0.0/12"));
+
+	/* or goes on, counting every failed line */
+	batch_write (path, "sfirewall ipset 9bad 10.0.0.0/8\n"
+			"sfirewall ipset next 172.16.0.0/12\n"
+			"sfirewall ipset last 10.0.0.0/33\n"
+			"sfirewall nosuch\n");
+	CHECK (vtysh_batch (path, 1) == 3);
+	CHECK (batch_has ("sfirewall ipset next 172.16.0.0/12"));
+
+	unlink (path);
+}
+
+int main (void)
+{
+	config_init ();
+	cmd_init ();
+	vtysh_init_vty ();
+	cmd_parse_init ();
+	cmd_sort_node ();
+
+	vtysh_execute ("enable");
+	vtysh_execute ("config terminal");
+	test_batch ();
+	return test_result ("test_batch");
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* X25519 against the test vectors of RFC 7748.  Built a second time with
+ * CURVE25519_NO_INT128 for the 16 bit limbs. */
+
+#include "../curve25519.h"
+#include "test.h"
+
+static void hex (uint8_t out[CURVE25519_KEY_SIZE], const char *str)
+{
+	int i;
+
+	for (i = 0; i < CURVE25519_KEY_SIZE; i++)
+		sscanf (str + i * 2, "%2hhx", &out[i]);
+}
+
+static const char *tohex (const uint8_t in[CURVE25519_KEY_SIZE])
+{
+	static char buf[CURVE25519_KEY_SIZE * 2 + 1];
+	int i;
+
+	for (i = 0; i < CURVE25519_KEY_SIZE; i++)
+		sprintf (buf + i * 2, "%02x", in[i]);
+	return buf;
+}
+
+static const char *x25519 (const char *scalar, const char *u)
+{
+	uint8_t k[CURVE25519_KEY_SIZE], p[CURVE25519_KEY_SIZE], out[CURVE25519_KEY_SIZE];
+
+	hex (k, scalar);
+	hex (p, u);
+	curve25519 (out, k, p);
+	return tohex (out);
+}
+
+/* RFC 7748 5.2 */
+static void test_vectors (void)
+{
+	CHECK_STR (x25519 ("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+				"e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c"),
+			"c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552");
+
+	/* The top bit of u is ignored */
+	CHECK_STR (x25519 ("4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+				"e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493"),
+			"95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957");
+}
+
+/* RFC 7748 5.2, k = X25519(k, u) and u = the old k, from k = u = 9 */
+static void test_iterations (void)
+{
+	uint8_t k[CURVE25519_KEY_SIZE] = { 9 }, u[CURVE25519_KEY_SIZE] = { 9 };
+	uint8_t out[CURVE25519_KEY_SIZE];
+	int i;
+
+	for (i = 1; i <= 1000; i++) {
+		curve25519 (out, k, u);
+		memcpy (u, k, sizeof (u));
+		memcpy (k, out, sizeof (k));
+		if (i == 1)
+			CHECK_STR (tohex (k), "422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079");
+	}
+	CHECK_STR (tohex (k), "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51");
+}
+
+/* RFC 7748 6.1 */
+static void test_dh (void)
+{
+	uint8_t alice[CURVE25519_KEY_SIZE], bob[CURVE25519_KEY_SIZE];
+	uint8_t alice_pub[CURVE25519_KEY_SIZE], bob_pub[CURVE25519_KEY_SIZE];
+	uint8_t shared[CURVE25519_KEY_SIZE];
+
+	hex (alice, "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+	hex (bob, "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+
+	curve25519_generate_public (alice_pub, alice);
+	CHECK_STR (tohex (alice_pub), "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+	curve25519_generate_public (bob_pub, bob);
+	CHECK_STR (tohex (bob_pub), "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f");
+
+	curve25519 (shared, alice, bob_pub);
+	CHECK_STR (tohex (shared), "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+	curve25519 (shared, bob, alice_pub);
+	CHECK_STR (tohex (shared), "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+}
+
+/* Generated secrets are clamped and match their public keys */
+static void test_keypairs (void)
+{
+	uint8_t secret[4][CURVE25519_KEY_SIZE], pub[4][CURVE25519_KEY_SIZE];
+	uint8_t check[CURVE25519_KEY_SIZE];
+	int i;
+
+	CHECK (curve25519_generate_keypairs (secret, pub, 4) == 0);
+	for (i = 0; i < 4; i++) {
+		CHECK ((secret[i][0] & 7) == 0 && (secret[i][31] & 0xc0) == 0x40);
+		curve25519_generate_public (check, secret[i]);
+		CHECK (memcmp (check, pub[i], sizeof (check)) == 0);
+	}
+	CHECK (memcmp (secret[0], secret[1], CURVE25519_KEY_SIZE) != 0);
+}
+
+int main (int argc, char **argv)
+{
+	test_vectors ();
+	test_iterations ();
+	test_dh ();
+	test_keypairs ();
+	return test_result (argv[0]);
+}
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* The static functions of cmd_fw.c, the module is included. */
+
+#include "../cmd/cmd_fw.c"
+#include "test.h"
+
+static void ruleset_load (struct fw_ruleset *rs, const char *path)
+{
+	FILE *fp = fopen (path, "r");
+
+	fw_ruleset_init (rs);
+	if (fp) {
+		fw_ruleset_parse (fp, rs);
+		fclose (fp);
+	}
+}
+
+static void ruleset_text (struct fw_ruleset *rs, const char *text)
+{
+	FILE *fp = fmemopen ((void *) text, strlen (text), "r");
+
+	fw_ruleset_init (rs);
+	fw_ruleset_parse (fp, rs);
+	fclose (fp);
+}
+
+/* The delta of the running ruleset to the one fw4 prints, NULL if it
+   needs a restart. */
+static char *delta (struct fw_ruleset *running, struct fw_ruleset *wanted)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fp = open_memstream (&buf, &size);
+	int changes = fw_delta_write (fp, running, wanted);
+
+	fclose (fp);
+	if (changes < 0) {
+		free (buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/* Rules and the map of the fixture rulesets: fw4 print, the portmap
+   include and nft -a list. */
+static void test_parse (void)
+{
+	struct fw_ruleset running, wanted;
+	struct fw_set *set;
+	int i;
+
+	ruleset_load (&running, FIXTURE_DIR "/fw4-running.nft");
+	ruleset_load (&wanted, FIXTURE_DIR "/fw4-print.nft");
+
+	CHECK (listcount (running.chains) == 7);
+	CHECK (listcount (wanted.chains) == 7);
+	CHECK (running.count == 17);
+	CHECK (wanted.count == 19);
+
+	i = fw_rule_lookup (&running, "forward_lan", "SFW-FLT-20-bbbbbbbb");
+	CHECK (i >= 0 && running.rules[i].handle == 102);
+	CHECK (i >= 0 && running.rules[i].expr != NULL && strstr (running.rules[i].expr, "# handle") == NULL);
+	i = fw_rule_lookup (&running, "input", "Accept traffic from loopback");
+	CHECK (i >= 0 && running.rules[i].handle == 12 && running.rules[i].expr == NULL);
+	CHECK (fw_rule_lookup (&wanted, "dstnat_wan", "SFW-NAT-2-22222222") >= 0);
+
+	set = fw_set_find (running.sets, "sfw_portmap_wan");
+	CHECK (set != NULL && set->map);
+	CHECK_STR (set ? set->elements : NULL,
+			"tcp . 8080 : 192.168.1.10 . 80, udp . 5000 : 192.168.1.11 . 5000");
+	set = fw_set_find (wanted.sets, "blocklist");
+	CHECK (set != NULL && !set->map);
+	CHECK_STR (set ? set->elements : NULL, "10.0.0.0/8, 192.168.100.0/24");
+
+	fw_ruleset_free (&running);
+	fw_ruleset_free (&wanted);
+}
+
+/* New rules go next to their running neighbour by handle, the rules at
+   the end of a chain after the last one running. */
+static void test_delta (void)
+{
+	struct fw_ruleset running, wanted;
+	char path[64], *text;
+	FILE *fp;
+
+	ruleset_load (&running, FIXTURE_DIR "/fw4-running.nft");
+	ruleset_load (&wanted, FIXTURE_DIR "/fw4-print.nft");
+	if ((fp = fopen (FIXTURE_DIR "/portmap.nft", "r")) != NULL) {
+		fw_ruleset_parse (fp, &wanted);
+		fclose (fp);
+	}
+
+	text = delta (&running, &wanted);
+	CHECK (text != NULL);
+	snprintf (path, sizeof (path), "/tmp/test_fw.%d", (int) getpid ());
+	if ((fp = fopen (path, "w")) != NULL) {
+		fputs (text ? text : "", fp);
+		fclose (fp);
+	}
+	CHECK_FILE (path, FIXTURE_DIR "/fw4-delta.nft");
+	unlink (path);
+	free (text);
+
+	/* Nothing to do against itself */
+	text = delta (&wanted, &wanted);
+	CHECK_STR (text, "");
+	free (text);
+
+	fw_ruleset_free (&running);
+	fw_ruleset_free (&wanted);
+}
+
+#define RUNNING_LAN \
+	"table inet fw4 {\n" \
+	"	chain forward_lan { # handle 20\n" \
+	"		jump accept_to_wan comment \"!fw4: Accept lan to wan forwarding\" # handle 30\n" \
+	"		jump accept_to_lan # handle 31\n" \
+	"	}\n" \
+	"}\n"
+
+/* Cases only a restart handles. */
+static void test_restart (void)
+{
+	struct fw_ruleset running, wanted;
+	char *text;
+
+	/* The rule jumps to a chain fw4 did not create */
+	ruleset_text (&running, RUNNING_LAN);
+	ruleset_text (&wanted,
+		"table inet fw4 {\n"
+		"	chain forward_lan {\n"
+		"		tcp dport 22 counter jump drop_to_lan comment \"!fw4: SFW-FLT-1-aaaaaaaa\"\n"
+		"		jump accept_to_wan comment \"!fw4: Accept lan to wan forwarding\"\n"
+		"		jump accept_to_lan\n"
+		"	}\n"
+		"	chain drop_to_lan {\n"
+		"		oifname \"br-lan\" counter drop comment \"!fw4: drop lan IPv4/IPv6 traffic\"\n"
+		"	}\n"
+		"}\n");
+	CHECK ((text = delta (&running, &wanted)) == NULL);
+	free (text);
+	fw_ruleset_free (&running);
+	fw_ruleset_free (&wanted);
+
+	/* The running rules are in another order */
+	ruleset_text (&running,
+		"table inet fw4 {\n"
+		"	chain forward_wan { # handle 21\n"
+		"		tcp dport 80 counter accept comment \"!fw4: SFW-FLT-10-aaaaaaaa\" # handle 40\n"
+		"		icmp type echo-request counter accept comment \"!fw4: Allow-Ping\" # handle 41\n"
+		"	}\n"
+		"}\n");
+	ruleset_text (&wanted,
+		"table inet fw4 {\n"
+		"	chain forward_wan {\n"
+		"		icmp type echo-request counter accept comment \"!fw4: Allow-Ping\"\n"
+		"		tcp dport 80 counter accept comment \"!fw4: SFW-FLT-10-aaaaaaaa\"\n"
+		"	}\n"
+		"}\n");
+	CHECK ((text = delta (&running, &wanted)) == NULL);
+	free (text);
+	fw_ruleset_free (&running);
+	fw_ruleset_free (&wanted);
+
+	/* Nothing named to place the new rule next to */
+	ruleset_text (&running, RUNNING_LAN);
+	ruleset_text (&wanted,
+		"table inet fw4 {\n"
+		"	chain forward_lan {\n"
+		"		jump accept_to_wan comment \"!fw4: Accept lan to wan forwarding\"\n"
+		"		jump accept_to_lan\n"
+		"		tcp dport 22 counter accept comment \"!fw4: SFW-FLT-1-aaaaaaaa\"\n"
+		"	}\n"
+		"}\n");
+	CHECK ((text = delta (&running, &wanted)) == NULL);
+	free (text);
+	fw_ruleset_free (&wanted);
+
+	/* but a rule after a named one is added after it */
+	ruleset_text (&wanted,
+		"table inet fw4 {\n"
+		"	chain forward_lan {\n"
+		"		jump accept_to_wan comment \"!fw4: Accept lan to wan forwarding\"\n"
+		"		tcp dport 22 counter accept comment \"!fw4: SFW-FLT-1-aaaaaaaa\"\n"
+		"		jump accept_to_lan\n"
+		"	}\n"
+		"}\n");
+	text = delta (&running, &wanted);
+	CHECK_STR (text, "add rule inet fw4 forward_lan position 30 "
+			"tcp dport 22 counter accept comment \"!fw4: SFW-FLT-1-aaaaaaaa\"\n");
+	free (text);
+	fw_ruleset_free (&running);
+	fw_ruleset_free (&wanted);
+}
+
+/* The UCI sections written for the sets and the filter rules, fw4 makes
+   a set of each ipset and a rule matching @set of an ipset option. */
+static void test_generate (void)
+{
+	char path[64];
+
+	config_init ();
+	config_add_line (config_top, SFW_IPSET_PREFIX "trusted 10.8.0.0/16");
+	config_add_line (config_top, SFW_IPSET_PREFIX "blocklist 10.0.0.0/8");
+	config_add_line (config_top, SFW_IPSET_PREFIX "blocklist 192.168.100.0/24");
+	config_add_line (config_top, "sfirewall filter 10 lan2wan fw insert deny tcp 192.168.1.0/24 any @blocklist 443 any any any");
+
+	snprintf (path, sizeof (path), "/tmp/test_fw.%d", (int) getpid ());
+	CHECK (fw_ipset_write (path) == 0);
+	CHECK_FILE (path, FIXTURE_DIR "/sfirewall_ipset");
+
+	/* Rule 20 is shadowed by rule 10 and left out */
+	CHECK (fw_filter_write (FIXTURE_DIR "/filter.txt", path) == 0);
+	CHECK_FILE (path, FIXTURE_DIR "/sfirewall_filter");
+	unlink (path);
+
+	CHECK (fw_filter_write (FIXTURE_DIR "/filter.missing", path) == -1);
+}
+
+/* A portmap of a port is a map element, the first of a port wins.  Each
+   zone with a map keeps a redirect so fw4 hooks its dstnat chain. */
+static void test_portmap (void)
+{
+	char *elements[sizeof (fw_portmap_zones) / sizeof (char *)] = { NULL };
+	char path[64];
+	int zone;
+
+	snprintf (path, sizeof (path), "/tmp/test_fw.%d", (int) getpid ());
+	CHECK (fw_portmap_write (FIXTURE_DIR "/portmap.txt", path, elements) == 0);
+	CHECK_FILE (path, FIXTURE_DIR "/sfirewall_nat");
+	CHECK_STR (elements[0], "tcp . 8080 : 192.168.1.10 . 80, tcp . 8443 : 192.168.1.10 . 443");
+	CHECK_STR (elements[1], "udp . 5000 : 192.168.1.30 . 5000");
+	unlink (path);
+	for (zone = 0; fw_portmap_zones[zone]; zone++)
+		if (elements[zone])
+			XFREE (MTYPE_TMP, elements[zone]);
+}
+
+static struct fw_prefix prefix (char *str)
+{
+	struct fw_prefix p;
+
+	CHECK (fw_prefix_parse (str, &p) == 0);
+	return p;
+}
+
+static void test_prefix (void)
+{
+	struct fw_prefix a, b, p;
+
+	/* Host bits are cleared */
+	p = prefix ("10.1.2.3/8");
+	CHECK (p.addr == 0x0a000000 && p.len == 8);
+	CHECK (fw_prefix_parse ("10.0.0.0", &p) == -1);
+	CHECK (fw_prefix_parse ("10.0.0.0/33", &p) == -1);
+	CHECK (fw_prefix_parse ("10.0.0.256/8", &p) == -1);
+
+	a = prefix ("10.0.0.0/8");
+	b = prefix ("10.1.0.0/16");
+	CHECK (fw_prefix_contains (&a, "10.0.0.0/8", &b, "10.1.0.0/16"));
+	CHECK (!fw_prefix_contains (&b, "10.1.0.0/16", &a, "10.0.0.0/8"));
+	CHECK (fw_prefix_contains (&a, "10.0.0.0/8", &a, "10.0.0.0/8"));
+	CHECK (fw_prefix_overlaps (&a, &b) && fw_prefix_overlaps (&b, &a));
+	p = prefix ("0.0.0.0/0");
+	CHECK (fw_prefix_contains (&p, "0.0.0.0/0", &b, "10.1.0.0/16"));
+	b = prefix ("11.0.0.0/8");
+	CHECK (!fw_prefix_contains (&a, "10.0.0.0/8", &b, "11.0.0.0/8"));
+	CHECK (!fw_prefix_overlaps (&a, &b));
+
+	/* 10.0.0.0/8 and 11.0.0.0/8 are the halves of 10.0.0.0/7 */
+	CHECK (fw_prefix_siblings (&a, &b) && fw_prefix_siblings (&b, &a));
+	b = prefix ("9.0.0.0/8");
+	CHECK (!fw_prefix_siblings (&a, &b));
+	b = prefix ("10.0.0.0/9");
+	CHECK (!fw_prefix_siblings (&a, &b));
+	CHECK (!fw_prefix_siblings (&p, &p));
+
+	/* A set only contains itself and may overlap anything */
+	a = prefix ("@blocklist");
+	b = prefix ("@trusted");
+	CHECK (fw_prefix_contains (&a, "@blocklist", &a, "@blocklist"));
+	CHECK (!fw_prefix_contains (&a, "@blocklist", &b, "@trusted"));
+	CHECK (!fw_prefix_contains (&p, "0.0.0.0/0", &a, "@blocklist"));
+	CHECK (fw_prefix_overlaps (&a, &b) && fw_prefix_overlaps (&a, &p));
+	CHECK (!fw_prefix_siblings (&a, &a));
+}
+
+static void filter (struct fw_filter *f, char *line)
+{
+	CHECK (fw_filter_parse (line, f) == 0);
+}
+
+static void test_ports (void)
+{
+	struct fw_filter a, b;
+	int lo, hi;
+
+	fw_port_parse ("any", &lo, &hi);
+	CHECK (lo == 0 && hi == 65535);
+	fw_port_parse ("8080", &lo, &hi);
+	CHECK (lo == 8080 && hi == 8080);
+	fw_port_parse ("1000:2000", &lo, &hi);
+	CHECK (lo == 1000 && hi == 2000);
+
+	filter (&a, "sfirewall filter 10 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 1000:2000 any any any");
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 1500 any any any");
+	CHECK (fw_filter_contains (&a, &b) && !fw_filter_contains (&b, &a));
+	CHECK (fw_filter_overlaps (&a, &b));
+
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 1500:2500 any any any");
+	CHECK (!fw_filter_contains (&a, &b) && !fw_filter_contains (&b, &a));
+	CHECK (fw_filter_overlaps (&a, &b) && fw_filter_overlaps (&b, &a));
+
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 2001:3000 any any any");
+	CHECK (!fw_filter_overlaps (&a, &b) && !fw_filter_overlaps (&b, &a));
+
+	/* icmp has no ports */
+	filter (&a, "sfirewall filter 10 lan2wan fw insert deny icmp 0.0.0.0/0 any 0.0.0.0/0 80 any any any");
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny icmp 0.0.0.0/0 any 0.0.0.0/0 443 any any any");
+	CHECK (fw_filter_contains (&a, &b) && fw_filter_overlaps (&a, &b));
+
+	/* Nor do rules of another protocol, zone or direction match */
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny udp 0.0.0.0/0 any 0.0.0.0/0 80 any any any");
+	CHECK (!fw_filter_contains (&a, &b) && !fw_filter_overlaps (&a, &b));
+	filter (&b, "sfirewall filter 20 wan2lan fw insert deny icmp 0.0.0.0/0 any 0.0.0.0/0 80 any any any");
+	CHECK (!fw_filter_contains (&a, &b) && !fw_filter_overlaps (&a, &b));
+
+	/* Days and times */
+	filter (&a, "sfirewall filter 10 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 80 mon|tue any any");
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 80 mon any any");
+	CHECK (fw_filter_contains (&a, &b) && !fw_filter_contains (&b, &a));
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 80 sat|sun any any");
+	CHECK (!fw_filter_overlaps (&a, &b));
+	filter (&b, "sfirewall filter 20 lan2wan fw insert deny tcp 0.0.0.0/0 any 0.0.0.0/0 80 mon 09:00 18:00");
+	CHECK (fw_filter_contains (&a, &b) && !fw_filter_contains (&b, &a));
+}
+
+/* Optimize the rules, return the reasons the rules were removed as
+   "reason by", one per rule, "-" for a kept rule. */
+static char *optimize (char **lines, int count, int *removed, struct fw_filter *f)
+{
+	static char result[1024];
+	int n, len = 0;
+
+	for (n = 0; n < count; n++)
+		filter (&f[n], lines[n]);
+	*removed = fw_filter_optimize (f, count);
+	result[0] = '\0';
+	for (n = 0; n < count; n++) {
+		if (f[n].removed)
+			len += snprintf (result + len, sizeof (result) - len, "%s%s %s", n ? ", " : "",
+					f[n].removed, f[f[n].by].param[0]);
+		else
+			len += snprintf (result + len, sizeof (result) - len, "%s-", n ? ", " : "");
+	}
+	return result;
+}
+
+static void test_optimize (void)
+{
+	struct fw_filter f[8];
+	int removed;
+	char *shadow[] = {
+		"sfirewall filter 10 lan2wan fw insert deny tcp 10.0.0.0/8 any 0.0.0.0/0 any any any any",
+		"sfirewall filter 20 lan2wan fw insert permit tcp 10.1.0.0/16 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 30 lan2wan fw insert deny tcp 10.0.0.0/8 any 0.0.0.0/0 any any any any",
+	};
+	char *contained[] = {
+		"sfirewall filter 10 lan2wan fw insert deny tcp 10.1.0.0/16 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 20 lan2wan fw insert deny tcp 10.0.0.0/8 any 0.0.0.0/0 any any any any",
+	};
+	/* Rule 20 permits what rule 10 denies, so 10 can't move to 30 */
+	char *crossed[] = {
+		"sfirewall filter 10 lan2wan fw insert deny tcp 10.1.0.0/16 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 20 lan2wan fw insert permit tcp 10.0.0.0/8 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 30 lan2wan fw insert deny tcp 10.0.0.0/8 any 0.0.0.0/0 any any any any",
+	};
+	char *merged[] = {
+		"sfirewall filter 10 lan2wan fw insert deny udp 192.168.0.0/25 any 8.8.8.8/32 53 any any any",
+		"sfirewall filter 20 lan2wan fw insert deny udp 192.168.0.128/25 any 8.8.8.8/32 53 any any any",
+		"sfirewall filter 30 lan2wan fw insert deny udp 192.168.1.0/24 any 8.8.8.8/32 53 any any any",
+		"sfirewall filter 40 lan2wan fw insert deny udp 10.0.0.0/24 any 8.8.4.4/32 53 any any any",
+		"sfirewall filter 50 lan2wan fw insert deny udp 10.0.0.0/24 any 8.8.4.5/32 53 any any any",
+	};
+	/* Siblings with another port, or a rule in between, are kept apart */
+	char *apart[] = {
+		"sfirewall filter 10 lan2wan fw insert deny udp 192.168.0.0/25 any 8.8.8.8/32 53 any any any",
+		"sfirewall filter 20 lan2wan fw insert permit udp 192.168.0.128/26 any 8.8.8.8/32 53 any any any",
+		"sfirewall filter 30 lan2wan fw insert deny udp 192.168.0.128/25 any 8.8.8.8/32 53 any any any",
+		"sfirewall filter 40 lan2wan fw insert deny udp 192.168.1.0/24 any 8.8.8.8/32 54 any any any",
+	};
+	/* in|out|fw is not written to fw4, rule 20 stands between 10 and 30 */
+	char *direction[] = {
+		"sfirewall filter 10 lan2wan in insert permit tcp 10.0.0.5/32 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 20 lan2wan fw insert deny tcp 10.0.0.0/24 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 30 lan2wan in insert permit tcp 10.0.0.0/16 any 0.0.0.0/0 80 any any any",
+		"sfirewall filter 40 lan2wan out insert permit tcp 10.0.0.0/25 any 0.0.0.0/0 80 any any any",
+	};
+	/* A day not known is no day in particular */
+	char *days[] = {
+		"sfirewall filter 10 lan2wan fw insert deny tcp 10.0.0.0/8 any 0.0.0.0/0 any mon any any",
+		"sfirewall filter 20 lan2wan fw insert permit tcp 10.0.0.0/8 any 0.0.0.0/0 any Mon|Tue any any",
+		"sfirewall filter 30 lan2wan fw insert permit tcp 10.0.0.0/8 any 0.0.0.0/0 any tue any any",
+	};
+
+	CHECK_STR (optimize (shadow, 3, &removed, f), "-, shadowed by 10, duplicate of 10");
+	CHECK (removed == 2);
+
+	CHECK_STR (optimize (contained, 2, &removed, f), "contained in 20, -");
+	CHECK (removed == 1);
+
+	CHECK_STR (optimize (crossed, 3, &removed, f), "-, -, -");
+	CHECK (removed == 0);
+
+	/* 10 and 20 merge into 192.168.0.0/24, which merges with 30 */
+	CHECK_STR (optimize (merged, 5, &removed, f), "-, merged into 10, merged into 10, -, merged into 40");
+	CHECK (removed == 3);
+	CHECK (f[0].merged && f[3].merged);
+	CHECK_STR (f[0].param[6], "192.168.0.0/23");
+	CHECK_STR (f[0].line, "sfirewall filter 10 lan2wan fw insert deny udp 192.168.0.0/23 any 8.8.8.8/32 53 any any any");
+	CHECK_STR (f[3].param[8], "8.8.4.4/31");
+
+	CHECK_STR (optimize (apart, 4, &removed, f), "-, -, -, -");
+	CHECK (removed == 0);
+
+	CHECK_STR (optimize (direction, 4, &removed, f), "-, -, -, shadowed by 20");
+	CHECK (removed == 1);
+
+	CHECK (fw_days_parse ("any") == 0x7f);
+	CHECK (fw_days_parse ("mon|tue|sun") == 0x43);
+	CHECK (fw_days_parse ("Mon|tue") == -1);
+	CHECK (fw_days_parse ("montue") == -1);
+	CHECK (fw_days_parse ("|") == -1);
+	CHECK_STR (optimize (days, 3, &removed, f), "-, -, -");
+	CHECK (removed == 0);
+}
+
+int main (void)
+{
+	test_parse ();
+	test_delta ();
+	test_restart ();
+	test_generate ();
+	test_portmap ();
+	test_prefix ();
+	test_ports ();
+	test_optimize ();
+	return test_result ("test_fw");
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* The lpm table against a brute force search and the properties of
+   lpm_aggregate() on random prefixes inside 10.0.0.0/16, where the
+   covered addresses fit in a bitmap. */
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "../lpm.h"
+#include "test.h"
+
+#define ROUNDS		200
+#define PREFIXES	64
+#define SPACE		65536		/* the addresses of 10.0.0.0/16 */
+
+/* The index of the first address of the prefix in the space. */
+static unsigned int lpm_index (const struct lpm_prefix *p)
+{
+	return p->addr[2] << 8 | p->addr[3];
+}
+
+static void lpm_set (struct lpm_prefix *p, unsigned int index, int plen)
+{
+	unsigned int mask = 0xffff << (32 - plen);
+
+	memset (p, 0, sizeof (*p));
+	p->family = AF_INET;
+	p->plen = plen;
+	p->addr[0] = 10;
+	p->addr[2] = (index & mask) >> 8;
+	p->addr[3] = (index & mask) & 0xff;
+}
+
+static unsigned int lpm_size (const struct lpm_prefix *p)
+{
+	return 1u << (32 - p->plen);
+}
+
+static void lpm_random (struct lpm_prefix *p)
+{
+	lpm_set (p, rand () % SPACE, 16 + rand () % 17);
+}
+
+static int lpm_covers (const struct lpm_prefix *p, unsigned int index)
+{
+	unsigned int base = lpm_index (p);
+
+	return index >= base && index < base + lpm_size (p);
+}
+
+/* Mark the addresses of the prefixes, return how many were marked. */
+static unsigned int lpm_mark (uint8_t *bitmap, const struct lpm_prefix *p, int n)
+{
+	unsigned int a, marked = 0;
+	int i;
+
+	memset (bitmap, 0, SPACE);
+	for (i = 0; i < n; i++)
+		for (a = lpm_index (&p[i]); a < lpm_index (&p[i]) + lpm_size (&p[i]); a++)
+			if (!bitmap[a]) {
+				bitmap[a] = 1;
+				marked++;
+			}
+	return marked;
+}
+
+/* lpm_match() finds the longest of the inserted prefixes covering an
+   address, the data of a prefix inserted twice is the last one. */
+static void test_match (void)
+{
+	struct lpm_table *table = lpm_table_new ();
+	struct lpm_prefix p[PREFIXES], addr, match;
+	int i, j, best, bad = 0;
+	void *data;
+
+	for (i = 0; i < PREFIXES; i++) {
+		lpm_random (&p[i]);
+		lpm_insert (table, &p[i], &p[i]);
+	}
+
+	for (j = 0; j < 10000; j++) {
+		lpm_set (&addr, rand () % SPACE, 32);
+		best = -1;
+		for (i = 0; i < PREFIXES; i++)
+			if (lpm_covers (&p[i], lpm_index (&addr)) &&
+					(best < 0 || p[i].plen >= p[best].plen))
+				best = i;
+
+		data = lpm_match (table, &addr, &match);
+		if (best < 0 ? data != NULL :
+				data != &p[best] || match.plen != p[best].plen ||
+				lpm_index (&match) != lpm_index (&p[best]))
+			bad++;
+	}
+	CHECK (bad == 0);
+	lpm_table_free (table, NULL);
+}
+
+/* The aggregated prefixes cover the same addresses, are sorted and
+   disjoint, and none of them could be merged into its parent. */
+static void test_aggregate (void)
+{
+	struct lpm_prefix p[PREFIXES], parent;
+	uint8_t *before = malloc (SPACE), *after = malloc (SPACE);
+	unsigned int a, covered, sum;
+	int round, i, n, same = 0, disjoint = 0, sorted = 0, maximal = 0;
+
+	for (round = 0; round < ROUNDS; round++) {
+		/* Few to many prefixes of a narrow length range merge often */
+		n = 1 + rand () % PREFIXES;
+		for (i = 0; i < n; i++)
+			lpm_set (&p[i], rand () % 4096, 24 + rand () % 9);
+		lpm_mark (before, p, n);
+
+		n = lpm_aggregate (p, n);
+		covered = lpm_mark (after, p, n);
+		same += memcmp (before, after, SPACE) == 0;
+
+		for (i = 0, sum = 0; i < n; i++)
+			sum += lpm_size (&p[i]);
+		disjoint += sum == covered;
+
+		for (i = 1; i < n && lpm_index (&p[i - 1]) < lpm_index (&p[i]); i++)
+			;
+		sorted += i >= n;
+
+		for (i = 0; i < n; i++) {
+			if (p[i].plen == 16)
+				continue;
+			lpm_set (&parent, lpm_index (&p[i]), p[i].plen - 1);
+			for (a = lpm_index (&parent); a < lpm_index (&parent) + lpm_size (&parent); a++)
+				if (!after[a])
+					break;
+			if (a == lpm_index (&parent) + lpm_size (&parent))
+				break;
+		}
+		maximal += i == n;
+	}
+	CHECK (same == ROUNDS);
+	CHECK (disjoint == ROUNDS);
+	CHECK (sorted == ROUNDS);
+	CHECK (maximal == ROUNDS);
+	free (before);
+	free (after);
+}
+
+/* The families are aggregated apart, IPv4 first. */
+static void test_aggregate_family (void)
+{
+	static const char *list[] = {
+		"2001:db8::/33", "10.0.1.0/24", "2001:db8:8000::/33",
+		"10.0.0.0/24", "2001:db8::1", "0.0.0.0/0",
+	};
+	struct lpm_prefix p[6];
+	char buf[64];
+	int i;
+
+	for (i = 0; i < 6; i++)
+		CHECK (lpm_prefix_parse (&p[i], list[i]) == 0);
+	CHECK (lpm_aggregate (p, 6) == 2);
+	CHECK_STR (lpm_prefix_str (&p[0], buf, sizeof (buf)), "0.0.0.0/0");
+	CHECK_STR (lpm_prefix_str (&p[1], buf, sizeof (buf)), "2001:db8::/32");
+}
+
+int main (void)
+{
+	srand (1);
+	test_match ();
+	test_aggregate ();
+	test_aggregate_family ();
+	return test_result ("test_lpm");
+}
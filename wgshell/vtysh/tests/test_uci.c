@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* uci_load()/uci_save() against a fixture /etc/config/firewall. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "linklist.h"
+#include "uci.h"
+#include "test.h"
+
+static void test_load (void)
+{
+	struct uci_package *pkg;
+	struct uci_section *sec;
+	struct uci_option *opt;
+	struct listnode *nn;
+	int networks = 0;
+
+	pkg = uci_load (FIXTURE_DIR "/firewall");
+	CHECK (pkg != NULL);
+	if (pkg == NULL)
+		return;
+	CHECK (listcount (pkg->sections) == 8);
+
+	/* Unquoted values and lists */
+	sec = uci_section_find (pkg, "zone", "name", "wan");
+	CHECK (sec != NULL);
+	CHECK_STR (uci_option_get (sec, "input"), "REJECT");
+	CHECK_STR (uci_option_get (sec, "mtu_fix"), "1");
+	CHECK (uci_option_get (sec, "network") == NULL);
+	LIST_LOOP (sec->options, opt, nn)
+		if (opt->is_list && strcmp (opt->name, "network") == 0)
+			networks++;
+	CHECK (networks == 2);
+
+	/* A named section and the escapes of a double quoted value */
+	sec = uci_section_find (pkg, "rule", "name", "Allow-WG-Inbound");
+	CHECK (sec != NULL && sec->name && strcmp (sec->name, "wg") == 0);
+	sec = uci_section_find (pkg, "rule", "name", "Allow-\"Quoted\" it's");
+	CHECK (sec != NULL);
+	CHECK_STR (uci_option_get (sec, "dest_port"), "22 443");
+
+	/* The second rule of the same name */
+	sec = uci_section_find (pkg, "rule", "name", "Allow-WG-Inbound");
+	CHECK (uci_section_find_next (pkg, sec, "rule", "name", "Allow-WG-Inbound") != NULL);
+	CHECK (uci_section_find (pkg, "rule", "name", "Allow-Nothing") == NULL);
+	uci_free (pkg);
+
+	errno = 0;
+	CHECK (uci_load (FIXTURE_DIR "/firewall.bad") == NULL && errno == EINVAL);
+	CHECK (uci_load (FIXTURE_DIR "/nonexistent") == NULL);
+}
+
+static void test_edit (void)
+{
+	struct uci_package *pkg;
+	struct uci_section *sec;
+
+	pkg = uci_load (FIXTURE_DIR "/firewall");
+	if (pkg == NULL)
+		return;
+	sec = uci_section_find (pkg, "defaults", NULL, NULL);
+	CHECK (sec != NULL);
+	CHECK (uci_option_set (sec, "input", "ACCEPT") == 0);
+	CHECK (uci_option_set (sec, "input", "DROP") == 1);
+	CHECK (uci_option_set (sec, "drop_invalid", "1") == 1);
+	CHECK_STR (uci_option_get (sec, "input"), "DROP");
+	uci_option_del (sec, "syn_flood");
+	CHECK (uci_option_get (sec, "syn_flood") == NULL);
+
+	sec = uci_section_add (pkg, "include", "user");
+	uci_option_set (sec, "path", "/etc/firewall.user");
+	CHECK (uci_section_find (pkg, "include", "path", "/etc/firewall.user") == sec);
+	uci_section_del (pkg, sec);
+	CHECK (uci_section_find (pkg, "include", NULL, NULL) == NULL);
+	uci_free (pkg);
+}
+
+/* A saved package reads back the same and is written in the format of
+   'uci commit', a second save gives the same bytes. */
+static void test_save (void)
+{
+	struct uci_package *pkg;
+	char path[64];
+
+	snprintf (path, sizeof (path), "/tmp/test_uci.%d", (int) getpid ());
+	pkg = uci_load (FIXTURE_DIR "/firewall");
+	if (pkg == NULL)
+		return;
+	CHECK (uci_save (pkg, path) == 0);
+	uci_free (pkg);
+	CHECK_FILE (path, FIXTURE_DIR "/firewall.saved");
+
+	pkg = uci_load (path);
+	CHECK (pkg != NULL);
+	if (pkg) {
+		CHECK (uci_save (pkg, path) == 0);
+		uci_free (pkg);
+	}
+	CHECK_FILE (path, FIXTURE_DIR "/firewall.saved");
+	unlink (path);
+}
+
+int main (void)
+{
+	test_load ();
+	test_edit ();
+	test_save ();
+	return test_result ("test_uci");
+}
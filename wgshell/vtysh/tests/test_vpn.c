@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* The static functions of cmd_vpn.c, the module is included. */
+
+#define USAGE_PATH		"/tmp/test_vpn.usage"
+#define USAGE_BOOT_ID_PATH	"/tmp/test_vpn.boot_id"
+
+#include "../cmd/cmd_vpn.c"
+#include "test.h"
+
+static int copy_file (const char *src, const char *dst)
+{
+	char *text = test_read_file (src);
+	FILE *fp = fopen (dst, "w");
+
+	if (text == NULL || fp == NULL) {
+		free (text);
+		if (fp)
+			fclose (fp);
+		return -1;
+	}
+	fputs (text, fp);
+	fclose (fp);
+	free (text);
+	return 0;
+}
+
+/* The rule is updated in place, the duplicate is dropped and an unchanged
+   rule leaves the file alone. */
+static void test_firewall_rule (void)
+{
+	struct uci_package *pkg;
+	struct uci_section *sec;
+	char path[64];
+
+	snprintf (path, sizeof (path), "/tmp/test_vpn.%d", (int) getpid ());
+	CHECK (copy_file (FIXTURE_DIR "/firewall", path) == 0);
+
+	CHECK (wg_firewall_rule_update (path, 51821) == 1);
+	CHECK_FILE (path, FIXTURE_DIR "/firewall.wg");
+	CHECK (wg_firewall_rule_update (path, 51821) == 0);
+	CHECK_FILE (path, FIXTURE_DIR "/firewall.wg");
+
+	/* A config without the rule gets one */
+	pkg = uci_load (path);
+	sec = uci_section_find (pkg, "rule", "name", "Allow-WG-Inbound");
+	uci_section_del (pkg, sec);
+	uci_save (pkg, path);
+	uci_free (pkg);
+	CHECK (wg_firewall_rule_update (path, 51822) == 1);
+	pkg = uci_load (path);
+	sec = uci_section_find (pkg, "rule", "name", "Allow-WG-Inbound");
+	CHECK (sec != NULL && sec->name == NULL);
+	CHECK_STR (uci_option_get (sec, "dest_port"), "51822");
+	CHECK_STR (uci_option_get (sec, "proto"), "udp");
+	CHECK (uci_section_find_next (pkg, sec, "rule", "name", "Allow-WG-Inbound") == NULL);
+	uci_free (pkg);
+	unlink (path);
+
+	CHECK (wg_firewall_rule_update (FIXTURE_DIR "/firewall.bad", 51820) == -1);
+}
+
+#define BOOT_ID		"0b9cd1d2-4c1f-4d0e-9a51-6f5e8f1c2a10"
+
+static void usage_write (const char *magic, const char *boot_id, uint32_t ifindex)
+{
+	struct wg_usage_header header;
+	struct wg_usage record;
+	FILE *fp = fopen (USAGE_PATH, "w");
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, magic, sizeof (header.magic));
+	header.count = 1;
+	memcpy (header.boot_id, boot_id, sizeof (header.boot_id));
+	header.ifindex = ifindex;
+	memset (&record, 0, sizeof (record));
+	record.rx_total = 5000;
+	record.tx_total = 7000;
+	record.rx_last = 1000;
+	record.tx_last = 2000;
+
+	/* A "WGU1" header is the magic and the count */
+	if (!strcmp (magic, USAGE_MAGIC_V1))
+		fwrite (&header, offsetof (struct wg_usage_header, boot_id), 1, fp);
+	else
+		fwrite (&header, sizeof (header), 1, fp);
+	fwrite (&record, sizeof (record), 1, fp);
+	fclose (fp);
+}
+
+/* The saved kernel counters only count for the boot and the interface
+   they were read on. */
+static void test_usage (void)
+{
+	struct wg_usage *usage;
+	uint32_t lo = if_nametoindex ("lo");
+	time_t saved;
+	FILE *fp;
+
+	fp = fopen (USAGE_BOOT_ID_PATH, "w");
+	fputs (BOOT_ID "\n", fp);
+	fclose (fp);
+
+	usage_write (USAGE_MAGIC, BOOT_ID, lo);
+	CHECK (wg_usage_load (&usage, &saved, "lo") == 1);
+	CHECK (usage && usage[0].rx_last == 1000 && usage[0].tx_last == 2000 && usage[0].rx_total == 5000);
+	XFREE (MTYPE_TMP, usage);
+
+	/* Rebooted */
+	usage_write (USAGE_MAGIC, "f00dd1d2-4c1f-4d0e-9a51-6f5e8f1c2a10", lo);
+	CHECK (wg_usage_load (&usage, &saved, "lo") == 1);
+	CHECK (usage && usage[0].rx_last == 0 && usage[0].tx_last == 0 && usage[0].rx_total == 5000);
+	XFREE (MTYPE_TMP, usage);
+
+	/* The interface was created again */
+	usage_write (USAGE_MAGIC, BOOT_ID, lo + 100);
+	CHECK (wg_usage_load (&usage, &saved, "lo") == 1);
+	CHECK (usage && usage[0].rx_last == 0 && usage[0].tx_last == 0);
+	XFREE (MTYPE_TMP, usage);
+
+	/* A file of the old layout is taken as it is */
+	usage_write (USAGE_MAGIC_V1, "", 0);
+	CHECK (wg_usage_load (&usage, &saved, "lo") == 1);
+	CHECK (usage && usage[0].rx_last == 1000 && usage[0].tx_total == 7000);
+	XFREE (MTYPE_TMP, usage);
+
+	usage_write ("WGU9", BOOT_ID, lo);
+	CHECK (wg_usage_load (&usage, &saved, "lo") == -1 && usage == NULL);
+
+	unlink (USAGE_PATH);
+	CHECK (wg_usage_load (&usage, &saved, "lo") == 0 && usage == NULL);
+	unlink (USAGE_BOOT_ID_PATH);
+}
+
+#define PEER_A		"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA="
+#define PEER_B		"BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB="
+
+/* A list is not limited in its number of prefixes or its length. */
+static void test_allowedips_long (void)
+{
+	struct lpm_prefix *p;
+	char *list, *merged, bad[64];
+	int i, len = 0, before, after;
+
+	list = malloc (300 * 16);
+	for (i = 0; i < 300; i++)
+		len += sprintf (list + len, "%s10.0.%d.%d", i ? "," : "", i / 256, i % 256);
+	CHECK (len > 2048);
+
+	CHECK (wg_allowedips_parse (list, &p, bad, sizeof (bad)) == 300);
+	CHECK (p && p[299].plen == 32 && p[299].addr[2] == 1 && p[299].addr[3] == 43);
+	XFREE (MTYPE_TMP, p);
+
+	/* 10.0.0.0/24 + 10.0.1.0/27 + 10.0.1.32/29 + 10.0.1.40/30 */
+	merged = wg_allowedips_aggregate (list, &before, &after);
+	CHECK (before == 300 && after == 4);
+	CHECK_STR (merged, "10.0.0.0/24,10.0.1.0/27,10.0.1.32/29,10.0.1.40/30");
+	XFREE (MTYPE_TMP, merged);
+
+	strcat (list, ",10.0.9.300");
+	CHECK (wg_allowedips_parse (list, &p, bad, sizeof (bad)) == -1 && p == NULL);
+	CHECK_STR (bad, "10.0.9.300");
+	CHECK (wg_allowedips_parse ("", &p, bad, sizeof (bad)) == -1 && p == NULL);
+	free (list);
+}
+
+/* An overlap with another peer is refused when typed and taken with a
+   warning when the saved config is replayed at boot. */
+static void test_allowedips_overlap (void)
+{
+	struct vty *vty = vty_new ();
+	struct lpm_prefix p;
+
+	vty->type = VTY_SHELL;
+	config_add_line (config_top, "wg peer " PEER_A " allowed-ips 10.0.0.0/8");
+
+	CHECK (wg_allowedips_set (vty, PEER_B, "10.1.0.0/16") == CMD_WARNING);
+	lpm_prefix_parse (&p, "10.1.0.0/16");
+	CHECK (lpm_get (wg_allowedips, &p) == NULL);
+
+	host.boot = 1;
+	CHECK (wg_allowedips_set (vty, PEER_B, "10.1.0.0/16") == CMD_SUCCESS);
+	host.boot = 0;
+	CHECK_STR (lpm_get (wg_allowedips, &p), PEER_B);
+
+	CHECK (wg_allowedips_set (vty, PEER_B, "192.168.1.0/24") == CMD_SUCCESS);
+	vty_destroy (vty);
+}
+
+#define FIRST_IP	"\"2001:db8:ffff:ffff:ffff:ffff:ffff:0/128\","
+
+/* A peer with more allowed ips than fitted the old 4096 byte buffer is
+   listed whole, in json too. */
+static void test_allowedips_str (void)
+{
+	struct wgallowedip ips[200];
+	struct wgpeer peer;
+	char *str, *last;
+	int i;
+
+	memset (&peer, 0, sizeof (peer));
+	memset (ips, 0, sizeof (ips));
+	for (i = 0; i < 200; i++) {
+		ips[i].family = AF_INET6;
+		inet_pton (AF_INET6, "2001:db8:ffff:ffff:ffff:ffff:ffff:0", &ips[i].ip6);
+		ips[i].ip6.s6_addr[15] = i;
+		ips[i].cidr = 128;
+		ips[i].next_allowedip = i < 199 ? &ips[i + 1] : NULL;
+	}
+	peer.first_allowedip = &ips[0];
+
+	str = wg_allowedips_str (&peer, 1);
+	CHECK (strlen (str) > 4096);
+	CHECK (!strncmp (str, FIRST_IP, sizeof (FIRST_IP) - 1));
+	last = strrchr (str, ',');
+	CHECK_STR (last, ",\"2001:db8:ffff:ffff:ffff:ffff:ffff:c7/128\"");
+	XFREE (MTYPE_TMP, str);
+
+	str = wg_allowedips_str (&peer, 0);
+	CHECK_STR (strrchr (str, ','), ",2001:db8:ffff:ffff:ffff:ffff:ffff:c7/128");
+	XFREE (MTYPE_TMP, str);
+
+	peer.first_allowedip = NULL;
+	str = wg_allowedips_str (&peer, 1);
+	CHECK_STR (str, "");
+	XFREE (MTYPE_TMP, str);
+}
+
+int main (void)
+{
+	config_init ();
+	test_firewall_rule ();
+	test_usage ();
+	test_allowedips_long ();
+	test_allowedips_overlap ();
+	test_allowedips_str ();
+	return test_result ("test_vpn");
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Minimal reader/writer of UCI configuration files. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "memory.h"
+#include "linklist.h"
+#include "uci.h"
+
+#define UCI_TOKEN_MAX	8
+
+static void uci_option_free (struct uci_option *opt)
+{
+	XFREE (MTYPE_TMP, opt->name);
+	XFREE (MTYPE_TMP, opt->value);
+	XFREE (MTYPE_TMP, opt);
+}
+
+static void uci_section_free (struct uci_section *sec)
+{
+	list_delete (sec->options);
+	XFREE (MTYPE_TMP, sec->type);
+	if (sec->name)
+		XFREE (MTYPE_TMP, sec->name);
+	XFREE (MTYPE_TMP, sec);
+}
+
+/* Split a line into at most UCI_TOKEN_MAX words in place.  Words may be
+   quoted with ' or " (with \ escapes), a word starting with # ends the
+   line.  Return the number of words or -1 on a syntax error. */
+static int uci_tokenize (char *line, char **tok)
+{
+	char *r = line, *w;
+	int n = 0;
+	char q;
+
+	while (1) {
+		while (*r == ' ' || *r == '\t' || *r == '\r' || *r == '\n')
+			r++;
+		if (*r == '\0' || *r == '#')
+			return n;
+		if (n == UCI_TOKEN_MAX)
+			return -1;
+
+		tok[n++] = w = r;
+		while (*r && *r != ' ' && *r != '\t' && *r != '\r' && *r != '\n') {
+			if (*r == '\'' || *r == '"') {
+				q = *r++;
+				while (*r && *r != q) {
+					if (q == '"' && *r == '\\' && r[1])
+						r++;
+					*w++ = *r++;
+				}
+				if (*r != q)
+					return -1;
+				r++;
+			} else if (*r == '\\' && r[1]) {
+				r++;
+				*w++ = *r++;
+			} else
+				*w++ = *r++;
+		}
+		if (*r)
+			r++;
+		*w = '\0';
+	}
+}
+
+struct uci_package *uci_load (char *path)
+{
+	struct uci_package *pkg;
+	struct uci_section *sec = NULL;
+	struct uci_option *opt;
+	char *tok[UCI_TOKEN_MAX];
+	char *line = NULL;
+	size_t size = 0;
+	int n;
+	FILE *fp;
+
+	fp = fopen (path, "r");
+	if (fp == NULL)
+		return NULL;
+
+	pkg = XCALLOC (MTYPE_TMP, sizeof (struct uci_package));
+	pkg->sections = list_new ();
+	pkg->sections->del = (void (*) (void *)) uci_section_free;
+
+	while (getline (&line, &size, fp) > 0) {
+		n = uci_tokenize (line, tok);
+		if (n < 0)
+			goto error;
+		if (n == 0 || strcmp (tok[0], "package") == 0)
+			continue;
+
+		if (strcmp (tok[0], "config") == 0 && (n == 2 || n == 3)) {
+			sec = uci_section_add (pkg, tok[1], (n == 3) ? tok[2] : NULL);
+		} else if ((strcmp (tok[0], "option") == 0 || strcmp (tok[0], "list") == 0) &&
+				n == 3 && sec) {
+			opt = XCALLOC (MTYPE_TMP, sizeof (struct uci_option));
+			opt->name = XSTRDUP (MTYPE_TMP, tok[1]);
+			opt->value = XSTRDUP (MTYPE_TMP, tok[2]);
+			opt->is_list = (tok[0][0] == 'l');
+			listnode_add (sec->options, opt);
+		} else
+			goto error;
+	}
+	free (line);
+	fclose (fp);
+	return pkg;
+
+error:
+	free (line);
+	fclose (fp);
+	uci_free (pkg);
+	errno = EINVAL;
+	return NULL;
+}
+
+void uci_free (struct uci_package *pkg)
+{
+	list_delete (pkg->sections);
+	XFREE (MTYPE_TMP, pkg);
+}
+
+/* Write a value in single quotes, a quote inside is written as '\''. */
+static void uci_write_value (FILE *fp, char *value)
+{
+	fputc ('\'', fp);
+	for (; *value; value++) {
+		if (*value == '\'')
+			fputs ("'\\''", fp);
+		else
+			fputc (*value, fp);
+	}
+	fputc ('\'', fp);
+}
+
+/* Write the package to path the way 'uci commit' does.  The file is
+   replaced atomically by renaming a synced temporary file. */
+int uci_save (struct uci_package *pkg, char *path)
+{
+	struct uci_section *sec;
+	struct uci_option *opt;
+	struct listnode *nn, *nm;
+	char tmpfile[PATH_MAX];
+	struct stat sb;
+	mode_t mode = 0644;
+	FILE *fp;
+	int fd;
+
+	if (stat (path, &sb) == 0)
+		mode = sb.st_mode & 07777;
+
+	snprintf (tmpfile, sizeof (tmpfile), "%s.tmp", path);
+	fd = open (tmpfile, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd < 0)
+		return -1;
+	fp = fdopen (fd, "w");
+	if (fp == NULL) {
+		close (fd);
+		unlink (tmpfile);
+		return -1;
+	}
+
+	LIST_LOOP (pkg->sections, sec, nn) {
+		fprintf (fp, "\nconfig %s", sec->type);
+		if (sec->name) {
+			fputc (' ', fp);
+			uci_write_value (fp, sec->name);
+		}
+		fputc ('\n', fp);
+
+		LIST_LOOP (sec->options, opt, nm) {
+			fprintf (fp, "\t%s %s ", opt->is_list ? "list" : "option", opt->name);
+			uci_write_value (fp, opt->value);
+			fputc ('\n', fp);
+		}
+	}
+	fputc ('\n', fp);
+
+	if (fflush (fp) != 0 || fsync (fd) < 0) {
+		fclose (fp);
+		unlink (tmpfile);
+		return -1;
+	}
+	if (fclose (fp) != 0 || rename (tmpfile, path) < 0) {
+		unlink (tmpfile);
+		return -1;
+	}
+	return 0;
+}
+
+/* Find the first section after 'after'(NULL to search from the start) of
+   the type whose option has the value. */
+struct uci_section *uci_section_find_next (struct uci_package *pkg, struct uci_section *after,
+		char *type, char *option, char *value)
+{
+	struct uci_section *sec;
+	struct listnode *nn;
+	char *v;
+
+	nn = pkg->sections->head;
+	if (after) {
+		while (nn && nn->data != after)
+			nn = nn->next;
+		if (nn)
+			nn = nn->next;
+	}
+
+	for (; nn; nn = nn->next) {
+		sec = nn->data;
+		if (strcmp (sec->type, type) != 0)
+			continue;
+		if (option == NULL)
+			return sec;
+		v = uci_option_get (sec, option);
+		if (v && strcmp (v, value) == 0)
+			return sec;
+	}
+	return NULL;
+}
+
+struct uci_section *uci_section_find (struct uci_package *pkg, char *type,
+		char *option, char *value)
+{
+	return uci_section_find_next (pkg, NULL, type, option, value);
+}
+
+struct uci_section *uci_section_add (struct uci_package *pkg, char *type, char *name)
+{
+	struct uci_section *sec;
+
+	sec = XCALLOC (MTYPE_TMP, sizeof (struct uci_section));
+	sec->type = XSTRDUP (MTYPE_TMP, type);
+	if (name)
+		sec->name = XSTRDUP (MTYPE_TMP, name);
+	sec->options = list_new ();
+	sec->options->del = (void (*) (void *)) uci_option_free;
+	listnode_add (pkg->sections, sec);
+	return sec;
+}
+
+void uci_section_del (struct uci_package *pkg, struct uci_section *sec)
+{
+	listnode_delete (pkg->sections, sec);
+	uci_section_free (sec);
+}
+
+static struct uci_option *uci_option_lookup (struct uci_section *sec, char *name)
+{
+	struct uci_option *opt;
+	struct listnode *nn;
+
+	LIST_LOOP (sec->options, opt, nn)
+		if (! opt->is_list && strcmp (opt->name, name) == 0)
+			return opt;
+	return NULL;
+}
+
+char *uci_option_get (struct uci_section *sec, char *name)
+{
+	struct uci_option *opt = uci_option_lookup (sec, name);
+
+	return opt ? opt->value : NULL;
+}
+
+/* Set the option, return 1 if the section changed and 0 if the option
+   already had the value. */
+int uci_option_set (struct uci_section *sec, char *name, char *value)
+{
+	struct uci_option *opt = uci_option_lookup (sec, name);
+
+	if (opt) {
+		if (strcmp (opt->value, value) == 0)
+			return 0;
+		XFREE (MTYPE_TMP, opt->value);
+		opt->value = XSTRDUP (MTYPE_TMP, value);
+		return 1;
+	}
+
+	opt = XCALLOC (MTYPE_TMP, sizeof (struct uci_option));
+	opt->name = XSTRDUP (MTYPE_TMP, name);
+	opt->value = XSTRDUP (MTYPE_TMP, value);
+	listnode_add (sec->options, opt);
+	return 1;
+}
+
+void uci_option_del (struct uci_section *sec, char *name)
+{
+	struct uci_option *opt = uci_option_lookup (sec, name);
+
+	if (opt) {
+		listnode_delete (sec->options, opt);
+		uci_option_free (opt);
+	}
+}
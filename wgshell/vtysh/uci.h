@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Minimal reader/writer of UCI configuration files(/etc/config/...).
+ * A package is read into memory, edited and written back in the format
+ * 'uci commit' uses, without running the uci tool. */
+
+#ifndef __UCI_H__
+#define __UCI_H__
+
+struct uci_option {
+	char *name;
+	char *value;
+
+	/* 'list' instead of 'option' */
+	int is_list;
+};
+
+struct uci_section {
+	char *type;
+
+	/* NULL for an anonymous section */
+	char *name;
+
+	/* List of struct uci_option */
+	struct list *options;
+};
+
+struct uci_package {
+	/* List of struct uci_section */
+	struct list *sections;
+};
+
+struct uci_package *uci_load (char *path);
+int uci_save (struct uci_package *pkg, char *path);
+void uci_free (struct uci_package *pkg);
+
+struct uci_section *uci_section_find (struct uci_package *pkg, char *type,
+		char *option, char *value);
+struct uci_section *uci_section_find_next (struct uci_package *pkg, struct uci_section *after,
+		char *type, char *option, char *value);
+struct uci_section *uci_section_add (struct uci_package *pkg, char *type, char *name);
+void uci_section_del (struct uci_package *pkg, struct uci_section *sec);
+
+char *uci_option_get (struct uci_section *sec, char *name);
+int uci_option_set (struct uci_section *sec, char *name, char *value);
+void uci_option_del (struct uci_section *sec, char *name);
+
+#endif
@@ -37,6 +37,7 @@
 #include "command.h"
 #include "memory.h"
 #include "vtysh.h"
+#include "vtysh_config.h"
 
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -111,62 +112,81 @@ int vtysh_execute (char *line)
 	return vtysh_execute_func (line, 1);
 }
 
-/* Configration make from file. */
-static int vtysh_config_from_file (struct vty *vty, char *filename)
+/* Execute one configuration line in vty->buf. */
+static void vtysh_config_line (struct vty *vty)
 {
 	int ret;
 	vector vline;
 	struct cmd_element *cmd;
-	FILE *fp;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL)
-		return -1;
+	if (vty->buf[0] == '#')
+		return;
+	if (vty->buf[0] == '!')
+		vty->node = CONFIG_NODE;
 
-	while (fgets (vty->buf, VTY_BUFSIZ, fp)) {
-		if (vty->buf[0] == '#')
-			continue;
-		if (vty->buf[0] == '!')
-			vty->node = CONFIG_NODE;
+	vline = cmd_make_strvec (vty->buf);
 
-		vline = cmd_make_strvec (vty->buf);
+	/* In case of comment line */
+	if (vline == NULL)
+		return;
 
-		/* In case of comment line */
-		if (vline == NULL)
-			continue;
+	/* Execute configuration command : this is strict match */
+	ret = cmd_execute_command_strict (vline, vty, &cmd);
 
-		/* Execute configuration command : this is strict match */
+	/* Try again with setting node to CONFIG_NODE */
+	if (ret != CMD_SUCCESS && ret != CMD_SUCCESS_DAEMON && ret != CMD_WARNING) {
+		vtysh_execute ("end");
+		vtysh_execute ("configure terminal");
+		vty->node = CONFIG_NODE;
 		ret = cmd_execute_command_strict (vline, vty, &cmd);
+	}	  
 
-		/* Try again with setting node to CONFIG_NODE */
-		if (ret != CMD_SUCCESS && ret != CMD_SUCCESS_DAEMON && ret != CMD_WARNING) {
-			vtysh_execute ("end");
-			vtysh_execute ("configure terminal");
-			vty->node = CONFIG_NODE;
-			ret = cmd_execute_command_strict (vline, vty, &cmd);
-		}	  
-
-		cmd_free_strvec (vline);
-
-		switch (ret) {
-			case CMD_WARNING:
-				//printf ("Warning...\n");
-				break;
-			case CMD_ERR_AMBIGUOUS:
-				printf ("%% Ambiguous command.\n");
-				break;
-			case CMD_ERR_NO_MATCH:
-				printf ("%% Unknown command: %s", vty->buf);
-				break;
-			case CMD_ERR_INCOMPLETE:
-				printf ("%% Command incomplete.\n");
-				break;
-			case CMD_SUCCESS_DAEMON:
-				if (cmd->func)
-					(*cmd->func) (cmd, vty, 0, NULL);
-				break;
-		}
+	cmd_free_strvec (vline);
+
+	switch (ret) {
+		case CMD_WARNING:
+			//printf ("Warning...\n");
+			break;
+		case CMD_ERR_AMBIGUOUS:
+			printf ("%% Ambiguous command.\n");
+			break;
+		case CMD_ERR_NO_MATCH:
+			printf ("%% Unknown command: %s", vty->buf);
+			break;
+		case CMD_ERR_INCOMPLETE:
+			printf ("%% Command incomplete.\n");
+			break;
+		case CMD_SUCCESS_DAEMON:
+			if (cmd->func)
+				(*cmd->func) (cmd, vty, 0, NULL);
+			break;
 	}
+}
+
+/* Execute one line replayed from the journal or the cache. */
+static void vtysh_config_replay_line (char *line, void *arg)
+{
+	struct vty *vty = arg;
+
+	snprintf (vty->buf, VTY_BUFSIZ, "%s\n", line);
+	vtysh_config_line (vty);
+}
+
+/* Configration make from file. */
+static int vtysh_config_from_file (struct vty *vty, char *filename)
+{
+	FILE *fp;
+
+	if (config_journal_replay (filename, vtysh_config_replay_line, vty) == 0)
+		return CMD_SUCCESS;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets (vty->buf, VTY_BUFSIZ, fp))
+		vtysh_config_line (vty);
+
 	fclose(fp);
 	return CMD_SUCCESS;
 }
@@ -178,8 +198,14 @@ int vtysh_load_config(char *filename)
 
 	myvty->type = VTY_FILE;
 	myvty->node = CONFIG_NODE;
-	nRet = vtysh_config_from_file(myvty, filename);
+	if (config_cache_load(filename, vtysh_config_replay_line, myvty) == 0)
+		nRet = CMD_SUCCESS;
+	else {
+		nRet = vtysh_config_from_file(myvty, filename);
+		config_cache_save(filename);
+	}
 	vty_destroy(myvty);
+	config_journal_reset();
 	return nRet;
 }
 
@@ -190,11 +216,67 @@ int vtysh_boot_config(char *filename)
 
 	myvty->type = VTY_SHELL;
 	myvty->node = CONFIG_NODE;
+	host.defer = 1;
+	host.boot = 1;
 	nRet = vtysh_config_from_file(myvty, filename);
+	host.boot = 0;
+	host.defer = 0;
+	cmd_ip_flush();
+	cmd_vpn_flush();
 	vty_destroy(myvty);
 	return nRet;
 }
 
+/* Execute the commands in the file("-" is stdin) one per line, reporting
+   the status of every line.  Stop at the first failing line unless
+   keep_going is set.  The wireguard, address and route changes are
+   applied once at the end.  Return the number of failed lines. */
+int vtysh_batch (char *filename, int keep_going)
+{
+	char buf[VTY_BUFSIZ];
+	int lineno = 0;
+	int failed = 0;
+	int ret;
+	char *p;
+	FILE *fp;
+
+	if (strcmp (filename, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (filename, "r")) == NULL) {
+		printf ("%% Can't open batch file %s.\n", filename);
+		return 1;
+	}
+
+	host.defer = 1;
+	while (fgets (buf, sizeof (buf), fp)) {
+		lineno++;
+		buf[strcspn (buf, "\r\n")] = '\0';
+		for (p = buf; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '\0' || *p == '#' || *p == '!')
+			continue;
+
+		ret = vtysh_execute (p);
+		if (ret == CMD_SUCCESS || ret == CMD_SUCCESS_DAEMON) {
+			printf ("line %d: ok: %s\n", lineno, p);
+			continue;
+		}
+
+		printf ("line %d: failed(%d): %s\n", lineno, ret, p);
+		failed++;
+		if (! keep_going)
+			break;
+	}
+
+	if (fp != stdin)
+		fclose (fp);
+
+	host.defer = 0;
+	cmd_ip_flush ();
+	cmd_vpn_flush ();
+	return failed;
+}
+
 /* We don't care about the point of the cursor when '?' is typed. */
 static int vtysh_rl_describe ()
 {
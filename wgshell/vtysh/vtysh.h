@@ -32,6 +32,7 @@
 int vtysh_load_config(char *filename);
 int vtysh_boot_config(char *filename);
 int vtysh_execute (char *line);
+int vtysh_batch (char *filename, int keep_going);
 void vtysh_init_vty ();
 char * vtysh_readline();
 
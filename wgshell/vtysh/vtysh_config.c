@@ -27,15 +27,74 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "command.h"
 #include "linklist.h"
 #include "memory.h"
+#include "hash.h"
 
 #include "vtysh.h"
 #include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "vtysh_config.h"
 
 static vector configvec;
 
 struct list *config_top;
 
+/* Configuration sections keyed by (index, name). */
+static struct hash *config_section_hash;
+
+/* Line indexes keyed by the line list they belong to. */
+static struct hash *config_index_hash;
+
+/* List nodes which share one hash string(a full line or an identity key). */
+struct config_ref {
+	char *str;
+	struct list *nodes;
+};
+
+/* Lookup index of one configuration line list. */
+struct config_index {
+	struct list *list;
+
+	/* Full line -> struct config_ref */
+	struct hash *byline;
+
+	/* Identity key -> struct config_ref */
+	struct hash *bykey;
+};
+
+/* The identity of a line is its leading tokens which name the configured
+   object, e.g. "wg peer PUBLICKEY" or "sfirewall filter NUM".  A prefix
+   lookup which is exactly an identity key is answered from the hash. */
+static struct config_ident {
+	char *prefix;
+	int ntokens;
+} config_idents[] = {
+	{ "wg peer",               3 },
+	{ "wg listenport",         2 },
+	{ "wg link-up",            2 },
+	{ "wg link-down",          2 },
+	{ "ip address",            3 },
+	{ "ip route",              4 },
+	{ "nameserver",            1 },
+	{ "hostname",              1 },
+	{ "enable password",       2 },
+	{ "password",              1 },
+	{ "bridge",                2 },
+	{ "sfirewall filter",      3 },
+	{ "sfirewall nat portmap", 4 },
+	{ NULL,                    0 }
+};
+
+#define CONFIG_KEY_MAX	256
+
+static void config_journal_record (struct list *config, char op, char *line);
+
 static int line_cmp (char *c1, char *c2)
 {
 	return strcmp (c1, c2);
@@ -46,6 +105,232 @@ static void line_del (char *line)
 	XFREE (MTYPE_VTYSH_CONFIG_LINE, line);
 }
 
+/* Make the identity key of str.  Return 1 if str has an identity and set
+   *exact when str has no tokens beyond it. */
+static int config_ident_key (char *str, char *key, int size, int *exact)
+{
+	struct config_ident *id;
+	char *p;
+	int len, n, k;
+
+	while (isspace ((int) *str))
+		str++;
+
+	for (id = config_idents; id->prefix; id++) {
+		len = strlen (id->prefix);
+		if (strncmp (str, id->prefix, len) == 0 &&
+				(str[len] == '\0' || isspace ((int) str[len])))
+			break;
+	}
+	if (! id->prefix)
+		return 0;
+
+	n = k = 0;
+	*exact = 1;
+	for (p = str; *p; ) {
+		while (isspace ((int) *p))
+			p++;
+		if (*p == '\0')
+			break;
+		if (n == id->ntokens) {
+			*exact = 0;
+			break;
+		}
+		if (n && k < size - 1)
+			key[k++] = ' ';
+		while (*p && ! isspace ((int) *p)) {
+			if (k >= size - 1)
+				return 0;
+			key[k++] = *p++;
+		}
+		n++;
+	}
+	key[k] = '\0';
+
+	return n == id->ntokens;
+}
+
+static unsigned int config_ref_key (struct config_ref *ref)
+{
+	return string_hash_make (ref->str);
+}
+
+static int config_ref_cmp (struct config_ref *r1, struct config_ref *r2)
+{
+	return strcmp (r1->str, r2->str) == 0;
+}
+
+static struct config_ref *config_ref_alloc (struct config_ref *probe)
+{
+	struct config_ref *ref;
+
+	ref = XCALLOC (MTYPE_VTYSH_CONFIG, sizeof (struct config_ref));
+	ref->str = XSTRDUP (MTYPE_VTYSH_CONFIG_LINE, probe->str);
+	ref->nodes = list_new ();
+	return ref;
+}
+
+static void config_ref_free (struct config_ref *ref)
+{
+	list_delete (ref->nodes);
+	XFREE (MTYPE_VTYSH_CONFIG_LINE, ref->str);
+	XFREE (MTYPE_VTYSH_CONFIG, ref);
+}
+
+static void config_ref_add (struct hash *hash, char *str, struct listnode *node)
+{
+	struct config_ref probe;
+	struct config_ref *ref;
+
+	probe.str = str;
+	ref = hash_get (hash, &probe, (void *(*) (void *)) config_ref_alloc);
+	listnode_add_old (ref->nodes, node);
+}
+
+static void config_ref_del (struct hash *hash, char *str, struct listnode *node)
+{
+	struct config_ref probe;
+	struct config_ref *ref;
+
+	probe.str = str;
+	ref = hash_lookup (hash, &probe);
+	if (! ref)
+		return;
+
+	listnode_delete (ref->nodes, node);
+	if (list_isempty (ref->nodes)) {
+		hash_release (hash, ref);
+		config_ref_free (ref);
+	}
+}
+
+/* Return the first list node registered under str, in list order. */
+static struct listnode *config_ref_first (struct hash *hash, char *str)
+{
+	struct config_ref probe;
+	struct config_ref *ref;
+	struct listnode *node;
+	struct listnode *first;
+	struct listnode *nn;
+
+	probe.str = str;
+	ref = hash_lookup (hash, &probe);
+	if (! ref)
+		return NULL;
+
+	first = NULL;
+	LIST_LOOP (ref->nodes, node, nn) {
+		if (! first || strcmp (node->data, first->data) < 0)
+			first = node;
+	}
+	return first;
+}
+
+static unsigned int config_index_key (struct config_index *ci)
+{
+	return (unsigned int) (((unsigned long) ci->list >> 4) * 2654435761UL);
+}
+
+static int config_index_cmp (struct config_index *c1, struct config_index *c2)
+{
+	return c1->list == c2->list;
+}
+
+static struct config_index *config_index_new (struct list *list)
+{
+	struct config_index *ci;
+
+	ci = XCALLOC (MTYPE_VTYSH_CONFIG, sizeof (struct config_index));
+	ci->list = list;
+	ci->byline = hash_create_size (64, (unsigned int (*) (void *)) config_ref_key,
+			(int (*) (void *, void *)) config_ref_cmp);
+	ci->bykey = hash_create_size (64, (unsigned int (*) (void *)) config_ref_key,
+			(int (*) (void *, void *)) config_ref_cmp);
+	hash_get (config_index_hash, ci, hash_alloc_intern);
+	return ci;
+}
+
+static void config_index_free (struct config_index *ci)
+{
+	hash_release (config_index_hash, ci);
+	hash_clean (ci->byline, (void (*) (void *)) config_ref_free);
+	hash_free (ci->byline);
+	hash_clean (ci->bykey, (void (*) (void *)) config_ref_free);
+	hash_free (ci->bykey);
+	XFREE (MTYPE_VTYSH_CONFIG, ci);
+}
+
+static struct config_index *config_index_lookup (struct list *list)
+{
+	struct config_index probe;
+
+	probe.list = list;
+	return hash_lookup (config_index_hash, &probe);
+}
+
+static void config_line_index (struct config_index *ci, struct listnode *node)
+{
+	char key[CONFIG_KEY_MAX];
+	int exact;
+
+	config_ref_add (ci->byline, node->data, node);
+	if (config_ident_key (node->data, key, sizeof (key), &exact))
+		config_ref_add (ci->bykey, key, node);
+}
+
+static void config_line_unindex (struct config_index *ci, struct listnode *node)
+{
+	char key[CONFIG_KEY_MAX];
+	int exact;
+
+	config_ref_del (ci->byline, node->data, node);
+	if (config_ident_key (node->data, key, sizeof (key), &exact))
+		config_ref_del (ci->bykey, key, node);
+}
+
+static struct listnode *config_line_insert (struct list *config, char *line)
+{
+	struct config_index *ci;
+	struct listnode *node;
+
+	node = listnode_add (config, XSTRDUP (MTYPE_VTYSH_CONFIG_LINE, line));
+	if ((ci = config_index_lookup (config)) != NULL)
+		config_line_index (ci, node);
+	config_journal_record (config, '+', line);
+	return node;
+}
+
+static void config_line_remove (struct list *config, struct listnode *node)
+{
+	struct config_index *ci;
+	char *pnt = node->data;
+
+	if ((ci = config_index_lookup (config)) != NULL)
+		config_line_unindex (ci, node);
+	config_journal_record (config, '-', pnt);
+	list_delete_node (config, node);
+	line_del (pnt);
+}
+
+/* Find the first line which starts with the given string. */
+static struct listnode *config_line_lookup_byleft (struct list *config, char *line)
+{
+	struct config_index *ci;
+	struct listnode *nn;
+	char key[CONFIG_KEY_MAX];
+	int exact;
+
+	ci = config_index_lookup (config);
+	if (ci && config_ident_key (line, key, sizeof (key), &exact) && exact)
+		return config_ref_first (ci->bykey, key);
+
+	for (nn = config->head; nn; nn = nn->next) {
+		if (nn->data && strncmp (nn->data, line, strlen (line)) == 0)
+			return nn;
+	}
+	return NULL;
+}
+
 static struct config *config_new ()
 {
 	struct config *config;
@@ -60,20 +345,32 @@ static int config_cmp (struct config *c1, struct config *c2)
 
 static void config_del (struct config* config)
 {
+	struct config_index *ci;
+
+	hash_release (config_section_hash, config);
+	if ((ci = config_index_lookup (config->line)) != NULL)
+		config_index_free (ci);
 	list_delete (config->line);
 	if (config->name)
 		XFREE (MTYPE_VTYSH_CONFIG_LINE, config->name);
 	XFREE (MTYPE_VTYSH_CONFIG, config);
 }
 
+static unsigned int config_section_key (struct config *config)
+{
+	return string_hash_make (config->name) ^ (config->index * 2654435761U);
+}
+
+static int config_section_cmp (struct config *c1, struct config *c2)
+{
+	return c1->index == c2->index && strcmp (c1->name, c2->name) == 0;
+}
+
 struct config *config_get (int index, char *line)
 {
 	struct config *config;
-	struct config *config_loop;
+	struct config probe;
 	struct list *master;
-	struct listnode *nn;
-
-	config = config_loop = NULL;
 
 	master = vector_lookup_ensure (configvec, index);
 
@@ -84,10 +381,9 @@ struct config *config_get (int index, char *line)
 		vector_set_index (configvec, index, master);
 	}
 
-	LIST_LOOP (master, config_loop, nn) {
-		if (strcmp (config_loop->name, line) == 0)
-			config = config_loop;
-	}
+	probe.name = line;
+	probe.index = index;
+	config = hash_lookup (config_section_hash, &probe);
 
 	if (! config) {
 		config = config_new ();
@@ -97,6 +393,8 @@ struct config *config_get (int index, char *line)
 		config->name = XSTRDUP (MTYPE_VTYSH_CONFIG_LINE, line);
 		config->index = index;
 		listnode_add (master, config);
+		hash_get (config_section_hash, config, hash_alloc_intern);
+		config_index_new (config->line);
 	}
 	return config;
 }
@@ -108,7 +406,7 @@ void config_add_line (struct list *config, char *line, ...)
 
 	va_start(ap, line);
 	if (vasprintf(&info, line, ap) > 0) {
-		listnode_add (config, XSTRDUP (MTYPE_VTYSH_CONFIG_LINE, info));
+		config_line_insert (config, info);
 		free(info);
 	}
 	va_end(ap);
@@ -116,13 +414,18 @@ void config_add_line (struct list *config, char *line, ...)
 
 void config_del_line (struct list *config, char *line)
 {
+	struct config_index *ci;
 	struct listnode *nn;
-	char *pnt;
 
-	LIST_LOOP (config, pnt, nn) {
-		if (strcmp (pnt, line) == 0) {
-			listnode_delete (config, pnt);
-			line_del(pnt);
+	if ((ci = config_index_lookup (config)) != NULL) {
+		if ((nn = config_ref_first (ci->byline, line)) != NULL)
+			config_line_remove (config, nn);
+		return;
+	}
+
+	for (nn = config->head; nn; nn = nn->next) {
+		if (nn->data && strcmp (nn->data, line) == 0) {
+			config_line_remove (config, nn);
 			return;
 		}
 	}
@@ -131,33 +434,95 @@ void config_del_line (struct list *config, char *line)
 void config_del_line_byleft(struct list *config, char *line)
 {
 	struct listnode *nn;
-	char *pnt;
 
-	LIST_LOOP (config, pnt, nn) {
-		if (strncmp(pnt, line, strlen(line)) == 0) {
-			listnode_delete (config, pnt);
-			line_del(pnt);
-			return;
-		}
-	}
+	if ((nn = config_line_lookup_byleft (config, line)) != NULL)
+		config_line_remove (config, nn);
 }
 
 char * config_get_line_byleft(struct list *config, char *line)
 {
 	struct listnode *nn;
-	char *pnt;
 
-	LIST_LOOP (config, pnt, nn) {
-		if (strncmp(pnt, line, strlen(line)) == 0) {
-			return pnt;
+	if ((nn = config_line_lookup_byleft (config, line)) != NULL)
+		return nn->data;
+
+	return NULL;
+}
+
+/* Replace the first line which starts with 'left' by the new line.  The
+   line keeps its list node when the sort order allows it, so replacing a
+   peer or a port costs no list walk at all. */
+void config_replace_line_byleft (struct list *config, char *left, char *line, ...)
+{
+	struct config_index *ci;
+	struct listnode *nn;
+	char *info = NULL;
+	va_list ap;
+
+	va_start(ap, line);
+	if (vasprintf(&info, line, ap) <= 0) {
+		va_end(ap);
+		return;
+	}
+	va_end(ap);
+
+	nn = config_line_lookup_byleft (config, left);
+	if (nn) {
+		if (! config->cmp ||
+				((! nn->prev || (*config->cmp) (nn->prev->data, info) <= 0) &&
+				 (! nn->next || (*config->cmp) (info, nn->next->data) <= 0))) {
+			ci = config_index_lookup (config);
+			if (ci)
+				config_line_unindex (ci, nn);
+			config_journal_record (config, '-', nn->data);
+			config_journal_record (config, '+', info);
+			line_del (nn->data);
+			nn->data = XSTRDUP (MTYPE_VTYSH_CONFIG_LINE, info);
+			if (ci)
+				config_line_index (ci, nn);
+			free(info);
+			return;
 		}
+		config_line_remove (config, nn);
 	}
 
-	return NULL;
+	config_line_insert (config, info);
+	free(info);
 }
 
-/* Display configuration to file pointer.  */
-void config_dump (FILE *fp)
+/* Growable buffer the configuration is rendered into. */
+struct config_buf {
+	char *data;
+	size_t len;
+	size_t size;
+
+	/* Offset of the configuration body, after the time stamp line. */
+	size_t body;
+};
+
+static void config_buf_printf (struct config_buf *buf, const char *format, ...)
+{
+	va_list ap;
+	int n;
+
+	while (1) {
+		va_start(ap, format);
+		n = vsnprintf (buf->data + buf->len, buf->size - buf->len, format, ap);
+		va_end(ap);
+
+		if (n < 0)
+			return;
+		if (buf->len + n < buf->size)
+			break;
+
+		buf->size = (buf->size + n + 1) * 2;
+		buf->data = XREALLOC (MTYPE_TMP, buf->data, buf->size);
+	}
+	buf->len += n;
+}
+
+/* Render the running configuration into one buffer. */
+static int config_render (struct config_buf *buf)
 {
 	struct listnode *nn;
 	struct listnode *nm;
@@ -174,40 +539,651 @@ void config_dump (FILE *fp)
 	tmp = localtime(&t);
 	if (tmp == NULL) {
 		vty_out(vty, "Get localtime error\n");
-		return;
+		return -1;
 	}
 	memset(timestr, 0, sizeof(timestr));
 	strftime(timestr, sizeof(timestr), "%c", tmp);
-	fprintf(fp,"#Writed on %s\n", timestr);
+
+	buf->size = 4096;
+	buf->len = 0;
+	buf->data = XMALLOC (MTYPE_TMP, buf->size);
+	buf->data[0] = '\0';
+
+	config_buf_printf (buf, "#Writed on %s\n", timestr);
+	buf->body = buf->len;
 
 	LIST_LOOP (config_top, line, nn) {
-		fprintf (fp, "%s\n", line);
-		fflush (fp);
+		config_buf_printf (buf, "%s\n", line);
 	}
-	fprintf (fp, "!\n");
-	fflush (fp);
+	config_buf_printf (buf, "!\n");
 
 	for (i = 0; i < vector_max (configvec); i++) {
 		if ((master = vector_slot (configvec, i)) != NULL) {
 			LIST_LOOP (master, config, nn) {
 				if (config->line->head) {
-					fprintf (fp, "%s\n", config->name);
-					fflush (fp);
+					config_buf_printf (buf, "%s\n", config->name);
 
 					LIST_LOOP (config->line, line, nm) {
-						fprintf  (fp, " %s\n", line);
-						fflush (fp);
+						config_buf_printf (buf, " %s\n", line);
 					}
-					fprintf (fp, "!\n");
-					fflush (fp);
+					config_buf_printf (buf, "!\n");
 				}
 			}
 		}
 	}
+	return 0;
+}
+
+/* Display configuration to file pointer.  */
+void config_dump (FILE *fp)
+{
+	struct config_buf buf;
+
+	if (config_render (&buf) < 0)
+		return;
+
+	fwrite (buf.data, 1, buf.len, fp);
+	fflush (fp);
+	XFREE (MTYPE_TMP, buf.data);
+}
+
+/* Is the body of the file(everything after the time stamp line) equal
+   to the rendered configuration ? */
+static int config_file_same (char *filename, struct config_buf *buf)
+{
+	struct stat sb;
+	size_t body_len = buf->len - buf->body;
+	char *data, *body;
+	ssize_t n;
+	size_t got;
+	int fd, same = 0;
+
+	fd = open (filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	if (fstat (fd, &sb) < 0 || sb.st_size <= (off_t) body_len ||
+			sb.st_size > (off_t) buf->len + 256) {
+		close (fd);
+		return 0;
+	}
+
+	data = XMALLOC (MTYPE_TMP, sb.st_size + 1);
+	for (got = 0; got < (size_t) sb.st_size; got += n) {
+		n = read (fd, data + got, sb.st_size - got);
+		if (n <= 0)
+			break;
+	}
+	close (fd);
+
+	if (got == (size_t) sb.st_size) {
+		data[got] = '\0';
+		body = (strncmp (data, "#Writed on ", 11) == 0) ? strchr (data, '\n') : NULL;
+		if (body && (size_t) (data + got - (body + 1)) == body_len &&
+				memcmp (body + 1, buf->data + buf->body, body_len) == 0)
+			same = 1;
+	}
+	XFREE (MTYPE_TMP, data);
+	return same;
+}
+
+/* Save the configuration to the file.  The new contents are written to a
+   temporary file with one write(), synced and renamed over the old file,
+   so a power cut leaves either the old or the new config.  Return 0 on
+   success, 1 if the file already had the same contents and -1 on error. */
+int config_save (char *filename)
+{
+	struct config_buf buf;
+	struct stat sb;
+	char tmpfile[PATH_MAX];
+	mode_t mode = 0644;
+	ssize_t n;
+	size_t off;
+	int fd, ret = -1;
+
+	if (config_render (&buf) < 0)
+		return -1;
+
+	if (config_file_same (filename, &buf)) {
+		XFREE (MTYPE_TMP, buf.data);
+		return 1;
+	}
+
+	if (stat (filename, &sb) == 0)
+		mode = sb.st_mode & 07777;
+
+	snprintf (tmpfile, sizeof (tmpfile), "%s.tmp", filename);
+	fd = open (tmpfile, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd < 0)
+		goto out;
+
+	for (off = 0; off < buf.len; off += n) {
+		n = write (fd, buf.data + off, buf.len - off);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			goto fail;
+	}
+
+	if (fsync (fd) < 0)
+		goto fail;
+	if (close (fd) < 0) {
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+
+	if (rename (tmpfile, filename) < 0)
+		goto fail;
+	ret = 0;
+	goto out;
+
+fail:
+	if (fd >= 0)
+		close (fd);
+	unlink (tmpfile);
+out:
+	XFREE (MTYPE_TMP, buf.data);
+	return ret;
+}
+
+/* Configuration journal.
+
+   'write' does not render the whole configuration every time.  The lines
+   added to and deleted from config_top since the last write are appended
+   to "<config>.journal" as "+ line" and "- line" records, and the loader
+   replays the configuration file(the snapshot) plus the journal.  Once
+   the journal grows past CONFIG_JOURNAL_RATIO percent of the snapshot,
+   a full snapshot is written and the journal is removed.
+
+   The first line of the journal names the snapshot it applies to by
+   inode, size and mtime.  A new snapshot is renamed into place, so a
+   journal left over from before a compaction never matches again. */
+
+#define CONFIG_JOURNAL_RATIO	50
+#define CONFIG_JOURNAL_MIN	4096
+
+/* Records not written yet. */
+static struct config_buf config_journal_pending;
+
+/* Record changes only after the configuration has been loaded. */
+static int config_journal_enabled;
+
+/* A change the journal can't describe(a section line), compact on write. */
+static int config_journal_full;
+
+static void config_journal_record (struct list *config, char op, char *line)
+{
+	if (! config_journal_enabled)
+		return;
+
+	if (config != config_top) {
+		if (config_index_lookup (config))
+			config_journal_full = 1;
+		return;
+	}
+	config_buf_printf (&config_journal_pending, "%c %s\n", op, line);
+}
+
+static void config_journal_name (char *filename, char *journal, size_t size)
+{
+	snprintf (journal, size, "%s.journal", filename);
+}
+
+static void config_journal_header (struct stat *sb, char *header, size_t size)
+{
+	snprintf (header, size, "#journal %lu %lld %lld\n", (unsigned long) sb->st_ino,
+			(long long) sb->st_size, (long long) sb->st_mtime);
+}
+
+/* Forget the pending records and start recording from now on. */
+void config_journal_reset ()
+{
+	config_journal_pending.len = 0;
+	config_journal_full = 0;
+	config_journal_enabled = 1;
+}
+
+/* Is the journal valid for the snapshot ?  Return its size or -1. */
+static off_t config_journal_check (char *filename, char *journal)
+{
+	struct stat sb, jb;
+	char header[128];
+	char buf[128];
+	ssize_t n;
+	int fd;
+
+	if (stat (filename, &sb) < 0)
+		return -1;
+
+	fd = open (journal, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	config_journal_header (&sb, header, sizeof (header));
+	n = read (fd, buf, strlen (header));
+	if (fstat (fd, &jb) < 0 || n != (ssize_t) strlen (header) ||
+			memcmp (buf, header, n) != 0) {
+		close (fd);
+		return -1;
+	}
+	close (fd);
+	return jb.st_size;
+}
+
+/* Append the pending records to the journal. */
+static int config_journal_append (char *filename, char *journal, off_t jsize)
+{
+	struct config_buf *buf = &config_journal_pending;
+	struct stat sb;
+	char header[128];
+	struct iovec iov[2];
+	ssize_t n;
+	int fd, cnt = 0;
+
+	if (stat (filename, &sb) < 0)
+		return -1;
+
+	if (jsize < 0) {
+		fd = open (journal, O_WRONLY | O_CREAT | O_TRUNC, sb.st_mode & 07777);
+		config_journal_header (&sb, header, sizeof (header));
+		iov[cnt].iov_base = header;
+		iov[cnt++].iov_len = strlen (header);
+	}
+	else
+		fd = open (journal, O_WRONLY | O_APPEND);
+	if (fd < 0)
+		return -1;
+
+	iov[cnt].iov_base = buf->data;
+	iov[cnt++].iov_len = buf->len;
+
+	while (cnt) {
+		n = writev (fd, iov, cnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			close (fd);
+			return -1;
+		}
+		while (cnt && (size_t) n >= iov[0].iov_len) {
+			n -= iov[0].iov_len;
+			iov[0] = iov[1];
+			cnt--;
+		}
+		if (cnt) {
+			iov[0].iov_base = (char *) iov[0].iov_base + n;
+			iov[0].iov_len -= n;
+		}
+	}
+
+	if (fsync (fd) < 0) {
+		close (fd);
+		return -1;
+	}
+	return close (fd);
+}
+
+/* Write the changes to the configuration file.  Small changes go to the
+   journal, otherwise a full snapshot is saved.  Return 0 on success and
+   -1 on error. */
+int config_write (char *filename)
+{
+	char journal[PATH_MAX];
+	struct stat sb;
+	off_t jsize, limit;
+
+	config_journal_name (filename, journal, sizeof (journal));
+
+	if (config_journal_enabled && ! config_journal_full && stat (filename, &sb) == 0) {
+		if (config_journal_pending.len == 0)
+			return 0;
+
+		jsize = config_journal_check (filename, journal);
+		limit = sb.st_size * CONFIG_JOURNAL_RATIO / 100;
+		if (limit < CONFIG_JOURNAL_MIN)
+			limit = CONFIG_JOURNAL_MIN;
+
+		if ((jsize < 0 ? 0 : jsize) + (off_t) config_journal_pending.len <= limit) {
+			if (config_journal_append (filename, journal, jsize) < 0)
+				return -1;
+			config_journal_pending.len = 0;
+			config_cache_save (filename);
+			return 0;
+		}
+	}
+
+	if (config_save (filename) < 0)
+		return -1;
+	unlink (journal);
+	config_journal_pending.len = 0;
+	config_journal_full = 0;
+	config_cache_save (filename);
+	return 0;
+}
+
+/* Replay the configuration file plus its journal, calling func for every
+   resulting line.  Return -1 if there is no valid journal, the caller
+   then reads the file as it is. */
+int config_journal_replay (char *filename, void (*func) (char *, void *), void *arg)
+{
+	char journal[PATH_MAX];
+	struct config_index *ci;
+	struct list *top, *rest;
+	struct listnode *nn;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int in_top = 1;
+	FILE *fp;
+
+	config_journal_name (filename, journal, sizeof (journal));
+	if (config_journal_check (filename, journal) < 0)
+		return -1;
+
+	fp = fopen (filename, "r");
+	if (fp == NULL)
+		return -1;
+
+	top = list_new ();
+	top->del = (void (*) (void *))line_del;
+	top->cmp = (int (*)(void *, void *)) line_cmp;
+	ci = config_index_new (top);
+
+	rest = list_new ();
+	rest->del = (void (*) (void *))line_del;
+
+	/* The top level lines come first, up to the first '!'. */
+	while ((len = getline (&line, &size, fp)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (line[0] == '#')
+			continue;
+		if (in_top && line[0] == '!')
+			in_top = 0;
+		if (in_top)
+			config_line_insert (top, line);
+		else
+			listnode_add (rest, XSTRDUP (MTYPE_VTYSH_CONFIG_LINE, line));
+	}
+	fclose (fp);
+
+	fp = fopen (journal, "r");
+	if (fp) {
+		while ((len = getline (&line, &size, fp)) > 0) {
+			/* A record cut short by a crash is not applied. */
+			if (line[len - 1] != '\n' || len < 3 || line[1] != ' ')
+				continue;
+			line[--len] = '\0';
+			if (line[0] == '+')
+				config_line_insert (top, line + 2);
+			else if (line[0] == '-')
+				config_del_line (top, line + 2);
+		}
+		fclose (fp);
+	}
+	free (line);
+
+	for (nn = top->head; nn; nn = nn->next)
+		(*func) (nn->data, arg);
+	for (nn = rest->head; nn; nn = nn->next)
+		(*func) (nn->data, arg);
+
+	config_index_free (ci);
+	list_delete (top);
+	list_delete (rest);
+	return 0;
+}
+
+/* Binary configuration cache.
+
+   Loading the configuration executes every line of the file just to
+   rebuild config_top.  After a load or a write the store is also saved
+   to "<config>.cache", a header followed by the lines in order, each one
+   NUL terminated and flagged as stored or replayed.  A stored line is
+   put into config_top as it is; a replayed line is executed because
+   its command keeps state elsewhere(host name, passwords, ...).
+
+   The cache is used only when the inode, size, mtime and content hash
+   of the configuration file and of its journal match the header. */
+
+#define CONFIG_CACHE_MAGIC	0x43595456	/* "VTYC" */
+#define CONFIG_CACHE_VERSION	1
+
+#define CONFIG_CACHE_STORED	's'
+#define CONFIG_CACHE_REPLAY	'r'
+
+/* Commands which do nothing but check their arguments and set the line
+   while loading. */
+static char *config_cache_stored[] = {
+	"wg peer ",
+	"sfirewall filter ",
+	"sfirewall ipset ",
+	"sfirewall nat portmap ",
+	NULL
+};
+
+struct config_cache_source {
+	unsigned long long ino;
+	long long size;
+	long long mtime_sec;
+	long long mtime_nsec;
+	unsigned int hash;
+	unsigned int pad;
+};
+
+struct config_cache_header {
+	unsigned int magic;
+	unsigned int version;
+	struct config_cache_source config;
+	struct config_cache_source journal;
+	unsigned int count;
+	unsigned int hash;
+	unsigned long long len;
+};
+
+static unsigned int config_hash_buf (const char *buf, size_t len)
+{
+	unsigned int hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char) buf[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* Describe the file, a missing file is all zero. */
+static int config_cache_source (char *filename, struct config_cache_source *src)
+{
+	struct stat sb;
+	char *map;
+	int fd;
+
+	memset (src, 0, sizeof (struct config_cache_source));
+
+	fd = open (filename, O_RDONLY);
+	if (fd < 0)
+		return (errno == ENOENT) ? 0 : -1;
+
+	if (fstat (fd, &sb) < 0) {
+		close (fd);
+		return -1;
+	}
+	src->ino = sb.st_ino;
+	src->size = sb.st_size;
+	src->mtime_sec = sb.st_mtim.tv_sec;
+	src->mtime_nsec = sb.st_mtim.tv_nsec;
+
+	if (sb.st_size > 0) {
+		map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close (fd);
+			return -1;
+		}
+		src->hash = config_hash_buf (map, sb.st_size);
+		munmap (map, sb.st_size);
+	}
+	close (fd);
+	return 0;
+}
+
+static int config_cache_sources (char *filename, struct config_cache_source *config,
+		struct config_cache_source *journal)
+{
+	char jname[PATH_MAX];
+
+	config_journal_name (filename, jname, sizeof (jname));
+	if (config_cache_source (filename, config) < 0 || config->size == 0)
+		return -1;
+	return config_cache_source (jname, journal);
+}
+
+static int config_cache_is_stored (char *line)
+{
+	int i;
+
+	for (i = 0; config_cache_stored[i]; i++)
+		if (strncmp (line, config_cache_stored[i], strlen (config_cache_stored[i])) == 0)
+			return 1;
+	return 0;
+}
+
+static void config_cache_name (char *filename, char *cache, size_t size)
+{
+	snprintf (cache, size, "%s.cache", filename);
+}
+
+/* Save config_top to the cache of the configuration file. */
+void config_cache_save (char *filename)
+{
+	struct config_cache_header header;
+	struct config_buf buf;
+	struct listnode *nn;
+	struct list *master;
+	struct config *config;
+	char cache[PATH_MAX];
+	char tmpfile[PATH_MAX + 8];
+	char *line;
+	struct iovec iov[2];
+	int fd, i;
+
+	config_cache_name (filename, cache, sizeof (cache));
+
+	/* Sections are not cached. */
+	for (i = 0; i < vector_max (configvec); i++)
+		if ((master = vector_slot (configvec, i)) != NULL)
+			LIST_LOOP (master, config, nn)
+				if (config->line->head) {
+					unlink (cache);
+					return;
+				}
+
+	memset (&header, 0, sizeof (header));
+	header.magic = CONFIG_CACHE_MAGIC;
+	header.version = CONFIG_CACHE_VERSION;
+	if (config_cache_sources (filename, &header.config, &header.journal) < 0) {
+		unlink (cache);
+		return;
+	}
+
+	memset (&buf, 0, sizeof (buf));
+	LIST_LOOP (config_top, line, nn) {
+		config_buf_printf (&buf, "%c%s", config_cache_is_stored (line) ?
+				CONFIG_CACHE_STORED : CONFIG_CACHE_REPLAY, line);
+		/* Keep the terminating NUL in the buffer. */
+		buf.len++;
+		header.count++;
+	}
+	header.len = buf.len;
+	header.hash = config_hash_buf (buf.data, buf.len);
+
+	snprintf (tmpfile, sizeof (tmpfile), "%s.tmp", cache);
+	fd = open (tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		goto out;
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof (header);
+	iov[1].iov_base = buf.data;
+	iov[1].iov_len = buf.len;
+	if (writev (fd, iov, 2) != (ssize_t) (sizeof (header) + buf.len)) {
+		close (fd);
+		unlink (tmpfile);
+		goto out;
+	}
+	if (close (fd) < 0 || rename (tmpfile, cache) < 0)
+		unlink (tmpfile);
+out:
+	if (buf.data)
+		XFREE (MTYPE_TMP, buf.data);
+}
+
+/* Load config_top from the cache of the configuration file, calling
+   func for the lines to be replayed.  Return -1 if the cache is missing
+   or stale, the caller then loads the configuration file. */
+int config_cache_load (char *filename, void (*func) (char *, void *), void *arg)
+{
+	struct config_cache_header *header;
+	struct config_cache_source config, journal;
+	struct stat sb;
+	char cache[PATH_MAX];
+	char *map, *p, *end;
+	unsigned int i;
+	int fd, ret = -1;
+
+	config_cache_name (filename, cache, sizeof (cache));
+	fd = open (cache, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat (fd, &sb) < 0 || sb.st_size < (off_t) sizeof (*header)) {
+		close (fd);
+		return -1;
+	}
+	map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = (struct config_cache_header *) map;
+	p = map + sizeof (*header);
+	end = map + sb.st_size;
+
+	if (header->magic != CONFIG_CACHE_MAGIC || header->version != CONFIG_CACHE_VERSION ||
+			header->len != (unsigned long long) (end - p) ||
+			(header->len && end[-1] != '\0') ||
+			config_hash_buf (p, header->len) != header->hash)
+		goto out;
+
+	if (config_cache_sources (filename, &config, &journal) < 0 ||
+			memcmp (&config, &header->config, sizeof (config)) != 0 ||
+			memcmp (&journal, &header->journal, sizeof (journal)) != 0)
+		goto out;
+
+	for (i = 0; i < header->count && p < end; i++) {
+		if (*p == CONFIG_CACHE_STORED)
+			config_line_insert (config_top, p + 1);
+		else
+			(*func) (p + 1, arg);
+		p += strlen (p) + 1;
+	}
+	ret = 0;
+out:
+	munmap (map, sb.st_size);
+	return ret;
 }
 
 void config_init ()
 {
+	config_index_hash = hash_create_size (16, (unsigned int (*) (void *)) config_index_key,
+			(int (*) (void *, void *)) config_index_cmp);
+	config_section_hash = hash_create_size (16, (unsigned int (*) (void *)) config_section_key,
+			(int (*) (void *, void *)) config_section_cmp);
+
 	config_top = list_new ();
 	config_top->del = (void (*) (void *))line_del;
 #if 0
@@ -215,5 +1191,6 @@ void config_init ()
 #else
 	config_top->cmp = (int (*)(void *, void *)) line_cmp;
 #endif
+	config_index_new (config_top);
 	configvec = vector_init (1);
 }
@@ -25,7 +25,14 @@ void config_add_line(struct list *config, char *line, ...);
 void config_del_line(struct list *config, char *line);
 void config_del_line_byleft(struct list *config, char *line);
 char *config_get_line_byleft(struct list *config, char *line);
+void config_replace_line_byleft(struct list *config, char *left, char *line, ...);
 void config_dump (FILE *fp);
+int config_save (char *filename);
+int config_write (char *filename);
+int config_journal_replay (char *filename, void (*func) (char *, void *), void *arg);
+void config_journal_reset ();
+void config_cache_save (char *filename);
+int config_cache_load (char *filename, void (*func) (char *, void *), void *arg);
 void config_init ();
 
 extern struct list *config_top;
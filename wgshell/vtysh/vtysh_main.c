@@ -37,6 +37,8 @@ static void usage (char *progname, int status)
 	printf ("Usage : %s [OPTION...]\n"
 		"\t-b, --boot          Execute boot startup configuration\n"
 		"\t-e, --eval          Execute argument as command\n"
+		"\t-f, --batch         Execute the commands in the file(- for stdin) and write once\n"
+		"\t-k, --continue      Don't stop the batch at the first failing command\n"
 		"\t-c, --config        Load the config file,default["CONFIG_DIR"/"CONFIG_FILE"]\n"
 		"\t-v, --version       Show the version\n"
 		"\t-h, --help          Display this help and exit\n", basename(progname));
@@ -48,6 +50,8 @@ struct option longopts[] =
 {
 	{ "boot",	no_argument,		NULL, 'b'},
 	{ "eval",	required_argument,	NULL, 'e'},
+	{ "batch",	required_argument,	NULL, 'f'},
+	{ "continue",	no_argument,		NULL, 'k'},
 	{ "config",	required_argument,	NULL, 'c'},
 	{ "version",	no_argument,		NULL, 'v'},
 	{ "help",	no_argument,		NULL, 'h'},
@@ -94,13 +98,15 @@ int main (int argc, char **argv, char **env)
 	int opt;
 	int eval_flag = 0;
 	int boot_flag = 0;
+	int keep_going = 0;
 	char *eval_line = NULL;
+	char *batch_file = NULL;
 	char *config_file = CONFIG_DIR "/" CONFIG_FILE;
 
 	if (getenv("VTYSH_CONFIG"))
 		config_file = getenv("VTYSH_CONFIG");
 	while (1) {
-		opt = getopt_long (argc, argv, "be:c:hv", longopts, 0);
+		opt = getopt_long (argc, argv, "be:f:kc:hv", longopts, 0);
 		if (opt == EOF)
 			break;
 		switch (opt) {
@@ -113,6 +119,12 @@ int main (int argc, char **argv, char **env)
 				eval_flag = 1;
 				eval_line = optarg;
 				break;
+			case 'f':
+				batch_file = optarg;
+				break;
+			case 'k':
+				keep_going = 1;
+				break;
 			case 'h':
 				usage (argv[0], 0);
 				break;
@@ -152,28 +164,40 @@ int main (int argc, char **argv, char **env)
 	if (boot_flag)
 		exit(vtysh_boot_config (config_file));
 
-	in_show_welcome();
+	if (! batch_file)
+		in_show_welcome();
 	host.config = config_file;
 	vtysh_load_config(config_file);
 
+	/* If batch mode */
+	if (batch_file) {
+		int failed;
+
+		vtysh_execute("enable");
+		vtysh_execute("config terminal");
+		failed = vtysh_batch(batch_file, keep_going);
+
+		/* Keep what was applied, even if the batch stopped early. */
+		if (config_write(host.config) < 0) {
+			printf ("%% Can't write configuration file %s.\n", host.config);
+			exit(1);
+		}
+		exit(failed ? 1 : 0);
+	}
+
 	/* If eval mode */
 	if (eval_flag) {
 		vtysh_execute("enable");
 		vtysh_execute("config terminal");
 		vtysh_execute(eval_line);
 
-		FILE *fp;
 		if (host.config == NULL) {
 			return CMD_WARNING;
 		}
-		fp = fopen(host.config, "w");
-		if (fp == NULL) {
+		if (config_write(host.config) < 0) {
 			return CMD_WARNING;
 		}
 
-		config_dump(fp);
-		fflush(fp);
-
 		exit(0);	
 	}
 
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Reader of a WireGuard device over generic netlink. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "wgnl.h"
+
+#define WGNL_BUFSIZE	65536
+
+#define NLA_DATA(nla)		((void *) ((char *) (nla) + NLA_HDRLEN))
+#define NLA_LEN(nla)		((nla)->nla_len - NLA_HDRLEN)
+#define NLA_OK(nla, len)	((len) >= (int) sizeof (struct nlattr) && \
+				 (nla)->nla_len >= sizeof (struct nlattr) && \
+				 (nla)->nla_len <= (len))
+#define NLA_NEXT(nla, len)	((len) -= NLA_ALIGN ((nla)->nla_len), \
+				 (struct nlattr *) ((char *) (nla) + NLA_ALIGN ((nla)->nla_len)))
+#define NLA_FOR_EACH_NESTED(pos, nla, rem) \
+	for ((pos) = NLA_DATA (nla), (rem) = NLA_LEN (nla); NLA_OK (pos, rem); (pos) = NLA_NEXT (pos, rem))
+
+static void wgnl_attr_add (struct nlmsghdr *nlh, int type, const void *data, int len)
+{
+	struct nlattr *nla = (struct nlattr *) ((char *) nlh + NLMSG_ALIGN (nlh->nlmsg_len));
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy (NLA_DATA (nla), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN (nlh->nlmsg_len) + NLA_ALIGN (nla->nla_len);
+}
+
+static struct nlattr *wgnl_attrs (struct nlmsghdr *nlh, int *len)
+{
+	*len = nlh->nlmsg_len - NLMSG_SPACE (GENL_HDRLEN);
+	return (struct nlattr *) ((char *) NLMSG_DATA (nlh) + GENL_HDRLEN);
+}
+
+/* Send a request and hand every reply message to func until the end of
+   the dump, the reply or an error.  The requests are sent without
+   NLM_F_ACK, an ack left queued would end the next request on the socket,
+   and each gets its own sequence number.  Return 0 or -1 with errno set. */
+static int wgnl_request (int fd, struct nlmsghdr *req,
+		int (*func) (struct nlmsghdr *, void *), void *arg)
+{
+	static unsigned int seq;
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nlh;
+	char *buf;
+	int len, ret = 0, done = 0, err;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	if (seq == 0)
+		seq = time (NULL);
+	req->nlmsg_seq = ++seq;
+	if (sendto (fd, req, req->nlmsg_len, 0, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+		return -1;
+
+	buf = malloc (WGNL_BUFSIZE);
+	if (buf == NULL)
+		return -1;
+
+	while (!done) {
+		len = recv (fd, buf, WGNL_BUFSIZE, 0);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			ret = -1;
+			break;
+		}
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len)) {
+			if (nlh->nlmsg_seq != req->nlmsg_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+				/* Both carry the error code */
+				err = *(int *) NLMSG_DATA (nlh);
+				if (err < 0) {
+					errno = -err;
+					ret = -1;
+				}
+				done = 1;
+				break;
+			}
+			if (ret == 0 && (*func) (nlh, arg) < 0)
+				ret = -1;
+			if (!(nlh->nlmsg_flags & NLM_F_MULTI)) {
+				done = 1;
+				break;
+			}
+		}
+	}
+
+	free (buf);
+	return ret;
+}
+
+static int wgnl_family_one (struct nlmsghdr *nlh, void *arg)
+{
+	struct nlattr *nla;
+	int len;
+
+	for (nla = wgnl_attrs (nlh, &len); NLA_OK (nla, len); nla = NLA_NEXT (nla, len))
+		if ((nla->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID)
+			*(uint16_t *) arg = *(uint16_t *) NLA_DATA (nla);
+	return 0;
+}
+
+/* The id of the wireguard family, 0 if the module is not loaded */
+static uint16_t wgnl_family (int fd)
+{
+	char buf[NLMSG_SPACE (GENL_HDRLEN) + 64];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+	struct genlmsghdr *genl = NLMSG_DATA (nlh);
+	uint16_t id = 0;
+
+	memset (buf, 0, sizeof (buf));
+	nlh->nlmsg_len = NLMSG_LENGTH (GENL_HDRLEN);
+	nlh->nlmsg_type = GENL_ID_CTRL;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	genl->cmd = CTRL_CMD_GETFAMILY;
+	genl->version = 1;
+	wgnl_attr_add (nlh, CTRL_ATTR_FAMILY_NAME, WG_GENL_NAME, sizeof (WG_GENL_NAME));
+
+	if (wgnl_request (fd, nlh, wgnl_family_one, &id) < 0)
+		return 0;
+	return id;
+}
+
+static int wgnl_allowedip (struct nlattr *nested, struct wgpeer *peer)
+{
+	struct wgallowedip *ip;
+	struct nlattr *nla;
+	int rem;
+
+	ip = calloc (1, sizeof (*ip));
+	if (ip == NULL)
+		return -1;
+
+	NLA_FOR_EACH_NESTED (nla, nested, rem) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case WGALLOWEDIP_A_FAMILY:
+			ip->family = *(uint16_t *) NLA_DATA (nla);
+			break;
+		case WGALLOWEDIP_A_IPADDR:
+			if (NLA_LEN (nla) == sizeof (ip->ip4))
+				memcpy (&ip->ip4, NLA_DATA (nla), sizeof (ip->ip4));
+			else if (NLA_LEN (nla) == sizeof (ip->ip6))
+				memcpy (&ip->ip6, NLA_DATA (nla), sizeof (ip->ip6));
+			break;
+		case WGALLOWEDIP_A_CIDR_MASK:
+			ip->cidr = *(uint8_t *) NLA_DATA (nla);
+			break;
+		}
+	}
+
+	if (peer->last_allowedip)
+		peer->last_allowedip->next_allowedip = ip;
+	else
+		peer->first_allowedip = ip;
+	peer->last_allowedip = ip;
+	return 0;
+}
+
+/* A peer continued from the previous message has the same public key as
+   the last one, its allowed IPs are appended to it. */
+static int wgnl_peer (struct nlattr *nested, struct wgdevice *dev)
+{
+	struct wgpeer *peer = NULL;
+	struct nlattr *nla, *ip;
+	int rem, irem;
+
+	NLA_FOR_EACH_NESTED (nla, nested, rem)
+		if ((nla->nla_type & NLA_TYPE_MASK) == WGPEER_A_PUBLIC_KEY &&
+				NLA_LEN (nla) == WG_KEY_LEN && dev->last_peer &&
+				memcmp (dev->last_peer->public_key, NLA_DATA (nla), WG_KEY_LEN) == 0)
+			peer = dev->last_peer;
+
+	if (peer == NULL) {
+		peer = calloc (1, sizeof (*peer));
+		if (peer == NULL)
+			return -1;
+		if (dev->last_peer)
+			dev->last_peer->next_peer = peer;
+		else
+			dev->first_peer = peer;
+		dev->last_peer = peer;
+	}
+
+	NLA_FOR_EACH_NESTED (nla, nested, rem) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case WGPEER_A_PUBLIC_KEY:
+			if (NLA_LEN (nla) == WG_KEY_LEN) {
+				memcpy (peer->public_key, NLA_DATA (nla), WG_KEY_LEN);
+				peer->flags |= WGPEER_HAS_PUBLIC_KEY;
+			}
+			break;
+		case WGPEER_A_PRESHARED_KEY:
+			if (NLA_LEN (nla) == WG_KEY_LEN) {
+				memcpy (peer->preshared_key, NLA_DATA (nla), WG_KEY_LEN);
+				peer->flags |= WGPEER_HAS_PRESHARED_KEY;
+			}
+			break;
+		case WGPEER_A_ENDPOINT:
+			if ((size_t) NLA_LEN (nla) <= sizeof (peer->endpoint))
+				memcpy (&peer->endpoint, NLA_DATA (nla), NLA_LEN (nla));
+			break;
+		case WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL:
+			peer->persistent_keepalive_interval = *(uint16_t *) NLA_DATA (nla);
+			break;
+		case WGPEER_A_LAST_HANDSHAKE_TIME:
+			/* struct __kernel_timespec, 64 bit fields on every arch */
+			if (NLA_LEN (nla) == 2 * sizeof (int64_t)) {
+				peer->last_handshake_time.tv_sec = ((int64_t *) NLA_DATA (nla))[0];
+				peer->last_handshake_time.tv_nsec = ((int64_t *) NLA_DATA (nla))[1];
+			}
+			break;
+		case WGPEER_A_RX_BYTES:
+			memcpy (&peer->rx_bytes, NLA_DATA (nla), sizeof (uint64_t));
+			break;
+		case WGPEER_A_TX_BYTES:
+			memcpy (&peer->tx_bytes, NLA_DATA (nla), sizeof (uint64_t));
+			break;
+		case WGPEER_A_ALLOWEDIPS:
+			NLA_FOR_EACH_NESTED (ip, nla, irem)
+				if (wgnl_allowedip (ip, peer) < 0)
+					return -1;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* One message of the dump: the device, then peers continuing the list */
+static int wgnl_device_one (struct nlmsghdr *nlh, void *arg)
+{
+	struct wgdevice *dev = arg;
+	struct nlattr *nla, *peer;
+	int len, rem;
+
+	for (nla = wgnl_attrs (nlh, &len); NLA_OK (nla, len); nla = NLA_NEXT (nla, len)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case WGDEVICE_A_IFINDEX:
+			dev->ifindex = *(uint32_t *) NLA_DATA (nla);
+			break;
+		case WGDEVICE_A_IFNAME:
+			snprintf (dev->name, sizeof (dev->name), "%.*s", NLA_LEN (nla), (char *) NLA_DATA (nla));
+			break;
+		case WGDEVICE_A_PRIVATE_KEY:
+			if (NLA_LEN (nla) == WG_KEY_LEN) {
+				memcpy (dev->private_key, NLA_DATA (nla), WG_KEY_LEN);
+				dev->flags |= WGDEVICE_HAS_PRIVATE_KEY;
+			}
+			break;
+		case WGDEVICE_A_PUBLIC_KEY:
+			if (NLA_LEN (nla) == WG_KEY_LEN) {
+				memcpy (dev->public_key, NLA_DATA (nla), WG_KEY_LEN);
+				dev->flags |= WGDEVICE_HAS_PUBLIC_KEY;
+			}
+			break;
+		case WGDEVICE_A_LISTEN_PORT:
+			dev->listen_port = *(uint16_t *) NLA_DATA (nla);
+			break;
+		case WGDEVICE_A_FWMARK:
+			dev->fwmark = *(uint32_t *) NLA_DATA (nla);
+			break;
+		case WGDEVICE_A_PEERS:
+			NLA_FOR_EACH_NESTED (peer, nla, rem)
+				if (wgnl_peer (peer, dev) < 0)
+					return -1;
+			break;
+		}
+	}
+	return 0;
+}
+
+int wgnl_get_device (struct wgdevice **device, const char *ifname)
+{
+	char buf[NLMSG_SPACE (GENL_HDRLEN) + 64];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+	struct genlmsghdr *genl = NLMSG_DATA (nlh);
+	struct wgdevice *dev;
+	uint16_t family;
+	int fd, ret, saved;
+
+	*device = NULL;
+	fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (fd < 0)
+		return -1;
+
+	if ((family = wgnl_family (fd)) == 0) {
+		close (fd);
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+
+	dev = calloc (1, sizeof (*dev));
+	if (dev == NULL) {
+		close (fd);
+		return -1;
+	}
+
+	memset (buf, 0, sizeof (buf));
+	nlh->nlmsg_len = NLMSG_LENGTH (GENL_HDRLEN);
+	nlh->nlmsg_type = family;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	genl->cmd = WG_CMD_GET_DEVICE;
+	genl->version = WG_GENL_VERSION;
+	wgnl_attr_add (nlh, WGDEVICE_A_IFNAME, ifname, strlen (ifname) + 1);
+
+	ret = wgnl_request (fd, nlh, wgnl_device_one, dev);
+	saved = errno;
+	close (fd);
+	if (ret < 0) {
+		free_wgdevice (dev);
+		errno = saved;
+		return -1;
+	}
+	*device = dev;
+	return 0;
+}
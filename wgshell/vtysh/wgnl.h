@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ */
+
+/* Reader of a WireGuard device over generic netlink(WG_CMD_GET_DEVICE),
+ * without running 'wg show'. */
+
+#ifndef __WGNL_H__
+#define __WGNL_H__
+
+#include "include/containers.h"
+
+/* Read the device with all of its peers, the peers split over several
+   messages are put back together.  Return 0 or -1 with errno set, the
+   device is freed with free_wgdevice(). */
+int wgnl_get_device (struct wgdevice **device, const char *ifname);
+
+#endif